@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+size_t arena_aligned_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+int arena_reserve(Arena *arena, size_t size) {
+    arena->used = 0;
+    if (arena->base != NULL && arena->size >= size) {
+        return 0;
+    }
+
+    /* Aligned so every allocation carved from the block is also aligned */
+    char *base = aligned_alloc(ARENA_ALIGNMENT, arena_aligned_size(size));
+    if (base == NULL) {
+        return -1;
+    }
+    free(arena->base);
+    arena->base = base;
+    arena->size = arena_aligned_size(size);
+    arena->nr_mallocs++;
+    return 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size_t aligned_size = arena_aligned_size(size);
+    if (arena->base == NULL || arena->size - arena->used < aligned_size) {
+        return NULL;
+    }
+    void *ptr = arena->base + arena->used;
+    arena->used += aligned_size;
+    return ptr;
+}
+
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
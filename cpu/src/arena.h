@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief A bump allocator over one block of memory.
+ * 
+ * Allocations are carved from the block in order and are never freed one by one.
+ * arena_reset hands the whole block back for reuse, so a caller that allocates 
+ * the same amount every cycle only ever mallocs once.
+ */
+typedef struct {
+    /* @brief The block of memory (NULL until first reserved) */
+    char *base;
+    /* @brief Size of the block in bytes */
+    size_t size;
+    /* @brief Bytes handed out since the last reset */
+    size_t used;
+    /* @brief Number of times the block was (re)allocated with malloc */
+    int nr_mallocs;
+} Arena;
+
+/**
+ * @brief Makes sure the arena has at least size bytes. Resets the arena.
+ * 
+ * The block is only replaced when it is too small, everything allocated from it
+ * before is invalid afterwards.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int arena_reserve(Arena *arena, size_t size);
+
+/**
+ * @brief Allocates size bytes (aligned for any type) from the arena.
+ * 
+ * @return NULL when the arena does not have enough room left.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * @brief The number of arena bytes an allocation of size bytes takes up.
+ */
+size_t arena_aligned_size(size_t size);
+
+/**
+ * @brief Hands all allocations back to the arena without freeing the block.
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * @brief Frees the block.
+ */
+void arena_free(Arena *arena);
+
+#endif
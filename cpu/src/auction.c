@@ -0,0 +1,376 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm_types.h"
+#include "scheduler.h"
+#include "auction.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define AUCTION_HAVE_AVX2 1
+#endif
+
+/**
+ * Columns per AVX2 vector. Rows are padded to a multiple of it.
+ */
+#define AUCTION_LANES 8
+/**
+ * Price of the padding columns, above anything a real column can reach.
+ */
+#define AUCTION_PAD_PRICE (1 << 30)
+/**
+ * Prices only grow. An auction whose prices get this high gives up rather
+ * than overflow into the padding.
+ */
+#define AUCTION_MAX_PRICE (1 << 29)
+
+static bool simd_enabled = true;
+
+void auction_set_simd(bool enabled) {
+    simd_enabled = enabled;
+}
+
+bool auction_simd_active(void) {
+#ifdef AUCTION_HAVE_AVX2
+    return simd_enabled && __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief The memory of one auction, carved from the workspace's solver arena.
+ */
+typedef struct {
+    /* @brief Columns (pCPU slots) and rows (VMs, then dummies) of the square matrix */
+    int nr_columns;
+    /* @brief Ints per row, nr_columns rounded up to AUCTION_LANES */
+    int stride;
+    /* @brief The scaled cost row of every VM */
+    int *costs;
+    /* @brief The cost row of the dummy rows, all zero */
+    int *zero_row;
+    /* @brief Unscaled cost of every column for a VM on a cached pCPU, without its move penalty */
+    int *from_costs;
+    /* @brief -1 in the columns a VM on a cached pCPU moves to, 0 where it stays */
+    int *from_moves;
+    int *prices;
+    /* @brief The row assigned to every column, -1 when none */
+    int *owners;
+    /* @brief The column assigned to every row, -1 when none */
+    int *assigned;
+    /* @brief Rows still bidding */
+    int *unassigned;
+} AuctionMatrix;
+
+static int *carve_ints(Arena *arena, int nr) {
+    return arena_alloc(arena, sizeof(int) * nr);
+}
+
+static int auction_reserve(Arena *arena, AuctionMatrix *a, int nr_vms, int nr_pcpus) {
+    int m = a->nr_columns;
+    int stride = a->stride;
+    size_t size = arena_aligned_size(sizeof(int) * stride * nr_vms) +
+                  2 * arena_aligned_size(sizeof(int) * stride * (nr_pcpus + 1)) +
+                  3 * arena_aligned_size(sizeof(int) * stride) +
+                  2 * arena_aligned_size(sizeof(int) * m);
+    if (arena_reserve(arena, size) < 0) {
+        return -1;
+    }
+    a->costs = carve_ints(arena, stride * nr_vms);
+    a->from_costs = carve_ints(arena, stride * (nr_pcpus + 1));
+    a->from_moves = carve_ints(arena, stride * (nr_pcpus + 1));
+    a->zero_row = carve_ints(arena, stride);
+    a->prices = carve_ints(arena, stride);
+    a->owners = carve_ints(arena, stride);
+    a->assigned = carve_ints(arena, m);
+    a->unassigned = carve_ints(arena, m);
+    return 0;
+}
+
+/**
+ * @brief Fills the unscaled cost row of a VM on pCPU id from, and the columns it moves to.
+ *
+ * Column s * nr_pcpus + j costs the VM's slot 0 edge to pCPU j
+ * (vm_pcpu_slot_cost_with_load) without its move penalty, plus the s-th
+ * piece of the pCPU's convex edge to the sink.
+ */
+static void fill_from_row(const SystemState *state, const AuctionMatrix *a, const int *load_costs,
+                          int from, int *costs, int *moves) {
+    int nr_pcpus = state->nr_pcpus;
+    for (int c = 0; c < a->stride; c++) {
+        costs[c] = 0;
+        moves[c] = 0;
+    }
+    for (int j = 0; j < nr_pcpus; j++) {
+        int id = state->pcpus[j].id;
+        int cost = load_costs[j] + (id == from ? 0 : migration_cost(state, from, id));
+        for (int slot = 0; slot < MAX_VMS_PER_PCPU; slot++) {
+            costs[slot * nr_pcpus + j] = cost + slot * ADDITION_VM_PENALTY;
+            moves[slot * nr_pcpus + j] = id == from ? 0 : -1;
+        }
+    }
+}
+
+/**
+ * @brief Scales a VM's row: (costs + (moves & move_penalty)) * scale.
+ */
+static void scale_row_scalar(int *row, const int *costs, const int *moves, int move_penalty, int scale, int stride) {
+    for (int c = 0; c < stride; c++) {
+        row[c] = (costs[c] + (moves[c] & move_penalty)) * scale;
+    }
+}
+
+/**
+ * @brief The cheapest column of row + prices, its value and the second cheapest value.
+ *
+ * Ties go to the lowest column.
+ */
+static int best_column_scalar(const int *row, const int *prices, int nr_columns, int *best, int *second) {
+    int column = 0;
+    int v1 = INT_MAX;
+    int v2 = INT_MAX;
+    for (int c = 0; c < nr_columns; c++) {
+        int v = row[c] + prices[c];
+        if (v < v1) {
+            v2 = v1;
+            v1 = v;
+            column = c;
+        } else if (v < v2) {
+            v2 = v;
+        }
+    }
+    *best = v1;
+    *second = v2;
+    return column;
+}
+
+#ifdef AUCTION_HAVE_AVX2
+__attribute__((target("avx2")))
+static void scale_row_avx2(int *row, const int *costs, const int *moves, int move_penalty, int scale, int stride) {
+    __m256i penalty = _mm256_set1_epi32(move_penalty);
+    __m256i factor = _mm256_set1_epi32(scale);
+    for (int c = 0; c < stride; c += AUCTION_LANES) {
+        __m256i cost = _mm256_loadu_si256((const __m256i *) (costs + c));
+        __m256i move = _mm256_loadu_si256((const __m256i *) (moves + c));
+        cost = _mm256_add_epi32(cost, _mm256_and_si256(move, penalty));
+        _mm256_storeu_si256((__m256i *) (row + c), _mm256_mullo_epi32(cost, factor));
+    }
+}
+
+/**
+ * @brief best_column_scalar over whole vectors: every lane keeps the best and
+ * second best of its columns, then the lanes are merged.
+ */
+__attribute__((target("avx2")))
+static int best_column_avx2(const int *row, const int *prices, int stride, int *best, int *second) {
+    __m256i min1 = _mm256_set1_epi32(INT_MAX);
+    __m256i min2 = _mm256_set1_epi32(INT_MAX);
+    __m256i index1 = _mm256_setzero_si256();
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i step = _mm256_set1_epi32(AUCTION_LANES);
+    for (int c = 0; c < stride; c += AUCTION_LANES) {
+        __m256i v = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (row + c)),
+                                     _mm256_loadu_si256((const __m256i *) (prices + c)));
+        __m256i lower = _mm256_cmpgt_epi32(min1, v);
+        /* The old best drops to second where v beats it, v competes for second elsewhere */
+        min2 = _mm256_min_epi32(min2, _mm256_blendv_epi8(v, min1, lower));
+        min1 = _mm256_min_epi32(min1, v);
+        index1 = _mm256_blendv_epi8(index1, index, lower);
+        index = _mm256_add_epi32(index, step);
+    }
+    int lane_min1[AUCTION_LANES];
+    int lane_min2[AUCTION_LANES];
+    int lane_index[AUCTION_LANES];
+    _mm256_storeu_si256((__m256i *) lane_min1, min1);
+    _mm256_storeu_si256((__m256i *) lane_min2, min2);
+    _mm256_storeu_si256((__m256i *) lane_index, index1);
+
+    int lane = 0;
+    for (int l = 1; l < AUCTION_LANES; l++) {
+        if (lane_min1[l] < lane_min1[lane] || (lane_min1[l] == lane_min1[lane] && lane_index[l] < lane_index[lane])) {
+            lane = l;
+        }
+    }
+    int v2 = INT_MAX;
+    for (int l = 0; l < AUCTION_LANES; l++) {
+        v2 = lane_min2[l] < v2 ? lane_min2[l] : v2;
+        v2 = (l != lane && lane_min1[l] < v2) ? lane_min1[l] : v2;
+    }
+    *best = lane_min1[lane];
+    *second = v2;
+    return lane_index[lane];
+}
+#endif
+
+/**
+ * @brief Builds the scaled cost rows of the VMs.
+ *
+ * The rows of VMs on the same pCPU only differ by their move penalty, so each
+ * pCPU's unscaled row is filled once.
+ *
+ * @return The largest scaled cost, or -1 when the costs are out of range.
+ */
+static int build_costs(const SystemState *state, AuctionMatrix *a, int scale, bool simd) {
+    int nr_pcpus = state->nr_pcpus;
+    int load_costs[MAX_PCPUS];
+    int cached_row[MAX_PCPUS];
+    int nr_cached = 0;
+    pcpu_load_costs(state, load_costs);
+    for (int id = 0; id < MAX_PCPUS; id++) {
+        cached_row[id] = -1;
+    }
+
+    int max_cost = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int from = vm->current_pcpu;
+        int r = nr_pcpus;
+        if (from >= 0 && from < MAX_PCPUS && cached_row[from] >= 0) {
+            r = cached_row[from];
+        } else {
+            /* Once every row is taken, pCPUs the cache misses share the last one */
+            if (from >= 0 && from < MAX_PCPUS && nr_cached < nr_pcpus) {
+                r = nr_cached++;
+                cached_row[from] = r;
+            }
+            fill_from_row(state, a, load_costs, from, a->from_costs + (size_t) r * a->stride,
+                          a->from_moves + (size_t) r * a->stride);
+        }
+        const int *costs = a->from_costs + (size_t) r * a->stride;
+        const int *moves = a->from_moves + (size_t) r * a->stride;
+        int move_penalty = vm->move_penalty > 0 ? vm->move_penalty : 0;
+        for (int c = 0; c < a->nr_columns; c++) {
+            int cost = costs[c] + (moves[c] & move_penalty);
+            if (cost < 0 || cost > AUCTION_MAX_SCALED_COST / scale) {
+                return -1;
+            }
+            max_cost = cost > max_cost ? cost : max_cost;
+        }
+        int *row = a->costs + (size_t) i * a->stride;
+#ifdef AUCTION_HAVE_AVX2
+        if (simd) {
+            scale_row_avx2(row, costs, moves, move_penalty, scale, a->stride);
+            continue;
+        }
+#endif
+        scale_row_scalar(row, costs, moves, move_penalty, scale, a->stride);
+    }
+    (void) simd;
+    return max_cost * scale;
+}
+
+/**
+ * @brief Runs one ε phase: every row bids for its cheapest column until all are assigned.
+ *
+ * @return The number of bids, or -1 when the prices got out of range.
+ */
+static int auction_phase(const SystemState *state, AuctionMatrix *a, int epsilon, bool simd) {
+    int m = a->nr_columns;
+    int nr_unassigned = 0;
+    for (int c = 0; c < m; c++) {
+        a->owners[c] = -1;
+    }
+    /* Lowest rows bid first */
+    for (int i = m - 1; i >= 0; i--) {
+        a->assigned[i] = -1;
+        a->unassigned[nr_unassigned++] = i;
+    }
+
+    int nr_bids = 0;
+    while (nr_unassigned > 0) {
+        int i = a->unassigned[--nr_unassigned];
+        const int *row = i < state->nr_vms ? a->costs + (size_t) i * a->stride : a->zero_row;
+        int best;
+        int second;
+        int column;
+#ifdef AUCTION_HAVE_AVX2
+        if (simd) {
+            column = best_column_avx2(row, a->prices, a->stride, &best, &second);
+        } else
+#endif
+        column = best_column_scalar(row, a->prices, m, &best, &second);
+
+        a->prices[column] += second - best + epsilon;
+        if (a->prices[column] > AUCTION_MAX_PRICE) {
+            return -1;
+        }
+        int previous = a->owners[column];
+        a->owners[column] = i;
+        a->assigned[i] = column;
+        if (previous >= 0) {
+            a->assigned[previous] = -1;
+            a->unassigned[nr_unassigned++] = previous;
+        }
+        nr_bids++;
+    }
+    (void) simd;
+    return nr_bids;
+}
+
+/**
+ * @brief Solves the state with an ε-scaled auction (see auction_schedule_solver).
+ */
+static int auction_schedule(ScheduleWorkspace *ws, const SystemState *state, Schedule *out) {
+    int nr_vms = state->nr_vms;
+    int nr_pcpus = state->nr_pcpus;
+    AuctionMatrix a;
+    a.nr_columns = nr_pcpus * MAX_VMS_PER_PCPU;
+    a.stride = (a.nr_columns + AUCTION_LANES - 1) / AUCTION_LANES * AUCTION_LANES;
+    if (nr_pcpus <= 0 || nr_vms > a.nr_columns) {
+        return -1;
+    }
+    for (int i = 0; i < nr_vms; i++) {
+        if (vm_nr_vcpus(&state->vms[i]) > 1) {
+            return -1;
+        }
+    }
+    if (auction_reserve(&ws->solver_arena, &a, nr_vms, nr_pcpus) < 0) {
+        fprintf(stderr, "Failed to allocate the auction for %d VMs and %d pCPUs\n", nr_vms, nr_pcpus);
+        return -1;
+    }
+
+    /* With costs scaled by one more than the number of rows, ε = 1 is below the gap between two assignments */
+    bool simd = auction_simd_active();
+    int scale = a.nr_columns + 1;
+    int max_cost = build_costs(state, &a, scale, simd);
+    if (max_cost < 0) {
+        return -1;
+    }
+    for (int c = 0; c < a.stride; c++) {
+        a.zero_row[c] = 0;
+        a.prices[c] = c < a.nr_columns ? 0 : AUCTION_PAD_PRICE;
+    }
+
+    int nr_bids = 0;
+    int epsilon = max_cost / AUCTION_EPSILON_FACTOR;
+    while (true) {
+        epsilon = epsilon > 1 ? epsilon : 1;
+        int phase_bids = auction_phase(state, &a, epsilon, simd);
+        if (phase_bids < 0) {
+            return -1;
+        }
+        nr_bids += phase_bids;
+        if (epsilon == 1) {
+            break;
+        }
+        epsilon /= AUCTION_EPSILON_FACTOR;
+    }
+
+    memset(out, -1, sizeof(Schedule));
+    for (int i = 0; i < nr_vms; i++) {
+        int j = a.assigned[i] % nr_pcpus;
+        schedule_place_vcpus(out, state, i, &j, 1);
+    }
+    out->num_assigned = nr_vms;
+    out->total_cost = schedule_total_cost(state, out);
+    ws->result.total_flow = nr_vms;
+    ws->result.total_cost = out->total_cost;
+    ws->result.nr_augmentations = nr_bids;
+    return 0;
+}
+
+const ScheduleSolver auction_schedule_solver = {
+    .name = "auction",
+    .solve = auction_schedule,
+};
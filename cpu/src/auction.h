@@ -0,0 +1,45 @@
+#ifndef AUCTION_H
+#define AUCTION_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "scheduler.h"
+
+/**
+ * ε shrinks this many times between two phases of the auction.
+ */
+#define AUCTION_EPSILON_FACTOR 8
+/**
+ * Largest scaled cost the auction takes. Prices stay below a few times the
+ * largest cost, so the int32 lanes of the bidding loop can't overflow.
+ */
+#define AUCTION_MAX_SCALED_COST (1 << 26)
+
+/**
+ * @brief Bertsekas' auction over a dense vCPU x pCPU slot cost matrix.
+ *
+ * Column s * nr_pcpus + j is slot s of pCPU j and costs the VM its
+ * vm_pcpu_slot_cost_with_load plus s * ADDITION_VM_PENALTY, the prices of
+ * compute_schedule's flow network. Dummy rows at no cost fill the matrix up to
+ * square. The costs are scaled by the number of columns plus one so that the
+ * last phase, at ε = 1, ends at an optimal assignment (ε-scaling, Gauss-Seidel
+ * bids). The cost rows and the search for the best and second best column of
+ * a bid run on AVX2 when the CPU has it, and on a scalar loop with the same
+ * results otherwise.
+ *
+ * Only takes states where every VM has one vCPU and every vCPU has a slot.
+ * Returns -1 for the others, and compute_schedule_on falls back to the flow network.
+ */
+extern const ScheduleSolver auction_schedule_solver;
+
+/**
+ * @brief Lets the auction use AVX2 (the default) or keeps it on the scalar loops.
+ */
+void auction_set_simd(bool enabled);
+
+/**
+ * @brief Whether the auction runs its AVX2 loops: enabled and supported by the CPU.
+ */
+bool auction_simd_active(void);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "control_loop.h"
+#include "sim_backend.h"
+#include "tick_schedule.h"
+
+/**
+ * Control loop overhead against a simulated hypervisor.
+ *
+ * Every tick runs the daemon's cpu_control_tick (query, utilization, sampling,
+ * stable_schedule, pinning) on a SimHypervisor, then lets one period of
+ * simulated time pass. The result is printed as one JSON object per line,
+ * like bench_scheduler.
+ *
+ * Usage: ./bench_control_loop [-v vms] [-p pcpus] [-c max_vcpus] [-t ticks] [-r rpc_us] [-b load] [-s seed] [-l label]
+ *   -v vms        Domains on the host (default 1000)
+ *   -p pcpus      pCPUs of the host (default 512)
+ *   -c max_vcpus  Every domain gets 1 to max_vcpus vCPUs (default 1)
+ *   -t ticks      Ticks to time, after the first one (default 50)
+ *   -r rpc_us     Latency injected per RPC in microseconds (default 0)
+ *   -b load       steady, bursty or walk (default bursty)
+ *   -s seed       Seed of the simulated host (default 6210)
+ *   -l label      Free form label copied to every line (e.g. the git revision)
+ */
+
+#define PERIOD_NS 1000000000LL
+
+static SimHypervisor sim;
+static CPUControl control;
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest rank percentile of sorted samples.
+ */
+static double percentile(const double *sorted, int nr_samples, double p) {
+    int rank = (int) ceil(p / 100.0 * nr_samples);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+int main(int argc, char *argv[]) {
+    SimConfig config = { .nr_vms = 1000, .nr_pcpus = 512, .max_vcpus = 1, .load = SIM_LOAD_BURSTY, .seed = 6210 };
+    int nr_ticks = 50;
+    const char *label = "";
+    const char *load = "bursty";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "v:p:c:t:r:b:s:l:")) != -1) {
+        switch (opt) {
+            case 'v': config.nr_vms = atoi(optarg); break;
+            case 'p': config.nr_pcpus = atoi(optarg); break;
+            case 'c': config.max_vcpus = atoi(optarg); break;
+            case 't': nr_ticks = atoi(optarg); break;
+            case 'r': config.rpc_latency_ns = atoll(optarg) * 1000; break;
+            case 'b': load = optarg; break;
+            case 's': config.seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'l': label = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-v vms] [-p pcpus] [-c max_vcpus] [-t ticks] [-r rpc_us] [-b load] [-s seed] [-l label]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (strcmp(load, "steady") == 0) {
+        config.load = SIM_LOAD_STEADY;
+    } else if (strcmp(load, "walk") == 0) {
+        config.load = SIM_LOAD_RANDOM_WALK;
+    } else if (strcmp(load, "bursty") != 0) {
+        fprintf(stderr, "Unknown load %s, use steady, bursty or walk\n", load);
+        return 1;
+    }
+    if (nr_ticks < 1 || sim_init(&sim, config) < 0) {
+        return 1;
+    }
+
+    double *tick_ms = malloc(sizeof(double) * nr_ticks);
+    if (tick_ms == NULL) {
+        fprintf(stderr, "Failed to allocate the latency samples\n");
+        return 1;
+    }
+    VirtBackend backend = sim_backend(&sim);
+    cpu_control_init(&control, PERIOD_NS);
+    /* The first tick only records the CPU times */
+    if (cpu_control_tick(&control, &backend, sim.clock_ns) < 0) {
+        return 1;
+    }
+    sim_advance(&sim, PERIOD_NS);
+    ControlStats before = control.stats;
+    int rpcs_before = sim.nr_rpcs;
+    double unmet_before = sim.unmet_vcpu_ns;
+    for (int t = 0; t < nr_ticks; t++) {
+        long long start_ns = tick_now_ns();
+        if (cpu_control_tick(&control, &backend, sim.clock_ns) < 0) {
+            return 1;
+        }
+        tick_ms[t] = (tick_now_ns() - start_ns) / 1e6;
+        sim_advance(&sim, PERIOD_NS);
+    }
+
+    qsort(tick_ms, nr_ticks, sizeof(double), compare_double);
+    double total_ms = 0;
+    for (int t = 0; t < nr_ticks; t++) {
+        total_ms += tick_ms[t];
+    }
+    const ControlStats *stats = &control.stats;
+    printf("{\"label\": \"%s\", \"bench\": \"control_loop\", \"vms\": %d, \"pcpus\": %d, \"max_vcpus\": %d, "
+           "\"load\": \"%s\", \"rpc_us\": %lld, \"seed\": %u, \"ticks\": %d, "
+           "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"mean_ms\": %.4f, \"max_ms\": %.4f, "
+           "\"query_ms\": %.4f, \"schedule_ms\": %.4f, \"apply_ms\": %.4f, "
+           "\"rpcs_per_tick\": %.2f, \"pins_per_tick\": %.2f, \"unmet_vcpu_s_per_tick\": %.4f}\n",
+        label, config.nr_vms, config.nr_pcpus, config.max_vcpus, load, config.rpc_latency_ns / 1000, config.seed, nr_ticks,
+        percentile(tick_ms, nr_ticks, 50), percentile(tick_ms, nr_ticks, 99), total_ms / nr_ticks, tick_ms[nr_ticks - 1],
+        (stats->query_ns - before.query_ns) / 1e6 / nr_ticks,
+        (stats->schedule_ns - before.schedule_ns) / 1e6 / nr_ticks,
+        (stats->apply_ns - before.apply_ns) / 1e6 / nr_ticks,
+        (double) (sim.nr_rpcs - rpcs_before) / nr_ticks,
+        (double) (stats->nr_pin_rpcs - before.nr_pin_rpcs) / nr_ticks,
+        (sim.unmet_vcpu_ns - unmet_before) / 1e9 / nr_ticks);
+    free(tick_ms);
+    cpu_control_destroy(&control);
+    return 0;
+}
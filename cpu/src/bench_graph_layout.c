@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graph.h"
+#include "csr_graph.h"
+#include "mcmf.h"
+
+/**
+ * Compares solving the same synthetic VM/pCPU flow network over the adjacency
+ * list layout (FlowGraph) and the CSR structure of arrays layout (CSRGraph).
+ * 
+ * Usage: ./bench_graph_layout [repetitions]
+ */
+
+#define MIGRATION_COST 50
+#define MAX_VMS_PER_PCPU 2
+
+typedef struct {
+    int nr_vms;
+    int nr_pcpus;
+} Topology;
+
+static const Topology topologies[] = {
+    {8, 4},
+    {64, 32},
+    {128, 64},
+    {256, 128},
+    {512, 256},
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Builds the same Source -> VMs -> pCPUs -> Sink network compute_schedule does.
+ */
+static void build_vm_pcpu_graph(FlowGraph *g, int nr_vms, int nr_pcpus, unsigned int seed) {
+    int source = 0;
+    int vm_base = 1;
+    int pcpu_base = vm_base + nr_vms;
+    int sink = pcpu_base + nr_pcpus;
+
+    srand(seed);
+    int *utilization = malloc(sizeof(int) * nr_pcpus);
+    for (int j = 0; j < nr_pcpus; j++) {
+        utilization[j] = rand() % 100;
+    }
+
+    graph_init(g, sink + 1);
+    for (int i = 0; i < nr_vms; i++) {
+        graph_add_edge(g, source, vm_base + i, 1, 0);
+    }
+    for (int i = 0; i < nr_vms; i++) {
+        int current_pcpu = rand() % nr_pcpus;
+        for (int j = 0; j < nr_pcpus; j++) {
+            int affinity_cost = (j == current_pcpu) ? 0 : MIGRATION_COST;
+            graph_add_edge(g, vm_base + i, pcpu_base + j, 1, affinity_cost + utilization[j]);
+        }
+    }
+    for (int j = 0; j < nr_pcpus; j++) {
+        graph_add_edge(g, pcpu_base + j, sink, MAX_VMS_PER_PCPU, 0);
+    }
+    free(utilization);
+}
+
+int main(int argc, char *argv[]) {
+    int repetitions = (argc > 1) ? atoi(argv[1]) : 3;
+    int nr_topologies = sizeof(topologies) / sizeof(topologies[0]);
+    const Topology *largest = &topologies[nr_topologies - 1];
+    int max_nodes = largest->nr_vms + largest->nr_pcpus + 2;
+    int max_edges = (largest->nr_vms + largest->nr_vms * largest->nr_pcpus + largest->nr_pcpus) * 2;
+
+    FlowGraph template;
+    FlowGraph list_graph;
+    CSRGraph csr;
+    if (graph_create(&template, max_nodes, max_edges) < 0 ||
+        graph_create(&list_graph, max_nodes, max_edges) < 0 ||
+        csr_create(&csr, max_nodes, max_edges) < 0) {
+        fprintf(stderr, "Failed to allocate the graphs\n");
+        return 1;
+    }
+
+    printf("%-9s %-8s %6s %6s %8s %12s %12s %8s\n",
+        "algorithm", "layout", "vms", "pcpus", "edges", "solve_ms", "build_ms", "cost");
+    for (int t = 0; t < nr_topologies; t++) {
+        const Topology *topology = &topologies[t];
+        int sink = 1 + topology->nr_vms + topology->nr_pcpus;
+        build_vm_pcpu_graph(&template, topology->nr_vms, topology->nr_pcpus, 6210 + t);
+
+        for (int a = 0; a < 2; a++) {
+            MCMFAlgorithm algorithm = (a == 0) ? MCMF_SPFA : MCMF_DIJKSTRA;
+            const char *name = (a == 0) ? "spfa" : "dijkstra";
+            double list_ms = 0;
+            double csr_ms = 0;
+            double csr_build_ms = 0;
+            MCMFResult list_result = { 0 };
+            MCMFResult csr_result = { 0 };
+
+            for (int r = 0; r < repetitions; r++) {
+                graph_copy(&list_graph, &template);
+                double start = now_ms();
+                list_result = mcmf_solve_with(&list_graph, 0, sink, algorithm);
+                list_ms += now_ms() - start;
+
+                start = now_ms();
+                csr_from_graph(&csr, &template);
+                double built = now_ms();
+                csr_result = mcmf_solve_csr(&csr, 0, sink, algorithm);
+                csr_ms += now_ms() - built;
+                csr_build_ms += built - start;
+            }
+
+            if (list_result.total_cost != csr_result.total_cost ||
+                list_result.total_flow != csr_result.total_flow) {
+                fprintf(stderr, "Layouts disagree on %d x %d\n", topology->nr_vms, topology->nr_pcpus);
+                return 1;
+            }
+            printf("%-9s %-8s %6d %6d %8d %12.3f %12s %8d\n", name, "list",
+                topology->nr_vms, topology->nr_pcpus, template.nr_edges,
+                list_ms / repetitions, "-", list_result.total_cost);
+            printf("%-9s %-8s %6d %6d %8d %12.3f %12.3f %8d\n", name, "csr",
+                topology->nr_vms, topology->nr_pcpus, template.nr_edges,
+                csr_ms / repetitions, csr_build_ms / repetitions, csr_result.total_cost);
+        }
+    }
+
+    graph_destroy(&template);
+    graph_destroy(&list_graph);
+    csr_destroy(&csr);
+    return 0;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include "vm_types.h"
+#include "scheduler.h"
+#include "incremental_scheduler.h"
+#include "auction.h"
+#include "domain_scheduler.h"
+#include "tick_schedule.h"
+
+/**
+ * Scheduler microbenchmarks over seeded random host topologies.
+ *
+ * Every topology is solved with compute_schedule (full solve every tick),
+ * the auction solver (with and without AVX2), domain_schedule (one solve per
+ * NUMA node on 1 to 8 threads) and incremental_schedule (warm started from the
+ * previous tick, without and with a deadline). Each result is
+ * printed as one JSON object per line so runs from two revisions can be diffed
+ * or loaded into a spreadsheet.
+ *
+ * Usage: ./bench_scheduler [-s seed] [-n samples] [-m max_vms] [-l label]
+ *   -s seed     Seed for the random topologies (default 6210)
+ *   -n samples  Samples per topology (default scales down with the VM count)
+ *   -m max_vms  Skip topologies with more VMs (default 1024)
+ *   -l label    Free form label copied to every line (e.g. the git revision)
+ */
+
+typedef struct {
+    int nr_vms;
+    int nr_pcpus;
+} Topology;
+
+/*
+ * Hosts with spare pCPU slots (the VMs have somewhere to move to) and full
+ * hosts (every slot taken, so only the MAX_VMS_PER_PCPU limit decides).
+ */
+static const Topology topologies[] = {
+    {8, 4},
+    {32, 32},
+    {128, 64},
+    {256, 256},
+    {512, 256},
+    {512, 512},
+    {1024, 512},
+};
+
+/* pCPUs that change utilization between two incremental ticks */
+#define CHANGED_PCPUS_PER_TICK 4
+/* pCPUs of a NUMA node for domain_schedule, hosts with fewer aren't split */
+#define PCPUS_PER_NODE 32
+/* Threads domain_schedule runs on, the caller and the workers */
+static const int domain_threads[] = { 1, 2, 4, 8 };
+/* Solve budget of incremental_schedule_until, per tick */
+#define INCREMENTAL_BUDGET_MS 5
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief A utilization in [0, 100) skewed towards idle with a few busy pCPUs.
+ */
+static double skewed_utilization(void) {
+    double r = (double) rand() / RAND_MAX;
+    return 99.0 * pow(r, 3.0);
+}
+
+/**
+ * @brief Random state where most VMs start crowded on the low numbered pCPUs.
+ */
+static void generate_state(SystemState *state, int nr_vms, int nr_pcpus) {
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = nr_pcpus;
+    for (int j = 0; j < nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].utilization_rate = skewed_utilization();
+    }
+    state->nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        double r = (double) rand() / RAND_MAX;
+        state->vms[i].id = i + 1;
+        snprintf(state->vms[i].name, MAX_NAME_LEN, "vm%d", i + 1);
+        state->vms[i].current_pcpu = (int) (nr_pcpus * r * r) % nr_pcpus;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest rank percentile of sorted samples.
+ */
+static double percentile(const double *sorted, int nr_samples, double p) {
+    int rank = (int) ceil(p / 100.0 * nr_samples);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+static void report(const char *label, const char *bench, const Topology *topology, unsigned int seed,
+                   double *latency_ms, int nr_samples, double augmentations, double allocs) {
+    qsort(latency_ms, nr_samples, sizeof(double), compare_double);
+    double total = 0;
+    for (int k = 0; k < nr_samples; k++) {
+        total += latency_ms[k];
+    }
+    printf("{\"label\": \"%s\", \"bench\": \"%s\", \"vms\": %d, \"pcpus\": %d, \"seed\": %u, "
+           "\"samples\": %d, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"mean_ms\": %.4f, \"max_ms\": %.4f, "
+           "\"augmentations_per_solve\": %.2f, \"allocs_per_solve\": %.2f}\n",
+        label, bench, topology->nr_vms, topology->nr_pcpus, seed, nr_samples,
+        percentile(latency_ms, nr_samples, 50), percentile(latency_ms, nr_samples, 99),
+        total / nr_samples, latency_ms[nr_samples - 1], augmentations, allocs);
+    fflush(stdout);
+}
+
+/**
+ * @brief compute_schedule on a fresh random state every sample, reusing one workspace.
+ */
+static void bench_compute_schedule(const char *label, const Topology *topology, unsigned int seed,
+                                   int nr_samples, SystemState *state, double *latency_ms) {
+    static ScheduleWorkspace ws;
+    long augmentations = 0;
+    int allocs = 0;
+
+    srand(seed);
+    for (int k = 0; k < nr_samples; k++) {
+        generate_state(state, topology->nr_vms, topology->nr_pcpus);
+        int mallocs_before = ws.graph.arena.nr_mallocs + ws.csr.arena.nr_mallocs;
+        double start = now_ms();
+        compute_schedule_on(&ws, state);
+        latency_ms[k] = now_ms() - start;
+        allocs += ws.graph.arena.nr_mallocs + ws.csr.arena.nr_mallocs - mallocs_before;
+        augmentations += ws.result.nr_augmentations;
+    }
+    report(label, "compute_schedule", topology, seed, latency_ms, nr_samples,
+        (double) augmentations / nr_samples, (double) allocs / nr_samples);
+    schedule_workspace_destroy(&ws);
+}
+
+/**
+ * @brief compute_schedule with the auction solver on the same states as bench_compute_schedule.
+ *
+ * Augmentations are the bids. Every schedule is checked against the flow network's cost.
+ */
+static void bench_auction_schedule(const char *label, const Topology *topology, unsigned int seed,
+                                   int nr_samples, SystemState *state, double *latency_ms, bool simd) {
+    static ScheduleWorkspace ws;
+    static ScheduleWorkspace flow;
+    long bids = 0;
+    int allocs = 0;
+
+    ws.solver = &auction_schedule_solver;
+    auction_set_simd(simd);
+    srand(seed);
+    for (int k = 0; k < nr_samples; k++) {
+        generate_state(state, topology->nr_vms, topology->nr_pcpus);
+        int mallocs_before = ws.solver_arena.nr_mallocs;
+        double start = now_ms();
+        Schedule schedule = compute_schedule_on(&ws, state);
+        latency_ms[k] = now_ms() - start;
+        allocs += ws.solver_arena.nr_mallocs - mallocs_before;
+        bids += ws.result.nr_augmentations;
+        Schedule expected = compute_schedule_on(&flow, state);
+        if (schedule.total_cost != expected.total_cost) {
+            fprintf(stderr, "%s cost %d instead of %d on %d VMs and %d pCPUs\n", ws.solved_by,
+                schedule.total_cost, expected.total_cost, topology->nr_vms, topology->nr_pcpus);
+        }
+    }
+    report(label, auction_simd_active() ? "auction_avx2" : "auction_scalar", topology, seed, latency_ms,
+        nr_samples, (double) bids / nr_samples, (double) allocs / nr_samples);
+    auction_set_simd(true);
+    schedule_workspace_destroy(&ws);
+    schedule_workspace_destroy(&flow);
+}
+
+/**
+ * @brief domain_schedule on the states of bench_compute_schedule, split into nodes of PCPUS_PER_NODE pCPUs.
+ *
+ * Augmentations are the paths of all the domains.
+ */
+static void bench_domain_schedule(const char *label, const Topology *topology, unsigned int seed,
+                                  int nr_samples, SystemState *state, double *latency_ms, int nr_threads) {
+    static DomainScheduler ds;
+    static Schedule schedule;
+    long augmentations = 0;
+    int allocs = 0;
+    char bench[32];
+
+    if (domain_scheduler_start(&ds, SPLIT_BY_NODE, nr_threads - 1) < 0) {
+        return;
+    }
+    srand(seed);
+    for (int k = 0; k < nr_samples; k++) {
+        generate_state(state, topology->nr_vms, topology->nr_pcpus);
+        state->topology.nr_cpus = topology->nr_pcpus;
+        for (int j = 0; j < topology->nr_pcpus; j++) {
+            state->topology.core[j] = j;
+            state->topology.llc[j] = j / PCPUS_PER_NODE;
+            state->topology.node[j] = j / PCPUS_PER_NODE;
+        }
+        int mallocs_before = 0;
+        for (int d = 0; d < DOMAIN_MAX_DOMAINS && ds.domains[d] != NULL; d++) {
+            mallocs_before += ds.domains[d]->ws.graph.arena.nr_mallocs + ds.domains[d]->ws.csr.arena.nr_mallocs;
+        }
+        double start = now_ms();
+        domain_schedule(&ds, state, &schedule);
+        latency_ms[k] = now_ms() - start;
+        for (int d = 0; d < ds.nr_domains; d++) {
+            const ScheduleWorkspace *ws = &ds.domains[d]->ws;
+            allocs += ws->graph.arena.nr_mallocs + ws->csr.arena.nr_mallocs;
+            augmentations += ws->result.nr_augmentations;
+        }
+        allocs -= mallocs_before;
+    }
+    snprintf(bench, sizeof(bench), "domain_schedule_%dt", nr_threads);
+    report(label, bench, topology, seed, latency_ms, nr_samples,
+        (double) augmentations / nr_samples, (double) allocs / nr_samples);
+    domain_scheduler_stop(&ds);
+}
+
+/**
+ * @brief incremental_schedule over consecutive ticks where a few pCPUs change utilization.
+ *
+ * The first tick (a full build) is not sampled. Augmentations are the negative cycles cancelled.
+ * With a budget the ticks are solved by incremental_schedule_until.
+ */
+static void bench_incremental_schedule(const char *label, const Topology *topology, unsigned int seed,
+                                       int nr_samples, SystemState *state, double *latency_ms, int budget_ms) {
+    static IncrementalScheduler scheduler;
+    static Schedule schedule;
+    char bench[64] = "incremental_schedule";
+    long cycles = 0;
+    int allocs = 0;
+
+    srand(seed);
+    generate_state(state, topology->nr_vms, topology->nr_pcpus);
+    incremental_schedule(&scheduler, state, &schedule);
+    for (int k = 0; k < nr_samples; k++) {
+        /* The VMs were pinned where they were scheduled and a few pCPUs changed load */
+        for (int i = 0; i < state->nr_vms; i++) {
+            if (schedule.vm_to_pcpu[i] >= 0) {
+                state->vms[i].current_pcpu = schedule.vm_to_pcpu[i];
+            }
+        }
+        for (int c = 0; c < CHANGED_PCPUS_PER_TICK; c++) {
+            state->pcpus[rand() % state->nr_pcpus].utilization_rate = skewed_utilization();
+        }
+
+        int mallocs_before = scheduler.graph.arena.nr_mallocs + scheduler.arena.nr_mallocs;
+        double start = now_ms();
+        long long deadline_ns = budget_ms > 0 ? tick_now_ns() + budget_ms * 1000000LL : 0;
+        incremental_schedule_until(&scheduler, state, deadline_ns, &schedule);
+        latency_ms[k] = now_ms() - start;
+        allocs += scheduler.graph.arena.nr_mallocs + scheduler.arena.nr_mallocs - mallocs_before;
+        cycles += scheduler.stats.nr_cancelled_cycles;
+    }
+    if (budget_ms > 0) {
+        snprintf(bench, sizeof(bench), "incremental_schedule_%dms", budget_ms);
+    }
+    report(label, bench, topology, seed, latency_ms, nr_samples,
+        (double) cycles / nr_samples, (double) allocs / nr_samples);
+    incremental_scheduler_destroy(&scheduler);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int seed = 6210;
+    int samples = 0;
+    int max_vms = MAX_VMS;
+    const char *label = "";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:m:l:")) != -1) {
+        switch (opt) {
+            case 's': seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'n': samples = atoi(optarg); break;
+            case 'm': max_vms = atoi(optarg); break;
+            case 'l': label = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seed] [-n samples] [-m max_vms] [-l label]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    static SystemState state;
+    int nr_topologies = sizeof(topologies) / sizeof(topologies[0]);
+    for (int t = 0; t < nr_topologies; t++) {
+        const Topology *topology = &topologies[t];
+        if (topology->nr_vms > max_vms) {
+            continue;
+        }
+        /* Full solves get slow on big hosts, so they get fewer samples by default */
+        int full_samples = samples > 0 ? samples : 2048 / topology->nr_vms;
+        if (full_samples < 3) {
+            full_samples = 3;
+        }
+        int incremental_samples = samples > 0 ? samples : 200;
+        int nr_latencies = full_samples > incremental_samples ? full_samples : incremental_samples;
+        double *latency_ms = malloc(sizeof(double) * nr_latencies);
+        if (latency_ms == NULL) {
+            fprintf(stderr, "Failed to allocate the latency samples\n");
+            return 1;
+        }
+
+        bench_compute_schedule(label, topology, seed + t, full_samples, &state, latency_ms);
+        bench_auction_schedule(label, topology, seed + t, full_samples, &state, latency_ms, true);
+        bench_auction_schedule(label, topology, seed + t, full_samples, &state, latency_ms, false);
+        for (int n = 0; n < (int) (sizeof(domain_threads) / sizeof(domain_threads[0])); n++) {
+            if (topology->nr_pcpus >= 2 * PCPUS_PER_NODE) {
+                bench_domain_schedule(label, topology, seed + t, full_samples, &state, latency_ms, domain_threads[n]);
+            }
+        }
+        bench_incremental_schedule(label, topology, seed + t, incremental_samples, &state, latency_ms, 0);
+        bench_incremental_schedule(label, topology, seed + t, incremental_samples, &state, latency_ms, INCREMENTAL_BUDGET_MS);
+        free(latency_ms);
+    }
+    return 0;
+}
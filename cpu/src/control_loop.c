@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include "control_loop.h"
+#include "tick_schedule.h"
+
+void cpu_control_init(CPUControl *ctl, long long period_ns) {
+    memset(ctl, 0, sizeof(CPUControl));
+    ctl->period_ns = period_ns;
+    memset(&ctl->previous, -1, sizeof(SystemState));
+    ctl->previous_query_ns = -1;
+    stabilizer_init(&ctl->stabilizer, stability_default_policy());
+    ctl->stabilizer.policy.solve_budget_ns = period_ns * CONTROL_SOLVE_BUDGET_PERCENT / 100;
+    sampler_init(&ctl->sampler, SAMPLE_EWMA_ALPHA);
+}
+
+void cpu_control_destroy(CPUControl *ctl) {
+    incremental_scheduler_destroy(&ctl->scheduler);
+    stabilizer_destroy(&ctl->stabilizer);
+}
+
+bool cpu_control_sample(CPUControl *ctl, const VirtBackend *backend, long long now_ns, double busy_percent) {
+    double previous_rate[MAX_PCPUS];
+    double current_rate[MAX_PCPUS];
+    Sampler *sampler = &ctl->sampler;
+    if (backend->ops->query_state(backend->impl, &ctl->sample) < 0) {
+        return false;
+    }
+    int nr_pcpus = ctl->sample.nr_pcpus == sampler->nr_pcpus ? ctl->sample.nr_pcpus : 0;
+    for (int j = 0; j < nr_pcpus; j++) {
+        previous_rate[j] = sampler->pcpus[j].utilization.ewma;
+    }
+    sampler_add(sampler, &ctl->sample, now_ns);
+    for (int j = 0; j < nr_pcpus; j++) {
+        current_rate[j] = sampler->pcpus[j].utilization.ewma;
+    }
+    return tick_crossed_above(previous_rate, current_rate, nr_pcpus, busy_percent) > 0;
+}
+
+int cpu_control_tick(CPUControl *ctl, const VirtBackend *backend, long long now_ns) {
+    SystemState *state = &ctl->current;
+    long long start_ns = tick_now_ns();
+    if (backend->ops->query_state(backend->impl, state) < 0) {
+        fprintf(stderr, "Failed to query the current system state\n");
+        return -1;
+    }
+    ctl->stats.query_ns += tick_now_ns() - start_ns;
+    ctl->stats.nr_ticks++;
+
+    /* Early ticks make the time since the last query shorter than the period */
+    unsigned long long interval_ns = ctl->previous_query_ns < 0 ? ctl->period_ns : now_ns - ctl->previous_query_ns;
+    ctl->previous_query_ns = now_ns;
+    if (ctl->verbose) {
+        printf("Found %d VMs, %d pCPUs\n", state->nr_vms, state->nr_pcpus);
+    }
+    if (ctl->previous.nr_pcpus == -1) {
+        if (ctl->verbose) {
+            printf("Skip the cycle for gathering more system information for scheduling\n");
+        }
+        ctl->previous = *state;
+        return 0;
+    }
+
+    start_ns = tick_now_ns();
+    caculate_utilization_rate(state, &ctl->previous, interval_ns);
+    ctl->previous = *state;
+    /* The cost model uses the smoothed samples, the raw rates above only cover VMs not sampled yet */
+    sampler_add(&ctl->sampler, state, now_ns);
+    sampler_apply(&ctl->sampler, state);
+    if (ctl->verbose) {
+        printf("\n");
+        print_sys_state(state);
+    }
+    if (ctl->trace != NULL) {
+        trace_write_state(ctl->trace, now_ns, state);
+    }
+    if (state->nr_vms == 0) {
+        ctl->stats.schedule_ns += tick_now_ns() - start_ns;
+        return 0;
+    }
+
+    /* Small gains, VMs that just moved and moves over the budget are held back */
+    Schedule *schedule = &ctl->schedule;
+    if (stable_schedule(&ctl->stabilizer, &ctl->scheduler, state, schedule) < 0) {
+        fprintf(stderr, "Failed to compute the schedule\n");
+        return -1;
+    }
+    ctl->stats.schedule_ns += tick_now_ns() - start_ns;
+    ctl->stats.nr_cut_short += !ctl->stabilizer.stats.optimal;
+    if (ctl->trace != NULL) {
+        trace_write_schedule(ctl->trace, now_ns, schedule);
+    }
+    if (ctl->verbose) {
+        print_schedule(schedule, state->nr_vms);
+        printf("Rebuilt: %d, updated edges: %d, cancelled cycles: %d\n",
+            ctl->scheduler.stats.rebuilt, ctl->scheduler.stats.nr_updated_edges, ctl->scheduler.stats.nr_cancelled_cycles);
+        printf("Migrations: %d, cooling down: %d, improvement: %d%s\n", ctl->stabilizer.stats.nr_migrations,
+            ctl->stabilizer.stats.nr_cooling, ctl->stabilizer.stats.improvement,
+            ctl->stabilizer.stats.kept_current ? " (kept the current placement)" : "");
+        if (!ctl->stabilizer.stats.optimal) {
+            printf("Ran out of solve budget, the next tick carries on\n");
+        }
+    }
+
+    /* Only vCPUs that move get pinned */
+    start_ns = tick_now_ns();
+    int nr_rpcs = backend->ops->apply_pinning(backend->impl, state, schedule);
+    ctl->stats.apply_ns += tick_now_ns() - start_ns;
+    if (nr_rpcs < 0) {
+        fprintf(stderr, "Failed to apply the schedule\n");
+        return -1;
+    }
+    ctl->stats.nr_pin_rpcs += nr_rpcs;
+    if (ctl->verbose) {
+        printf("Pinning made %d %s calls\n", nr_rpcs, backend->ops->name);
+    }
+    return 0;
+}
+
+void print_sys_state(SystemState *state) {
+    printf("System state\n");
+	for(int i = 0; i < state->nr_vms; i++){
+		printf(
+			"%d: VM %d (%s) pCPU: %d, vCPUs: %d, usage rate: %.4f%% (peak %.2f%%, stddev %.2f), cpu time: %lld\n",
+			i,
+            state->vms[i].id,
+			state->vms[i].name,
+			state->vms[i].current_pcpu,
+			state->vms[i].nr_vcpus,
+			state->vms[i].cpu_usage_rate,
+			state->vms[i].cpu_usage_peak,
+			state->vms[i].cpu_usage_stddev,
+            state->vms[i].cpu_time
+		);
+		for (int k = 1; k < state->vms[i].nr_vcpus; k++) {
+			printf("   vCPU %d pCPU: %d\n", k, state->vms[i].vcpu_pcpu[k]);
+		}
+	}
+	for(int i = 0; i < state->nr_pcpus; i++){
+		printf(
+			"PCPU %d utilization: %.6f%% (peak %.2f%%, stddev %.2f) idle (ns): %lld idel rate: %.4f%%\n",
+			state->pcpus[i].id,
+			state->pcpus[i].utilization_rate,
+			state->pcpus[i].utilization_peak,
+			state->pcpus[i].utilization_stddev,
+            state->pcpus[i].idle_ns,
+            state->pcpus[i].idle_rate
+		);
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "scheduler.h"
+#include "incremental_scheduler.h"
+#include "stability.h"
+#include "sampler.h"
+#include "trace.h"
+#include "virt_backend.h"
+
+/**
+ * Share of the period the solves of a tick may take. Past it the tick takes the
+ * best schedule found so far and the next tick carries on improving it.
+ */
+#define CONTROL_SOLVE_BUDGET_PERCENT 25
+
+/**
+ * @brief Where a tick's time goes, measured on the monotonic clock.
+ */
+typedef struct {
+    int       nr_ticks;
+    int       nr_pin_rpcs;
+    long long query_ns;     // In the backend's query_state
+    long long schedule_ns;  // Utilization, sampling and stable_schedule
+    long long apply_ns;     // In the backend's apply_pinning
+    int       nr_cut_short; // Ticks whose solves ran out of budget before the optimum
+} ControlStats;
+
+/**
+ * @brief What vcpu_scheduler keeps between ticks. Too big for the stack, keep it static.
+ *
+ * The loop only talks to the hypervisor through a VirtBackend, so the same ticks
+ * run against libvirt in the daemon and against a SimHypervisor in the tests.
+ */
+typedef struct {
+    long long            period_ns;
+    bool                 verbose;            // Print the state and schedule of every tick
+    TraceWriter          *trace;             // NULL when not recording
+    SystemState          previous;           // nr_pcpus is -1 until the first query
+    long long            previous_query_ns;  // Ticks are not evenly spaced once they can run early
+    SystemState          current;
+    Schedule             schedule;
+    IncrementalScheduler scheduler;          // Flow network and previous optimum
+    Stabilizer           stabilizer;         // Keeps VMs from moving back and forth
+    Sampler              sampler;            // Utilization sampled between ticks
+    SystemState          sample;
+    ControlStats         stats;
+} CPUControl;
+
+void cpu_control_init(CPUControl *ctl, long long period_ns);
+
+void cpu_control_destroy(CPUControl *ctl);
+
+/**
+ * @brief Queries the host, schedules the VMs and pins the vCPUs that move.
+ *
+ * The first tick only records the CPU times the next one needs for utilization.
+ *
+ * @param now_ns Monotonic time of the tick, the simulated clock against a SimHypervisor
+ * @return 0 on success, -1 when the query, the schedule or the pinning failed
+ */
+int cpu_control_tick(CPUControl *ctl, const VirtBackend *backend, long long now_ns);
+
+/**
+ * @brief Samples the VM and pCPU times between ticks.
+ *
+ * @return true when a pCPU's average utilization crossed busy_percent, asking for an early tick
+ */
+bool cpu_control_sample(CPUControl *ctl, const VirtBackend *backend, long long now_ns, double busy_percent);
+
+void print_sys_state(SystemState *state);
+
+#endif
@@ -0,0 +1,106 @@
+#include <string.h>
+#include "csr_graph.h"
+
+/**
+ * @brief Number of arena bytes csr_carve needs.
+ */
+static size_t csr_arena_size(int max_nodes, int max_edges) {
+    return arena_aligned_size(sizeof(int) * (max_nodes + 1)) * 2
+        + arena_aligned_size(sizeof(int) * max_edges) * 7
+        + arena_aligned_size(sizeof(int) * max_nodes) * 4
+        + arena_aligned_size(sizeof(bool) * max_nodes);
+}
+
+/**
+ * @brief Carves the edge and scratch arrays from the graph's arena.
+ */
+static int csr_carve(CSRGraph *csr, int max_nodes, int max_edges) {
+    csr->offsets = arena_alloc(&csr->arena, sizeof(int) * (max_nodes + 1));
+    csr->to = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->cap = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->cost = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->flow = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->rev = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->edge_id = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->position = arena_alloc(&csr->arena, sizeof(int) * max_edges);
+    csr->dist = arena_alloc(&csr->arena, sizeof(int) * max_nodes);
+    csr->prev_edges = arena_alloc(&csr->arena, sizeof(int) * max_nodes);
+    csr->potential = arena_alloc(&csr->arena, sizeof(int) * max_nodes);
+    csr->queue = arena_alloc(&csr->arena, sizeof(int) * (max_nodes + 1));
+    csr->heap_pos = arena_alloc(&csr->arena, sizeof(int) * max_nodes);
+    csr->visited = arena_alloc(&csr->arena, sizeof(bool) * max_nodes);
+    if (!csr->offsets || !csr->to || !csr->cap || !csr->cost || !csr->flow || !csr->rev ||
+        !csr->edge_id || !csr->position || !csr->dist || !csr->prev_edges || !csr->potential || !csr->queue ||
+        !csr->heap_pos || !csr->visited) {
+        return -1;
+    }
+    csr->max_nodes = max_nodes;
+    csr->max_edges = max_edges;
+    return 0;
+}
+
+int csr_create(CSRGraph *csr, int max_nodes, int max_edges) {
+    memset(csr, 0, sizeof(CSRGraph));
+    return csr_reserve(csr, max_nodes, max_edges);
+}
+
+int csr_reserve(CSRGraph *csr, int max_nodes, int max_edges) {
+    if (csr->arena.base != NULL && max_nodes <= csr->max_nodes && max_edges <= csr->max_edges) {
+        return 0;
+    }
+    if (max_nodes < csr->max_nodes) {
+        max_nodes = csr->max_nodes;
+    }
+    if (max_edges < csr->max_edges) {
+        max_edges = csr->max_edges;
+    }
+    csr->nr_nodes = 0;
+    csr->nr_edges = 0;
+    if (arena_reserve(&csr->arena, csr_arena_size(max_nodes, max_edges)) < 0) {
+        return -1;
+    }
+    return csr_carve(csr, max_nodes, max_edges);
+}
+
+void csr_destroy(CSRGraph *csr) {
+    arena_free(&csr->arena);
+    memset(csr, 0, sizeof(CSRGraph));
+}
+
+int csr_from_graph(CSRGraph *csr, const FlowGraph *g) {
+    if (csr_reserve(csr, g->nr_nodes, g->nr_edges) < 0) {
+        return -1;
+    }
+    csr->nr_nodes = g->nr_nodes;
+    csr->nr_edges = g->nr_edges;
+
+    /* Walk every adjacency list in order so ties break the same way in both layouts */
+    int p = 0;
+    for (int u = 0; u < g->nr_nodes; u++) {
+        csr->offsets[u] = p;
+        for (int e = g->heads[u]; e >= 0; e = g->edges[e].next) {
+            csr->to[p] = g->edges[e].to;
+            csr->cap[p] = g->edges[e].capacity;
+            csr->cost[p] = g->edges[e].cost;
+            csr->flow[p] = g->edges[e].flow;
+            csr->edge_id[p] = e;
+            csr->position[e] = p;
+            p++;
+        }
+    }
+    csr->offsets[g->nr_nodes] = p;
+
+    for (p = 0; p < csr->nr_edges; p++) {
+        csr->rev[p] = csr->position[csr->edge_id[p] ^ 1];
+    }
+    return 0;
+}
+
+void csr_to_graph(const CSRGraph *csr, FlowGraph *g) {
+    for (int p = 0; p < csr->nr_edges; p++) {
+        Edge *edge = &g->edges[csr->edge_id[p]];
+        edge->capacity = csr->cap[p];
+        edge->cost = csr->cost[p];
+        edge->flow = csr->flow[p];
+    }
+}
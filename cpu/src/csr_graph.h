@@ -0,0 +1,95 @@
+#ifndef CSR_GRAPH_H
+#define CSR_GRAPH_H
+
+#include <stdbool.h>
+#include "arena.h"
+#include "graph.h"
+
+/**
+ * @brief A compressed sparse row (CSR) copy of a FlowGraph for the solver hot loop.
+ * 
+ * The edges leaving node u sit next to each other at [offsets[u], offsets[u + 1])
+ * and every edge field lives in its own array (structure of arrays). Relaxing the
+ * edges of a node reads to[], cap[] and cost[] front to back instead of copying 
+ * whole Edge structs and following the next links around the edge array.
+ * 
+ * Edges keep the order of the FlowGraph adjacency lists so both layouts break 
+ * ties between equally cheap paths the same way.
+ * 
+ * rev[p] is the position of the counterpart edge of p (the FlowGraph layout 
+ * gets it with e ^ 1), and edge_id[p] is the index of p in FlowGraph.edges.
+ * The flow result is copied back to the FlowGraph with csr_to_graph.
+ */
+typedef struct {
+    /* @brief The edges of node u are at [offsets[u], offsets[u + 1]) */
+    int *offsets;
+    /* @brief The target node of each edge */
+    int *to;
+    /* @brief The remaining capacity of each edge */
+    int *cap;
+    /* @brief The cost for flowing through each edge */
+    int *cost;
+    /* @brief The current flow of each edge */
+    int *flow;
+    /* @brief The position of the counterpart (forward or reverse) edge */
+    int *rev;
+    /* @brief The index of each edge in FlowGraph.edges */
+    int *edge_id;
+    /* @brief The position of each FlowGraph edge (i.e. the inverse of edge_id) */
+    int *position;
+    /* @brief Number of edges */
+    int nr_edges;
+    /* @brief Number of nodes */
+    int nr_nodes;
+    /* @brief Number of edges the graph has room for */
+    int max_edges;
+    /* @brief Number of nodes the graph has room for */
+    int max_nodes;
+    /* @brief Solver scratch: distance of each node to the source */
+    int *dist;
+    /* @brief Solver scratch: the edge that leads the shortest path to each node */
+    int *prev_edges;
+    /* @brief Solver scratch: node potentials for reduced costs */
+    int *potential;
+    /* @brief Solver scratch: SPFA queue or Dijkstra heap (max_nodes + 1 entries) */
+    int *queue;
+    /* @brief Solver scratch: position of each node in the Dijkstra heap */
+    int *heap_pos;
+    /* @brief Solver scratch: SPFA in-queue flags or Dijkstra settled flags */
+    bool *visited;
+    /* @brief The memory all the arrays above are carved from */
+    Arena arena;
+} CSRGraph;
+
+/**
+ * @brief Allocates a CSRGraph with room for max_nodes nodes and max_edges edges.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int csr_create(CSRGraph *csr, int max_nodes, int max_edges);
+
+/**
+ * @brief Makes sure a created CSRGraph has room for max_nodes nodes and max_edges edges.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int csr_reserve(CSRGraph *csr, int max_nodes, int max_edges);
+
+/**
+ * @brief Frees the memory of a CSRGraph.
+ */
+void csr_destroy(CSRGraph *csr);
+
+/**
+ * @brief Lays out the nodes and edges of g in CSR form. Grows csr when needed.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int csr_from_graph(CSRGraph *csr, const FlowGraph *g);
+
+/**
+ * @brief Writes the capacity, cost and flow of every edge back to the FlowGraph it came from.
+ */
+void csr_to_graph(const CSRGraph *csr, FlowGraph *g);
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+#include "vm_types.h"
+#include "graph.h"
+#include "mcmf.h"
+#include "scheduler.h"
+#include "demand_scheduler.h"
+
+/**
+ * @brief The loads every pCPU is priced against.
+ */
+typedef struct {
+    int pcpu_index[MAX_PCPUS];   // By pCPU id, -1 for unknown ids
+    int background[MAX_PCPUS];   // Utilization the VMs on the pCPU don't account for
+    int share;                   // Every pCPU's part of the whole load, rounded up
+    int capacity;                // Past this a pCPU is overloaded
+    int total_demand;
+} DemandLoads;
+
+static bool is_saturated(const SystemState *state, int pcpu_id) {
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        if (state->pcpus[j].id == pcpu_id) {
+            return state->pcpus[j].utilization_rate >= DEMAND_SATURATED_PERCENT;
+        }
+    }
+    return false;
+}
+
+int vm_vcpu_demand(const SystemState *state, int vm_index) {
+    const VM *vm = &state->vms[vm_index];
+    int nr_vcpus = vm_nr_vcpus(vm);
+    for (int k = 0; k < nr_vcpus; k++) {
+        if (is_saturated(state, vm_vcpu_pcpu(vm, k))) {
+            return 100;
+        }
+    }
+    int demand = (int) (vm->cpu_usage_rate / nr_vcpus + 0.999);
+    return demand < 1 ? 1 : (demand > 100 ? 100 : demand);
+}
+
+/**
+ * @brief Splits the pCPUs' utilization into the demand of the VMs on them and the rest.
+ */
+static void demand_loads(const SystemState *state, const int *demands, DemandLoads *loads) {
+    double vm_usage[MAX_PCPUS];
+    for (int id = 0; id < MAX_PCPUS; id++) {
+        loads->pcpu_index[id] = -1;
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        if (state->pcpus[j].id >= 0 && state->pcpus[j].id < MAX_PCPUS) {
+            loads->pcpu_index[state->pcpus[j].id] = j;
+        }
+        vm_usage[j] = 0;
+    }
+    loads->total_demand = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int nr_vcpus = vm_nr_vcpus(vm);
+        loads->total_demand += demands[i] * nr_vcpus;
+        for (int k = 0; k < nr_vcpus; k++) {
+            int id = vm_vcpu_pcpu(vm, k);
+            int j = (id >= 0 && id < MAX_PCPUS) ? loads->pcpu_index[id] : -1;
+            if (j >= 0) {
+                vm_usage[j] += vm->cpu_usage_rate / nr_vcpus;
+            }
+        }
+    }
+    int total = loads->total_demand;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        double background = state->pcpus[j].utilization_rate - vm_usage[j];
+        loads->background[j] = background > 0 ? (int) background : 0;
+        total += loads->background[j];
+    }
+    loads->share = state->nr_pcpus > 0 ? (total + state->nr_pcpus - 1) / state->nr_pcpus : 0;
+    loads->capacity = DEMAND_HEADROOM_PERCENT;
+}
+
+/**
+ * @brief What a pCPU carrying load costs, convex in the load.
+ */
+static long long load_cost(const DemandLoads *loads, int load) {
+    int overloaded = loads->share > loads->capacity ? loads->share : loads->capacity;
+    long long cost = 0;
+    if (load > loads->share) {
+        cost += (long long) DEMAND_IMBALANCE_COST * ((load < overloaded ? load : overloaded) - loads->share);
+    }
+    if (load > overloaded) {
+        cost += (long long) DEMAND_OVERLOAD_COST * (load - overloaded);
+    }
+    return cost * DEMAND_COST_SCALE;
+}
+
+/**
+ * @brief The cost of one percent of the VM's demand on the pCPU, when slot of its vCPUs are already there.
+ */
+static int unit_cost(const SystemState *state, int vm_index, int pcpu_index, int slot, int demand) {
+    int cost = vm_pcpu_slot_cost_with_load(state, vm_index, pcpu_index, slot, 0) * DEMAND_COST_SCALE;
+    return (cost + demand - 1) / demand;
+}
+
+/**
+ * @brief What the vCPUs of a VM pay to be where the schedule puts them, DEMAND_COST_SCALE times finer.
+ *
+ * @return The cost, or -1 when a vCPU is unassigned or on an unknown pCPU.
+ */
+static long long vm_move_cost(const SystemState *state, const Schedule *schedule, int vm_index, const int *demands,
+                              const DemandLoads *loads) {
+    int vm_vcpus_on_pcpu[MAX_PCPUS];
+    int nr_vcpus = vm_nr_vcpus(&state->vms[vm_index]);
+    for (int k = 0; k < nr_vcpus; k++) {
+        int id = schedule->vcpu_to_pcpu[vm_index][k];
+        int j = (id >= 0 && id < MAX_PCPUS) ? loads->pcpu_index[id] : -1;
+        if (j < 0) {
+            return -1;
+        }
+        vm_vcpus_on_pcpu[j] = 0;
+    }
+    long long cost = 0;
+    for (int k = 0; k < nr_vcpus; k++) {
+        int j = loads->pcpu_index[schedule->vcpu_to_pcpu[vm_index][k]];
+        cost += (long long) unit_cost(state, vm_index, j, vm_vcpus_on_pcpu[j], demands[vm_index]) * demands[vm_index];
+        vm_vcpus_on_pcpu[j]++;
+    }
+    return cost;
+}
+
+/**
+ * @brief Adds up the load the schedule puts on every pCPU, background included.
+ */
+static void pcpu_loads(const SystemState *state, const Schedule *schedule, const int *demands, const DemandLoads *loads,
+                       int *pcpu_load) {
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        pcpu_load[j] = loads->background[j];
+    }
+    for (int i = 0; i < state->nr_vms; i++) {
+        for (int k = 0; k < vm_nr_vcpus(&state->vms[i]); k++) {
+            int id = schedule->vcpu_to_pcpu[i][k];
+            int j = (id >= 0 && id < MAX_PCPUS) ? loads->pcpu_index[id] : -1;
+            if (j >= 0) {
+                pcpu_load[j] += demands[i];
+            }
+        }
+    }
+}
+
+static int total_cost(const SystemState *state, const Schedule *schedule, const int *demands, const DemandLoads *loads) {
+    int pcpu_load[MAX_PCPUS];
+    long long cost = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        long long vm_cost = vm_move_cost(state, schedule, i, demands, loads);
+        if (vm_cost < 0) {
+            return -1;
+        }
+        cost += vm_cost;
+    }
+    pcpu_loads(state, schedule, demands, loads, pcpu_load);
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        cost += load_cost(loads, pcpu_load[j]) - load_cost(loads, loads->background[j]);
+    }
+    return (int) ((cost + DEMAND_COST_SCALE / 2) / DEMAND_COST_SCALE);
+}
+
+int demand_schedule_total_cost(const SystemState *state, const Schedule *schedule) {
+    int demands[MAX_VMS];
+    DemandLoads loads;
+    for (int i = 0; i < state->nr_vms; i++) {
+        demands[i] = vm_vcpu_demand(state, i);
+    }
+    demand_loads(state, demands, &loads);
+    return total_cost(state, schedule, demands, &loads);
+}
+
+Schedule compute_demand_schedule(const SystemState *state) {
+    ScheduleWorkspace ws;
+    memset(&ws, 0, sizeof(ws));
+    Schedule schedule = compute_demand_schedule_on(&ws, state);
+    schedule_workspace_destroy(&ws);
+    return schedule;
+}
+
+/**
+ * @brief Moves vCPUs off pCPUs above the balanced share onto pCPUs below it while that lowers the cost.
+ *
+ * Rounding the flow to whole vCPUs can leave a pCPU with a vCPU too many, which
+ * another pCPU could take if one of its own light vCPUs made room. Every move
+ * lowers the cost, so the passes end.
+ */
+static void balance_vcpus(const SystemState *state, Schedule *schedule, const int *demands, const DemandLoads *loads) {
+    int pcpu_load[MAX_PCPUS];
+    pcpu_loads(state, schedule, demands, loads, pcpu_load);
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (int i = 0; i < state->nr_vms; i++) {
+            int *vcpu_to_pcpu = schedule->vcpu_to_pcpu[i];
+            int d = demands[i];
+            for (int k = 0; k < vm_nr_vcpus(&state->vms[i]); k++) {
+                int from = vcpu_to_pcpu[k] >= 0 && vcpu_to_pcpu[k] < MAX_PCPUS ? loads->pcpu_index[vcpu_to_pcpu[k]] : -1;
+                if (from < 0 || pcpu_load[from] <= loads->share) {
+                    continue;
+                }
+                long long stay_cost = vm_move_cost(state, schedule, i, demands, loads);
+                long long freed = load_cost(loads, pcpu_load[from] - d) - load_cost(loads, pcpu_load[from]);
+                long long best_delta = 0;
+                int best = -1;
+                for (int to = 0; to < state->nr_pcpus; to++) {
+                    if (pcpu_load[to] >= loads->share) {
+                        continue;
+                    }
+                    vcpu_to_pcpu[k] = state->pcpus[to].id;
+                    long long delta = vm_move_cost(state, schedule, i, demands, loads) - stay_cost + freed +
+                                      load_cost(loads, pcpu_load[to] + d) - load_cost(loads, pcpu_load[to]);
+                    if (delta < best_delta) {
+                        best_delta = delta;
+                        best = to;
+                    }
+                }
+                vcpu_to_pcpu[k] = state->pcpus[best >= 0 ? best : from].id;
+                if (best >= 0) {
+                    pcpu_load[from] -= d;
+                    pcpu_load[best] += d;
+                    moved = true;
+                }
+            }
+            schedule->vm_to_pcpu[i] = vcpu_to_pcpu[0];
+        }
+    }
+}
+
+Schedule compute_demand_schedule_on(ScheduleWorkspace *ws, const SystemState *state) {
+    int demands[MAX_VMS] = { 0 };
+    DemandLoads loads;
+    FlowGraph *g = &ws->graph;
+    Schedule schedule;
+    memset(&schedule, -1, sizeof(Schedule));
+
+    int nr_vms = state->nr_vms;
+    int nr_pcpus = state->nr_pcpus;
+    for (int i = 0; i < nr_vms; i++) {
+        demands[i] = vm_vcpu_demand(state, i);
+    }
+    demand_loads(state, demands, &loads);
+
+    /* Node Indexes */
+    int source = 0;
+    int vm_base = 1;
+    int pcpu_base = vm_base + nr_vms;
+    int sink = pcpu_base + nr_pcpus;
+
+    /* Source -> VM, VM -> PCPU (one per vCPU slot) and three PCPU -> Sink edges with their reverse edges */
+    int nr_edges = nr_vms + 3 * nr_pcpus;
+    for (int i = 0; i < nr_vms; i++) {
+        nr_edges += nr_pcpus * vm_nr_pcpu_slots(&state->vms[i]);
+    }
+    nr_edges *= 2;
+    if (graph_reserve(g, sink + 1, nr_edges) < 0 || csr_reserve(&ws->csr, sink + 1, nr_edges) < 0) {
+        fprintf(stderr, "Failed to allocate the flow graph for %d VMs and %d pCPUs\n", nr_vms, nr_pcpus);
+        schedule.num_assigned = 0;
+        schedule.total_cost = 0;
+        return schedule;
+    }
+    graph_init(g, sink + 1);
+
+    /* Define Source to each VM, the demand of all its vCPUs */
+    for (int i = 0; i < nr_vms; i++) {
+        graph_add_edge(g, source, vm_base + i, demands[i] * vm_nr_vcpus(&state->vms[i]), 0);
+    }
+
+    /* Define VM to each PCPU, room for the demand of one vCPU per slot */
+    for (int i = 0; i < nr_vms; i++) {
+        for (int j = 0; j < nr_pcpus; j++) {
+            for (int slot = 0; slot < vm_nr_pcpu_slots(&state->vms[i]); slot++) {
+                graph_add_edge(g, vm_base + i, pcpu_base + j, demands[i], unit_cost(state, i, j, slot, demands[i]));
+            }
+        }
+    }
+
+    /* Define PCPU to Sink, convex: free up to the balanced share, then the headroom, then overload */
+    int overloaded = loads.share > loads.capacity ? loads.share : loads.capacity;
+    int band_costs[3] = { 0, DEMAND_IMBALANCE_COST * DEMAND_COST_SCALE, DEMAND_OVERLOAD_COST * DEMAND_COST_SCALE };
+    for (int j = 0; j < nr_pcpus; j++) {
+        int background = loads.background[j];
+        int balanced = loads.share - background;
+        int headroom = overloaded - (background > loads.share ? background : loads.share);
+        int band_capacities[3] = { balanced > 0 ? balanced : 0, headroom > 0 ? headroom : 0, loads.total_demand };
+        graph_add_convex_edge(g, pcpu_base + j, sink, band_capacities, band_costs, 3);
+    }
+
+    csr_from_graph(&ws->csr, g);
+    MCMFResult result = mcmf_solve_csr(&ws->csr, source, sink, MCMF_DEFAULT_ALGORITHM);
+    ws->result = result;
+    csr_to_graph(&ws->csr, g);
+
+    /* Every vCPU goes to the pCPU with most of its VM's flow left */
+    schedule.num_assigned = 0;
+    for (int i = 0; i < nr_vms; i++) {
+        int flow[MAX_PCPUS];
+        int flow_pcpus[MAX_PCPUS];
+        int nr_flow_pcpus = 0;
+        for (int e = g->heads[vm_base + i]; e >= 0; e = g->edges[e].next) {
+            Edge edge = g->edges[e];
+            if (edge.to >= pcpu_base && edge.to < sink && edge.flow > 0) {
+                int j = edge.to - pcpu_base;
+                bool seen = false;
+                for (int p = 0; p < nr_flow_pcpus && !seen; p++) {
+                    seen = flow_pcpus[p] == j;
+                }
+                if (!seen) {
+                    flow_pcpus[nr_flow_pcpus++] = j;
+                    flow[j] = 0;
+                }
+                flow[j] += edge.flow;
+            }
+        }
+        int pcpu_indexes[MAX_VCPUS_PER_VM];
+        int nr_vcpus = vm_nr_vcpus(&state->vms[i]);
+        int nr_placed = 0;
+        for (; nr_placed < nr_vcpus && nr_flow_pcpus > 0; nr_placed++) {
+            int best = flow_pcpus[0];
+            for (int p = 1; p < nr_flow_pcpus; p++) {
+                best = flow[flow_pcpus[p]] > flow[best] ? flow_pcpus[p] : best;
+            }
+            pcpu_indexes[nr_placed] = best;
+            flow[best] -= demands[i];
+        }
+        schedule_place_vcpus(&schedule, state, i, pcpu_indexes, nr_placed);
+        schedule.num_assigned += nr_placed;
+    }
+
+    balance_vcpus(state, &schedule, demands, &loads);
+    schedule.total_cost = total_cost(state, &schedule, demands, &loads);
+    return schedule;
+}
@@ -0,0 +1,75 @@
+#ifndef DEMAND_SCHEDULER_H
+#define DEMAND_SCHEDULER_H
+
+#include "vm_types.h"
+#include "scheduler.h"
+
+/**
+ * Share of a pCPU the placement fills before it counts as overloaded.
+ */
+#define DEMAND_HEADROOM_PERCENT 90
+/**
+ * A pCPU this busy doesn't show what its vCPUs want, so each of them is
+ * taken to want a whole pCPU until it runs somewhere with room.
+ */
+#define DEMAND_SATURATED_PERCENT 95
+/**
+ * Cost of every percent of load a pCPU carries above the balanced share, up to
+ * its headroom, and of every percent above both.
+ */
+#define DEMAND_IMBALANCE_COST 2
+#define DEMAND_OVERLOAD_COST 4
+/**
+ * The flow's edge costs are per percent of demand, so a vCPU's move cost is
+ * spread over its demand. They are kept this many times finer to round less.
+ */
+#define DEMAND_COST_SCALE 10
+
+/**
+ * @brief What the flow network routes from the VMs to the pCPUs.
+ */
+typedef enum {
+    /* One unit per vCPU, MAX_VMS_PER_PCPU vCPUs per pCPU (compute_schedule) */
+    PLACE_VCPU_SLOTS,
+    /* The vCPUs' measured demand in percent, up to DEMAND_HEADROOM_PERCENT of every pCPU (compute_demand_schedule) */
+    PLACE_BY_DEMAND,
+} PlacementMode;
+
+/**
+ * @brief The demand of every vCPU of VM vm_index, in percent of a pCPU (1 to 100).
+ *
+ * Its usage rate split over its vCPUs, or 100 when one of its vCPUs runs on a
+ * pCPU over DEMAND_SATURATED_PERCENT.
+ */
+int vm_vcpu_demand(const SystemState *state, int vm_index);
+
+/**
+ * @brief The cost compute_demand_schedule gives the vCPU assignment of a schedule.
+ *
+ * Every vCPU pays its move cost (vm_pcpu_slot_cost without the load), every pCPU
+ * DEMAND_IMBALANCE_COST and DEMAND_OVERLOAD_COST per percent of load above the
+ * balanced share and the headroom. Load the VMs don't account for stays where it is.
+ *
+ * @return The cost, or -1 when a vCPU is unassigned or on an unknown pCPU.
+ */
+int demand_schedule_total_cost(const SystemState *state, const Schedule *schedule);
+
+/**
+ * @brief Computes the VM to pCPU assignment that routes the vCPUs' demand.
+ *
+ * The min cost flow may split a VM's demand over several pCPUs. Each vCPU then
+ * goes where most of its VM's flow went, and vCPUs on pCPUs above the balanced
+ * share move to pCPUs below it while that lowers demand_schedule_total_cost.
+ * Builds the flow network in memory of its own and frees it before returning.
+ */
+Schedule compute_demand_schedule(const SystemState *state);
+
+/**
+ * @brief Same as compute_demand_schedule but builds the flow network in the caller's workspace.
+ *
+ * The workspace grows on demand and is reused by later calls. Calls on different
+ * workspaces can run at the same time.
+ */
+Schedule compute_demand_schedule_on(ScheduleWorkspace *ws, const SystemState *state);
+
+#endif
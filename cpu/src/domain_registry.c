@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "domain_registry.h"
+
+/**
+ * @brief Keeps the running (and persistent, as the listing does) domains.
+ */
+static int lifecycle_event(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque) {
+    DomainRegistry *registry = opaque;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    switch (event) {
+        case VIR_DOMAIN_EVENT_STARTED:
+        case VIR_DOMAIN_EVENT_RESUMED:
+            if (virDomainIsPersistent(dom) != 1) {
+                return 0;
+            }
+            if (domain_registry_add(registry, dom) == NULL) {
+                registry->stale = true;
+            }
+            break;
+        case VIR_DOMAIN_EVENT_SUSPENDED:
+        case VIR_DOMAIN_EVENT_STOPPED:
+        case VIR_DOMAIN_EVENT_CRASHED:
+        case VIR_DOMAIN_EVENT_PMSUSPENDED:
+        case VIR_DOMAIN_EVENT_UNDEFINED:
+            if (virDomainGetUUID(dom, uuid) < 0) {
+                registry->stale = true;
+                break;
+            }
+            domain_registry_remove(registry, uuid);
+            break;
+        default:
+            return 0;
+    }
+    if (registry->on_change != NULL) {
+        registry->on_change(registry->on_change_opaque);
+    }
+    return 0;
+}
+
+/* Only there so the event loop returns right away when nothing else is pending */
+static void wake_event_loop(int timer, void *opaque) {
+}
+
+void domain_registry_open(DomainRegistry *registry, virConnectPtr conn) {
+    memset(registry, 0, sizeof(DomainRegistry));
+    vm_table_clear(&registry->by_id);
+    registry->conn = conn;
+    registry->stale = true;
+    registry->timer_id = virEventAddTimeout(-1, wake_event_loop, NULL, NULL);
+    registry->callback_id = -1;
+    if (registry->timer_id >= 0) {
+        registry->callback_id = virConnectDomainEventRegisterAny(conn, NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+            VIR_DOMAIN_EVENT_CALLBACK(lifecycle_event), registry, NULL);
+    }
+    if (registry->callback_id < 0) {
+        fprintf(stderr, "No lifecycle events, the domains are listed every tick\n");
+    }
+}
+
+void domain_registry_watch(DomainRegistry *registry, void (*on_change)(void *opaque), void *opaque) {
+    registry->external_loop = true;
+    registry->on_change = on_change;
+    registry->on_change_opaque = opaque;
+}
+
+/**
+ * @brief Runs the callbacks of the events libvirt received since the last tick, without blocking.
+ */
+static void dispatch_events(DomainRegistry *registry) {
+    if (registry->callback_id < 0 || registry->external_loop) {
+        return;
+    }
+    virEventUpdateTimeout(registry->timer_id, 0);
+    virEventRunDefaultImpl();
+    virEventUpdateTimeout(registry->timer_id, -1);
+}
+
+int domain_registry_refresh(DomainRegistry *registry) {
+    dispatch_events(registry);
+    if (!registry->stale && registry->callback_id >= 0) {
+        return 0;
+    }
+
+    virDomainPtr *domains;
+    unsigned int flags = VIR_CONNECT_LIST_DOMAINS_RUNNING |
+                         VIR_CONNECT_LIST_DOMAINS_PERSISTENT;
+    int nr_doms = virConnectListAllDomains(registry->conn, &domains, flags);
+    registry->nr_rpcs++;
+    if (nr_doms < 0) {
+        fprintf(stderr, "Failed to get list of domains\n");
+        return -1;
+    }
+    domain_registry_sync(registry, domains, nr_doms);
+    for (int i = 0; i < nr_doms; i++) {
+        virDomainFree(domains[i]);
+    }
+    free(domains);
+    return 0;
+}
+
+void domain_registry_sync(DomainRegistry *registry, virDomainPtr *doms, int nr_doms) {
+    bool seen[MAX_VMS] = {false};
+    bool full = false;
+    for (int i = 0; i < nr_doms; i++) {
+        DomainEntry *entry = domain_registry_add(registry, doms[i]);
+        if (entry == NULL) {
+            full = true;
+            continue;
+        }
+        seen[entry - registry->entries] = true;
+    }
+    for (int s = 0; s < MAX_VMS; s++) {
+        if (registry->entries[s].dom != NULL && !seen[s]) {
+            domain_registry_remove(registry, registry->entries[s].uuid);
+        }
+    }
+    registry->stale = full;
+}
+
+/**
+ * @brief Drops the ID of the entry from the index, unless another domain took it over.
+ */
+static void forget_id(DomainRegistry *registry, const DomainEntry *entry) {
+    if (vm_table_get(&registry->by_id, entry->id) == entry - registry->entries) {
+        vm_table_remove(&registry->by_id, entry->id);
+    }
+}
+
+DomainEntry *domain_registry_add(DomainRegistry *registry, virDomainPtr dom) {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    if (virDomainGetUUID(dom, uuid) < 0) {
+        return NULL;
+    }
+    int id = virDomainGetID(dom);
+    /* Known domains are found by ID in O(1), only new ones pay for the UUID scan */
+    DomainEntry *entry = domain_registry_find_id(registry, id);
+    if (entry != NULL && memcmp(entry->uuid, uuid, VIR_UUID_BUFLEN) == 0) {
+        return entry;
+    }
+    entry = domain_registry_find(registry, uuid);
+
+    /* A new domain, or one that restarted with another ID behind our back */
+    if (entry == NULL) {
+        for (int s = 0; s < MAX_VMS && entry == NULL; s++) {
+            if (registry->entries[s].dom == NULL) {
+                entry = &registry->entries[s];
+            }
+        }
+        if (entry == NULL) {
+            fprintf(stderr, "Found more than %d domains\n", MAX_VMS);
+            return NULL;
+        }
+        registry->nr_domains++;
+    } else {
+        forget_id(registry, entry);
+        virDomainFree(entry->dom);
+    }
+    virDomainRef(dom);
+    entry->dom = dom;
+    memcpy(entry->uuid, uuid, VIR_UUID_BUFLEN);
+    entry->id = id;
+    vm_table_put(&registry->by_id, id, entry - registry->entries);
+    entry->generation++;
+    if (entry->generation == 0) {
+        entry->generation++;
+    }
+    return entry;
+}
+
+void domain_registry_remove(DomainRegistry *registry, const unsigned char *uuid) {
+    DomainEntry *entry = domain_registry_find(registry, uuid);
+    if (entry == NULL) {
+        return;
+    }
+    forget_id(registry, entry);
+    virDomainFree(entry->dom);
+    entry->dom = NULL;
+    registry->nr_domains--;
+}
+
+DomainEntry *domain_registry_find(DomainRegistry *registry, const unsigned char *uuid) {
+    for (int s = 0; s < MAX_VMS; s++) {
+        DomainEntry *entry = &registry->entries[s];
+        if (entry->dom != NULL && memcmp(entry->uuid, uuid, VIR_UUID_BUFLEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+DomainEntry *domain_registry_find_id(DomainRegistry *registry, int id) {
+    int slot = vm_table_get(&registry->by_id, id);
+    return slot >= 0 ? &registry->entries[slot] : NULL;
+}
+
+DomainEntry *domain_registry_lookup_id(DomainRegistry *registry, int id) {
+    DomainEntry *entry = domain_registry_find_id(registry, id);
+    if (entry != NULL) {
+        return entry;
+    }
+    virDomainPtr dom = virDomainLookupByID(registry->conn, id);
+    registry->nr_rpcs++;
+    if (dom == NULL) {
+        return NULL;
+    }
+    entry = domain_registry_add(registry, dom);
+    virDomainFree(dom);
+    return entry;
+}
+
+void domain_registry_close(DomainRegistry *registry) {
+    if (registry->callback_id >= 0) {
+        virConnectDomainEventDeregisterAny(registry->conn, registry->callback_id);
+    }
+    if (registry->timer_id >= 0) {
+        virEventRemoveTimeout(registry->timer_id);
+    }
+    for (int s = 0; s < MAX_VMS; s++) {
+        if (registry->entries[s].dom != NULL) {
+            virDomainFree(registry->entries[s].dom);
+        }
+    }
+    memset(registry, 0, sizeof(DomainRegistry));
+    vm_table_clear(&registry->by_id);
+    registry->callback_id = -1;
+    registry->timer_id = -1;
+}
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "domain_scheduler.h"
+#include "tick_schedule.h"
+
+/**
+ * @brief The node or LLC of pCPU pcpu_index, -1 when the topology doesn't know it.
+ */
+static int pcpu_group(const SystemState *state, DomainLevel level, int pcpu_index) {
+    int id = state->pcpus[pcpu_index].id;
+    if (id < 0 || id >= state->topology.nr_cpus) {
+        return -1;
+    }
+    return level == SPLIT_BY_NODE ? state->topology.node[id] : state->topology.llc[id];
+}
+
+/**
+ * @brief Gives every pCPU a domain, numbered in the order the groups first show up.
+ *
+ * @return The number of domains
+ */
+static int split_pcpus(const DomainScheduler *ds, const SystemState *state, int *pcpu_domain) {
+    int groups[MAX_PCPUS];
+    int nr_groups = 0;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        int group = pcpu_group(state, ds->level, j);
+        int g = 0;
+        while (g < nr_groups && groups[g] != group) {
+            g++;
+        }
+        if (g == nr_groups) {
+            groups[nr_groups++] = group;
+        }
+        /* Past DOMAIN_MAX_DOMAINS the groups join the domains from the first on */
+        pcpu_domain[j] = g % DOMAIN_MAX_DOMAINS;
+    }
+    return nr_groups < DOMAIN_MAX_DOMAINS ? nr_groups : DOMAIN_MAX_DOMAINS;
+}
+
+/**
+ * @brief Gives every VM a domain (ds->vm_domain), see DomainScheduler.
+ *
+ * A domain's share of the vCPUs follows its idle capacity, and is never more
+ * than its pCPU slots. A slot is cheaper than a move when its load and crowding
+ * cost less than REMOTE_NODE_MIGRATION_PENALTY on the idlest pCPU.
+ */
+static void split_vms(DomainScheduler *ds, const SystemState *state, const int *pcpu_domain, int nr_domains) {
+    int id_domain[MAX_PCPUS];
+    int load_costs[MAX_PCPUS];
+    int capacity[DOMAIN_MAX_DOMAINS] = { 0 };
+    long long idle[DOMAIN_MAX_DOMAINS] = { 0 };
+    int share[DOMAIN_MAX_DOMAINS];
+    int keep[DOMAIN_MAX_DOMAINS] = { 0 };
+    int used[DOMAIN_MAX_DOMAINS] = { 0 };
+    for (int id = 0; id < MAX_PCPUS; id++) {
+        id_domain[id] = -1;
+    }
+    pcpu_load_costs(state, load_costs);
+    int min_load = load_costs[0];
+    for (int j = 1; j < state->nr_pcpus; j++) {
+        min_load = load_costs[j] < min_load ? load_costs[j] : min_load;
+    }
+    long long total_idle = 0;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        int d = pcpu_domain[j];
+        int id = state->pcpus[j].id;
+        if (id >= 0 && id < MAX_PCPUS) {
+            id_domain[id] = d;
+        }
+        /* Every pCPU counts a little, so busy domains still get a share */
+        int pcpu_idle = 1 + (load_costs[j] < 100 ? 100 - load_costs[j] : 0);
+        capacity[d] += MAX_VMS_PER_PCPU;
+        /* Slots cheaper than moving to the idlest pCPU of another node */
+        for (int slot = 0; slot < MAX_VMS_PER_PCPU; slot++) {
+            keep[d] += load_costs[j] + slot * ADDITION_VM_PENALTY <= min_load + REMOTE_NODE_MIGRATION_PENALTY;
+        }
+        idle[d] += pcpu_idle;
+        total_idle += pcpu_idle;
+    }
+    long long nr_vcpus = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        nr_vcpus += vm_nr_vcpus(&state->vms[i]);
+    }
+    for (int d = 0; d < nr_domains; d++) {
+        long long rounded_up = (nr_vcpus * idle[d] + total_idle - 1) / total_idle;
+        share[d] = rounded_up < capacity[d] ? (int) rounded_up : capacity[d];
+        keep[d] = keep[d] > share[d] ? keep[d] : share[d];
+    }
+
+    /* VMs stay in their domain while it has room below its share, or slots that are cheaper than a move */
+    ds->stats.nr_moved = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int from = vm_vcpu_pcpu(vm, 0);
+        int home = (from >= 0 && from < MAX_PCPUS) ? id_domain[from] : -1;
+        ds->vm_domain[i] = -1;
+        if (home >= 0 && used[home] + vm_nr_vcpus(vm) <= keep[home]) {
+            ds->vm_domain[i] = home;
+            used[home] += vm_nr_vcpus(vm);
+        }
+    }
+    /* The others go where the most room below the share is left, or the most slots once every share is used */
+    for (int i = 0; i < state->nr_vms; i++) {
+        if (ds->vm_domain[i] >= 0) {
+            continue;
+        }
+        int nr = vm_nr_vcpus(&state->vms[i]);
+        int best = 0;
+        for (int d = 1; d < nr_domains; d++) {
+            int room = share[d] - used[d];
+            int best_room = share[best] - used[best];
+            if (room > best_room || (room == best_room && capacity[d] - used[d] > capacity[best] - used[best])) {
+                best = d;
+            }
+        }
+        if (share[best] - used[best] < nr) {
+            for (int d = 0; d < nr_domains; d++) {
+                best = capacity[d] - used[d] > capacity[best] - used[best] ? d : best;
+            }
+        }
+        ds->vm_domain[i] = best;
+        used[best] += nr;
+        ds->stats.nr_moved++;
+    }
+}
+
+/**
+ * @brief Builds the state of every domain from the host's, allocating the domains the first time.
+ *
+ * @return 0 on success, -1 when a domain couldn't be allocated
+ */
+static int build_domains(DomainScheduler *ds, const SystemState *state, const int *pcpu_domain, int nr_domains) {
+    for (int d = 0; d < nr_domains; d++) {
+        if (ds->domains[d] == NULL) {
+            ds->domains[d] = calloc(1, sizeof(HostDomain));
+            if (ds->domains[d] == NULL) {
+                fprintf(stderr, "Failed to allocate scheduling domain %d\n", d);
+                return -1;
+            }
+        }
+        SystemState *domain_state = &ds->domains[d]->state;
+        domain_state->nr_vms = 0;
+        domain_state->nr_pcpus = 0;
+        domain_state->topology = state->topology;
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        SystemState *domain_state = &ds->domains[pcpu_domain[j]]->state;
+        domain_state->pcpus[domain_state->nr_pcpus++] = state->pcpus[j];
+    }
+    for (int i = 0; i < state->nr_vms; i++) {
+        HostDomain *domain = ds->domains[ds->vm_domain[i]];
+        domain->vm_indexes[domain->state.nr_vms] = i;
+        domain->state.vms[domain->state.nr_vms++] = state->vms[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Solves domains of the current split until none is left to take. Called with the lock held.
+ */
+static void solve_domains(DomainScheduler *ds) {
+    while (ds->next_domain < ds->nr_domains) {
+        HostDomain *domain = ds->domains[ds->next_domain++];
+        pthread_mutex_unlock(&ds->lock);
+
+        domain->ws.solver = ds->inner;
+        domain->schedule = compute_schedule_on(&domain->ws, &domain->state);
+
+        pthread_mutex_lock(&ds->lock);
+        ds->nr_solved++;
+        pthread_cond_broadcast(&ds->done);
+    }
+}
+
+static void *run_worker(void *opaque) {
+    DomainScheduler *ds = opaque;
+    pthread_mutex_lock(&ds->lock);
+    for (;;) {
+        while (ds->next_domain >= ds->nr_domains && !ds->stopping) {
+            pthread_cond_wait(&ds->queued, &ds->lock);
+        }
+        if (ds->stopping) {
+            break;
+        }
+        solve_domains(ds);
+    }
+    pthread_mutex_unlock(&ds->lock);
+    return NULL;
+}
+
+/**
+ * @brief domain_schedule as a ScheduleSolver, with the DomainScheduler as its opaque.
+ */
+static int domain_solve(ScheduleWorkspace *ws, const SystemState *state, Schedule *out) {
+    DomainScheduler *ds = ws->solver->opaque;
+    if (domain_schedule(ds, state, out) < 0) {
+        return -1;
+    }
+    ws->result.total_flow = out->num_assigned;
+    ws->result.total_cost = out->total_cost;
+    ws->result.nr_augmentations = 0;
+    for (int d = 0; d < ds->nr_domains; d++) {
+        ws->result.nr_augmentations += ds->domains[d]->ws.result.nr_augmentations;
+    }
+    return 0;
+}
+
+int domain_scheduler_start(DomainScheduler *ds, DomainLevel level, int nr_workers) {
+    if (nr_workers < 0 || nr_workers > DOMAIN_MAX_WORKERS) {
+        fprintf(stderr, "Can't schedule domains on %d workers\n", nr_workers);
+        return -1;
+    }
+    memset(ds, 0, sizeof(DomainScheduler));
+    ds->level = level;
+    ds->solver.name = level == SPLIT_BY_NODE ? "numa_nodes" : "llc_domains";
+    ds->solver.solve = domain_solve;
+    ds->solver.opaque = ds;
+    pthread_mutex_init(&ds->lock, NULL);
+    pthread_cond_init(&ds->queued, NULL);
+    pthread_cond_init(&ds->done, NULL);
+    for (int w = 0; w < nr_workers; w++) {
+        if (pthread_create(&ds->workers[w], NULL, run_worker, ds) != 0) {
+            fprintf(stderr, "Failed to start scheduling worker %d\n", w);
+            domain_scheduler_stop(ds);
+            return -1;
+        }
+        ds->nr_workers++;
+    }
+    return 0;
+}
+
+int domain_schedule(DomainScheduler *ds, const SystemState *state, Schedule *out) {
+    long long start_ns = tick_now_ns();
+    int pcpu_domain[MAX_PCPUS];
+    int nr_domains = split_pcpus(ds, state, pcpu_domain);
+    if (nr_domains < 2) {
+        return -1;
+    }
+    split_vms(ds, state, pcpu_domain, nr_domains);
+    if (build_domains(ds, state, pcpu_domain, nr_domains) < 0) {
+        return -1;
+    }
+    long long split_ns = tick_now_ns();
+
+    /* The caller solves along with the workers */
+    pthread_mutex_lock(&ds->lock);
+    ds->nr_domains = nr_domains;
+    ds->next_domain = 0;
+    ds->nr_solved = 0;
+    pthread_cond_broadcast(&ds->queued);
+    solve_domains(ds);
+    while (ds->nr_solved < nr_domains) {
+        pthread_cond_wait(&ds->done, &ds->lock);
+    }
+    pthread_mutex_unlock(&ds->lock);
+    long long solve_ns = tick_now_ns();
+
+    memset(out, -1, sizeof(Schedule));
+    out->num_assigned = 0;
+    out->total_cost = 0;
+    for (int d = 0; d < nr_domains; d++) {
+        const HostDomain *domain = ds->domains[d];
+        for (int k = 0; k < domain->state.nr_vms; k++) {
+            int i = domain->vm_indexes[k];
+            out->vm_to_pcpu[i] = domain->schedule.vm_to_pcpu[k];
+            memcpy(out->vcpu_to_pcpu[i], domain->schedule.vcpu_to_pcpu[k], sizeof(out->vcpu_to_pcpu[i]));
+        }
+        out->num_assigned += domain->schedule.num_assigned;
+        out->total_cost += domain->schedule.total_cost;
+    }
+    ds->stats.nr_domains = nr_domains;
+    ds->stats.split_ns = split_ns - start_ns;
+    ds->stats.solve_ns = solve_ns - split_ns;
+    return 0;
+}
+
+void domain_scheduler_stop(DomainScheduler *ds) {
+    pthread_mutex_lock(&ds->lock);
+    ds->stopping = true;
+    pthread_cond_broadcast(&ds->queued);
+    pthread_mutex_unlock(&ds->lock);
+    for (int w = 0; w < ds->nr_workers; w++) {
+        pthread_join(ds->workers[w], NULL);
+    }
+    ds->nr_workers = 0;
+    for (int d = 0; d < DOMAIN_MAX_DOMAINS; d++) {
+        if (ds->domains[d] != NULL) {
+            schedule_workspace_destroy(&ds->domains[d]->ws);
+            free(ds->domains[d]);
+            ds->domains[d] = NULL;
+        }
+    }
+    pthread_cond_destroy(&ds->queued);
+    pthread_cond_destroy(&ds->done);
+    pthread_mutex_destroy(&ds->lock);
+}
@@ -0,0 +1,99 @@
+#ifndef DOMAIN_SCHEDULER_H
+#define DOMAIN_SCHEDULER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "vm_types.h"
+#include "scheduler.h"
+
+/**
+ * Worker threads solving domains at the same time, at most.
+ */
+#define DOMAIN_MAX_WORKERS 16
+/**
+ * Domains a host is split in, at most. The groups of a bigger host share domains.
+ */
+#define DOMAIN_MAX_DOMAINS 64
+
+/**
+ * @brief The topology level a host is split at.
+ */
+typedef enum {
+    SPLIT_BY_NODE,
+    SPLIT_BY_LLC,
+} DomainLevel;
+
+/**
+ * @brief One domain of the last split: its part of the host and its schedule.
+ */
+typedef struct {
+    SystemState       state;                // The domain's pCPUs and the VMs given to it
+    int               vm_indexes[MAX_VMS];  // Index in the host's state of each of its VMs
+    ScheduleWorkspace ws;                   // Only the thread solving the domain touches it
+    Schedule          schedule;
+} HostDomain;
+
+/**
+ * @brief What the last domain_schedule call did.
+ */
+typedef struct {
+    int       nr_domains;
+    int       nr_moved;    // VMs given a domain other than the one they run in
+    long long split_ns;    // Giving the VMs their domains and building the domains' states
+    long long solve_ns;    // From handing out the domains until the last one was solved
+} DomainStats;
+
+/**
+ * @brief Schedules a big host one NUMA node (or LLC) at a time, on a pool of worker threads.
+ *
+ * A first pass gives every VM a domain: the one it runs in while the domain has
+ * room below its share of the vCPUs, or slots cheaper than a move to another
+ * node, and the domain furthest below its share otherwise. Each domain's VMs
+ * and pCPUs are then solved on their own, with the inner solver in the domain's
+ * own workspace, so the threads share no memory but the host's state. The
+ * schedules are merged into one. Each domain's schedule is optimal, the merged
+ * one only as good as the first pass.
+ *
+ * One caller at a time. Start from domain_scheduler_start.
+ */
+typedef struct {
+    DomainLevel           level;
+    const ScheduleSolver  *inner;                         // Solves each domain, NULL for the flow network
+    ScheduleSolver        solver;                         // domain_schedule for compute_schedule_on and the stabilizer
+    pthread_t             workers[DOMAIN_MAX_WORKERS];
+    int                   nr_workers;
+    pthread_mutex_t       lock;
+    pthread_cond_t        queued;                         // Domains to solve, or the workers should stop
+    pthread_cond_t        done;                           // A domain was solved
+    HostDomain            *domains[DOMAIN_MAX_DOMAINS];   // Allocated when the host first needs them
+    int                   nr_domains;                     // Of the last split
+    int                   next_domain;                    // The next one a thread takes
+    int                   nr_solved;
+    bool                  stopping;
+    int                   vm_domain[MAX_VMS];             // Domain of every VM of the last split
+    DomainStats           stats;
+} DomainScheduler;
+
+/**
+ * @brief Starts nr_workers threads. With none, domain_schedule solves every domain itself.
+ *
+ * The caller of domain_schedule solves domains too, so n workers solve on n + 1 threads.
+ *
+ * @return 0 on success, -1 when nr_workers is out of range or a thread couldn't start
+ */
+int domain_scheduler_start(DomainScheduler *ds, DomainLevel level, int nr_workers);
+
+/**
+ * @brief Splits the host into domains, solves them in parallel and merges their schedules.
+ *
+ * @return 0 on success, -1 when the topology doesn't split the host into two or
+ *         more domains or a domain couldn't be allocated
+ */
+int domain_schedule(DomainScheduler *ds, const SystemState *state, Schedule *out);
+
+/**
+ * @brief Stops the workers and frees the domains.
+ */
+void domain_scheduler_stop(DomainScheduler *ds);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_types.h"
+#include "domain_stats.h"
+
+int domain_stats_to_vm(VM *vm, const DomainStat *stats, int nr_stats) {
+    int nr_vcpus = -1;
+    unsigned long long cpu_time = 0;
+    for (int p = 0; p < nr_stats; p++) {
+        int vcpu;
+        char rest[DOMAIN_STAT_FIELD_LEN];
+        if (strcmp(stats[p].field, "vcpu.current") == 0) {
+            nr_vcpus = (int) stats[p].value;
+        } else if (sscanf(stats[p].field, "vcpu.%d.%79s", &vcpu, rest) == 2 && strcmp(rest, "time") == 0) {
+            cpu_time += stats[p].value;
+        }
+    }
+    if (nr_vcpus < 1 || nr_vcpus > MAX_VCPUS_PER_VM) {
+        fprintf(stderr, "Only support VM with 1 to %d vCPUs but found %d vCPUs\n", MAX_VCPUS_PER_VM, nr_vcpus);
+        return -1;
+    }
+    vm->nr_vcpus = nr_vcpus;
+    vm->cpu_time = cpu_time;
+    vm->current_pcpu = -1;
+    for (int k = 0; k < nr_vcpus; k++) {
+        vm->vcpu_pcpu[k] = -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Turns the stats collected for the current domain block into the next VM.
+ */
+static int finish_virsh_domain(SystemState *state, const char *name, const DomainStat *stats, int nr_stats) {
+    if (state->nr_vms >= MAX_VMS) {
+        fprintf(stderr, "Found more than %d VMs\n", MAX_VMS);
+        return -1;
+    }
+    VM *vm = &state->vms[state->nr_vms];
+    memset(vm, 0, sizeof(VM));
+    snprintf(vm->name, MAX_NAME_LEN, "%s", name);
+    vm->id = state->nr_vms + 1;
+    if (domain_stats_to_vm(vm, stats, nr_stats) < 0) {
+        return -1;
+    }
+    state->nr_vms++;
+    return 0;
+}
+
+int domain_stats_read_virsh(FILE *file, SystemState *state) {
+    static DomainStat stats[MAX_DOMAIN_STATS];
+    int nr_stats = 0;
+    char name[256] = "";
+    bool in_domain = false;
+    char line[512];
+
+    state->nr_vms = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            continue;
+        }
+
+        if (strncmp(p, "Domain: ", 8) == 0) {
+            if (in_domain && finish_virsh_domain(state, name, stats, nr_stats) < 0) {
+                return -1;
+            }
+            /* Domain: 'name' */
+            char *start = strchr(p, '\'');
+            char *end = start != NULL ? strrchr(start + 1, '\'') : NULL;
+            if (start == NULL || end == NULL) {
+                fprintf(stderr, "Malformed domain line: %s\n", line);
+                return -1;
+            }
+            *end = '\0';
+            snprintf(name, sizeof(name), "%s", start + 1);
+            in_domain = true;
+            nr_stats = 0;
+            continue;
+        }
+
+        /* field=value, only numeric values are kept */
+        char *equals = strchr(p, '=');
+        if (!in_domain || equals == NULL) {
+            fprintf(stderr, "Malformed stats line: %s\n", line);
+            return -1;
+        }
+        *equals = '\0';
+        char *end;
+        unsigned long long value = strtoull(equals + 1, &end, 10);
+        if (end == equals + 1 || *end != '\0' || nr_stats >= MAX_DOMAIN_STATS || strlen(p) >= DOMAIN_STAT_FIELD_LEN) {
+            continue;
+        }
+        strcpy(stats[nr_stats].field, p);
+        stats[nr_stats].value = value;
+        nr_stats++;
+    }
+    if (in_domain && finish_virsh_domain(state, name, stats, nr_stats) < 0) {
+        return -1;
+    }
+    return state->nr_vms;
+}
@@ -0,0 +1,39 @@
+#ifndef DOMAIN_STATS_H
+#define DOMAIN_STATS_H
+
+#include <stdio.h>
+#include "vm_types.h"
+
+#define DOMAIN_STAT_FIELD_LEN 80
+/* Stats kept per domain, enough for MAX_VCPUS_PER_VM vCPUs with every vcpu.<n>.* field */
+#define MAX_DOMAIN_STATS 512
+
+/**
+ * @brief One numeric typed parameter of a domain stats record (libvirt free).
+ */
+typedef struct {
+    char field[DOMAIN_STAT_FIELD_LEN];
+    unsigned long long value;
+} DomainStat;
+
+/**
+ * @brief Fills the vCPU count and CPU time of the VM from the vcpu.* stats of one domain.
+ *
+ * vcpu.current gives the vCPU count and the vcpu.<n>.time fields add up to the
+ * CPU time. The stats don't say where a vCPU runs, so every vCPU's pCPU is set to -1.
+ *
+ * @return 0 on success, -1 when vcpu.current is missing or above MAX_VCPUS_PER_VM.
+ */
+int domain_stats_to_vm(VM *vm, const DomainStat *stats, int nr_stats);
+
+/**
+ * @brief Reads recorded `virsh domstats --raw --vcpu` output into the VMs of the state.
+ *
+ * Each "Domain: 'name'" block becomes a VM, in order. virsh doesn't print the
+ * domain ID, so the VMs get IDs 1, 2, ... The pCPUs are left alone.
+ *
+ * @return The number of VMs read, -1 on a malformed record.
+ */
+int domain_stats_read_virsh(FILE *file, SystemState *state);
+
+#endif
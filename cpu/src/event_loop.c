@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <libvirt/libvirt.h>
+#include "event_loop.h"
+
+static void rearm(EventLoop *loop) {
+    virEventUpdateTimeout(loop->timer_id, tick_schedule_timeout_ms(&loop->schedule, tick_now_ns(), loop->early));
+}
+
+static void on_tick_timer(int timer, void *opaque) {
+    EventLoop *loop = opaque;
+    int timeout_ms = tick_schedule_timeout_ms(&loop->schedule, tick_now_ns(), loop->early);
+    if (timeout_ms > 0) {
+        /* libvirt timers fire a little early sometimes */
+        virEventUpdateTimeout(timer, timeout_ms);
+        return;
+    }
+    if (tick_now_ns() < loop->schedule.next_ns) {
+        loop->nr_early_ticks++;
+    }
+    loop->early = false;
+    loop->tick(loop->opaque);
+    loop->nr_ticks++;
+    tick_schedule_ran(&loop->schedule, tick_now_ns());
+    rearm(loop);
+}
+
+static void on_probe_timer(int timer, void *opaque) {
+    EventLoop *loop = opaque;
+    if (loop->probe(loop->opaque)) {
+        event_loop_request_tick(loop);
+    }
+}
+
+void event_loop_request_tick(EventLoop *loop) {
+    loop->early = true;
+    if (loop->timer_id >= 0) {
+        rearm(loop);
+    }
+}
+
+int event_loop_run(EventLoop *loop, long long period_ns, long long probe_period_ns, const volatile int *is_exit) {
+    tick_schedule_init(&loop->schedule, tick_now_ns(), period_ns);
+    loop->early = false;
+    loop->probe_timer_id = -1;
+    loop->timer_id = virEventAddTimeout(0, on_tick_timer, loop, NULL);
+    if (loop->timer_id < 0) {
+        return -1;
+    }
+    if (loop->probe != NULL && probe_period_ns > 0) {
+        int probe_ms = probe_period_ns / 1000000 > 0 ? probe_period_ns / 1000000 : 1;
+        loop->probe_timer_id = virEventAddTimeout(probe_ms, on_probe_timer, loop, NULL);
+        if (loop->probe_timer_id < 0) {
+            fprintf(stderr, "Failed to add the probe timer, no early ticks on load changes\n");
+        }
+    }
+
+    while (!*is_exit) {
+        if (virEventRunDefaultImpl() < 0) {
+            fprintf(stderr, "Failed to run the event loop\n");
+            break;
+        }
+    }
+
+    if (loop->probe_timer_id >= 0) {
+        virEventRemoveTimeout(loop->probe_timer_id);
+    }
+    virEventRemoveTimeout(loop->timer_id);
+    loop->timer_id = -1;
+    loop->probe_timer_id = -1;
+    return 0;
+}
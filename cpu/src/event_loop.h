@@ -0,0 +1,40 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include "tick_schedule.h"
+
+/**
+ * @brief Runs ticks from libvirt's default event loop instead of sleeping between them.
+ *
+ * Ticks follow a TickSchedule, so the period is sub-second capable and doesn't
+ * drift. A probe can run several times per period and ask for an early tick, and
+ * so can any other event callback (e.g. a domain starting) through event_loop_request_tick.
+ */
+typedef struct {
+    TickSchedule schedule;
+    int   timer_id;
+    int   probe_timer_id;             // -1 without a probe
+    bool  early;                      // An early tick is pending
+    void  (*tick)(void *opaque);
+    bool  (*probe)(void *opaque);     // Returns true to ask for an early tick, may be NULL
+    void  *opaque;
+    int   nr_ticks;
+    int   nr_early_ticks;
+} EventLoop;
+
+/**
+ * @brief Runs the loop until *is_exit is set.
+ *
+ * virEventRegisterDefaultImpl must have been called before the connection was opened.
+ *
+ * @return 0 when it stopped on *is_exit, -1 when the timers couldn't be added (no event loop).
+ */
+int event_loop_run(EventLoop *loop, long long period_ns, long long probe_period_ns, const volatile int *is_exit);
+
+/**
+ * @brief Asks for a tick before the next deadline, at least a minimum gap after the last tick.
+ */
+void event_loop_request_tick(EventLoop *loop);
+
+#endif
@@ -2,6 +2,77 @@
 #include <string.h>
 #include "graph.h"
 
+/**
+ * @brief Carves the edge, head and scratch arrays from the graph's arena.
+ */
+static int graph_carve(FlowGraph *g, int max_nodes, int max_edges) {
+    g->edges = arena_alloc(&g->arena, sizeof(Edge) * max_edges);
+    g->heads = arena_alloc(&g->arena, sizeof(int) * max_nodes);
+    g->dist = arena_alloc(&g->arena, sizeof(int) * max_nodes);
+    g->prev_edges = arena_alloc(&g->arena, sizeof(int) * max_nodes);
+    g->potential = arena_alloc(&g->arena, sizeof(int) * max_nodes);
+    g->queue = arena_alloc(&g->arena, sizeof(int) * (max_nodes + 1));
+    g->heap_pos = arena_alloc(&g->arena, sizeof(int) * max_nodes);
+    g->visited = arena_alloc(&g->arena, sizeof(bool) * max_nodes);
+    if (!g->edges || !g->heads || !g->dist || !g->prev_edges || !g->potential ||
+        !g->queue || !g->heap_pos || !g->visited) {
+        return -1;
+    }
+    g->max_nodes = max_nodes;
+    g->max_edges = max_edges;
+    return 0;
+}
+
+/**
+ * @brief Number of arena bytes graph_carve needs.
+ */
+static size_t graph_arena_size(int max_nodes, int max_edges) {
+    return arena_aligned_size(sizeof(Edge) * max_edges)
+        + arena_aligned_size(sizeof(int) * max_nodes) * 5
+        + arena_aligned_size(sizeof(int) * (max_nodes + 1))
+        + arena_aligned_size(sizeof(bool) * max_nodes);
+}
+
+int graph_create(FlowGraph *g, int max_nodes, int max_edges) {
+    memset(g, 0, sizeof(FlowGraph));
+    return graph_reserve(g, max_nodes, max_edges);
+}
+
+int graph_reserve(FlowGraph *g, int max_nodes, int max_edges) {
+    if (g->arena.base != NULL && max_nodes <= g->max_nodes && max_edges <= g->max_edges) {
+        return 0;
+    }
+    /* Keep the larger of the old and new room so alternating sizes settle on one block */
+    if (max_nodes < g->max_nodes) {
+        max_nodes = g->max_nodes;
+    }
+    if (max_edges < g->max_edges) {
+        max_edges = g->max_edges;
+    }
+    g->nr_nodes = 0;
+    g->nr_edges = 0;
+    if (arena_reserve(&g->arena, graph_arena_size(max_nodes, max_edges)) < 0) {
+        return -1;
+    }
+    return graph_carve(g, max_nodes, max_edges);
+}
+
+void graph_destroy(FlowGraph *g) {
+    arena_free(&g->arena);
+    memset(g, 0, sizeof(FlowGraph));
+}
+
+int graph_copy(FlowGraph *dst, const FlowGraph *src) {
+    if (src->nr_nodes > dst->max_nodes || src->nr_edges > dst->max_edges) {
+        return -1;
+    }
+    memcpy(dst->edges, src->edges, sizeof(Edge) * src->nr_edges);
+    memcpy(dst->heads, src->heads, sizeof(int) * src->nr_nodes);
+    dst->nr_edges = src->nr_edges;
+    dst->nr_nodes = src->nr_nodes;
+    return 0;
+}
+
 void print_graph(const FlowGraph *g) {
     printf("Edges:\n");
     for (int i = 0; i < g->nr_edges; i++) {
@@ -16,11 +87,14 @@ void print_graph(const FlowGraph *g) {
 void graph_init(FlowGraph *g, int nr_nodes) {
     g->nr_edges = 0;
     g->nr_nodes = nr_nodes;
-    memset(g->heads, -1, sizeof(g->heads));
+    memset(g->heads, -1, sizeof(int) * nr_nodes);
 }
 
 int graph_add_edge(FlowGraph *g, int u, int v, int capacity, int cost) {
     int forward_edge_idx = g->nr_edges;
+    if (forward_edge_idx + 2 > g->max_edges) {
+        return -1;
+    }
 
     /* Add forward edge from u to v */
     g->edges[forward_edge_idx].to = v;
@@ -42,4 +116,20 @@ int graph_add_edge(FlowGraph *g, int u, int v, int capacity, int cost) {
     g->nr_edges += 2;
     
     return forward_edge_idx;
-}
\ No newline at end of file
+}
+
+int graph_add_convex_edge(FlowGraph *g, int u, int v, const int *capacities, const int *costs, int nr_pieces) {
+    if (nr_pieces < 1 || g->nr_edges + 2 * nr_pieces > g->max_edges) {
+        return -1;
+    }
+    for (int p = 1; p < nr_pieces; p++) {
+        if (costs[p] < costs[p - 1]) {
+            return -1;
+        }
+    }
+    int first_edge_idx = g->nr_edges;
+    for (int p = 0; p < nr_pieces; p++) {
+        graph_add_edge(g, u, v, capacities[p], costs[p]);
+    }
+    return first_edge_idx;
+}
@@ -3,9 +3,8 @@
 
 #include <stdbool.h>
 #include <limits.h>
+#include "arena.h"
 
-#define MAX_NODES  1 + 8 + 4 + 1      // Source + VMs + PCPUs + Sink
-#define MAX_EDGES (8 + 8 * 4 + 4) * 2 // Double edges
 #define INF       INT_MAX
 
 /**
@@ -35,7 +34,10 @@ typedef struct {
  * assignment constrains. Then use cost to pioritize the affinity and balance
  * the utilization across PCPUs.
  * 
- * All the edges are stored in one array to avoid dynamic memory allocation.
+ * The maximum number of nodes and edges is set when the graph is created. All
+ * the edges, heads and the per node scratch arrays used by the solvers are 
+ * carved from one arena, so adding an edge never allocates memory and a graph
+ * that is reset with graph_init can be rebuilt without allocating again.
  * 
  * When adding a new edge to this graph it results a pair of forward edge and 
  * reverse edge stored.
@@ -47,25 +49,90 @@ typedef struct {
  */
 typedef struct {
     /* @brief All the edges are stored in pairs - forward edge is followed by a reverse edge */
-    Edge edges[MAX_EDGES];
+    Edge *edges;
     /* @brief All the nodes and stores the index for the first edge in the adjacency list */
-    int heads[MAX_NODES];
+    int *heads;
     /* @brief Number of edges */
     int nr_edges;
     /* @brief Number of nodes */
     int nr_nodes;
+    /* @brief Number of edges the graph has room for */
+    int max_edges;
+    /* @brief Number of nodes the graph has room for */
+    int max_nodes;
+    /* @brief Solver scratch: distance of each node to the source */
+    int *dist;
+    /* @brief Solver scratch: the edge that leads the shortest path to each node */
+    int *prev_edges;
+    /* @brief Solver scratch: node potentials for reduced costs */
+    int *potential;
+    /* @brief Solver scratch: SPFA queue or Dijkstra heap (max_nodes + 1 entries) */
+    int *queue;
+    /* @brief Solver scratch: position of each node in the Dijkstra heap */
+    int *heap_pos;
+    /* @brief Solver scratch: SPFA in-queue flags or Dijkstra settled flags */
+    bool *visited;
+    /* @brief The memory all the arrays above are carved from */
+    Arena arena;
 } FlowGraph;
 
 /**
- * @brief Initialize a new FlowGraph for given number of nodes.
+ * @brief Allocates a FlowGraph with room for max_nodes nodes and max_edges edges.
+ * 
+ * Reverse edges count towards max_edges, so one graph_add_edge takes two.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int graph_create(FlowGraph *g, int max_nodes, int max_edges);
+
+/**
+ * @brief Makes sure a created FlowGraph has room for max_nodes nodes and max_edges edges.
+ * 
+ * The arena is only reallocated when it is too small. The graph has to be 
+ * initialized with graph_init again afterwards.
+ * 
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int graph_reserve(FlowGraph *g, int max_nodes, int max_edges);
+
+/**
+ * @brief Frees the memory of a FlowGraph.
+ */
+void graph_destroy(FlowGraph *g);
+
+/**
+ * @brief Copies the nodes and edges of src into dst. dst needs the room for them.
+ * 
+ * @return 0 on success, -1 when dst is too small.
+ */
+int graph_copy(FlowGraph *dst, const FlowGraph *src);
+
+/**
+ * @brief Initialize a new FlowGraph for given number of nodes (up to max_nodes).
  */
 void graph_init(FlowGraph *g, int nr_nodes);
 
 /**
  * @brief Adds an edge that connects node u and v with certain capacity and cost.
+ * 
+ * @return The index of the forward edge or -1 when the graph is full.
  */
 int graph_add_edge(FlowGraph *g, int u, int v, int capacity, int cost);
 
+/**
+ * @brief Adds edges from u to v whose cost is convex piecewise linear in the flow.
+ * 
+ * Piece p carries up to capacities[p] units at costs[p] per unit. The pieces are
+ * marginal-cost parallel edges, so with non-decreasing costs a min cost flow uses
+ * them in order and pays the convex cost of the total flow, with no change to the
+ * graph while the solver runs. The forward edges of the pieces are 2 apart, the
+ * first one at the returned index.
+ * 
+ * @return The index of the first piece's forward edge, or -1 when the graph is
+ * full or the costs decrease (a concave cost has no exact min cost flow this way).
+ */
+int graph_add_convex_edge(FlowGraph *g, int u, int v, const int *capacities, const int *costs, int nr_pieces);
+
 /**
  * @brief Print out the graph for debugging
  */
@@ -0,0 +1,817 @@
+#include <stdio.h>
+#include <string.h>
+#include "mcmf.h"
+#include "incremental_scheduler.h"
+#include "tick_schedule.h"
+
+/* Node Indexes */
+#define SOURCE 0
+#define VM_NODE(i) (1 + (i))
+#define PCPU_NODE(s, j) (1 + (s)->nr_vms + (j))
+#define SINK(s) (1 + (s)->nr_vms + (s)->nr_pcpus)
+
+/* Edges the cycle search looks at between two looks at the clock, when there is a deadline */
+#define DEADLINE_CHECK_EDGES 4096
+
+/**
+ * @brief Index of the Source -> VM i edge.
+ */
+static int source_vm_edge(int vm) {
+    return 2 * vm;
+}
+
+/**
+ * @brief Index of the VM i -> pCPU j edge for the given vCPU slot.
+ */
+static int vm_pcpu_edge(const IncrementalScheduler *s, int vm, int pcpu, int slot) {
+    return s->vm_edge_base[vm] + 2 * (pcpu * s->vm_nr_slots[vm] + slot);
+}
+
+/**
+ * @brief Index of the pCPU j -> Sink edge for the given VM slot.
+ */
+static int pcpu_slot_edge(const IncrementalScheduler *s, int pcpu, int slot) {
+    return s->pcpu_edge_base + 2 * (pcpu * MAX_VMS_PER_PCPU + slot);
+}
+
+/**
+ * @brief Pushes amount of flow through edge e. Flow is only recorded on forward edges.
+ */
+static void push_flow(FlowGraph *g, int e, int amount) {
+    g->edges[e].capacity -= amount;
+    g->edges[e ^ 1].capacity += amount;
+    if ((e & 1) == 0) {
+        g->edges[e].flow += amount;
+    } else {
+        g->edges[e ^ 1].flow -= amount;
+    }
+}
+
+static void add_seed(IncrementalScheduler *s, int node) {
+    if (!s->is_seed[node]) {
+        s->is_seed[node] = true;
+        s->seeds[s->nr_seeds++] = node;
+    }
+}
+
+/**
+ * @brief Resets the search state of the nodes the last search touched.
+ */
+static void reset_search(IncrementalScheduler *s, int nr_touched) {
+    FlowGraph *g = &s->graph;
+    for (int t = 0; t < nr_touched; t++) {
+        int v = s->touched[t];
+        g->dist[v] = 0;
+        g->prev_edges[v] = -1;
+        s->path_len[v] = 0;
+    }
+}
+
+/**
+ * @brief Forgets the round of the search the deadline cut short, once its distances no longer match the graph.
+ *
+ * Its seeds stay, and the next rounds start from half as many of them so that
+ * one is more likely to end before something changes again.
+ */
+static void drop_paused_search(IncrementalScheduler *s) {
+    if (!s->search_paused) {
+        return;
+    }
+    int batch_size = s->nr_seeds - s->search_batch_start;
+    s->seed_batch = batch_size > 1 ? batch_size / 2 : 1;
+    FlowGraph *g = &s->graph;
+    int queue_size = g->nr_nodes + 1;
+    for (int q = s->search_head; q != s->search_tail; q = (q + 1) % queue_size) {
+        g->visited[g->queue[q]] = false;
+    }
+    reset_search(s, s->nr_search_touched);
+    s->search_paused = false;
+}
+
+/**
+ * @brief Number of vCPUs of the VM assigned to the pCPU.
+ */
+static int nr_placed_on(const IncrementalScheduler *s, int vm, int pcpu) {
+    int count = 0;
+    for (int p = 0; p < s->vm_nr_placed[vm]; p++) {
+        if (s->vm_placement[vm][p] == pcpu) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void unplace_vcpu(IncrementalScheduler *s, int vm, int pcpu) {
+    for (int p = 0; p < s->vm_nr_placed[vm]; p++) {
+        if (s->vm_placement[vm][p] == pcpu) {
+            s->vm_placement[vm][p] = s->vm_placement[vm][--s->vm_nr_placed[vm]];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sets the cost of the VM -> pCPU edge and seeds the cycle search when it needs to.
+ */
+static void update_vm_pcpu_cost(IncrementalScheduler *s, int vm, int pcpu, int slot, int cost) {
+    FlowGraph *g = &s->graph;
+    int e = vm_pcpu_edge(s, vm, pcpu, slot);
+    if (g->edges[e].cost == cost) {
+        return;
+    }
+    drop_paused_search(s);
+    s->total_cost += (cost - g->edges[e].cost) * g->edges[e].flow;
+    g->edges[e].cost = cost;
+    g->edges[e ^ 1].cost = -cost;
+    s->stats.nr_updated_edges++;
+
+    /* Only an edge whose reduced cost went negative can start a negative cycle */
+    int vm_node = VM_NODE(vm);
+    int pcpu_node = PCPU_NODE(s, pcpu);
+    int reduced_cost = cost + g->potential[vm_node] - g->potential[pcpu_node];
+    if (g->edges[e].capacity > 0 && reduced_cost < 0) {
+        add_seed(s, vm_node);
+    }
+    if (g->edges[e ^ 1].capacity > 0 && -reduced_cost < 0) {
+        add_seed(s, pcpu_node);
+    }
+}
+
+static void update_vm_pcpu_costs(IncrementalScheduler *s, const SystemState *state, int vm, int pcpu) {
+    for (int slot = 0; slot < s->vm_nr_slots[vm]; slot++) {
+        update_vm_pcpu_cost(s, vm, pcpu, slot, vm_pcpu_slot_cost_with_load(state, vm, pcpu, slot, s->pcpu_load_cost[pcpu]));
+    }
+}
+
+/**
+ * @brief Puts one more vCPU of the VM on the pCPU while building the first flow.
+ *
+ * @return Whether the pCPU (and the VM's edges to it) had room.
+ */
+static bool place_vcpu(IncrementalScheduler *s, int *used_slots, int vm, int pcpu) {
+    FlowGraph *g = &s->graph;
+    int vm_slot = nr_placed_on(s, vm, pcpu);
+    if (used_slots[pcpu] >= MAX_VMS_PER_PCPU || vm_slot >= s->vm_nr_slots[vm]) {
+        return false;
+    }
+    int slot = used_slots[pcpu]++;
+    int e = vm_pcpu_edge(s, vm, pcpu, vm_slot);
+    push_flow(g, source_vm_edge(vm), 1);
+    push_flow(g, e, 1);
+    int sink_edge = pcpu_slot_edge(s, pcpu, slot);
+    push_flow(g, sink_edge, 1);
+    s->vm_placement[vm][s->vm_nr_placed[vm]++] = pcpu;
+    s->total_flow++;
+    s->total_cost += g->edges[e].cost + g->edges[sink_edge].cost;
+    return true;
+}
+
+/**
+ * @brief Builds the flow network for the system state with a feasible maximum flow.
+ *
+ * Every vCPU keeps its current pCPU while the pCPU has a free slot, the rest take
+ * the first pCPU with a free slot. The graph is complete between VMs and pCPUs
+ * so this is already a maximum flow, just not the cheapest one.
+ */
+static int rebuild(IncrementalScheduler *s, const SystemState *state) {
+    FlowGraph *g = &s->graph;
+    s->nr_vms = state->nr_vms;
+    s->nr_pcpus = state->nr_pcpus;
+    int nr_nodes = SINK(s) + 1;
+    int nr_edges = 2 * s->nr_vms;
+    for (int i = 0; i < s->nr_vms; i++) {
+        s->vm_nr_vcpus[i] = vm_nr_vcpus(&state->vms[i]);
+        s->vm_nr_slots[i] = vm_nr_pcpu_slots(&state->vms[i]);
+        s->vm_edge_base[i] = nr_edges;
+        nr_edges += 2 * s->nr_pcpus * s->vm_nr_slots[i];
+    }
+    s->pcpu_edge_base = nr_edges;
+    nr_edges += 2 * s->nr_pcpus * MAX_VMS_PER_PCPU;
+
+    if (graph_reserve(g, nr_nodes, nr_edges) < 0) {
+        return -1;
+    }
+    size_t size = arena_aligned_size(sizeof(int) * nr_nodes) * 4 + arena_aligned_size(sizeof(bool) * nr_nodes);
+    if (arena_reserve(&s->arena, size) < 0) {
+        return -1;
+    }
+    s->path_len = arena_alloc(&s->arena, sizeof(int) * nr_nodes);
+    s->touched = arena_alloc(&s->arena, sizeof(int) * nr_nodes);
+    s->walk_mark = arena_alloc(&s->arena, sizeof(int) * nr_nodes);
+    memset(s->walk_mark, 0, sizeof(int) * nr_nodes);
+    s->seeds = arena_alloc(&s->arena, sizeof(int) * nr_nodes);
+    s->is_seed = arena_alloc(&s->arena, sizeof(bool) * nr_nodes);
+
+    s->topology = state->topology;
+    pcpu_load_costs(state, s->pcpu_load_cost);
+
+    graph_init(g, nr_nodes);
+    for (int i = 0; i < s->nr_vms; i++) {
+        graph_add_edge(g, SOURCE, VM_NODE(i), s->vm_nr_vcpus[i], 0);
+    }
+    for (int i = 0; i < s->nr_vms; i++) {
+        for (int j = 0; j < s->nr_pcpus; j++) {
+            for (int slot = 0; slot < s->vm_nr_slots[i]; slot++) {
+                graph_add_edge(g, VM_NODE(i), PCPU_NODE(s, j), 1, vm_pcpu_slot_cost_with_load(state, i, j, slot, s->pcpu_load_cost[j]));
+            }
+        }
+    }
+    int slot_capacities[MAX_VMS_PER_PCPU];
+    int slot_costs[MAX_VMS_PER_PCPU];
+    pcpu_slot_costs(slot_capacities, slot_costs);
+    for (int j = 0; j < s->nr_pcpus; j++) {
+        graph_add_convex_edge(g, PCPU_NODE(s, j), SINK(s), slot_capacities, slot_costs, MAX_VMS_PER_PCPU);
+    }
+
+    for (int i = 0; i < s->nr_vms; i++) {
+        s->vm_ids[i] = state->vms[i].id;
+        s->vm_move_penalty[i] = state->vms[i].move_penalty;
+        for (int k = 0; k < s->vm_nr_vcpus[i]; k++) {
+            s->vm_vcpu_pcpu[i][k] = vm_vcpu_pcpu(&state->vms[i], k);
+        }
+        s->vm_nr_placed[i] = 0;
+    }
+    int used_slots[MAX_PCPUS];
+    for (int j = 0; j < s->nr_pcpus; j++) {
+        s->pcpu_ids[j] = state->pcpus[j].id;
+        used_slots[j] = 0;
+    }
+
+    /* Feasible flow: current pCPU first, then the first pCPU with a free slot */
+    s->total_flow = 0;
+    s->total_cost = 0;
+    for (int i = 0; i < s->nr_vms; i++) {
+        for (int k = 0; k < s->vm_nr_vcpus[i]; k++) {
+            for (int j = 0; j < s->nr_pcpus; j++) {
+                if (s->pcpu_ids[j] == s->vm_vcpu_pcpu[i][k]) {
+                    place_vcpu(s, used_slots, i, j);
+                    break;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < s->nr_vms; i++) {
+        for (int j = 0; j < s->nr_pcpus && s->vm_nr_placed[i] < s->vm_nr_vcpus[i]; j++) {
+            while (s->vm_nr_placed[i] < s->vm_nr_vcpus[i] && place_vcpu(s, used_slots, i, j)) {
+            }
+        }
+    }
+
+    /* Nothing is known about the costs yet, so every node starts the cycle search */
+    for (int v = 0; v < nr_nodes; v++) {
+        g->potential[v] = 0;
+        g->dist[v] = 0;
+        g->prev_edges[v] = -1;
+        g->visited[v] = false;
+        s->path_len[v] = 0;
+        s->is_seed[v] = false;
+    }
+    s->nr_seeds = 0;
+    for (int v = 0; v < nr_nodes; v++) {
+        add_seed(s, v);
+    }
+    s->seed_batch = nr_nodes;
+    s->search_paused = false;
+    s->next_vm = 0;
+    s->nr_unmoved_vms = 0;
+    s->stats.rebuilt = true;
+    s->initialized = true;
+    return 0;
+}
+
+/**
+ * @brief Whether the graph was built for the same VMs and pCPUs.
+ */
+static bool same_structure(const IncrementalScheduler *s, const SystemState *state) {
+    if (!s->initialized || s->nr_vms != state->nr_vms || s->nr_pcpus != state->nr_pcpus) {
+        return false;
+    }
+    for (int i = 0; i < s->nr_vms; i++) {
+        if (s->vm_ids[i] != state->vms[i].id || s->vm_nr_vcpus[i] != vm_nr_vcpus(&state->vms[i])) {
+            return false;
+        }
+    }
+    for (int j = 0; j < s->nr_pcpus; j++) {
+        if (s->pcpu_ids[j] != state->pcpus[j].id) {
+            return false;
+        }
+    }
+    /* Every migration cost depends on the topology */
+    return memcmp(&s->topology, &state->topology, sizeof(CPUTopology)) == 0;
+}
+
+/**
+ * @brief Walks the predecessor edges back from node looking for a cycle.
+ *
+ * @return A node on the cycle, or -1 when the walk reaches a node without predecessor.
+ */
+static int find_cycle_node(const FlowGraph *g, int node) {
+    for (int step = 0; step < g->nr_nodes; step++) {
+        if (g->prev_edges[node] < 0) {
+            return -1;
+        }
+        node = g->edges[g->prev_edges[node] ^ 1].to;
+    }
+    /* After nr_nodes steps the walk is going around a cycle. Make sure it closes. */
+    int x = node;
+    for (int step = 0; step < g->nr_nodes; step++) {
+        if (g->prev_edges[x] < 0) {
+            return -1;
+        }
+        x = g->edges[g->prev_edges[x] ^ 1].to;
+        if (x == node) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Looks for a cycle among the predecessor edges of the touched nodes.
+ *
+ * Each walk follows the predecessors from a touched node and marks the nodes it
+ * passes with its own number. Meeting a node marked by the same walk closes a
+ * cycle, meeting one from an earlier walk means the rest was already checked.
+ * Every predecessor cycle of the search is a negative cycle.
+ *
+ * @return A node on the cycle, or -1 when the predecessor edges form a tree.
+ */
+static int find_predecessor_cycle(IncrementalScheduler *s, int nr_touched) {
+    FlowGraph *g = &s->graph;
+    int cycle_node = -1;
+    for (int t = 0; t < nr_touched && cycle_node < 0; t++) {
+        int walk = t + 1;
+        int x = s->touched[t];
+        while (s->walk_mark[x] == 0 && g->prev_edges[x] >= 0) {
+            s->walk_mark[x] = walk;
+            x = g->edges[g->prev_edges[x] ^ 1].to;
+        }
+        if (s->walk_mark[x] == walk) {
+            cycle_node = x;
+        }
+    }
+    for (int t = 0; t < nr_touched; t++) {
+        s->walk_mark[s->touched[t]] = 0;
+    }
+    return cycle_node;
+}
+
+/**
+ * @brief Pushes flow around the negative cycle through node and seeds its nodes.
+ */
+static void cancel_cycle(IncrementalScheduler *s, int node) {
+    FlowGraph *g = &s->graph;
+    int bottleneck = INF;
+    int x = node;
+    do {
+        int e = g->prev_edges[x];
+        if (g->edges[e].capacity < bottleneck) {
+            bottleneck = g->edges[e].capacity;
+        }
+        x = g->edges[e ^ 1].to;
+    } while (x != node);
+
+    x = node;
+    do {
+        int e = g->prev_edges[x];
+        push_flow(g, e, bottleneck);
+        s->total_cost += g->edges[e].cost * bottleneck;
+        add_seed(s, x);
+        x = g->edges[e ^ 1].to;
+    } while (x != node);
+
+    /* Keep the vCPU placement in step with the VM -> pCPU edges, removals first */
+    for (int forward = 0; forward < 2; forward++) {
+        x = node;
+        do {
+            int e = g->prev_edges[x];
+            if (e >= 2 * s->nr_vms && e < s->pcpu_edge_base && (e & 1) == !forward) {
+                int vm = g->edges[(e & ~1) ^ 1].to - VM_NODE(0);
+                int pcpu = g->edges[e & ~1].to - PCPU_NODE(s, 0);
+                if (forward) {
+                    s->vm_placement[vm][s->vm_nr_placed[vm]++] = pcpu;
+                } else {
+                    unplace_vcpu(s, vm, pcpu);
+                }
+            }
+            x = g->edges[e ^ 1].to;
+        } while (x != node);
+    }
+    s->stats.nr_cancelled_cycles++;
+}
+
+/**
+ * @brief Whether the deadline (tick_now_ns, 0 or less for none) has passed.
+ */
+static bool past_deadline(long long deadline_ns) {
+    return deadline_ns > 0 && tick_now_ns() >= deadline_ns;
+}
+
+/**
+ * @brief The cheapest of count parallel edges (every other edge from first) with capacity left, -1 when none has.
+ */
+static int cheapest_free_edge(const FlowGraph *g, int first, int count) {
+    int best = -1;
+    for (int k = 0; k < count; k++) {
+        int e = first + 2 * k;
+        if (g->edges[e].capacity > 0 && (best < 0 || g->edges[e].cost < g->edges[best].cost)) {
+            best = e;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief The dearest of count parallel edges (every other edge from first) with flow, -1 when none has.
+ */
+static int dearest_used_edge(const FlowGraph *g, int first, int count) {
+    int best = -1;
+    for (int k = 0; k < count; k++) {
+        int e = first + 2 * k;
+        if (g->edges[e].flow > 0 && (best < 0 || g->edges[e].cost > g->edges[best].cost)) {
+            best = e;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Cancels the cycle of four nodes where edges[k] is the edge into nodes[k].
+ */
+static void cancel_short_cycle(IncrementalScheduler *s, const int *nodes, const int *edges) {
+    FlowGraph *g = &s->graph;
+    drop_paused_search(s);
+    for (int k = 0; k < 4; k++) {
+        g->prev_edges[nodes[k]] = edges[k];
+    }
+    cancel_cycle(s, nodes[0]);
+    for (int k = 0; k < 4; k++) {
+        g->prev_edges[nodes[k]] = -1;
+    }
+}
+
+static void replace_on_pcpu(int *vms_on_pcpu, int nr_on_pcpu, int from_vm, int to_vm) {
+    for (int k = 0; k < nr_on_pcpu; k++) {
+        if (vms_on_pcpu[k] == from_vm) {
+            vms_on_pcpu[k] = to_vm;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Moves a vCPU of the VM off pCPU a, into the free slot or the swap with another VM's vCPU that saves the most.
+ *
+ * A move is the cycle VM -> b -> Sink -> a -> VM, a swap with VM w on b the
+ * cycle VM -> b -> w -> a -> VM.
+ *
+ * @return Whether the vCPU moved
+ */
+static bool improve_vcpu(IncrementalScheduler *s, int vm, int a, int (*vms_on_pcpu)[MAX_VMS_PER_PCPU], int *nr_on_pcpu) {
+    FlowGraph *g = &s->graph;
+    int e_va = dearest_used_edge(g, vm_pcpu_edge(s, vm, a, 0), s->vm_nr_slots[vm]);
+    int e_as = dearest_used_edge(g, pcpu_slot_edge(s, a, 0), MAX_VMS_PER_PCPU);
+    int best_delta = 0;
+    int nodes[4] = { VM_NODE(vm), -1, -1, PCPU_NODE(s, a) };
+    int edges[4] = { e_va ^ 1, -1, -1, -1 };
+    int swap_with = -1;
+    for (int b = 0; b < s->nr_pcpus; b++) {
+        int e_vb = b == a ? -1 : cheapest_free_edge(g, vm_pcpu_edge(s, vm, b, 0), s->vm_nr_slots[vm]);
+        if (e_vb < 0) {
+            continue;
+        }
+        int e_bs = cheapest_free_edge(g, pcpu_slot_edge(s, b, 0), MAX_VMS_PER_PCPU);
+        if (e_bs >= 0) {
+            int delta = g->edges[e_vb].cost + g->edges[e_bs].cost - g->edges[e_as].cost - g->edges[e_va].cost;
+            if (delta < best_delta) {
+                best_delta = delta;
+                nodes[1] = PCPU_NODE(s, b);
+                nodes[2] = SINK(s);
+                edges[1] = e_vb;
+                edges[2] = e_bs;
+                edges[3] = e_as ^ 1;
+                swap_with = -1;
+            }
+        }
+        for (int k = 0; k < nr_on_pcpu[b]; k++) {
+            int w = vms_on_pcpu[b][k];
+            if (w == vm) {
+                continue;
+            }
+            int e_wb = dearest_used_edge(g, vm_pcpu_edge(s, w, b, 0), s->vm_nr_slots[w]);
+            int e_wa = cheapest_free_edge(g, vm_pcpu_edge(s, w, a, 0), s->vm_nr_slots[w]);
+            if (e_wa < 0) {
+                continue;
+            }
+            int delta = g->edges[e_vb].cost - g->edges[e_wb].cost + g->edges[e_wa].cost - g->edges[e_va].cost;
+            if (delta < best_delta) {
+                best_delta = delta;
+                nodes[1] = PCPU_NODE(s, b);
+                nodes[2] = VM_NODE(w);
+                edges[1] = e_vb;
+                edges[2] = e_wb ^ 1;
+                edges[3] = e_wa;
+                swap_with = w;
+            }
+        }
+    }
+    if (best_delta == 0) {
+        return false;
+    }
+
+    cancel_short_cycle(s, nodes, edges);
+    int b = nodes[1] - PCPU_NODE(s, 0);
+    if (swap_with >= 0) {
+        replace_on_pcpu(vms_on_pcpu[a], nr_on_pcpu[a], vm, swap_with);
+        replace_on_pcpu(vms_on_pcpu[b], nr_on_pcpu[b], swap_with, vm);
+    } else {
+        nr_on_pcpu[a]--;
+        replace_on_pcpu(vms_on_pcpu[a], nr_on_pcpu[a], vm, vms_on_pcpu[a][nr_on_pcpu[a]]);
+        vms_on_pcpu[b][nr_on_pcpu[b]++] = vm;
+    }
+    return true;
+}
+
+/**
+ * @brief Moves and swaps single vCPUs while that lowers the cost, until none does or the deadline.
+ *
+ * Each step costs a scan of the pCPUs, where the cycle search may need many
+ * passes over the graph to find its first cycle after a rebuild. So a short
+ * budget still gets a better schedule, and the search finishes the job. The
+ * next call picks up at the VM this one stopped at. Once a round moves nothing,
+ * or the flow reached the optimum, the search takes over: later changes seed it
+ * locally. A search cut short after a change hands back to the moves.
+ */
+static void improve_locally(IncrementalScheduler *s, long long deadline_ns) {
+    int vms_on_pcpu[MAX_PCPUS][MAX_VMS_PER_PCPU];
+    int nr_on_pcpu[MAX_PCPUS] = { 0 };
+    for (int i = 0; i < s->nr_vms; i++) {
+        for (int p = 0; p < s->vm_nr_placed[i]; p++) {
+            int pcpu = s->vm_placement[i][p];
+            vms_on_pcpu[pcpu][nr_on_pcpu[pcpu]++] = i;
+        }
+    }
+    /* Done once a whole round of the VMs moves nothing, the round may span calls */
+    while (s->nr_unmoved_vms < s->nr_vms && !past_deadline(deadline_ns)) {
+        int i = s->next_vm;
+        s->next_vm = (i + 1) % s->nr_vms;
+        bool moved = false;
+        /* The placement changes under a move, so one per VM and round */
+        for (int p = 0; p < s->vm_nr_placed[i] && !moved; p++) {
+            moved = improve_vcpu(s, i, s->vm_placement[i][p], vms_on_pcpu, nr_on_pcpu);
+        }
+        s->nr_unmoved_vms = moved ? 0 : s->nr_unmoved_vms + 1;
+    }
+}
+
+/**
+ * @brief Cancels negative cycles until the flow is optimal, then moves the potentials.
+ *
+ * This is Bellman-Ford (SPFA) from a virtual node with a 0 cost edge to every node,
+ * over the reduced costs. Every node starts at distance 0 and edges that were not
+ * changed have a non-negative reduced cost, so only the seeds can lower a distance
+ * at first. The search grows from the seeds and stops where distances stop dropping.
+ *
+ * Every cancelled cycle leaves a cheaper feasible flow. At the deadline the search
+ * stops where it is, and the seeds stay for the next call to carry on from.
+ *
+ * Under a deadline a round starts from the last seed_batch seeds only. When it
+ * ends without a cycle, the distances still make every reduced cost out of the
+ * nodes it reached non-negative, and lower none out of the others, so the
+ * batch's seeds are done and only the rest have to be searched from. A round
+ * cut short stays paused for the next call, which resumes it unless the flow or
+ * a cost changed in between.
+ *
+ * @return Whether no negative cycle is left
+ */
+static bool cancel_negative_cycles(IncrementalScheduler *s, long long deadline_ns) {
+    FlowGraph *g = &s->graph;
+    int *dist = g->dist;
+    int *potential = g->potential;
+    int *queue = g->queue;
+    bool *in_queue = g->visited;
+    int queue_size = g->nr_nodes + 1;
+
+    while (s->nr_seeds > 0 || s->search_paused) {
+        if (past_deadline(deadline_ns)) {
+            return false;
+        }
+        int q_head = 0, q_tail = 0;
+        int nr_touched = 0;
+        int batch_start = 0;
+        int cycle_node = -1;
+        int interrupted_node = -1;
+        int interrupted_edge = -1;
+        long relaxations_since_check = 0;
+        long edges_since_clock = 0;
+        bool timed_out = false;
+
+        if (s->search_paused) {
+            q_head = s->search_head;
+            q_tail = s->search_tail;
+            nr_touched = s->nr_search_touched;
+            batch_start = s->search_batch_start;
+            interrupted_node = s->search_node;
+            interrupted_edge = s->search_edge;
+            relaxations_since_check = s->search_relaxations;
+            s->search_paused = false;
+        } else {
+            if (deadline_ns > 0 && s->nr_seeds > s->seed_batch) {
+                batch_start = s->nr_seeds - s->seed_batch;
+            }
+            for (int k = batch_start; k < s->nr_seeds; k++) {
+                queue[q_tail++] = s->seeds[k];
+                in_queue[s->seeds[k]] = true;
+            }
+        }
+
+        while (q_head != q_tail && cycle_node < 0 && !timed_out) {
+            int node_u = queue[q_head++];
+            if (q_head >= queue_size) {
+                q_head = 0;
+            }
+            in_queue[node_u] = false;
+            int first_edge = g->heads[node_u];
+            if (node_u == interrupted_node) {
+                /* The edges before it were looked at before the pause */
+                first_edge = interrupted_edge;
+                interrupted_node = -1;
+            }
+
+            for (int e = first_edge; e >= 0; e = g->edges[e].next) {
+                /* Most edges out of a pCPU are full, so count every edge looked at */
+                if (deadline_ns > 0 && ++edges_since_clock >= DEADLINE_CHECK_EDGES) {
+                    edges_since_clock = 0;
+                    timed_out = past_deadline(deadline_ns);
+                    if (timed_out) {
+                        interrupted_node = node_u;
+                        interrupted_edge = e;
+                        break;
+                    }
+                }
+                const Edge *edge = &g->edges[e];
+                if (edge->capacity <= 0) {
+                    continue;
+                }
+                int node_v = edge->to;
+                int reduced_cost = edge->cost + potential[node_u] - potential[node_v];
+                s->stats.nr_relaxations++;
+                if (dist[node_u] + reduced_cost >= dist[node_v]) {
+                    continue;
+                }
+                if (g->prev_edges[node_v] < 0 && dist[node_v] == 0) {
+                    s->touched[nr_touched++] = node_v;
+                }
+                dist[node_v] = dist[node_u] + reduced_cost;
+                g->prev_edges[node_v] = e;
+                s->path_len[node_v] = s->path_len[node_u] + 1;
+
+                /* A shortest path can't be longer than the number of nodes unless it loops */
+                if (s->path_len[node_v] >= g->nr_nodes) {
+                    cycle_node = find_cycle_node(g, node_v);
+                    if (cycle_node >= 0) {
+                        break;
+                    }
+                }
+                /*
+                 * Waiting for a path of nr_nodes edges can take many rounds around a
+                 * short cycle, so check the predecessor edges once the search has done
+                 * as many relaxations as it touched nodes. This keeps the check linear.
+                 */
+                if (++relaxations_since_check >= nr_touched) {
+                    relaxations_since_check = 0;
+                    cycle_node = find_predecessor_cycle(s, nr_touched);
+                    if (cycle_node >= 0) {
+                        break;
+                    }
+                }
+                if (!in_queue[node_v]) {
+                    queue[q_tail++] = node_v;
+                    in_queue[node_v] = true;
+                    if (q_tail >= queue_size) {
+                        q_tail = 0;
+                    }
+                }
+            }
+        }
+
+        if (timed_out) {
+            /* The interrupted node goes back to the head, to carry on at the edge it stopped at */
+            if (interrupted_node >= 0) {
+                q_head = q_head > 0 ? q_head - 1 : queue_size - 1;
+                queue[q_head] = interrupted_node;
+                in_queue[interrupted_node] = true;
+            }
+            s->search_paused = true;
+            s->search_batch_start = batch_start;
+            s->search_head = q_head;
+            s->search_tail = q_tail;
+            s->search_node = interrupted_node;
+            s->search_edge = interrupted_edge;
+            s->search_relaxations = relaxations_since_check;
+            s->nr_search_touched = nr_touched;
+            return false;
+        }
+
+        /* Empty whatever is left in the queue */
+        while (q_head != q_tail) {
+            in_queue[queue[q_head++]] = false;
+            if (q_head >= queue_size) {
+                q_head = 0;
+            }
+        }
+
+        if (cycle_node >= 0) {
+            cancel_cycle(s, cycle_node);
+            reset_search(s, nr_touched);
+            continue;
+        }
+
+        /* No negative cycle from the batch. The distances make its reduced costs non-negative again */
+        for (int t = 0; t < nr_touched; t++) {
+            potential[s->touched[t]] += dist[s->touched[t]];
+        }
+        reset_search(s, nr_touched);
+        for (int k = batch_start; k < s->nr_seeds; k++) {
+            s->is_seed[s->seeds[k]] = false;
+        }
+        s->nr_seeds = batch_start;
+    }
+    s->seed_batch = g->nr_nodes;
+    return true;
+}
+
+int incremental_schedule(IncrementalScheduler *s, const SystemState *state, Schedule *out) {
+    return incremental_schedule_until(s, state, 0, out);
+}
+
+int incremental_schedule_until(IncrementalScheduler *s, const SystemState *state, long long deadline_ns, Schedule *out) {
+    memset(&s->stats, 0, sizeof(IncrementalStats));
+
+    if (!same_structure(s, state)) {
+        if (rebuild(s, state) < 0) {
+            fprintf(stderr, "Failed to allocate the flow graph for %d VMs and %d pCPUs\n", state->nr_vms, state->nr_pcpus);
+            return -1;
+        }
+    } else {
+        /* Only VMs with a vCPU that moved or a new move penalty, and pCPUs whose load changed get new edge costs */
+        int load_costs[MAX_PCPUS];
+        bool load_changed[MAX_PCPUS];
+        pcpu_load_costs(state, load_costs);
+        for (int j = 0; j < s->nr_pcpus; j++) {
+            load_changed[j] = load_costs[j] != s->pcpu_load_cost[j];
+            s->pcpu_load_cost[j] = load_costs[j];
+        }
+        for (int i = 0; i < s->nr_vms; i++) {
+            bool moved = state->vms[i].move_penalty != s->vm_move_penalty[i];
+            s->vm_move_penalty[i] = state->vms[i].move_penalty;
+            for (int k = 0; k < s->vm_nr_vcpus[i]; k++) {
+                int pcpu = vm_vcpu_pcpu(&state->vms[i], k);
+                if (pcpu != s->vm_vcpu_pcpu[i][k]) {
+                    s->vm_vcpu_pcpu[i][k] = pcpu;
+                    moved = true;
+                }
+            }
+            if (moved) {
+                for (int j = 0; j < s->nr_pcpus; j++) {
+                    update_vm_pcpu_costs(s, state, i, j);
+                }
+            }
+        }
+        for (int j = 0; j < s->nr_pcpus; j++) {
+            if (load_changed[j]) {
+                for (int i = 0; i < s->nr_vms; i++) {
+                    update_vm_pcpu_costs(s, state, i, j);
+                }
+            }
+        }
+    }
+
+    if (deadline_ns > 0 && s->nr_unmoved_vms < s->nr_vms) {
+        improve_locally(s, deadline_ns);
+    }
+    int nr_cancelled_cycles = s->stats.nr_cancelled_cycles;
+    s->stats.optimal = cancel_negative_cycles(s, deadline_ns);
+    if (s->stats.optimal) {
+        /* From the optimum on only the changed edges can improve it, and the search starts from those */
+        s->nr_unmoved_vms = s->nr_vms;
+    } else if (s->nr_unmoved_vms >= s->nr_vms &&
+               (s->stats.nr_cancelled_cycles > nr_cancelled_cycles || s->stats.nr_updated_edges > 0)) {
+        /* Cut short on a flow or costs the last round of moves didn't see, so the next call moves vCPUs again */
+        s->nr_unmoved_vms = 0;
+    }
+
+    memset(out, -1, sizeof(Schedule));
+    out->num_assigned = s->total_flow;
+    out->total_cost = s->total_cost;
+    for (int i = 0; i < s->nr_vms; i++) {
+        schedule_place_vcpus(out, state, i, s->vm_placement[i], s->vm_nr_placed[i]);
+    }
+    return 0;
+}
+
+void incremental_scheduler_destroy(IncrementalScheduler *s) {
+    graph_destroy(&s->graph);
+    arena_free(&s->arena);
+    memset(s, 0, sizeof(IncrementalScheduler));
+}
@@ -0,0 +1,143 @@
+#ifndef INCREMENTAL_SCHEDULER_H
+#define INCREMENTAL_SCHEDULER_H
+
+#include <stdbool.h>
+#include "arena.h"
+#include "graph.h"
+#include "vm_types.h"
+#include "scheduler.h"
+
+/**
+ * @brief What the last incremental_schedule call had to do.
+ */
+typedef struct {
+    /* @brief The flow network was built from scratch (first call or VMs/vCPUs/pCPUs/topology changed) */
+    bool rebuilt;
+    /* @brief Number of VM -> pCPU edges whose cost changed */
+    int nr_updated_edges;
+    /* @brief Number of negative cycles cancelled to get back to the optimum */
+    int nr_cancelled_cycles;
+    /* @brief Number of edge relaxations spent looking for negative cycles */
+    long nr_relaxations;
+    /* @brief No negative cycle is left, false when the deadline stopped the search first */
+    bool optimal;
+} IncrementalStats;
+
+/**
+ * @brief A scheduler that keeps its flow network and optimum between ticks.
+ *
+ * The network is the same one compute_schedule builds. The pCPU -> Sink edges are
+ * convex (one edge per VM slot, cost 0, ADDITION_VM_PENALTY, ...), so the residual
+ * graph holds the true costs and can be re-optimized in place.
+ *
+ * Every vCPU is a unit of flow, with the VM -> pCPU edges of compute_schedule.
+ *
+ * The residual graph and the node potentials from the previous tick are kept.
+ * On the next tick only the VM -> pCPU edges of VMs that moved or got another
+ * move_penalty, and of pCPUs whose utilization changed, get new costs. Only
+ * those edges can have a negative reduced cost, so the search for negative
+ * cycles starts from their nodes and only reaches the part of the graph the
+ * change affects. Cancelling every negative cycle brings the old flow back to
+ * the optimum.
+ *
+ * Start from a zeroed IncrementalScheduler.
+ */
+typedef struct {
+    /* @brief The residual flow network (graph.potential holds the node potentials) */
+    FlowGraph graph;
+    /* @brief Memory for the cycle search arrays below */
+    Arena arena;
+    /* @brief Cycle search: number of edges on the path that relaxed each node */
+    int *path_len;
+    /* @brief Cycle search: nodes whose distance changed in the current search */
+    int *touched;
+    /* @brief Cycle search: which predecessor walk reached each node (0 when none) */
+    int *walk_mark;
+    /* @brief Cycle search: nodes the search starts from */
+    int *seeds;
+    /* @brief Cycle search: whether a node is already a seed */
+    bool *is_seed;
+    int nr_seeds;
+    /* @brief Under a deadline: seeds a round of the search starts from, halved every time a paused round has to start over */
+    int seed_batch;
+    /* @brief A round cut short by the deadline, until the flow or a cost changes: its first seed, queue (in graph.queue) and touched nodes */
+    bool search_paused;
+    int search_batch_start;
+    int search_head;
+    int search_tail;
+    int nr_search_touched;
+    /* @brief The node the deadline stopped in the middle of (at the head of the queue) and its next edge, -1 when none */
+    int search_node;
+    int search_edge;
+    /* @brief Relaxations since the paused round last looked for a predecessor cycle */
+    long search_relaxations;
+    /* @brief The VMs and pCPUs the graph was built for */
+    int nr_vms;
+    int nr_pcpus;
+    int vm_ids[MAX_VMS];
+    int pcpu_ids[MAX_PCPUS];
+    int vm_nr_vcpus[MAX_VMS];
+    /* @brief Edge layout: first VM -> pCPU edge of each VM, its edges per pCPU and the first pCPU -> Sink edge */
+    int vm_edge_base[MAX_VMS];
+    int vm_nr_slots[MAX_VMS];
+    int pcpu_edge_base;
+    /* @brief The inputs the current edge costs were computed from */
+    int vm_vcpu_pcpu[MAX_VMS][MAX_VCPUS_PER_VM];
+    int vm_move_penalty[MAX_VMS];
+    int pcpu_load_cost[MAX_PCPUS];
+    CPUTopology topology;
+    /* @brief Index of the pCPU of each assigned vCPU of a VM, in no particular order */
+    int vm_placement[MAX_VMS][MAX_VCPUS_PER_VM];
+    int vm_nr_placed[MAX_VMS];
+    int total_flow;
+    int total_cost;
+    /* @brief Under a deadline: the VM the next round of single vCPU moves starts at */
+    int next_vm;
+    /* @brief VMs in a row the single vCPU moves found nothing for. Done at nr_vms or at the optimum, until a call is cut short after the flow or the costs changed */
+    int nr_unmoved_vms;
+    bool initialized;
+    /* @brief What the last tick had to do */
+    IncrementalStats stats;
+} IncrementalScheduler;
+
+/**
+ * @brief Computes the VM to pCPU assignment, re-optimizing the previous one when possible.
+ *
+ * Gives a schedule with the same total cost as compute_schedule.
+ *
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int incremental_schedule(IncrementalScheduler *scheduler, const SystemState *state, Schedule *out);
+
+/**
+ * @brief incremental_schedule that stops improving the schedule at a deadline.
+ *
+ * The flow always starts out feasible: from the previous tick's, or from the
+ * current placement after a rebuild. Cancelling a negative cycle only ever makes
+ * it cheaper, so at the deadline the schedule is the best one found so far and
+ * stats.optimal tells whether it is the optimum. Before the search, single vCPUs
+ * move to a free slot or swap with another VM's while that saves cost, since a
+ * round of the search over a freshly built network can take longer than a short
+ * budget. They stop once a round finds nothing to move or the flow reaches the
+ * optimum. A later call that is cut short after the flow or the costs changed
+ * starts them again.
+ *
+ * What is left carries on at the next call. A round of the search that is cut
+ * short resumes where it stopped when nothing changed in between, so a budget
+ * under one round still reaches the optimum over repeated calls. When a change
+ * makes it start over, the next rounds start from half as many seeds.
+ *
+ * Building the flow network after a rebuild isn't bounded, it takes about as
+ * long as filling compute_schedule's graph.
+ *
+ * @param deadline_ns On the tick_now_ns clock, 0 or less for none
+ * @return 0 on success, -1 when memory allocation fails.
+ */
+int incremental_schedule_until(IncrementalScheduler *scheduler, const SystemState *state, long long deadline_ns, Schedule *out);
+
+/**
+ * @brief Frees the memory of the scheduler.
+ */
+void incremental_scheduler_destroy(IncrementalScheduler *scheduler);
+
+#endif
@@ -1,6 +1,5 @@
 #include "mcmf.h"
 #include <string.h>
-#define ADDITION_VM_PENALTY 50
 
 /**
  * @brief Use Bellman-Ford variation to calculate the shortest path between source and sink.
@@ -19,12 +18,13 @@
  * @return true if a path exists.
  */
 static bool find_cheapest_path(FlowGraph *g, int source, int sink, int *out_dist, int *out_prev_edges) {
-    bool in_queue[MAX_NODES];
-    int queue[MAX_NODES];
+    bool *in_queue = g->visited;
+    int *queue = g->queue;
+    int queue_size = g->nr_nodes + 1;  // Each node is queued at most once
     int q_head = 0, q_tail = 0;  // Circular queue
 
     /* Set all distance[node] to infinity except the source */
-    for (int i = 0; i < MAX_NODES; i++) {
+    for (int i = 0; i < g->nr_nodes; i++) {
         out_dist[i] = INF;      // All node distance to source is set to infinity. Reset source later.
         in_queue[i] = false;    // No node in queue yet.
         out_prev_edges[i] = -1;  // No edge is decided for each node yet.
@@ -38,11 +38,15 @@ static bool find_cheapest_path(FlowGraph *g, int source, int sink, int *out_dist
     /* SPFA loop stops no more node's distance to source is updated */
     while (q_head != q_tail) {
         int node_u = queue[q_head++];
-        if (q_head >= MAX_NODES) {
+        if (q_head >= queue_size) {
             /* Circular queue reset */
             q_head = 0;
         }
         in_queue[node_u] = false;
+        if (node_u == sink) {
+            /* Paths end at the sink. Leaving it through a reverse edge only finds cycles */
+            continue;
+        }
         /* Get each edge from the source */
         for(int e = g->heads[node_u]; e >= 0; e = g->edges[e].next) {
             Edge edge = g->edges[e];
@@ -58,7 +62,7 @@ static bool find_cheapest_path(FlowGraph *g, int source, int sink, int *out_dist
                 if (!in_queue[node_v]) {
                     queue[q_tail++] = node_v;   // Add to queue for updating its neighbors' distance
                     in_queue[node_v] = true;
-                    if (q_tail >= MAX_NODES) {
+                    if (q_tail >= queue_size) {
                         /* Circular queue reset */
                         q_tail = 0;
                     }
@@ -70,6 +74,158 @@ static bool find_cheapest_path(FlowGraph *g, int source, int sink, int *out_dist
     return out_dist[sink] != INF;
 }
 
+/**
+ * @brief Restores the heap order by moving the node at heap index i up towards the root.
+ */
+static void heap_sift_up(int *heap, int *heap_pos, const int *dist, int i) {
+    int node = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (dist[heap[parent]] <= dist[node]) {
+            break;
+        }
+        heap[i] = heap[parent];
+        heap_pos[heap[i]] = i;
+        i = parent;
+    }
+    heap[i] = node;
+    heap_pos[node] = i;
+}
+
+/**
+ * @brief Restores the heap order by moving the node at heap index i down towards the leaves.
+ */
+static void heap_sift_down(int *heap, int *heap_pos, const int *dist, int heap_size, int i) {
+    int node = heap[i];
+    while (2 * i + 1 < heap_size) {
+        int child = 2 * i + 1;
+        if (child + 1 < heap_size && dist[heap[child + 1]] < dist[heap[child]]) {
+            child++;
+        }
+        if (dist[node] <= dist[heap[child]]) {
+            break;
+        }
+        heap[i] = heap[child];
+        heap_pos[heap[i]] = i;
+        i = child;
+    }
+    heap[i] = node;
+    heap_pos[node] = i;
+}
+
+/**
+ * @brief Use Dijkstra with node potentials to calculate the shortest path between source and sink.
+ * 
+ * The reduced cost of an edge u -> v is cost + potential[u] - potential[v]. As long as the 
+ * potentials are the shortest distances from the previous round every edge with capacity 
+ * left has a non-negative reduced cost, including the negative cost reverse edges. This is
+ * what allows Dijkstra to be used instead of Bellman-Ford (i.e. Johnson reweighting).
+ * 
+ * The potentials are moved forward with the new distances once the search completes.
+ * 
+ * @param g The flow network represented through a graph.
+ * @param source The node index for source node (usually zero).
+ * @param sink The node index for sink node.
+ * @param potential The node potentials. Updated with the shortest distances found.
+ * @param out_cost The real (not reduced) cost of the path between source and sink.
+ * @param out_prev_edges The edges connects from source to sink. (e.g. The index of edge connects to node u is stored as prev_edge[u])
+ * @return true if a path exists.
+ */
+static bool find_cheapest_path_dijkstra(FlowGraph *g, int source, int sink, int *potential, int *out_cost, int *out_prev_edges) {
+    int *dist = g->dist;
+    int *heap = g->queue;
+    int *heap_pos = g->heap_pos;  // Position of each node in the heap (-1 when not in heap)
+    bool *done = g->visited;
+    int heap_size = 0;
+
+    for (int i = 0; i < g->nr_nodes; i++) {
+        dist[i] = INF;
+        heap_pos[i] = -1;
+        done[i] = false;
+        out_prev_edges[i] = -1;
+    }
+    dist[source] = 0;
+    heap[heap_size++] = source;
+    heap_pos[source] = 0;
+
+    while (heap_size > 0) {
+        /* Pop the closest node */
+        int node_u = heap[0];
+        heap_pos[node_u] = -1;
+        done[node_u] = true;
+        if (--heap_size > 0) {
+            heap[0] = heap[heap_size];
+            heap_sift_down(heap, heap_pos, dist, heap_size, 0);
+        }
+        if (node_u == sink) {
+            /* Paths end at the sink. Leaving it through a reverse edge only finds cycles */
+            continue;
+        }
+
+        for (int e = g->heads[node_u]; e >= 0; e = g->edges[e].next) {
+            const Edge *edge = &g->edges[e];
+            int node_v = edge->to;
+            if (edge->capacity <= 0 || done[node_v]) {
+                continue;
+            }
+            int reduced_cost = edge->cost + potential[node_u] - potential[node_v];
+            if (dist[node_u] + reduced_cost < dist[node_v]) {
+                dist[node_v] = dist[node_u] + reduced_cost;
+                out_prev_edges[node_v] = e;
+                if (heap_pos[node_v] < 0) {
+                    heap[heap_size] = node_v;
+                    heap_pos[node_v] = heap_size++;
+                }
+                heap_sift_up(heap, heap_pos, dist, heap_pos[node_v]);
+            }
+        }
+    }
+
+    if (dist[sink] == INF) {
+        return false;
+    }
+
+    /* Undo the reweighting for the path cost before moving the potentials */
+    *out_cost = dist[sink] - potential[source] + potential[sink];
+    for (int i = 0; i < g->nr_nodes; i++) {
+        if (dist[i] != INF) {
+            potential[i] += dist[i];
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Pushes the bottleneck capacity through the path found between source and sink.
+ * 
+ * @param graph The flow network between source and sink.
+ * @param sink The sink node in the graph
+ * @param prev_edges The edge that leads the shortest path to each node
+ * @return The amount of flow pushed through the path
+ */
+static int augment_path(FlowGraph *graph, int sink, const int *prev_edges) {
+    /* Calculate bottleneck (i.e. the max flow on the shortest path from source and sink) */
+    int bottleneck = INF;
+    for (int e = prev_edges[sink]; e >= 0; e = prev_edges[graph->edges[e ^ 1].to]){
+        Edge edge = graph->edges[e];
+        if (edge.capacity < bottleneck) {
+            bottleneck = edge.capacity;
+        }
+    }
+
+    /* Push capacity through the graph and update reverse edges */
+    for (int e = prev_edges[sink]; e >= 0; e = prev_edges[graph->edges[e ^ 1].to]){
+        graph->edges[e].capacity -= bottleneck;
+        graph->edges[e ^ 1].capacity += bottleneck;
+        graph->edges[e].flow += bottleneck;
+        /* remove the flow if the counterpart edge was used previously */
+        if (graph->edges[e ^ 1].flow > 0) {
+            graph->edges[e ^ 1].flow -= bottleneck;
+        }
+    }
+    return bottleneck;
+}
+
 /**
  * @brief Updates the flow graph to achieve minimum cost and maximum flow between source and sink
  * 
@@ -82,43 +238,276 @@ static bool find_cheapest_path(FlowGraph *g, int source, int sink, int *out_dist
  * @return A MCMFRsult object with total flow, and total cost
  */
 MCMFResult mcmf_solve(FlowGraph *graph, int source, int sink) {
+    return mcmf_solve_with(graph, source, sink, MCMF_DEFAULT_ALGORITHM);
+}
+
+/**
+ * @brief Same as mcmf_solve with the shortest path algorithm picked by the caller
+ * 
+ * Both algorithms give the same total flow and total cost. MCMF_DIJKSTRA runs SPFA once to
+ * seed the node potentials when the graph starts with negative costs, then every following
+ * path is found by Dijkstra in O(|E| log |V|).
+ * 
+ * The costs never change while the solver runs (convex costs are parallel edges, see
+ * graph_add_convex_edge), so successive shortest paths end at a min cost flow and
+ * the potentials stay valid between paths.
+ * 
+ * @param graph The flow network between source and sink.
+ * @param source The source node in the graph
+ * @param sink The sink node in the graph
+ * @param algorithm The shortest path algorithm for finding each augmenting path
+ * @return A MCMFRsult object with total flow, and total cost
+ */
+MCMFResult mcmf_solve_with(FlowGraph *graph, int source, int sink, MCMFAlgorithm algorithm) {
     MCMFResult result = {
         .total_flow = 0,
-        .total_cost =  0
+        .total_cost =  0,
+        .nr_augmentations = 0
     };
-    int distance[MAX_NODES];    // Record the shortest/cheapest path from source to each node
-    int prev_edges[MAX_NODES];  // Record the edge that leads the shortest path to each node
-
-    while(find_cheapest_path(graph, source, sink, distance, prev_edges)) {
-        /* Calculate bottleneck (i.e. the max flow on the shortest path from source and sink) */
-        int bottleneck = INF;
-        for (int e = prev_edges[sink]; e >= 0; e = prev_edges[graph->edges[e ^ 1].to]){
-            Edge edge = graph->edges[e];
-            if (edge.capacity < bottleneck) {
-                bottleneck = edge.capacity;
+    int *distance = graph->dist;          // Record the shortest/cheapest path from source to each node
+    int *prev_edges = graph->prev_edges;  // Record the edge that leads the shortest path to each node
+
+    if (algorithm == MCMF_SPFA) {
+        while(find_cheapest_path(graph, source, sink, distance, prev_edges)) {
+            int bottleneck = augment_path(graph, sink, prev_edges);
+            /* bottleneck is the total amount of flow can be pushed for current path */
+            result.total_flow += bottleneck;
+            result.nr_augmentations++;
+            /* distance[sink] give the total cost for connecting source to sink */
+            result.total_cost += distance[sink] * bottleneck;
+        }
+        return result;
+    }
+
+    int *potential = graph->potential;  // Shortest distance from source found in the previous round
+    memset(potential, 0, sizeof(int) * graph->nr_nodes);
+
+    /* Reduced costs start as the raw costs, so negative edges need a Bellman-Ford pass first */
+    bool has_negative_cost = false;
+    for (int e = 0; e < graph->nr_edges; e++) {
+        if (graph->edges[e].capacity > 0 && graph->edges[e].cost < 0) {
+            has_negative_cost = true;
+            break;
+        }
+    }
+    if (has_negative_cost) {
+        find_cheapest_path(graph, source, sink, distance, prev_edges);
+        for (int i = 0; i < graph->nr_nodes; i++) {
+            potential[i] = (distance[i] == INF) ? 0 : distance[i];
+        }
+    }
+
+    int path_cost = 0;
+    while(find_cheapest_path_dijkstra(graph, source, sink, potential, &path_cost, prev_edges)) {
+        int bottleneck = augment_path(graph, sink, prev_edges);
+        result.total_flow += bottleneck;
+        result.nr_augmentations++;
+        result.total_cost += path_cost * bottleneck;
+    }
+
+    return result;
+}
+
+/**
+ * @brief SPFA over the CSR layout. Same as find_cheapest_path.
+ * 
+ * Distances and previous edges (CSR positions) are left in g->dist and g->prev_edges.
+ */
+static bool csr_find_cheapest_path(CSRGraph *g, int source, int sink) {
+    int *dist = g->dist;
+    int *prev_edges = g->prev_edges;
+    bool *in_queue = g->visited;
+    int *queue = g->queue;
+    int queue_size = g->nr_nodes + 1;
+    int q_head = 0, q_tail = 0;
+
+    for (int i = 0; i < g->nr_nodes; i++) {
+        dist[i] = INF;
+        in_queue[i] = false;
+        prev_edges[i] = -1;
+    }
+    dist[source] = 0;
+    queue[q_tail++] = source;
+    in_queue[source] = true;
+
+    const int *to = g->to;
+    const int *cap = g->cap;
+    const int *cost = g->cost;
+    while (q_head != q_tail) {
+        int node_u = queue[q_head++];
+        if (q_head >= queue_size) {
+            q_head = 0;
+        }
+        in_queue[node_u] = false;
+        if (node_u == sink) {
+            continue;
+        }
+        int dist_u = dist[node_u];
+        for (int p = g->offsets[node_u]; p < g->offsets[node_u + 1]; p++) {
+            int node_v = to[p];
+            if (cap[p] > 0 && dist_u + cost[p] < dist[node_v]) {
+                dist[node_v] = dist_u + cost[p];
+                prev_edges[node_v] = p;
+                if (!in_queue[node_v]) {
+                    queue[q_tail++] = node_v;
+                    in_queue[node_v] = true;
+                    if (q_tail >= queue_size) {
+                        q_tail = 0;
+                    }
+                }
             }
         }
+    }
+
+    return dist[sink] != INF;
+}
+
+/**
+ * @brief Dijkstra with node potentials over the CSR layout. Same as find_cheapest_path_dijkstra.
+ */
+static bool csr_find_cheapest_path_dijkstra(CSRGraph *g, int source, int sink, int *out_cost) {
+    int *dist = g->dist;
+    int *prev_edges = g->prev_edges;
+    int *potential = g->potential;
+    int *heap = g->queue;
+    int *heap_pos = g->heap_pos;
+    bool *done = g->visited;
+    int heap_size = 0;
+
+    for (int i = 0; i < g->nr_nodes; i++) {
+        dist[i] = INF;
+        heap_pos[i] = -1;
+        done[i] = false;
+        prev_edges[i] = -1;
+    }
+    dist[source] = 0;
+    heap[heap_size++] = source;
+    heap_pos[source] = 0;
+
+    const int *to = g->to;
+    const int *cap = g->cap;
+    const int *cost = g->cost;
+    while (heap_size > 0) {
+        int node_u = heap[0];
+        heap_pos[node_u] = -1;
+        done[node_u] = true;
+        if (--heap_size > 0) {
+            heap[0] = heap[heap_size];
+            heap_sift_down(heap, heap_pos, dist, heap_size, 0);
+        }
+        if (node_u == sink) {
+            continue;
+        }
 
-        /* Push capacity through the graph and update reverse edges */
-        for (int e = prev_edges[sink]; e >= 0; e = prev_edges[graph->edges[e ^ 1].to]){
-            graph->edges[e].capacity -= bottleneck;
-            graph->edges[e ^ 1].capacity += bottleneck;
-            graph->edges[e].flow += bottleneck;
-            /* remove the flow if the counterpart edge was used previously */
-            if (graph->edges[e ^ 1].flow > 0) {
-                graph->edges[e ^ 1].flow -= bottleneck;
+        int base_u = dist[node_u] + potential[node_u];
+        for (int p = g->offsets[node_u]; p < g->offsets[node_u + 1]; p++) {
+            int node_v = to[p];
+            if (cap[p] <= 0 || done[node_v]) {
+                continue;
             }
-            /* Add penalty to edge betwen pCPU and Sink for adding second VM */
-            if (e == prev_edges[sink]) {
-                graph->edges[e].cost += ADDITION_VM_PENALTY;
-                graph->edges[e ^ 1].cost -= ADDITION_VM_PENALTY;
+            int candidate = base_u + cost[p] - potential[node_v];
+            if (candidate < dist[node_v]) {
+                dist[node_v] = candidate;
+                prev_edges[node_v] = p;
+                if (heap_pos[node_v] < 0) {
+                    heap[heap_size] = node_v;
+                    heap_pos[node_v] = heap_size++;
+                }
+                heap_sift_up(heap, heap_pos, dist, heap_pos[node_v]);
             }
         }
-        
-        /* bottleneck is the total amount of flow can be pushed for current path */
+    }
+
+    if (dist[sink] == INF) {
+        return false;
+    }
+
+    *out_cost = dist[sink] - potential[source] + potential[sink];
+    for (int i = 0; i < g->nr_nodes; i++) {
+        if (dist[i] != INF) {
+            potential[i] += dist[i];
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Pushes the bottleneck capacity through the path found over the CSR layout.
+ * 
+ * @return The amount of flow pushed through the path
+ */
+static int csr_augment_path(CSRGraph *g, int sink) {
+    const int *prev_edges = g->prev_edges;
+    int bottleneck = INF;
+    for (int p = prev_edges[sink]; p >= 0; p = prev_edges[g->to[g->rev[p]]]) {
+        if (g->cap[p] < bottleneck) {
+            bottleneck = g->cap[p];
+        }
+    }
+
+    for (int p = prev_edges[sink]; p >= 0; p = prev_edges[g->to[g->rev[p]]]) {
+        int r = g->rev[p];
+        g->cap[p] -= bottleneck;
+        g->cap[r] += bottleneck;
+        g->flow[p] += bottleneck;
+        if (g->flow[r] > 0) {
+            g->flow[r] -= bottleneck;
+        }
+    }
+    return bottleneck;
+}
+
+/**
+ * @brief Same as mcmf_solve_with over the CSR (structure of arrays) layout
+ * 
+ * Gives the same result and, because the CSR layout keeps the adjacency order,
+ * picks the same paths. Copy the flow back with csr_to_graph.
+ * 
+ * @param graph The flow network between source and sink in CSR layout.
+ * @param source The source node in the graph
+ * @param sink The sink node in the graph
+ * @param algorithm The shortest path algorithm for finding each augmenting path
+ * @return A MCMFRsult object with total flow, and total cost
+ */
+MCMFResult mcmf_solve_csr(CSRGraph *graph, int source, int sink, MCMFAlgorithm algorithm) {
+    MCMFResult result = {
+        .total_flow = 0,
+        .total_cost =  0,
+        .nr_augmentations = 0
+    };
+
+    if (algorithm == MCMF_SPFA) {
+        while (csr_find_cheapest_path(graph, source, sink)) {
+            int path_cost = graph->dist[sink];
+            int bottleneck = csr_augment_path(graph, sink);
+            result.total_flow += bottleneck;
+            result.nr_augmentations++;
+            result.total_cost += path_cost * bottleneck;
+        }
+        return result;
+    }
+
+    memset(graph->potential, 0, sizeof(int) * graph->nr_nodes);
+    bool has_negative_cost = false;
+    for (int p = 0; p < graph->nr_edges; p++) {
+        if (graph->cap[p] > 0 && graph->cost[p] < 0) {
+            has_negative_cost = true;
+            break;
+        }
+    }
+    if (has_negative_cost) {
+        csr_find_cheapest_path(graph, source, sink);
+        for (int i = 0; i < graph->nr_nodes; i++) {
+            graph->potential[i] = (graph->dist[i] == INF) ? 0 : graph->dist[i];
+        }
+    }
+
+    int path_cost = 0;
+    while (csr_find_cheapest_path_dijkstra(graph, source, sink, &path_cost)) {
+        int bottleneck = csr_augment_path(graph, sink);
         result.total_flow += bottleneck;
-        /* distance[sink] give the total cost for connecting source to sink */
-        result.total_cost += distance[sink] * bottleneck;
+        result.nr_augmentations++;
+        result.total_cost += path_cost * bottleneck;
     }
 
     return result;
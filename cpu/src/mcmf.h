@@ -2,13 +2,37 @@
 #define MCMF_H
 
 #include "graph.h"
+#include "csr_graph.h"
 #include <stdbool.h>
 
+/**
+ * @brief Shortest path algorithm used for finding each augmenting path.
+ */
+typedef enum {
+    /* Queue based Bellman-Ford (SPFA) over the raw edge costs */
+    MCMF_SPFA,
+    /* Binary heap Dijkstra over reduced costs (Johnson reweighting with node potentials) */
+    MCMF_DIJKSTRA,
+} MCMFAlgorithm;
+
+/**
+ * @brief The algorithm used by mcmf_solve. Override with -DMCMF_DEFAULT_ALGORITHM=MCMF_SPFA.
+ */
+#ifndef MCMF_DEFAULT_ALGORITHM
+#define MCMF_DEFAULT_ALGORITHM MCMF_DIJKSTRA
+#endif
+
 typedef struct {
     int total_flow;
     int total_cost;
+    /* @brief Number of augmenting paths pushed */
+    int nr_augmentations;
 } MCMFResult;
 
 MCMFResult mcmf_solve(FlowGraph *graph, int source, int sink);
 
-#endif
\ No newline at end of file
+MCMFResult mcmf_solve_with(FlowGraph *graph, int source, int sink, MCMFAlgorithm algorithm);
+
+MCMFResult mcmf_solve_csr(CSRGraph *graph, int source, int sink, MCMFAlgorithm algorithm);
+
+#endif
@@ -0,0 +1,180 @@
+#include <math.h>
+#include <string.h>
+#include "vm_types.h"
+#include "sampler.h"
+
+void sample_ring_add(SampleRing *ring, double value, double alpha) {
+    ring->ewma = ring->nr_values == 0 ? value : alpha * value + (1 - alpha) * ring->ewma;
+    ring->values[ring->head] = value;
+    ring->head = (ring->head + 1) % SAMPLE_RING_LEN;
+    if (ring->nr_values < SAMPLE_RING_LEN) {
+        ring->nr_values++;
+    }
+}
+
+double sample_ring_peak(const SampleRing *ring) {
+    double peak = 0;
+    for (int k = 0; k < ring->nr_values; k++) {
+        if (k == 0 || ring->values[k] > peak) {
+            peak = ring->values[k];
+        }
+    }
+    return peak;
+}
+
+double sample_ring_variance(const SampleRing *ring) {
+    if (ring->nr_values == 0) {
+        return 0;
+    }
+    double mean = 0;
+    for (int k = 0; k < ring->nr_values; k++) {
+        mean += ring->values[k];
+    }
+    mean /= ring->nr_values;
+    double variance = 0;
+    for (int k = 0; k < ring->nr_values; k++) {
+        variance += (ring->values[k] - mean) * (ring->values[k] - mean);
+    }
+    return variance / ring->nr_values;
+}
+
+void sampler_init(Sampler *sampler, double alpha) {
+    memset(sampler, 0, sizeof(Sampler));
+    sampler->alpha = alpha;
+    vm_table_clear(&sampler->vm_slots);
+    for (int s = 0; s < MAX_VMS; s++) {
+        sampler->free_slots[s] = MAX_VMS - 1 - s;
+    }
+    sampler->nr_free_slots = MAX_VMS;
+}
+
+static VMSampleHistory *add_vm(Sampler *sampler, int id) {
+    if (sampler->nr_free_slots == 0 || vm_table_put(&sampler->vm_slots, id, sampler->free_slots[sampler->nr_free_slots - 1]) < 0) {
+        return NULL;
+    }
+    VMSampleHistory *history = &sampler->vms[sampler->free_slots[--sampler->nr_free_slots]];
+    memset(history, 0, sizeof(VMSampleHistory));
+    history->id = id;
+    return history;
+}
+
+void sampler_add(Sampler *sampler, const SystemState *state, long long now_ns) {
+    /* A VM missing from this sample went away, its ID may come back as another domain */
+    bool *seen = sampler->seen;
+    memset(seen, 0, sizeof(sampler->seen));
+    int nr_seen = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int slot = vm_table_get(&sampler->vm_slots, vm->id);
+        VMSampleHistory *history = slot >= 0 ? &sampler->vms[slot] : NULL;
+        if (history == NULL) {
+            history = add_vm(sampler, vm->id);
+            if (history == NULL) {
+                continue;
+            }
+        }
+        if (!seen[history - sampler->vms]) {
+            seen[history - sampler->vms] = true;
+            nr_seen++;
+        }
+        if (history->sampled_ns > 0 && now_ns > history->sampled_ns && vm->cpu_time >= history->cpu_time) {
+            double usage = (vm->cpu_time - history->cpu_time) * 100.0 / (now_ns - history->sampled_ns);
+            sample_ring_add(&history->usage, usage, sampler->alpha);
+        }
+        history->cpu_time = vm->cpu_time;
+        history->sampled_ns = now_ns;
+    }
+    if (MAX_VMS - sampler->nr_free_slots > nr_seen) {
+        for (int s = 0; s < MAX_VMS; s++) {
+            if (!seen[s] && vm_table_get(&sampler->vm_slots, sampler->vms[s].id) == s) {
+                vm_table_remove(&sampler->vm_slots, sampler->vms[s].id);
+                sampler->free_slots[sampler->nr_free_slots++] = s;
+            }
+        }
+    }
+
+    if (state->nr_pcpus != sampler->nr_pcpus) {
+        memset(sampler->pcpus, 0, sizeof(sampler->pcpus));
+        sampler->nr_pcpus = state->nr_pcpus;
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        PCPUSampleHistory *history = &sampler->pcpus[j];
+        const PCPU *pcpu = &state->pcpus[j];
+        if (history->sampled_ns > 0 && now_ns > history->sampled_ns && pcpu->idle_ns >= history->idle_ns) {
+            /* Idle time is more up to date than the utilization libvirt reports */
+            double idle_rate = (pcpu->idle_ns - history->idle_ns) * 100.0 / (now_ns - history->sampled_ns);
+            double utilization = idle_rate > 100 ? 0 : 100 - idle_rate;
+            sample_ring_add(&history->utilization, utilization, sampler->alpha);
+        }
+        history->idle_ns = pcpu->idle_ns;
+        history->sampled_ns = now_ns;
+    }
+    sampler->nr_samples++;
+}
+
+int sampler_apply(const Sampler *sampler, SystemState *state) {
+    int nr_applied = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        int slot = vm_table_get(&sampler->vm_slots, vm->id);
+        if (slot < 0 || sampler->vms[slot].usage.nr_values == 0) {
+            continue;
+        }
+        const VMSampleHistory *history = &sampler->vms[slot];
+        vm->cpu_usage_rate = history->usage.ewma;
+        vm->cpu_usage_peak = sample_ring_peak(&history->usage);
+        vm->cpu_usage_stddev = sqrt(sample_ring_variance(&history->usage));
+        nr_applied++;
+    }
+    for (int j = 0; j < state->nr_pcpus && j < sampler->nr_pcpus; j++) {
+        PCPU *pcpu = &state->pcpus[j];
+        const SampleRing *ring = &sampler->pcpus[j].utilization;
+        if (ring->nr_values == 0) {
+            continue;
+        }
+        pcpu->utilization_rate = ring->ewma;
+        pcpu->idle_rate = 100 - ring->ewma;
+        pcpu->utilization_peak = sample_ring_peak(ring);
+        pcpu->utilization_stddev = sqrt(sample_ring_variance(ring));
+        nr_applied++;
+    }
+    return nr_applied;
+}
+
+int caculate_utilization_rate(SystemState *current, SystemState *previous, unsigned long long interval_ns) {
+    /* Index of every previous VM by domain ID */
+    VMTable previous_index;
+    vm_table_clear(&previous_index);
+    for (int j = 0; j < previous->nr_vms; j++) {
+        vm_table_put(&previous_index, previous->vms[j].id, j);
+    }
+
+    /* calculate current VM's utilization rate */
+    int vms_updated = 0;
+    for (int i = 0; i < current->nr_vms; i++) {
+        VM *vm = &current->vms[i];
+        int j = vm_table_get(&previous_index, vm->id);
+        /* find matching previous vm, a reused ID with another name is another domain */
+        if (j < 0 || strncmp(vm->name, previous->vms[j].name, MAX_NAME_LEN) != 0 || vm->cpu_time < previous->vms[j].cpu_time) {
+            continue;
+        }
+        vm->cpu_usage_rate = (vm->cpu_time - previous->vms[j].cpu_time) * 100.0 / interval_ns;
+        vms_updated++;
+    }
+    for (int i = 0; i < current->nr_pcpus; i++) {
+        /* pCPU ids are their indexes, so the same index almost always matches */
+        int j = i < previous->nr_pcpus && previous->pcpus[i].id == current->pcpus[i].id ? i : -1;
+        for (int k = 0; k < previous->nr_pcpus && j < 0; k++) {
+            if (current->pcpus[i].id == previous->pcpus[k].id) {
+                j = k;
+            }
+        }
+        if (j < 0) {
+            continue;
+        }
+        current->pcpus[i].idle_rate = (current->pcpus[i].idle_ns - previous->pcpus[j].idle_ns) * 100.0 / interval_ns;
+        /* Overwrite utilization rate */
+        current->pcpus[i].utilization_rate = 100.0 - current->pcpus[i].idle_rate;
+    }
+    return vms_updated;
+}
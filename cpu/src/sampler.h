@@ -0,0 +1,93 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "vm_table.h"
+
+/* Samples kept per VM and pCPU, 4 decision intervals at 4 samples each */
+#define SAMPLE_RING_LEN 16
+/* Weight of the newest sample in the moving average */
+#define SAMPLE_EWMA_ALPHA 0.2
+
+/**
+ * @brief The last SAMPLE_RING_LEN samples of one signal plus its moving average.
+ */
+typedef struct {
+    double values[SAMPLE_RING_LEN];
+    int    head;                // Slot the next sample goes to
+    int    nr_values;
+    double ewma;
+} SampleRing;
+
+void sample_ring_add(SampleRing *ring, double value, double alpha);
+
+/**
+ * @brief The largest sample in the ring, 0 when empty.
+ */
+double sample_ring_peak(const SampleRing *ring);
+
+/**
+ * @brief The population variance of the samples in the ring, 0 when empty.
+ */
+double sample_ring_variance(const SampleRing *ring);
+
+typedef struct {
+    int                id;
+    unsigned long long cpu_time;      // Counter at the last sample
+    long long          sampled_ns;    // 0 before the first sample
+    SampleRing         usage;         // Percent of one pCPU, over 100 for busy multi-vCPU VMs
+} VMSampleHistory;
+
+typedef struct {
+    unsigned long long idle_ns;       // Counter at the last sample
+    long long          sampled_ns;    // 0 before the first sample
+    SampleRing         utilization;
+} PCPUSampleHistory;
+
+/**
+ * @brief Turns cumulative CPU and idle times sampled faster than the decision
+ * interval into smoothed utilization signals.
+ *
+ * Every sample adds one rate per VM (found by domain ID) and per pCPU. VMs that
+ * are missing from a sample lose their history.
+ */
+typedef struct {
+    double            alpha;
+    VMSampleHistory   vms[MAX_VMS];
+    VMTable           vm_slots;          // Domain ID -> index into vms
+    int               free_slots[MAX_VMS];
+    int               nr_free_slots;
+    bool              seen[MAX_VMS];     // By slot, whether the VM is in the sample sampler_add is adding
+    PCPUSampleHistory pcpus[MAX_PCPUS];
+    int               nr_pcpus;
+    int               nr_samples;
+} Sampler;
+
+void sampler_init(Sampler *sampler, double alpha);
+
+/**
+ * @brief Adds the rates since the previous sample, from the cpu_time and idle_ns counters of the state.
+ *
+ * now_ns is the monotonic time of the sample and must be above 0.
+ */
+void sampler_add(Sampler *sampler, const SystemState *state, long long now_ns);
+
+/**
+ * @brief Writes the moving average, peak and standard deviation of every VM and pCPU into the state.
+ *
+ * @return The number of VMs and pCPUs with at least one rate, the others are left alone.
+ */
+int sampler_apply(const Sampler *sampler, SystemState *state);
+
+/**
+ * @brief Raw rates over one interval: each VM's usage and each pCPU's idle and utilization rate.
+ *
+ * VMs are matched by domain ID and name, so a VM only gets a rate when it was
+ * already running in the previous state.
+ *
+ * @return The number of VMs updated.
+ */
+int caculate_utilization_rate(SystemState *current, SystemState *previous, unsigned long long interval_ns);
+
+#endif
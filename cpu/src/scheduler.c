@@ -4,22 +4,278 @@
 #include "graph.h"
 #include "mcmf.h"
 #include "scheduler.h"
+#include "topology.h"
+
 
 /**
- * VM PCPU affinity provides edge cost at 0. Assigning different PCPU
- * incurs a migration penalty. The cost is 50% of a fully utilized CPU.
+ * The graphs reused by compute_schedule. They only grow, so ticks with the same
+ * number of VMs and pCPUs don't allocate.
  */
-#define MIGRATION_PENALTY 50
+static ScheduleWorkspace schedule_workspace;
+
+int vm_nr_vcpus(const VM *vm) {
+    return vm->nr_vcpus > 1 ? vm->nr_vcpus : 1;
+}
+
+int vm_vcpu_pcpu(const VM *vm, int vcpu) {
+    return vm->nr_vcpus > 1 ? vm->vcpu_pcpu[vcpu] : vm->current_pcpu;
+}
+
+int vm_nr_pcpu_slots(const VM *vm) {
+    int nr_vcpus = vm_nr_vcpus(vm);
+    return nr_vcpus < MAX_VMS_PER_PCPU ? nr_vcpus : MAX_VMS_PER_PCPU;
+}
+
+int migration_cost(const SystemState *state, int from_pcpu, int to_pcpu) {
+    switch (topology_distance(&state->topology, from_pcpu, to_pcpu)) {
+        case TOPOLOGY_SAME_CPU: return 0;
+        case TOPOLOGY_SMT_SIBLING: return SMT_SIBLING_MIGRATION_PENALTY;
+        case TOPOLOGY_SAME_LLC: return SAME_LLC_MIGRATION_PENALTY;
+        case TOPOLOGY_REMOTE_NODE: return REMOTE_NODE_MIGRATION_PENALTY;
+        default: return MIGRATION_PENALTY;
+    }
+}
+
 /**
- * Each PCPU allows to handle up to 2 VMs.
+ * @brief The SMT core of pCPU pcpu_index, -1 when the topology doesn't know it.
  */
-#define MAX_VMS_PER_PCPU 2
+static int pcpu_core(const SystemState *state, int pcpu_index) {
+    int id = state->pcpus[pcpu_index].id;
+    if (id < 0 || id >= state->topology.nr_cpus) {
+        return -1;
+    }
+    int core = state->topology.core[id];
+    return (core >= 0 && core < MAX_PCPUS) ? core : -1;
+}
 
+/**
+ * @brief The sampled utilization of the pCPU, raised by part of its spread.
+ */
+static double pcpu_utilization(const PCPU *pcpu) {
+    /* Not sampled */
+    if (!(pcpu->utilization_stddev > 0)) {
+        return pcpu->utilization_rate;
+    }
+    double utilization = pcpu->utilization_rate + pcpu->utilization_stddev * LOAD_STDDEV_PERCENT / 100;
+    return utilization < pcpu->utilization_peak ? utilization : pcpu->utilization_peak;
+}
 
-Schedule compute_schedule(const SystemState *state) {
-    FlowGraph g;
+int pcpu_load_cost(const SystemState *state, int pcpu_index) {
+    int core = pcpu_core(state, pcpu_index);
+    double sibling_utilization = 0;
+    for (int j = 0; j < state->nr_pcpus && core >= 0; j++) {
+        if (j != pcpu_index && pcpu_core(state, j) == core) {
+            sibling_utilization += pcpu_utilization(&state->pcpus[j]);
+        }
+    }
+    return (int) pcpu_utilization(&state->pcpus[pcpu_index]) + (int) (sibling_utilization * SMT_SIBLING_CONTENTION_PERCENT / 100);
+}
+
+void pcpu_load_costs(const SystemState *state, int *load_costs) {
+    double core_utilization[MAX_PCPUS];
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        int core = pcpu_core(state, j);
+        if (core >= 0) {
+            core_utilization[core] = 0;
+        }
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        int core = pcpu_core(state, j);
+        if (core >= 0) {
+            core_utilization[core] += pcpu_utilization(&state->pcpus[j]);
+        }
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        int core = pcpu_core(state, j);
+        double utilization = pcpu_utilization(&state->pcpus[j]);
+        double sibling_utilization = core >= 0 ? core_utilization[core] - utilization : 0;
+        load_costs[j] = (int) utilization + (int) (sibling_utilization * SMT_SIBLING_CONTENTION_PERCENT / 100);
+    }
+}
+
+int vm_pcpu_cost(const SystemState *state, int vm_index, int pcpu_index) {
+    return vm_pcpu_slot_cost(state, vm_index, pcpu_index, 0);
+}
+
+int vm_pcpu_slot_cost(const SystemState *state, int vm_index, int pcpu_index, int slot) {
+    return vm_pcpu_slot_cost_with_load(state, vm_index, pcpu_index, slot, pcpu_load_cost(state, pcpu_index));
+}
+
+int vm_pcpu_slot_cost_with_load(const SystemState *state, int vm_index, int pcpu_index, int slot, int load_cost) {
+    const VM *vm = &state->vms[vm_index];
+    int id = state->pcpus[pcpu_index].id;
+    int nr_on_pcpu = 0;
+    int closest_move = MIGRATION_PENALTY;
+    bool first_move = true;
+    for (int k = 0; k < vm_nr_vcpus(vm); k++) {
+        int from = vm_vcpu_pcpu(vm, k);
+        if (from == id) {
+            nr_on_pcpu++;
+            continue;
+        }
+        int cost = migration_cost(state, from, id);
+        if (first_move || cost < closest_move) {
+            closest_move = cost;
+            first_move = false;
+        }
+    }
+    int move_penalty = vm->move_penalty > 0 ? vm->move_penalty : 0;
+    int affinity_cost = (slot < nr_on_pcpu) ? 0 : closest_move + move_penalty;
+    int anti_affinity_cost = slot * VCPU_ANTI_AFFINITY_PENALTY;
+    return affinity_cost + anti_affinity_cost + load_cost;
+}
+
+void schedule_place_vcpus(Schedule *schedule, const SystemState *state, int vm_index,
+                          const int *pcpu_indexes, int nr_placed) {
+    const VM *vm = &state->vms[vm_index];
+    int nr_vcpus = vm_nr_vcpus(vm);
+    bool taken[MAX_VCPUS_PER_VM] = { false };
+    int *vcpu_to_pcpu = schedule->vcpu_to_pcpu[vm_index];
+
+    /* vCPUs that can stay where they are */
+    for (int k = 0; k < nr_vcpus; k++) {
+        vcpu_to_pcpu[k] = -1;
+        for (int p = 0; p < nr_placed; p++) {
+            if (!taken[p] && state->pcpus[pcpu_indexes[p]].id == vm_vcpu_pcpu(vm, k)) {
+                taken[p] = true;
+                vcpu_to_pcpu[k] = state->pcpus[pcpu_indexes[p]].id;
+                break;
+            }
+        }
+    }
+    /* The rest move to the pCPUs left over */
+    int p = 0;
+    for (int k = 0; k < nr_vcpus; k++) {
+        if (vcpu_to_pcpu[k] >= 0) {
+            continue;
+        }
+        while (p < nr_placed && taken[p]) {
+            p++;
+        }
+        if (p == nr_placed) {
+            break;
+        }
+        taken[p] = true;
+        vcpu_to_pcpu[k] = state->pcpus[pcpu_indexes[p]].id;
+    }
+    schedule->vm_to_pcpu[vm_index] = vcpu_to_pcpu[0];
+}
+
+void pcpu_slot_costs(int *capacities, int *costs) {
+    for (int slot = 0; slot < MAX_VMS_PER_PCPU; slot++) {
+        capacities[slot] = 1;
+        costs[slot] = slot * ADDITION_VM_PENALTY;
+    }
+}
+
+Schedule current_schedule(const SystemState *state) {
     Schedule schedule;
     memset(&schedule, -1, sizeof(Schedule));
+    schedule.num_assigned = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        for (int k = 0; k < vm_nr_vcpus(&state->vms[i]); k++) {
+            schedule.vcpu_to_pcpu[i][k] = vm_vcpu_pcpu(&state->vms[i], k);
+            schedule.num_assigned++;
+        }
+        schedule.vm_to_pcpu[i] = schedule.vcpu_to_pcpu[i][0];
+    }
+    schedule.total_cost = schedule_total_cost(state, &schedule);
+    return schedule;
+}
+
+int schedule_total_cost(const SystemState *state, const Schedule *schedule) {
+    int pcpu_index[MAX_PCPUS];
+    int vcpus_on_pcpu[MAX_PCPUS];
+    int load_costs[MAX_PCPUS];
+    for (int id = 0; id < MAX_PCPUS; id++) {
+        pcpu_index[id] = -1;
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        if (state->pcpus[j].id >= 0 && state->pcpus[j].id < MAX_PCPUS) {
+            pcpu_index[state->pcpus[j].id] = j;
+        }
+        vcpus_on_pcpu[j] = 0;
+    }
+    pcpu_load_costs(state, load_costs);
+
+    int cost = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        int vm_vcpus_on_pcpu[MAX_PCPUS];
+        int nr_vcpus = vm_nr_vcpus(&state->vms[i]);
+        for (int k = 0; k < nr_vcpus; k++) {
+            int id = schedule->vcpu_to_pcpu[i][k];
+            int j = (id >= 0 && id < MAX_PCPUS) ? pcpu_index[id] : -1;
+            if (j < 0) {
+                return -1;
+            }
+            vm_vcpus_on_pcpu[j] = 0;
+        }
+        /* The slot edges of a pCPU are used in order, and so are the pCPU -> Sink edges */
+        for (int k = 0; k < nr_vcpus; k++) {
+            int j = pcpu_index[schedule->vcpu_to_pcpu[i][k]];
+            if (vcpus_on_pcpu[j] >= MAX_VMS_PER_PCPU) {
+                return -1;
+            }
+            cost += vm_pcpu_slot_cost_with_load(state, i, j, vm_vcpus_on_pcpu[j], load_costs[j]) +
+                    vcpus_on_pcpu[j] * ADDITION_VM_PENALTY;
+            vm_vcpus_on_pcpu[j]++;
+            vcpus_on_pcpu[j]++;
+        }
+    }
+    return cost;
+}
+
+int schedule_nr_migrations(const SystemState *state, const Schedule *schedule) {
+    int nr_migrations = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        nr_migrations += vm_nr_migrations(state, schedule, i);
+    }
+    return nr_migrations;
+}
+
+int vm_nr_migrations(const SystemState *state, const Schedule *schedule, int vm_index) {
+    const VM *vm = &state->vms[vm_index];
+    int nr_migrations = 0;
+    for (int k = 0; k < vm_nr_vcpus(vm); k++) {
+        int pcpu = schedule->vcpu_to_pcpu[vm_index][k];
+        if (pcpu >= 0 && pcpu != vm_vcpu_pcpu(vm, k)) {
+            nr_migrations++;
+        }
+    }
+    return nr_migrations;
+}
+
+Schedule compute_schedule(const SystemState *state) {
+    return compute_schedule_on(&schedule_workspace, state);
+}
+
+void schedule_set_solver(const ScheduleSolver *solver) {
+    schedule_workspace.solver = solver;
+}
+
+void schedule_workspace_destroy(ScheduleWorkspace *ws) {
+    graph_destroy(&ws->graph);
+    csr_destroy(&ws->csr);
+    arena_free(&ws->solver_arena);
+}
+
+Schedule compute_schedule_on(ScheduleWorkspace *ws, const SystemState *state) {
+    Schedule schedule;
+    const ScheduleSolver *solver = ws->solver != NULL ? ws->solver : &mcmf_schedule_solver;
+    if (solver->solve(ws, state, &schedule) < 0) {
+        solver = &mcmf_schedule_solver;
+        solver->solve(ws, state, &schedule);
+    }
+    ws->solved_by = solver->name;
+    return schedule;
+}
+
+/**
+ * @brief Builds the flow network of the state and solves it with mcmf_solve_csr.
+ */
+static int mcmf_schedule(ScheduleWorkspace *ws, const SystemState *state, Schedule *out) {
+    FlowGraph *g = &ws->graph;
+    memset(out, -1, sizeof(Schedule));
 
     int nr_vms = state->nr_vms;
     int nr_pcpus = state->nr_pcpus;
@@ -30,52 +286,83 @@ Schedule compute_schedule(const SystemState *state) {
     int pcpu_base = vm_base + nr_vms;
     int sink = pcpu_base + nr_pcpus;
 
-    graph_init(&g, sink + 1);
+    /* Source -> VM, VM -> PCPU (one per vCPU slot) and PCPU -> Sink (one per slot) edges with their reverse edges */
+    int nr_edges = nr_vms + nr_pcpus * MAX_VMS_PER_PCPU;
+    for (int i = 0; i < nr_vms; i++) {
+        nr_edges += nr_pcpus * vm_nr_pcpu_slots(&state->vms[i]);
+    }
+    nr_edges *= 2;
+    if (graph_reserve(g, sink + 1, nr_edges) < 0 || csr_reserve(&ws->csr, sink + 1, nr_edges) < 0) {
+        fprintf(stderr, "Failed to allocate the flow graph for %d VMs and %d pCPUs\n", nr_vms, nr_pcpus);
+        out->num_assigned = 0;
+        out->total_cost = 0;
+        return 0;
+    }
+    graph_init(g, sink + 1);
 
-    /* Define Source to each VM */
+    /* Define Source to each VM, one unit of flow per vCPU */
     for (int i = 0; i < nr_vms; i++) {
-        graph_add_edge(&g, source, vm_base + i, 1, 0);
+        graph_add_edge(g, source, vm_base + i, vm_nr_vcpus(&state->vms[i]), 0);
     }
 
-    /* Define VM to each PCPU */
+    /* Define VM to each PCPU, one edge for each vCPU of the VM the PCPU can take */
+    int load_costs[MAX_PCPUS];
+    pcpu_load_costs(state, load_costs);
     for (int i = 0; i < nr_vms; i++) {
         for (int j = 0; j < nr_pcpus; j++) {
-            int affinity_cost = (state->vms[i].current_pcpu == state->pcpus[j].id) ? 0 : MIGRATION_PENALTY;
-            int pcpu_utilization_cost = (int) state->pcpus[j].utilization_rate;
-            int cost = affinity_cost + pcpu_utilization_cost;
-            graph_add_edge(&g, vm_base + i, pcpu_base + j, 1, cost);
+            for (int slot = 0; slot < vm_nr_pcpu_slots(&state->vms[i]); slot++) {
+                graph_add_edge(g, vm_base + i, pcpu_base + j, 1, vm_pcpu_slot_cost_with_load(state, i, j, slot, load_costs[j]));
+            }
         }
     }
 
-    /* Define PCPU to Sink */
+    /* Define PCPU to Sink, every vCPU already on the pCPU adds ADDITION_VM_PENALTY */
+    int slot_capacities[MAX_VMS_PER_PCPU];
+    int slot_costs[MAX_VMS_PER_PCPU];
+    pcpu_slot_costs(slot_capacities, slot_costs);
     for (int j = 0; j < nr_pcpus; j++) {
-        graph_add_edge(&g, pcpu_base + j, sink, MAX_VMS_PER_PCPU, 0);
+        graph_add_convex_edge(g, pcpu_base + j, sink, slot_capacities, slot_costs, MAX_VMS_PER_PCPU);
     }
 
-    MCMFResult result = mcmf_solve(&g, source, sink);
-    schedule.total_cost = result.total_cost;
-    schedule.num_assigned = result.total_flow;
+    /* Solve over the CSR layout and copy the flow back for extracting the assignment */
+    csr_from_graph(&ws->csr, g);
+    MCMFResult result = mcmf_solve_csr(&ws->csr, source, sink, MCMF_DEFAULT_ALGORITHM);
+    ws->result = result;
+    csr_to_graph(&ws->csr, g);
+    out->total_cost = result.total_cost;
+    out->num_assigned = result.total_flow;
 
     /* Extract VM to PCPU assignment */
     for (int i = 0; i < nr_vms; i++) {
+        int pcpu_indexes[MAX_VCPUS_PER_VM];
+        int nr_placed = 0;
         /* Start with the first edge then move to next edge until next is -1 */
-        for(int e = g.heads[vm_base + i]; e >= 0; e = g.edges[e].next) {
-            Edge edge = g.edges[e];
-            if (edge.to >= pcpu_base && edge.flow > 0 && edge.to < sink) {
-                schedule.vm_to_pcpu[i] = state->pcpus[edge.to - pcpu_base].id;
-                break;
+        for(int e = g->heads[vm_base + i]; e >= 0; e = g->edges[e].next) {
+            Edge edge = g->edges[e];
+            if (edge.to >= pcpu_base && edge.flow > 0 && edge.to < sink && nr_placed < MAX_VCPUS_PER_VM) {
+                pcpu_indexes[nr_placed++] = edge.to - pcpu_base;
             }
         }
+        schedule_place_vcpus(out, state, i, pcpu_indexes, nr_placed);
     }
-
-    return schedule;
+    return 0;
 }
 
+const ScheduleSolver mcmf_schedule_solver = {
+    .name = "mcmf",
+    .solve = mcmf_schedule,
+};
+
 void print_schedule(const Schedule *schedule, int nr_vms) {
     printf("Schedule\n");
     printf("Total cost: %d\n", schedule->total_cost);
     printf("Scheduled: %d\n", schedule->num_assigned);
     for (int i = 0; i < nr_vms; i++) {
         printf("VM %d -> PCPU %d\n", i, schedule->vm_to_pcpu[i]);
+        for (int k = 1; k < MAX_VCPUS_PER_VM; k++) {
+            if (schedule->vcpu_to_pcpu[i][k] >= 0) {
+                printf("VM %d vCPU %d -> PCPU %d\n", i, k, schedule->vcpu_to_pcpu[i][k]);
+            }
+        }
     }
 }
\ No newline at end of file
@@ -5,14 +5,219 @@
 #include "graph.h"
 #include "mcmf.h"
 
+/**
+ * VM PCPU affinity provides edge cost at 0. Assigning different PCPU
+ * incurs a migration penalty. The cost is 50% of a fully utilized CPU.
+ * It is the cost within a NUMA node, and of every move when the host
+ * topology is unknown.
+ */
+#define MIGRATION_PENALTY 50
+/**
+ * Migration costs by host topology. An SMT sibling shares every cache, a CPU on
+ * the same LLC keeps the last level cache warm and a remote node also loses
+ * local memory.
+ */
+#define SMT_SIBLING_MIGRATION_PENALTY 10
+#define SAME_LLC_MIGRATION_PENALTY 25
+#define REMOTE_NODE_MIGRATION_PENALTY 80
+/**
+ * Share of an SMT sibling's utilization added to a pCPU's cost, since siblings
+ * compete for the same core.
+ */
+#define SMT_SIBLING_CONTENTION_PERCENT 50
+/**
+ * Share of a pCPU's utilization standard deviation added to its load, so a
+ * bursty pCPU looks busier than a steady one with the same average. The load
+ * never goes above the recent peak.
+ */
+#define LOAD_STDDEV_PERCENT 50
+/**
+ * Each PCPU allows to handle up to 2 vCPUs.
+ */
+#define MAX_VMS_PER_PCPU 2
+/**
+ * Extra cost for every vCPU already placed on a pCPU. Each pCPU -> Sink edge is
+ * convex in the flow (0, ADDITION_VM_PENALTY, 2 * ADDITION_VM_PENALTY, ...).
+ */
+#define ADDITION_VM_PENALTY 50
+/**
+ * Extra cost for every vCPU of a VM placed on a pCPU that already runs one
+ * of its vCPUs, so the vCPUs of a domain spread across pCPUs.
+ */
+#define VCPU_ANTI_AFFINITY_PENALTY 50
+
 typedef struct {
-    int vm_to_pcpu[MAX_VMS];   /* result: vm i assigned to pcpu vm_to_pcpu[i] */
-    int num_assigned;
+    int vm_to_pcpu[MAX_VMS];   /* result: vm i assigned to pcpu vm_to_pcpu[i] (its vCPU 0) */
+    int vcpu_to_pcpu[MAX_VMS][MAX_VCPUS_PER_VM];   /* result: vCPU k of vm i assigned to pcpu vcpu_to_pcpu[i][k] */
+    int num_assigned;          /* number of vCPUs assigned */
     int total_cost;
 } Schedule;
 
+/**
+ * @brief The memory compute_schedule_on builds and solves the flow network in.
+ * 
+ * Start from a zeroed workspace. It grows on demand and is reused by later calls.
+ */
+typedef struct {
+    /* @brief The flow network built from the system state */
+    FlowGraph graph;
+    /* @brief The CSR layout of the flow network the solver runs on */
+    CSRGraph csr;
+    /* @brief What the solver reported for the last schedule (augmenting paths or bids) */
+    MCMFResult result;
+    /* @brief The solver compute_schedule_on dispatches to, NULL for mcmf_schedule_solver */
+    const struct ScheduleSolver *solver;
+    /* @brief The solver that computed the last schedule */
+    const char *solved_by;
+    /* @brief The memory of the solvers that don't use the flow network */
+    Arena solver_arena;
+} ScheduleWorkspace;
+
+/**
+ * @brief A way of solving the VM to pCPU assignment compute_schedule_on can dispatch to.
+ *
+ * Every solver prices a placement like the flow network (schedule_total_cost) and
+ * finds one of its cheapest placements. A solver that only handles some states
+ * returns -1 for the others and compute_schedule_on falls back to the flow network.
+ */
+typedef struct ScheduleSolver {
+    const char *name;
+    /* @brief Places the vCPUs of the state in out, using the workspace's memory. 0 on success, -1 when it can't */
+    int (*solve)(ScheduleWorkspace *ws, const SystemState *state, Schedule *out);
+    /* @brief What the solver keeps between solves, found through ws->solver */
+    void *opaque;
+} ScheduleSolver;
+
+/**
+ * @brief Min cost max flow over the flow network (mcmf_solve_csr), for any state.
+ */
+extern const ScheduleSolver mcmf_schedule_solver;
+
+/**
+ * @brief Number of vCPUs of the VM (at least 1).
+ */
+int vm_nr_vcpus(const VM *vm);
+
+/**
+ * @brief The pCPU vCPU vcpu of the VM currently runs on.
+ */
+int vm_vcpu_pcpu(const VM *vm, int vcpu);
+
+/**
+ * @brief Number of VM -> pCPU edges per pCPU, one for each vCPU of the VM the pCPU can take.
+ */
+int vm_nr_pcpu_slots(const VM *vm);
+
+/**
+ * @brief The cost of moving a vCPU from pCPU id from_pcpu to pCPU id to_pcpu.
+ *
+ * 0 for the same pCPU, otherwise tiered by the distance in state->topology.
+ */
+int migration_cost(const SystemState *state, int from_pcpu, int to_pcpu);
+
+/**
+ * @brief The load part of the cost of pCPU pcpu_index: its utilization rate plus
+ * SMT_SIBLING_CONTENTION_PERCENT of its SMT siblings' utilization.
+ *
+ * A sampled utilization also gets LOAD_STDDEV_PERCENT of its standard deviation, up to its peak.
+ */
+int pcpu_load_cost(const SystemState *state, int pcpu_index);
+
+/**
+ * @brief pcpu_load_cost of every pCPU at once (load_costs has nr_pcpus entries).
+ */
+void pcpu_load_costs(const SystemState *state, int *load_costs);
+
+/**
+ * @brief The cost of running VM vm_index on pCPU pcpu_index (indexes into the system state).
+ * 
+ * Affinity (staying on the current pCPU) is free, moving costs migration_cost,
+ * and pcpu_load_cost is added on top.
+ */
+int vm_pcpu_cost(const SystemState *state, int vm_index, int pcpu_index);
+
+/**
+ * @brief The cost of placing one more vCPU of VM vm_index on pCPU pcpu_index when
+ * slot of its vCPUs are already there.
+ *
+ * Like vm_pcpu_cost, where affinity holds for as many vCPUs as the VM currently runs
+ * on the pCPU and a move is priced from the closest of its other vCPUs' pCPUs,
+ * plus VCPU_ANTI_AFFINITY_PENALTY for each vCPU already there. The cost
+ * grows with slot, so a min cost flow fills the slots in order.
+ */
+int vm_pcpu_slot_cost(const SystemState *state, int vm_index, int pcpu_index, int slot);
+
+/**
+ * @brief vm_pcpu_slot_cost with the pCPU's load cost already computed (by pcpu_load_costs).
+ */
+int vm_pcpu_slot_cost_with_load(const SystemState *state, int vm_index, int pcpu_index, int slot, int load_cost);
+
+/**
+ * @brief The convex pCPU -> Sink cost: MAX_VMS_PER_PCPU pieces of one vCPU, each ADDITION_VM_PENALTY dearer.
+ *
+ * Fills capacities and costs (MAX_VMS_PER_PCPU entries each) for graph_add_convex_edge.
+ */
+void pcpu_slot_costs(int *capacities, int *costs);
+
+/**
+ * @brief Fills in the vCPU assignment of a VM from the pCPU indexes its vCPUs got.
+ *
+ * pcpu_indexes holds one entry per assigned vCPU. vCPUs keep their current pCPU
+ * when it is in the list, the others take what is left in order.
+ */
+void schedule_place_vcpus(Schedule *schedule, const SystemState *state, int vm_index,
+                          const int *pcpu_indexes, int nr_placed);
+
+/**
+ * @brief The schedule that keeps every vCPU where it runs now.
+ *
+ * Its total_cost is schedule_total_cost, -1 when the current placement isn't feasible.
+ */
+Schedule current_schedule(const SystemState *state);
+
+/**
+ * @brief The cost the flow network gives the vCPU assignment of a schedule.
+ *
+ * @return The cost, or -1 when a vCPU is unassigned or on an unknown pCPU, or a
+ * pCPU has more than MAX_VMS_PER_PCPU vCPUs.
+ */
+int schedule_total_cost(const SystemState *state, const Schedule *schedule);
+
+/**
+ * @brief Number of vCPUs the schedule moves off their current pCPU.
+ */
+int schedule_nr_migrations(const SystemState *state, const Schedule *schedule);
+
+/**
+ * @brief Number of vCPUs of VM vm_index the schedule moves off their current pCPU.
+ */
+int vm_nr_migrations(const SystemState *state, const Schedule *schedule, int vm_index);
+
+/**
+ * @brief Computes the VM to pCPU assignment for the given system state.
+ * 
+ * Reuses one workspace across calls (not thread safe), solving with the solver
+ * set by schedule_set_solver.
+ */
 Schedule compute_schedule(const SystemState *state);
 
+/**
+ * @brief Same as compute_schedule but solves in the caller's workspace, with ws->solver.
+ *
+ * Calls on different workspaces can run on different threads at the same time.
+ */
+Schedule compute_schedule_on(ScheduleWorkspace *ws, const SystemState *state);
+
+/**
+ * @brief Picks the solver of compute_schedule, NULL for mcmf_schedule_solver.
+ */
+void schedule_set_solver(const ScheduleSolver *solver);
+
+/**
+ * @brief Frees the memory of a workspace.
+ */
+void schedule_workspace_destroy(ScheduleWorkspace *ws);
+
 void print_schedule(const Schedule *schedule, int nr_vms);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_backend.h"
+
+static double random_between(SimHypervisor *sim, double low, double high) {
+    return low + (high - low) * (rand_r(&sim->rng) / (double) RAND_MAX);
+}
+
+static void start_domain(SimHypervisor *sim, SimDomain *domain) {
+    memset(domain, 0, sizeof(SimDomain));
+    domain->id = sim->next_id++;
+    snprintf(domain->name, MAX_NAME_LEN, "vm%u", (unsigned int) domain->id % 100000);
+    domain->nr_vcpus = 1 + rand_r(&sim->rng) % sim->config.max_vcpus;
+    int low_pcpus = sim->config.nr_pcpus > 1 ? sim->config.nr_pcpus / 2 : 1;
+    for (int k = 0; k < domain->nr_vcpus; k++) {
+        domain->vcpu_pcpu[k] = rand_r(&sim->rng) % low_pcpus;
+        domain->demand[k] = random_between(sim, 10, 90);
+    }
+    domain->phase_ns = rand_r(&sim->rng) % (SIM_BURST_PERIOD_NS / 1000000) * 1000000;
+}
+
+int sim_init(SimHypervisor *sim, SimConfig config) {
+    if (config.nr_vms < 0 || config.nr_vms > MAX_VMS || config.nr_pcpus < 1 || config.nr_pcpus > MAX_PCPUS ||
+        config.max_vcpus < 1 || config.max_vcpus > MAX_VCPUS_PER_VM) {
+        fprintf(stderr, "Can't simulate %d VMs of up to %d vCPUs on %d pCPUs\n", config.nr_vms, config.max_vcpus, config.nr_pcpus);
+        return -1;
+    }
+    memset(sim, 0, sizeof(SimHypervisor));
+    sim->config = config;
+    sim->rng = config.seed;
+    sim->next_id = 1;
+    return sim_resize(sim, config.nr_vms);
+}
+
+int sim_resize(SimHypervisor *sim, int nr_vms) {
+    if (nr_vms < 0 || nr_vms > MAX_VMS) {
+        fprintf(stderr, "Can't simulate %d VMs\n", nr_vms);
+        return -1;
+    }
+    while (sim->nr_domains < nr_vms) {
+        start_domain(sim, &sim->domains[sim->nr_domains++]);
+    }
+    sim->nr_domains = nr_vms;
+    return 0;
+}
+
+/**
+ * @brief Moves every vCPU's demand one step along its load generator.
+ */
+static void step_loads(SimHypervisor *sim) {
+    for (int i = 0; i < sim->nr_domains; i++) {
+        SimDomain *domain = &sim->domains[i];
+        for (int k = 0; k < domain->nr_vcpus; k++) {
+            if (sim->config.load == SIM_LOAD_BURSTY) {
+                bool busy = (sim->clock_ns + domain->phase_ns) % SIM_BURST_PERIOD_NS < SIM_BURST_PERIOD_NS / 2;
+                domain->demand[k] = busy ? 90 : 5;
+            } else if (sim->config.load == SIM_LOAD_RANDOM_WALK) {
+                double demand = domain->demand[k] + random_between(sim, -2, 2);
+                domain->demand[k] = demand < 0 ? 0 : (demand > 100 ? 100 : demand);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Shares every pCPU between its vCPUs for step_ns, in proportion to their demand when it is oversubscribed.
+ */
+static void run_guests(SimHypervisor *sim, long long step_ns) {
+    static double pcpu_demand[MAX_PCPUS];
+    int nr_pcpus = sim->config.nr_pcpus;
+    for (int j = 0; j < nr_pcpus; j++) {
+        pcpu_demand[j] = 0;
+    }
+    for (int i = 0; i < sim->nr_domains; i++) {
+        const SimDomain *domain = &sim->domains[i];
+        for (int k = 0; k < domain->nr_vcpus; k++) {
+            pcpu_demand[domain->vcpu_pcpu[k]] += domain->demand[k];
+        }
+    }
+    for (int i = 0; i < sim->nr_domains; i++) {
+        SimDomain *domain = &sim->domains[i];
+        for (int k = 0; k < domain->nr_vcpus; k++) {
+            double demand = pcpu_demand[domain->vcpu_pcpu[k]];
+            double share = demand > 100 ? domain->demand[k] * 100 / demand : domain->demand[k];
+            domain->cpu_time += (unsigned long long) (share / 100 * step_ns);
+            sim->unmet_vcpu_ns += (domain->demand[k] - share) / 100 * step_ns;
+        }
+    }
+    for (int j = 0; j < nr_pcpus; j++) {
+        double busy = pcpu_demand[j] < 100 ? pcpu_demand[j] : 100;
+        sim->idle_ns[j] += (unsigned long long) ((100 - busy) / 100 * step_ns);
+    }
+}
+
+void sim_advance(SimHypervisor *sim, long long ns) {
+    while (ns > 0) {
+        long long step_ns = ns < SIM_STEP_NS ? ns : SIM_STEP_NS;
+        step_loads(sim);
+        run_guests(sim, step_ns);
+        sim->clock_ns += step_ns;
+        ns -= step_ns;
+    }
+}
+
+/**
+ * @brief Counts the RPCs and sleeps for their injected latency.
+ */
+static void make_rpcs(SimHypervisor *sim, int nr_rpcs) {
+    sim->nr_rpcs += nr_rpcs;
+    long long latency_ns = sim->config.rpc_latency_ns * nr_rpcs;
+    if (latency_ns > 0) {
+        struct timespec latency = { latency_ns / 1000000000LL, latency_ns % 1000000000LL };
+        nanosleep(&latency, NULL);
+        sim->rpc_ns += latency_ns;
+    }
+}
+
+static int sim_query_state(void *impl, SystemState *state) {
+    SimHypervisor *sim = impl;
+    make_rpcs(sim, 1 + sim->config.nr_pcpus);
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = sim->config.nr_pcpus;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].idle_ns = sim->idle_ns[j];
+    }
+    state->topology = sim->topology;
+    state->nr_vms = sim->nr_domains;
+    for (int i = 0; i < sim->nr_domains; i++) {
+        const SimDomain *domain = &sim->domains[i];
+        VM *vm = &state->vms[i];
+        memcpy(vm->name, domain->name, MAX_NAME_LEN);
+        vm->id = domain->id;
+        vm->nr_vcpus = domain->nr_vcpus;
+        memcpy(vm->vcpu_pcpu, domain->vcpu_pcpu, sizeof(int) * domain->nr_vcpus);
+        vm->current_pcpu = domain->vcpu_pcpu[0];
+        vm->cpu_time = domain->cpu_time;
+    }
+    return 0;
+}
+
+static int sim_apply_pinning(void *impl, const SystemState *state, const Schedule *schedule) {
+    SimHypervisor *sim = impl;
+    int nr_rpcs = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        /* The state may be older than the host, a domain that stopped since can't be pinned */
+        SimDomain *domain = i < sim->nr_domains && sim->domains[i].id == state->vms[i].id ? &sim->domains[i] : NULL;
+        for (int d = 0; d < sim->nr_domains && domain == NULL; d++) {
+            domain = sim->domains[d].id == state->vms[i].id ? &sim->domains[d] : NULL;
+        }
+        for (int k = 0; domain != NULL && k < domain->nr_vcpus; k++) {
+            int pcpu_id = schedule->vcpu_to_pcpu[i][k];
+            if (pcpu_id >= 0 && pcpu_id < sim->config.nr_pcpus && pcpu_id != domain->vcpu_pcpu[k]) {
+                domain->vcpu_pcpu[k] = pcpu_id;
+                nr_rpcs++;
+            }
+        }
+    }
+    make_rpcs(sim, nr_rpcs);
+    return nr_rpcs;
+}
+
+static const VirtBackendOps sim_ops = {
+    .name = "simulated",
+    .query_state = sim_query_state,
+    .apply_pinning = sim_apply_pinning,
+};
+
+VirtBackend sim_backend(SimHypervisor *sim) {
+    VirtBackend backend = { .ops = &sim_ops, .impl = sim };
+    return backend;
+}
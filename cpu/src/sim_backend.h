@@ -0,0 +1,82 @@
+#ifndef SIM_BACKEND_H
+#define SIM_BACKEND_H
+
+#include "vm_types.h"
+#include "virt_backend.h"
+
+// The load generators change the demand this often
+#define SIM_STEP_NS 10000000LL
+// Period of a SIM_LOAD_BURSTY VM, busy the first half
+#define SIM_BURST_PERIOD_NS 4000000000LL
+
+typedef enum {
+    SIM_LOAD_STEADY,       // Every vCPU keeps a demand drawn from [10%, 90%]
+    SIM_LOAD_BURSTY,       // Every vCPU switches between 90% and 5%, each VM at its own phase
+    SIM_LOAD_RANDOM_WALK,  // Every vCPU's demand moves up to 2% per step within [0%, 100%]
+} SimLoad;
+
+typedef struct {
+    int          nr_vms;
+    int          nr_pcpus;
+    int          max_vcpus;       // Every VM gets 1 to max_vcpus vCPUs
+    SimLoad      load;
+    long long    rpc_latency_ns;  // Slept for every RPC, 0 for none
+    unsigned int seed;
+} SimConfig;
+
+typedef struct {
+    int                id;
+    char               name[MAX_NAME_LEN];
+    int                nr_vcpus;
+    int                vcpu_pcpu[MAX_VCPUS_PER_VM];
+    double             demand[MAX_VCPUS_PER_VM];  // Percent of a pCPU
+    long long          phase_ns;
+    unsigned long long cpu_time;
+} SimDomain;
+
+/**
+ * @brief An in-process host whose guests burn CPU time as their load generators ask.
+ *
+ * The vCPUs on a pCPU share it in proportion to their demand, so stacking busy
+ * vCPUs shows up as lost CPU time, the way it does on a real host. Time only
+ * passes in sim_advance, which keeps runs deterministic.
+ */
+typedef struct {
+    SimConfig          config;
+    SimDomain          domains[MAX_VMS];
+    int                nr_domains;
+    int                next_id;
+    unsigned long long idle_ns[MAX_PCPUS];
+    CPUTopology        topology;         // Unknown (all zero) unless a test fills it
+    long long          clock_ns;
+    unsigned int       rng;
+    int                nr_rpcs;
+    long long          rpc_ns;           // Latency injected so far
+    double             unmet_vcpu_ns;    // CPU time the vCPUs wanted and didn't get
+} SimHypervisor;
+
+/**
+ * @brief Starts config.nr_vms domains, with their vCPUs on the lower half of the pCPUs.
+ *
+ * @return 0 on success, -1 when the config doesn't fit MAX_VMS, MAX_PCPUS or MAX_VCPUS_PER_VM
+ */
+int sim_init(SimHypervisor *sim, SimConfig config);
+
+/**
+ * @brief Starts or stops domains until nr_vms run. New domains get new IDs, the last ones stop first.
+ */
+int sim_resize(SimHypervisor *sim, int nr_vms);
+
+/**
+ * @brief Runs the guests for ns nanoseconds of simulated time.
+ */
+void sim_advance(SimHypervisor *sim, long long ns);
+
+/**
+ * @brief The backend that queries and pins the simulated host.
+ *
+ * A query costs one RPC for the domain stats and one per pCPU, a pin one RPC per vCPU moved.
+ */
+VirtBackend sim_backend(SimHypervisor *sim);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "simulator.h"
+#include "tick_schedule.h"
+
+void simulator_init(CPUSimulator *sim, ReplayOptions options) {
+    memset(sim, 0, sizeof(CPUSimulator));
+    sim->options = options;
+    vm_table_clear(&sim->vm_slots);
+    stabilizer_init(&sim->stabilizer, stability_default_policy());
+    sim->stabilizer.placement = options.placement;
+}
+
+/**
+ * @brief Puts the VMs of the state where the simulated host runs them. VMs seen for the first time keep their recorded pCPUs.
+ */
+static int place_vms(CPUSimulator *sim, SystemState *state) {
+    static VMTable vm_slots;
+    static int vcpu_pcpu[MAX_VMS][MAX_VCPUS_PER_VM];
+    static int nr_vcpus[MAX_VMS];
+    /* Only the VMs of this state keep a slot */
+    vm_table_clear(&vm_slots);
+    for (int i = 0; i < state->nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        int slot = vm_table_get(&sim->vm_slots, vm->id);
+        nr_vcpus[i] = vm_nr_vcpus(vm);
+        for (int k = 0; k < nr_vcpus[i]; k++) {
+            bool known = slot >= 0 && k < sim->nr_vcpus[slot];
+            vcpu_pcpu[i][k] = known ? sim->vcpu_pcpu[slot][k] : vm_vcpu_pcpu(vm, k);
+            if (vm->nr_vcpus > 1) {
+                vm->vcpu_pcpu[k] = vcpu_pcpu[i][k];
+            }
+        }
+        vm->current_pcpu = vcpu_pcpu[i][0];
+        if (vm_table_put(&vm_slots, vm->id, i) < 0) {
+            fprintf(stderr, "Failed to track VM %d\n", vm->id);
+            return -1;
+        }
+    }
+    sim->vm_slots = vm_slots;
+    memcpy(sim->vcpu_pcpu, vcpu_pcpu, sizeof(int) * MAX_VCPUS_PER_VM * state->nr_vms);
+    memcpy(sim->nr_vcpus, nr_vcpus, sizeof(int) * state->nr_vms);
+    return 0;
+}
+
+/**
+ * @brief Adds up the demand of the vCPUs on each pCPU, each vCPU taking an even share of its VM's usage.
+ */
+static void pcpu_demand(const SystemState *state, double *demand) {
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        demand[j] = 0;
+    }
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int nr_vcpus = vm_nr_vcpus(vm);
+        double usage = vm->cpu_usage_rate > 0 ? vm->cpu_usage_rate : 0;
+        for (int k = 0; k < nr_vcpus; k++) {
+            for (int j = 0; j < state->nr_pcpus; j++) {
+                if (state->pcpus[j].id == vm_vcpu_pcpu(vm, k)) {
+                    demand[j] += usage / nr_vcpus;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static bool same_placement(const SystemState *state, const Schedule *a, const Schedule *b) {
+    for (int i = 0; i < state->nr_vms; i++) {
+        for (int k = 0; k < vm_nr_vcpus(&state->vms[i]); k++) {
+            if (a->vcpu_to_pcpu[i][k] != b->vcpu_to_pcpu[i][k]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int simulator_tick(CPUSimulator *sim, const SystemState *recorded_state, const Schedule *recorded) {
+    static SystemState state;
+    static Schedule schedule;
+    static double demand[MAX_PCPUS];
+    ReplayStats *stats = &sim->stats;
+    state = *recorded_state;
+    bool closed_loop = sim->options.mode == REPLAY_CLOSED_LOOP;
+    if (closed_loop && place_vms(sim, &state) < 0) {
+        return -1;
+    }
+
+    /* The load the placement puts on the host */
+    pcpu_demand(&state, demand);
+    double sum = 0;
+    double sum_squares = 0;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        double utilization = demand[j] < 100 ? demand[j] : 100;
+        if (demand[j] > 100) {
+            stats->nr_overloaded++;
+            stats->unmet_demand += demand[j] - 100;
+        }
+        if (closed_loop) {
+            state.pcpus[j].utilization_rate = utilization;
+            state.pcpus[j].utilization_peak = utilization;
+            state.pcpus[j].utilization_stddev = 0;
+        }
+        sum += utilization;
+        sum_squares += utilization * utilization;
+    }
+    if (state.nr_pcpus > 0) {
+        double mean = sum / state.nr_pcpus;
+        double variance = sum_squares / state.nr_pcpus - mean * mean;
+        stats->imbalance += variance > 0 ? sqrt(variance) : 0;
+    }
+    stats->nr_ticks++;
+    if (state.nr_vms == 0) {
+        return 0;
+    }
+
+    long long start_ns = tick_now_ns();
+    if (!sim->options.stable) {
+        schedule = sim->options.placement == PLACE_BY_DEMAND ? compute_demand_schedule(&state) : compute_schedule(&state);
+    } else if (stable_schedule(&sim->stabilizer, NULL, &state, &schedule) < 0) {
+        return -1;
+    }
+    stats->solve_ns += tick_now_ns() - start_ns;
+    stats->nr_decisions++;
+    stats->nr_migrations += schedule_nr_migrations(&state, &schedule);
+    if (recorded != NULL && !same_placement(&state, &schedule, recorded)) {
+        stats->nr_differences++;
+    }
+
+    /* The host runs the vCPUs where they were scheduled */
+    for (int i = 0; i < state.nr_vms && closed_loop; i++) {
+        for (int k = 0; k < vm_nr_vcpus(&state.vms[i]); k++) {
+            if (schedule.vcpu_to_pcpu[i][k] >= 0) {
+                sim->vcpu_pcpu[i][k] = schedule.vcpu_to_pcpu[i][k];
+            }
+        }
+    }
+    return 0;
+}
+
+int simulator_replay(CPUSimulator *sim, TraceReader *reader) {
+    static SystemState states[2];
+    static Schedule recorded;
+    SystemState *state = &states[0];
+    SystemState *next = &states[1];
+    bool has_state = false;
+    for (;;) {
+        int type = trace_read(reader, next, &recorded);
+        if (type < 0) {
+            return -1;
+        }
+        if (type == TRACE_SCHEDULE) {
+            if (has_state && simulator_tick(sim, state, &recorded) < 0) {
+                return -1;
+            }
+            has_state = false;
+            continue;
+        }
+        /* A state without a schedule (the first tick, or a failed one) */
+        if (has_state && simulator_tick(sim, state, NULL) < 0) {
+            return -1;
+        }
+        if (type == 0) {
+            return 0;
+        }
+        SystemState *swap = state;
+        state = next;
+        next = swap;
+        has_state = true;
+    }
+}
+
+void print_replay_stats(const ReplayStats *stats) {
+    printf("Ticks: %d, decisions: %d\n", stats->nr_ticks, stats->nr_decisions);
+    printf("Migrations: %d\n", stats->nr_migrations);
+    printf("Decisions unlike the recorded ones: %d\n", stats->nr_differences);
+    printf("Overloaded pCPU ticks: %d, unmet demand: %.1f%%\n", stats->nr_overloaded, stats->unmet_demand);
+    printf("Mean pCPU imbalance (stddev): %.2f%%\n", stats->nr_ticks > 0 ? stats->imbalance / stats->nr_ticks : 0);
+    printf("Scheduler time: %.3f ms\n", stats->solve_ns / 1e6);
+}
@@ -0,0 +1,76 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "vm_table.h"
+#include "scheduler.h"
+#include "stability.h"
+#include "trace.h"
+
+/**
+ * @brief How a trace is fed to the scheduler.
+ *
+ * Open loop replays every recorded state as it was and compares the decisions
+ * with the recorded ones. Closed loop keeps each VM's recorded CPU demand but
+ * places the VMs where the scheduler put them, and derives the pCPU
+ * utilization from that placement.
+ */
+typedef enum {
+    REPLAY_OPEN_LOOP,
+    REPLAY_CLOSED_LOOP,
+} ReplayMode;
+
+typedef struct {
+    ReplayMode mode;
+    bool       stable;          // Schedule through stable_schedule with the default policy
+    PlacementMode placement;
+} ReplayOptions;
+
+/**
+ * @brief What a replay measured. Everything but solve_ns is deterministic.
+ */
+typedef struct {
+    int       nr_ticks;         // States replayed
+    int       nr_decisions;     // Schedules computed (ticks with VMs)
+    int       nr_migrations;    // vCPUs moved off their pCPU
+    int       nr_differences;   // Open loop: decisions unlike the recorded schedule
+    int       nr_overloaded;    // pCPU ticks with more demand than 100%
+    double    unmet_demand;     // Demand over 100% summed over the pCPU ticks, in percent
+    double    imbalance;        // Standard deviation of the pCPU utilization, averaged over the ticks
+    long long solve_ns;         // Time spent in the scheduler
+} ReplayStats;
+
+/**
+ * @brief The simulated host: where every vCPU of the VMs of the last tick runs.
+ */
+typedef struct {
+    ReplayOptions options;
+    VMTable       vm_slots;                                 // Domain ID -> index into vcpu_pcpu
+    int           vcpu_pcpu[MAX_VMS][MAX_VCPUS_PER_VM];
+    int           nr_vcpus[MAX_VMS];
+    Stabilizer    stabilizer;
+    ReplayStats   stats;
+} CPUSimulator;
+
+void simulator_init(CPUSimulator *sim, ReplayOptions options);
+
+/**
+ * @brief Runs one recorded state through the scheduler (closed loop: on the simulated host).
+ *
+ * recorded is the schedule recorded for the state, NULL when there is none.
+ *
+ * @return 0 on success, -1 when the scheduler fails or there are more than MAX_VMS VMs.
+ */
+int simulator_tick(CPUSimulator *sim, const SystemState *state, const Schedule *recorded);
+
+/**
+ * @brief Replays every state of the trace through simulator_tick.
+ *
+ * @return 0 on success, -1 on a malformed trace or a failed tick.
+ */
+int simulator_replay(CPUSimulator *sim, TraceReader *reader);
+
+void print_replay_stats(const ReplayStats *stats);
+
+#endif
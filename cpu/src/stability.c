@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include "stability.h"
+#include "tick_schedule.h"
+
+/* Past this extra move penalty only the moves that have to happen are left */
+#define MAX_BUDGET_MOVE_PENALTY COOLDOWN_MOVE_PENALTY
+
+void stabilizer_init(Stabilizer *stabilizer, StabilityPolicy policy) {
+    memset(stabilizer, 0, sizeof(Stabilizer));
+    stabilizer->policy = policy;
+    vm_table_clear(&stabilizer->last_move);
+}
+
+void stabilizer_destroy(Stabilizer *stabilizer) {
+    schedule_workspace_destroy(&stabilizer->workspace);
+}
+
+StabilityPolicy stability_default_policy(void) {
+    StabilityPolicy policy = {
+        .min_improvement = STABILITY_MIN_IMPROVEMENT,
+        .max_migrations = STABILITY_MAX_MIGRATIONS,
+        .cooldown_ticks = STABILITY_COOLDOWN_TICKS,
+    };
+    return policy;
+}
+
+/**
+ * @brief The cost of a schedule under the stabilizer's placement mode.
+ */
+static int placement_cost(const Stabilizer *stabilizer, const SystemState *state, const Schedule *schedule) {
+    if (stabilizer->placement == PLACE_BY_DEMAND) {
+        return demand_schedule_total_cost(state, schedule);
+    }
+    return schedule_total_cost(state, schedule);
+}
+
+static bool is_cooling(const Stabilizer *stabilizer, int id) {
+    int moved_tick = vm_table_get(&stabilizer->last_move, id);
+    return moved_tick >= 0 && stabilizer->tick - moved_tick <= stabilizer->policy.cooldown_ticks;
+}
+
+/**
+ * @brief Solves for the state with budget_penalty on every move of a VM that isn't cooling down.
+ */
+static int solve(Stabilizer *stabilizer, IncrementalScheduler *scheduler, int budget_penalty, Schedule *out) {
+    SystemState *penalized_state = &stabilizer->penalized_state;
+    for (int i = 0; i < penalized_state->nr_vms; i++) {
+        penalized_state->vms[i].move_penalty = stabilizer->cooling[i] ? COOLDOWN_MOVE_PENALTY : budget_penalty;
+    }
+    stabilizer->stats.nr_solves++;
+    if (stabilizer->placement == PLACE_BY_DEMAND) {
+        *out = compute_demand_schedule_on(&stabilizer->workspace, penalized_state);
+        return 0;
+    }
+    if (stabilizer->solver != NULL) {
+        stabilizer->workspace.solver = stabilizer->solver;
+        *out = compute_schedule_on(&stabilizer->workspace, penalized_state);
+        return 0;
+    }
+    if (scheduler == NULL) {
+        *out = compute_schedule(penalized_state);
+        return 0;
+    }
+    if (incremental_schedule_until(scheduler, penalized_state, stabilizer->deadline_ns, out) < 0) {
+        return -1;
+    }
+    stabilizer->stats.optimal = stabilizer->stats.optimal && scheduler->stats.optimal;
+    return 0;
+}
+
+/**
+ * @brief Takes the placement of VMs that move in over into within, while they
+ * fit the budget and each lowers the cost.
+ *
+ * VMs with the same load and distance get the same penalty, so they all move at
+ * the same one and within can be well under the budget.
+ */
+static void fill_budget(const Stabilizer *stabilizer, const SystemState *state, const Schedule *over, Schedule *within,
+                        int max_migrations) {
+    int nr_migrations = schedule_nr_migrations(state, within);
+    int cost = placement_cost(stabilizer, state, within);
+    for (int i = 0; i < state->nr_vms && nr_migrations < max_migrations && cost >= 0; i++) {
+        int nr_vm_migrations = vm_nr_migrations(state, over, i);
+        int nr_added = nr_vm_migrations - vm_nr_migrations(state, within, i);
+        if (nr_vm_migrations == 0 || nr_added <= 0 || nr_migrations + nr_added > max_migrations) {
+            continue;
+        }
+        int placement[MAX_VCPUS_PER_VM];
+        memcpy(placement, within->vcpu_to_pcpu[i], sizeof(placement));
+        memcpy(within->vcpu_to_pcpu[i], over->vcpu_to_pcpu[i], sizeof(placement));
+        within->vm_to_pcpu[i] = over->vm_to_pcpu[i];
+        int new_cost = placement_cost(stabilizer, state, within);
+        if (new_cost >= 0 && new_cost < cost) {
+            cost = new_cost;
+            nr_migrations += nr_added;
+        } else {
+            memcpy(within->vcpu_to_pcpu[i], placement, sizeof(placement));
+            within->vm_to_pcpu[i] = placement[0];
+        }
+    }
+}
+
+/**
+ * @brief Raises the move penalty until the schedule moves at most max_migrations vCPUs.
+ *
+ * The number of moves only goes down as the penalty goes up, so this bisects
+ * for the smallest penalty within the budget and fills what is left of the
+ * budget from the schedule just over it. When even MAX_BUDGET_MOVE_PENALTY is
+ * over the budget, the moves left have to happen and schedule gets those.
+ * A solve cut short by the deadline ends the bisection where it is.
+ */
+static int fit_budget(Stabilizer *stabilizer, IncrementalScheduler *scheduler, const SystemState *state,
+                      Schedule *schedule) {
+    Schedule *candidate = &stabilizer->candidate;
+    Schedule *over = &stabilizer->over;
+    int max_migrations = stabilizer->policy.max_migrations;
+    int low = 0;
+    int high = MAX_BUDGET_MOVE_PENALTY;
+    *over = *schedule;
+    if (solve(stabilizer, scheduler, high, schedule) < 0) {
+        return -1;
+    }
+    if (schedule_nr_migrations(state, schedule) <= max_migrations) {
+        while (high - low > 1 && stabilizer->stats.optimal) {
+            int middle = low + (high - low) / 2;
+            if (solve(stabilizer, scheduler, middle, candidate) < 0) {
+                return -1;
+            }
+            if (schedule_nr_migrations(state, candidate) <= max_migrations) {
+                high = middle;
+                *schedule = *candidate;
+            } else {
+                low = middle;
+                *over = *candidate;
+            }
+        }
+        fill_budget(stabilizer, state, over, schedule, max_migrations);
+    }
+    stabilizer->stats.budget_penalty = high;
+    return 0;
+}
+
+int stable_schedule(Stabilizer *stabilizer, IncrementalScheduler *scheduler, const SystemState *state, Schedule *out) {
+    bool *cooling = stabilizer->cooling;
+    Schedule *current = &stabilizer->current;
+    VMTable *next_move = &stabilizer->next_move;
+    const StabilityPolicy *policy = &stabilizer->policy;
+    memset(&stabilizer->stats, 0, sizeof(StabilityStats));
+    stabilizer->stats.optimal = true;
+    stabilizer->tick++;
+    stabilizer->deadline_ns = policy->solve_budget_ns > 0 ? tick_now_ns() + policy->solve_budget_ns : 0;
+
+    stabilizer->penalized_state = *state;
+    for (int i = 0; i < state->nr_vms; i++) {
+        cooling[i] = is_cooling(stabilizer, state->vms[i].id);
+        stabilizer->stats.nr_cooling += cooling[i];
+    }
+    if (solve(stabilizer, scheduler, 0, out) < 0) {
+        return -1;
+    }
+    if (policy->max_migrations > 0 && schedule_nr_migrations(state, out) > policy->max_migrations &&
+        fit_budget(stabilizer, scheduler, state, out) < 0) {
+        return -1;
+    }
+
+    /* Both placements priced without the extra penalties */
+    int cost = placement_cost(stabilizer, state, out);
+    if (cost >= 0) {
+        out->total_cost = cost;
+    }
+    *current = current_schedule(state);
+    current->total_cost = placement_cost(stabilizer, state, current);
+    stabilizer->stats.improvement = -1;
+    if (current->total_cost >= 0 && cost >= 0) {
+        stabilizer->stats.improvement = current->total_cost - cost;
+        if (stabilizer->stats.improvement < policy->min_improvement && schedule_nr_migrations(state, out) > 0) {
+            *out = *current;
+            stabilizer->stats.kept_current = true;
+        }
+    }
+    stabilizer->stats.nr_migrations = schedule_nr_migrations(state, out);
+
+    /* Only VMs in the state that are still cooling down stay in the table */
+    vm_table_clear(next_move);
+    for (int i = 0; i < state->nr_vms; i++) {
+        int id = state->vms[i].id;
+        if (vm_nr_migrations(state, out, i) > 0) {
+            vm_table_put(next_move, id, stabilizer->tick);
+        } else if (cooling[i]) {
+            vm_table_put(next_move, id, vm_table_get(&stabilizer->last_move, id));
+        }
+    }
+    stabilizer->last_move = *next_move;
+    return 0;
+}
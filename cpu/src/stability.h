@@ -0,0 +1,113 @@
+#ifndef STABILITY_H
+#define STABILITY_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "vm_table.h"
+#include "scheduler.h"
+#include "incremental_scheduler.h"
+#include "demand_scheduler.h"
+
+/* A new schedule has to beat staying put by a tenth of a busy pCPU */
+#define STABILITY_MIN_IMPROVEMENT 10
+/* vCPU moves per tick */
+#define STABILITY_MAX_MIGRATIONS 4
+/* Ticks a VM stays where it was moved to */
+#define STABILITY_COOLDOWN_TICKS 2
+/**
+ * Move penalty of a VM in its cooldown. Larger than any load difference, so it
+ * only moves when there is no room left where it is.
+ */
+#define COOLDOWN_MOVE_PENALTY 1000
+
+/**
+ * @brief How much churn the stabilizer lets through. 0 or less turns a control off.
+ */
+typedef struct {
+    int min_improvement;    // Cost a new schedule has to save over keeping the current placement
+    int max_migrations;     // vCPU moves per tick
+    int cooldown_ticks;     // Ticks after a move before the VM may move again
+    long long solve_budget_ns;  // Time the incremental solves of a tick get together
+} StabilityPolicy;
+
+/**
+ * @brief What the last stable_schedule call decided.
+ */
+typedef struct {
+    bool kept_current;      // The new schedule didn't save min_improvement
+    int  improvement;       // Cost of the current placement minus the new one's, -1 when the current one isn't feasible
+    int  nr_migrations;
+    int  nr_cooling;        // VMs held by their cooldown
+    int  budget_penalty;    // Move penalty it took to stay within max_migrations
+    int  nr_solves;
+    bool optimal;           // Every solve finished before the solve budget ran out
+} StabilityStats;
+
+/**
+ * @brief Hysteresis on top of the min cost flow schedule.
+ *
+ * The flow network finds the cheapest schedule for one tick, so a small change
+ * in utilization can move VMs back and forth. The stabilizer prices moves so
+ * that only worthwhile ones happen:
+ *
+ * - A VM moved less than cooldown_ticks ago gets COOLDOWN_MOVE_PENALTY on every move.
+ * - When the schedule moves more than max_migrations vCPUs, every other VM gets
+ *   the smallest extra move penalty that brings the moves within the budget
+ *   (found by bisection), so the moves that save the most go first.
+ * - The result is only taken when it costs min_improvement less than keeping
+ *   the current placement, both priced without the extra penalties.
+ *
+ * A current placement that isn't feasible (new VMs, full pCPUs) always gets the
+ * new schedule, so the budget and cooldown give way when VMs have to move.
+ *
+ * With PLACE_BY_DEMAND the schedules come from compute_demand_schedule and are
+ * priced with demand_schedule_total_cost.
+ *
+ * With a solve_budget_ns the incremental solves stop at the tick's deadline with
+ * the best schedule found so far, and the bisection stops with them. The other
+ * solvers always run to the end.
+ *
+ * Start from stabilizer_init and free with stabilizer_destroy.
+ */
+typedef struct {
+    StabilityPolicy policy;
+    PlacementMode   placement;      // PLACE_VCPU_SLOTS after stabilizer_init
+    const ScheduleSolver *solver;   // NULL solves incrementally, else from scratch with this solver every tick
+    ScheduleWorkspace workspace;    // The memory of the solver and of the demand placement
+    int             tick;
+    long long       deadline_ns;    // Of the solves of the current tick (tick_now_ns), 0 for none
+    VMTable         last_move;      // Domain ID -> tick of its last move, only for VMs still cooling down
+    StabilityStats  stats;
+    /* Scratch space of stable_schedule, too large for the stack */
+    SystemState     penalized_state;    // The state the schedules are solved for, with the move penalties of the tick
+    bool            cooling[MAX_VMS];   // By VM index of the tick's state
+    Schedule        current;
+    Schedule        candidate;          // Of the budget bisection
+    Schedule        over;               // Last schedule of the bisection over the budget
+    VMTable         next_move;          // last_move of the next tick
+} Stabilizer;
+
+void stabilizer_init(Stabilizer *stabilizer, StabilityPolicy policy);
+
+/**
+ * @brief Frees the memory of the stabilizer's solver.
+ */
+void stabilizer_destroy(Stabilizer *stabilizer);
+
+/**
+ * @brief The default policy, from the STABILITY_* constants.
+ */
+StabilityPolicy stability_default_policy(void);
+
+/**
+ * @brief Computes the schedule for the tick and decides which of its moves happen.
+ *
+ * Solves with the incremental scheduler, or with compute_schedule when scheduler
+ * is NULL, or with the stabilizer's solver when it has one, or with
+ * compute_demand_schedule when placing by demand. Not thread safe.
+ *
+ * @return 0 on success, -1 when the scheduler fails.
+ */
+int stable_schedule(Stabilizer *stabilizer, IncrementalScheduler *scheduler, const SystemState *state, Schedule *out);
+
+#endif
@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_types.h"
+#include "scheduler.h"
+#include "auction.h"
+#include "stability.h"
+#include "topology.h"
+
+/* Too big for the stack */
+static SystemState state;
+
+/**
+ * @brief Random single vCPU VMs on random pCPUs, some of them reluctant to move.
+ */
+static void setup_random_state(int nr_vms, int nr_pcpus) {
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = nr_pcpus;
+    for (int j = 0; j < nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+        state.pcpus[j].utilization_rate = rand() % 100;
+    }
+    state.nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        state.vms[i].id = i + 1;
+        state.vms[i].current_pcpu = rand() % nr_pcpus;
+        state.vms[i].move_penalty = rand() % 4 == 0 ? rand() % 60 : 0;
+    }
+}
+
+static void test_auction_matches_mcmf_on_random_states() {
+    static ScheduleWorkspace flow;
+    static ScheduleWorkspace auction;
+    auction.solver = &auction_schedule_solver;
+    srand(6230);
+    for (int round = 0; round < 300; round++) {
+        int nr_pcpus = 1 + rand() % 40;
+        setup_random_state(1 + rand() % (nr_pcpus * MAX_VMS_PER_PCPU), nr_pcpus);
+        Schedule expected = compute_schedule_on(&flow, &state);
+        Schedule schedule = compute_schedule_on(&auction, &state);
+        assert(strcmp(auction.solved_by, "auction") == 0);
+        assert(schedule.num_assigned == state.nr_vms);
+        assert(schedule.total_cost == schedule_total_cost(&state, &schedule));
+        assert(schedule.total_cost == expected.total_cost);
+        assert(auction.result.total_cost == expected.total_cost && auction.result.nr_augmentations >= state.nr_vms);
+    }
+    schedule_workspace_destroy(&flow);
+    schedule_workspace_destroy(&auction);
+
+    printf("PASS test_auction_matches_mcmf_on_random_states\n");
+}
+
+static void test_auction_matches_mcmf_on_dual_socket_host() {
+    static ScheduleWorkspace flow;
+    static ScheduleWorkspace auction;
+    auction.solver = &auction_schedule_solver;
+    srand(6231);
+    for (int round = 0; round < 20; round++) {
+        setup_random_state(40 + rand() % 25, 32);
+        FILE *file = fopen("topology_dual_socket.lscpu", "r");
+        assert(file != NULL);
+        assert(topology_parse_lscpu(&state.topology, file) == 0);
+        fclose(file);
+        Schedule expected = compute_schedule_on(&flow, &state);
+        Schedule schedule = compute_schedule_on(&auction, &state);
+        assert(strcmp(auction.solved_by, "auction") == 0);
+        assert(schedule.total_cost == expected.total_cost);
+    }
+    schedule_workspace_destroy(&flow);
+    schedule_workspace_destroy(&auction);
+
+    printf("PASS test_auction_matches_mcmf_on_dual_socket_host\n");
+}
+
+static void test_simd_matches_scalar() {
+    static ScheduleWorkspace ws;
+    ws.solver = &auction_schedule_solver;
+    if (!auction_simd_active()) {
+        printf("SKIP test_simd_matches_scalar (no AVX2)\n");
+        return;
+    }
+    srand(6232);
+    for (int round = 0; round < 50; round++) {
+        /* Columns that don't fill the last vector too */
+        int nr_pcpus = 1 + rand() % 67;
+        setup_random_state(1 + rand() % (nr_pcpus * MAX_VMS_PER_PCPU), nr_pcpus);
+        Schedule simd = compute_schedule_on(&ws, &state);
+        int simd_bids = ws.result.nr_augmentations;
+        auction_set_simd(false);
+        assert(!auction_simd_active());
+        Schedule scalar = compute_schedule_on(&ws, &state);
+        auction_set_simd(true);
+        /* Same bids in the same order */
+        assert(ws.result.nr_augmentations == simd_bids);
+        assert(memcmp(simd.vm_to_pcpu, scalar.vm_to_pcpu, sizeof(int) * state.nr_vms) == 0);
+        assert(simd.total_cost == scalar.total_cost);
+    }
+    schedule_workspace_destroy(&ws);
+
+    printf("PASS test_simd_matches_scalar\n");
+}
+
+static void test_falls_back_to_mcmf() {
+    static ScheduleWorkspace ws;
+    ws.solver = &auction_schedule_solver;
+    srand(6233);
+
+    /* A VM with two vCPUs */
+    setup_random_state(6, 4);
+    state.vms[2].nr_vcpus = 2;
+    state.vms[2].vcpu_pcpu[0] = 1;
+    state.vms[2].vcpu_pcpu[1] = 3;
+    Schedule schedule = compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "mcmf") == 0);
+    assert(schedule.num_assigned == 7);
+
+    /* More VMs than pCPU slots */
+    setup_random_state(9, 4);
+    schedule = compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "mcmf") == 0);
+    assert(schedule.num_assigned == 8);
+
+    /* Costs too large to scale */
+    setup_random_state(4, 4);
+    state.vms[0].move_penalty = AUCTION_MAX_SCALED_COST;
+    schedule = compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "mcmf") == 0);
+    assert(schedule.num_assigned == 4);
+
+    setup_random_state(4, 4);
+    compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "auction") == 0);
+    schedule_workspace_destroy(&ws);
+
+    printf("PASS test_falls_back_to_mcmf\n");
+}
+
+static void test_compute_schedule_uses_the_set_solver() {
+    srand(6234);
+    setup_random_state(100, 64);
+    Schedule flow = compute_schedule(&state);
+    schedule_set_solver(&auction_schedule_solver);
+    Schedule auction = compute_schedule(&state);
+    schedule_set_solver(NULL);
+    assert(auction.total_cost == flow.total_cost);
+    assert(auction.num_assigned == 100);
+
+    printf("PASS test_compute_schedule_uses_the_set_solver\n");
+}
+
+static void test_stabilizer_solves_with_the_auction() {
+    Schedule schedule;
+    static Stabilizer stabilizer;
+    stabilizer_init(&stabilizer, stability_default_policy());
+    stabilizer.solver = &auction_schedule_solver;
+
+    /* A VM on a full pCPU next to an idle one */
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 2;
+    state.pcpus[0].id = 0;
+    state.pcpus[0].utilization_rate = 100;
+    state.pcpus[1].id = 1;
+    state.nr_vms = 1;
+    state.vms[0].id = 1;
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.vm_to_pcpu[0] == 1);
+    assert(schedule.total_cost == MIGRATION_PENALTY);
+    assert(stabilizer.stats.nr_migrations == 1);
+    stabilizer_destroy(&stabilizer);
+
+    printf("PASS test_stabilizer_solves_with_the_auction\n");
+}
+
+int main(void) {
+    printf("Running auction tests ...\n\n");
+
+    test_auction_matches_mcmf_on_random_states();
+    test_auction_matches_mcmf_on_dual_socket_host();
+    test_simd_matches_scalar();
+    test_falls_back_to_mcmf();
+    test_compute_schedule_uses_the_set_solver();
+    test_stabilizer_solves_with_the_auction();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "control_loop.h"
+#include "sim_backend.h"
+
+#define PERIOD_NS 1000000000LL
+
+/* Too big for the stack */
+static SimHypervisor sim;
+static CPUControl control;
+
+static void test_sim_backend_burns_cpu_time() {
+    static SystemState state;
+    SimConfig config = { .nr_vms = 2, .nr_pcpus = 2, .max_vcpus = 1, .load = SIM_LOAD_STEADY, .seed = 1 };
+    assert(sim_init(&sim, config) == 0);
+    /* Both on pCPU 0, asking for 150% between them */
+    sim.domains[0].demand[0] = 90;
+    sim.domains[1].demand[0] = 60;
+    VirtBackend backend = sim_backend(&sim);
+    sim_advance(&sim, PERIOD_NS);
+
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    assert(sim.nr_rpcs == 3);
+    assert(state.nr_vms == 2 && state.nr_pcpus == 2);
+    assert(state.vms[0].id == 1 && state.vms[1].id == 2);
+    assert(state.vms[0].current_pcpu == 0 && state.vms[1].current_pcpu == 0);
+    /* They share the pCPU in proportion to their demand */
+    assert(state.vms[0].cpu_time == 600000000ULL);
+    assert(state.vms[1].cpu_time == 400000000ULL);
+    assert(state.pcpus[0].idle_ns == 0);
+    assert(state.pcpus[1].idle_ns == PERIOD_NS);
+    assert(fabs(sim.unmet_vcpu_ns - 0.5 * PERIOD_NS) < 1);
+
+    /* A pin moves the vCPU, a pin to where it runs makes no RPC */
+    static Schedule schedule;
+    memset(&schedule, -1, sizeof(Schedule));
+    schedule.vcpu_to_pcpu[0][0] = 0;
+    schedule.vcpu_to_pcpu[1][0] = 1;
+    assert(backend.ops->apply_pinning(backend.impl, &state, &schedule) == 1);
+    assert(sim.domains[1].vcpu_pcpu[0] == 1);
+    sim_advance(&sim, PERIOD_NS);
+    assert(sim.domains[1].cpu_time == 1000000000ULL);
+    assert(fabs(sim.unmet_vcpu_ns - 0.5 * PERIOD_NS) < 1);
+
+    printf("PASS test_sim_backend_burns_cpu_time\n");
+}
+
+/**
+ * @brief Runs the control loop for nr_ticks periods and returns the CPU time the vCPUs didn't get in the last half.
+ */
+static double run_ticks(int nr_ticks, bool schedule) {
+    VirtBackend backend = sim_backend(&sim);
+    cpu_control_init(&control, PERIOD_NS);
+    double unmet_before = 0;
+    for (int t = 0; t < nr_ticks; t++) {
+        if (schedule) {
+            assert(cpu_control_tick(&control, &backend, sim.clock_ns) == 0);
+        }
+        if (t == nr_ticks / 2) {
+            unmet_before = sim.unmet_vcpu_ns;
+        }
+        sim_advance(&sim, PERIOD_NS);
+    }
+    cpu_control_destroy(&control);
+    return sim.unmet_vcpu_ns - unmet_before;
+}
+
+static void test_control_loop_spreads_stacked_vcpus() {
+    /* Every vCPU starts on the lower half of the pCPUs */
+    SimConfig config = { .nr_vms = 12, .nr_pcpus = 16, .max_vcpus = 2, .load = SIM_LOAD_STEADY, .seed = 16 };
+    assert(sim_init(&sim, config) == 0);
+    double unmet_unscheduled = run_ticks(20, false);
+    assert(sim_init(&sim, config) == 0);
+    double unmet_scheduled = run_ticks(20, true);
+    printf("Unmet CPU time: %.2f s unscheduled, %.2f s scheduled\n", unmet_unscheduled / 1e9, unmet_scheduled / 1e9);
+    assert(unmet_unscheduled > 0);
+    assert(unmet_scheduled < unmet_unscheduled / 2);
+    assert(control.stats.nr_ticks == 20);
+    assert(control.stats.nr_pin_rpcs > 0);
+    /* A quarter of the period is plenty for this host */
+    assert(control.stats.nr_cut_short == 0);
+
+    printf("PASS test_control_loop_spreads_stacked_vcpus\n");
+}
+
+static void test_control_loop_follows_domains_starting_and_stopping() {
+    SimConfig config = { .nr_vms = 6, .nr_pcpus = 8, .max_vcpus = 2, .load = SIM_LOAD_RANDOM_WALK, .seed = 17 };
+    assert(sim_init(&sim, config) == 0);
+    VirtBackend backend = sim_backend(&sim);
+    cpu_control_init(&control, PERIOD_NS);
+    static const int nr_vms[] = { 6, 6, 8, 3, 3, 7, 0, 0, 5, 5 };
+    for (int t = 0; t < 10; t++) {
+        assert(sim_resize(&sim, nr_vms[t]) == 0);
+        assert(cpu_control_tick(&control, &backend, sim.clock_ns) == 0);
+        assert(control.current.nr_vms == nr_vms[t]);
+        /* Sampled twice between ticks, like the daemon's probe */
+        sim_advance(&sim, PERIOD_NS / 2);
+        cpu_control_sample(&control, &backend, sim.clock_ns, 90);
+        sim_advance(&sim, PERIOD_NS / 2);
+    }
+    assert(control.stats.nr_ticks == 10);
+    /* The last domains were started after the host was empty, under new IDs */
+    assert(control.current.vms[0].id > 8);
+    cpu_control_destroy(&control);
+
+    printf("PASS test_control_loop_follows_domains_starting_and_stopping\n");
+}
+
+static void test_sim_backend_injects_rpc_latency() {
+    SimConfig config = { .nr_vms = 4, .nr_pcpus = 4, .max_vcpus = 1, .load = SIM_LOAD_BURSTY,
+                         .rpc_latency_ns = 1000000, .seed = 18 };
+    assert(sim_init(&sim, config) == 0);
+    VirtBackend backend = sim_backend(&sim);
+    cpu_control_init(&control, PERIOD_NS);
+    assert(cpu_control_tick(&control, &backend, sim.clock_ns) == 0);
+    /* One call for the domains and one per pCPU */
+    assert(sim.nr_rpcs == 5);
+    assert(sim.rpc_ns == 5000000);
+    assert(control.stats.query_ns >= 5000000);
+
+    sim_advance(&sim, PERIOD_NS);
+    assert(cpu_control_tick(&control, &backend, sim.clock_ns) == 0);
+    assert(sim.nr_rpcs == 10 + control.stats.nr_pin_rpcs);
+    assert(control.stats.apply_ns >= control.stats.nr_pin_rpcs * 1000000LL);
+    cpu_control_destroy(&control);
+
+    printf("PASS test_sim_backend_injects_rpc_latency\n");
+}
+
+int main(void) {
+    printf("Running control loop tests ...\n\n");
+
+    test_sim_backend_burns_cpu_time();
+    test_control_loop_spreads_stacked_vcpus();
+    test_control_loop_follows_domains_starting_and_stopping();
+    test_sim_backend_injects_rpc_latency();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
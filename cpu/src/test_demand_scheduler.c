@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "scheduler.h"
+#include "demand_scheduler.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+
+#define PERIOD_NS 1000000000LL
+
+/* Too big for the stack */
+static SystemState state;
+static SimHypervisor sim;
+static CPUControl control;
+
+/**
+ * @brief Single vCPU VMs on 4 pCPUs, VM i on pcpus[i], and the pCPUs busy with what runs on them.
+ */
+static void setup_state(int nr_vms, const int *pcpus, const double *usage) {
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_vms = nr_vms;
+    state.nr_pcpus = 4;
+    for (int j = 0; j < 4; j++) {
+        state.pcpus[j].id = j;
+    }
+    for (int i = 0; i < nr_vms; i++) {
+        state.vms[i].id = i + 1;
+        state.vms[i].nr_vcpus = 1;
+        state.vms[i].current_pcpu = pcpus[i];
+        state.vms[i].cpu_usage_rate = usage[i];
+        double utilization = state.pcpus[pcpus[i]].utilization_rate + usage[i];
+        state.pcpus[pcpus[i]].utilization_rate = utilization < 100 ? utilization : 100;
+    }
+}
+
+static int pcpu_demand(const Schedule *schedule, const double *demand, int pcpu) {
+    int total = 0;
+    for (int i = 0; i < state.nr_vms; i++) {
+        total += schedule->vm_to_pcpu[i] == pcpu ? (int) demand[i] : 0;
+    }
+    return total;
+}
+
+static void test_vcpu_demand() {
+    static const int pcpus[] = { 0, 0, 1, 2 };
+    static const double usage[] = { 60, 50, 0.2, 70 };
+    setup_state(4, pcpus, usage);
+    /* pCPU 0 is full, so its VMs may want more than they got */
+    assert(vm_vcpu_demand(&state, 0) == 100 && vm_vcpu_demand(&state, 1) == 100);
+    assert(vm_vcpu_demand(&state, 2) == 1);
+    assert(vm_vcpu_demand(&state, 3) == 70);
+    /* Split over the vCPUs */
+    state.vms[3].nr_vcpus = 2;
+    state.vms[3].vcpu_pcpu[0] = 2;
+    state.vms[3].vcpu_pcpu[1] = 3;
+    assert(vm_vcpu_demand(&state, 3) == 35);
+
+    printf("PASS test_vcpu_demand\n");
+}
+
+static void test_stacked_vcpus_spread_two_per_pcpu() {
+    /* Test case 2: 8 busy VMs all on pCPU 0, each getting an eighth of it */
+    static const int pcpus[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    static const double usage[] = { 12.5, 12.5, 12.5, 12.5, 12.5, 12.5, 12.5, 12.5 };
+    static const double demand[] = { 100, 100, 100, 100, 100, 100, 100, 100 };
+    setup_state(8, pcpus, usage);
+    Schedule schedule = compute_demand_schedule(&state);
+    assert(schedule.num_assigned == 8);
+    for (int j = 0; j < 4; j++) {
+        assert(pcpu_demand(&schedule, demand, j) == 200);
+    }
+    assert(schedule.total_cost == demand_schedule_total_cost(&state, &schedule));
+    Schedule current = current_schedule(&state);
+    assert(demand_schedule_total_cost(&state, &schedule) < demand_schedule_total_cost(&state, &current));
+
+    /* Once spread they stay */
+    static const int spread[] = { 0, 0, 1, 1, 2, 2, 3, 3 };
+    static const double half[] = { 50, 50, 50, 50, 50, 50, 50, 50 };
+    setup_state(8, spread, half);
+    schedule = compute_demand_schedule(&state);
+    assert(schedule_nr_migrations(&state, &schedule) == 0);
+
+    printf("PASS test_stacked_vcpus_spread_two_per_pcpu\n");
+}
+
+static void test_heavy_and_light_vms_pair_up() {
+    /* Test case 3: the two heavy VMs of pCPUs 0 and 1 leave the light ones of pCPUs 2 and 3 underused */
+    static const int pcpus[] = { 0, 0, 1, 1, 2, 2, 3, 3 };
+    static const double usage[] = { 50, 50, 50, 50, 20, 20, 20, 20 };
+    static const double demand[] = { 80, 80, 80, 80, 20, 20, 20, 20 };
+    setup_state(8, pcpus, usage);
+    /* The slot model is happy with two vCPUs per pCPU */
+    Schedule slots = compute_schedule(&state);
+    assert(schedule_nr_migrations(&state, &slots) == 0);
+
+    Schedule schedule = compute_demand_schedule(&state);
+    assert(schedule.num_assigned == 8);
+    for (int j = 0; j < 4; j++) {
+        /* Saturated heavy VMs count as 100, so one heavy and one light per pCPU */
+        assert(pcpu_demand(&schedule, demand, j) == 100);
+    }
+    assert(schedule_nr_migrations(&state, &schedule) == 4);
+    Schedule current = current_schedule(&state);
+    assert(demand_schedule_total_cost(&state, &schedule) < demand_schedule_total_cost(&state, &current));
+
+    printf("PASS test_heavy_and_light_vms_pair_up\n");
+}
+
+/**
+ * @brief Runs the control loop on test case 3 and returns the CPU time the vCPUs didn't get in the last half.
+ */
+static double run_heavy_and_light(PlacementMode placement, double *spread) {
+    SimConfig config = { .nr_vms = 8, .nr_pcpus = 4, .max_vcpus = 1, .load = SIM_LOAD_STEADY, .seed = 21 };
+    assert(sim_init(&sim, config) == 0);
+    for (int i = 0; i < 8; i++) {
+        sim.domains[i].vcpu_pcpu[0] = i / 2;
+        sim.domains[i].demand[0] = i < 4 ? 80 : 20;
+    }
+    VirtBackend backend = sim_backend(&sim);
+    cpu_control_init(&control, PERIOD_NS);
+    control.stabilizer.placement = placement;
+    double unmet_before = 0;
+    for (int t = 0; t < 20; t++) {
+        assert(cpu_control_tick(&control, &backend, sim.clock_ns) == 0);
+        if (t == 10) {
+            unmet_before = sim.unmet_vcpu_ns;
+        }
+        sim_advance(&sim, PERIOD_NS);
+    }
+    double demand[4] = { 0 };
+    for (int i = 0; i < 8; i++) {
+        demand[sim.domains[i].vcpu_pcpu[0]] += sim.domains[i].demand[0];
+    }
+    double mean = 0;
+    double variance = 0;
+    for (int j = 0; j < 4; j++) {
+        mean += demand[j] / 4;
+    }
+    for (int j = 0; j < 4; j++) {
+        variance += (demand[j] - mean) * (demand[j] - mean) / 4;
+    }
+    *spread = sqrt(variance);
+    cpu_control_destroy(&control);
+    return sim.unmet_vcpu_ns - unmet_before;
+}
+
+static void test_control_loop_balances_mixed_load() {
+    double slots_spread;
+    double demand_spread;
+    double unmet_slots = run_heavy_and_light(PLACE_VCPU_SLOTS, &slots_spread);
+    double unmet_demand = run_heavy_and_light(PLACE_BY_DEMAND, &demand_spread);
+    printf("vCPU slots: %.2f s unmet, pCPU demand stddev %.1f%%\n", unmet_slots / 1e9, slots_spread);
+    printf("Demand: %.2f s unmet, pCPU demand stddev %.1f%%\n", unmet_demand / 1e9, demand_spread);
+    assert(unmet_slots > 0);
+    assert(unmet_demand < unmet_slots / 4);
+    assert(demand_spread < slots_spread / 4);
+
+    printf("PASS test_control_loop_balances_mixed_load\n");
+}
+
+int main(void) {
+    printf("Running demand scheduler tests ...\n\n");
+
+    test_vcpu_demand();
+    test_stacked_vcpus_spread_two_per_pcpu();
+    test_heavy_and_light_vms_pair_up();
+    test_control_loop_balances_mixed_load();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_types.h"
+#include "scheduler.h"
+#include "auction.h"
+#include "domain_scheduler.h"
+
+/* Too big for the stack */
+static SystemState state;
+static DomainScheduler ds;
+
+/**
+ * @brief Random single vCPU VMs on a host of nr_nodes nodes, two LLCs each.
+ */
+static void setup_numa_state(int nr_vms, int nr_nodes, int pcpus_per_node) {
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = nr_nodes * pcpus_per_node;
+    state.topology.nr_cpus = state.nr_pcpus;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+        state.pcpus[j].utilization_rate = rand() % 100;
+        state.topology.core[j] = j;
+        state.topology.llc[j] = j / (pcpus_per_node / 2);
+        state.topology.node[j] = j / pcpus_per_node;
+    }
+    state.nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        state.vms[i].id = i + 1;
+        state.vms[i].current_pcpu = rand() % state.nr_pcpus;
+    }
+}
+
+/**
+ * @brief Checks the merged schedule places every vCPU within its VM's domain and fits the slots.
+ */
+static void assert_within_domains(const Schedule *schedule, int pcpus_per_domain) {
+    int nr_on_pcpu[MAX_PCPUS] = { 0 };
+    int nr_assigned = 0;
+    for (int i = 0; i < state.nr_vms; i++) {
+        int pcpu = schedule->vm_to_pcpu[i];
+        assert(pcpu >= 0 && pcpu < state.nr_pcpus);
+        assert(pcpu / pcpus_per_domain == ds.vm_domain[i]);
+        nr_on_pcpu[pcpu]++;
+        nr_assigned++;
+    }
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        assert(nr_on_pcpu[j] <= MAX_VMS_PER_PCPU);
+    }
+    assert(schedule->num_assigned == nr_assigned);
+    assert(schedule->total_cost == schedule_total_cost(&state, schedule));
+}
+
+static void test_splits_host_by_node() {
+    Schedule schedule;
+    srand(6240);
+    assert(domain_scheduler_start(&ds, SPLIT_BY_NODE, 0) == 0);
+    for (int round = 0; round < 50; round++) {
+        setup_numa_state(1 + rand() % 64, 4, 16);
+        assert(domain_schedule(&ds, &state, &schedule) == 0);
+        assert(ds.stats.nr_domains == 4);
+        assert_within_domains(&schedule, 16);
+        /* Never better than solving the whole host */
+        assert(schedule.total_cost >= compute_schedule(&state).total_cost);
+    }
+
+    /* By LLC, two per node */
+    domain_scheduler_stop(&ds);
+    assert(domain_scheduler_start(&ds, SPLIT_BY_LLC, 0) == 0);
+    setup_numa_state(48, 4, 16);
+    assert(domain_schedule(&ds, &state, &schedule) == 0);
+    assert(ds.stats.nr_domains == 8);
+    assert_within_domains(&schedule, 8);
+    domain_scheduler_stop(&ds);
+
+    printf("PASS test_splits_host_by_node\n");
+}
+
+static void test_vms_leave_busy_nodes() {
+    Schedule schedule;
+    srand(6241);
+    assert(domain_scheduler_start(&ds, SPLIT_BY_NODE, 0) == 0);
+
+    /* Eight VMs on an idle node 0 stay there while node 1 is full */
+    setup_numa_state(8, 2, 8);
+    for (int j = 0; j < 16; j++) {
+        state.pcpus[j].utilization_rate = j < 8 ? 0 : 100;
+    }
+    for (int i = 0; i < 8; i++) {
+        state.vms[i].current_pcpu = i;
+    }
+    assert(domain_schedule(&ds, &state, &schedule) == 0);
+    assert(ds.stats.nr_moved == 0);
+    assert(schedule_nr_migrations(&state, &schedule) == 0);
+
+    /* Once node 0 is the full one they move to node 1 */
+    for (int j = 0; j < 16; j++) {
+        state.pcpus[j].utilization_rate = j < 8 ? 100 : 0;
+    }
+    assert(domain_schedule(&ds, &state, &schedule) == 0);
+    assert(ds.stats.nr_moved == 7);
+    assert_within_domains(&schedule, 8);
+    assert(schedule.total_cost < current_schedule(&state).total_cost);
+
+    /* More VMs than a node has slots spill over */
+    setup_numa_state(20, 2, 8);
+    for (int i = 0; i < 20; i++) {
+        state.vms[i].current_pcpu = i % 8;
+    }
+    assert(domain_schedule(&ds, &state, &schedule) == 0);
+    assert(ds.stats.nr_moved >= 4);
+    assert_within_domains(&schedule, 8);
+    domain_scheduler_stop(&ds);
+
+    printf("PASS test_vms_leave_busy_nodes\n");
+}
+
+static void test_workers_match_one_thread() {
+    static Schedule serial;
+    static Schedule parallel;
+    static DomainScheduler threads;
+    srand(6242);
+    assert(domain_scheduler_start(&ds, SPLIT_BY_NODE, 0) == 0);
+    assert(domain_scheduler_start(&threads, SPLIT_BY_NODE, 4) == 0);
+    for (int round = 0; round < 30; round++) {
+        setup_numa_state(64 + rand() % 64, 8, 8);
+        assert(domain_schedule(&ds, &state, &serial) == 0);
+        assert(domain_schedule(&threads, &state, &parallel) == 0);
+        assert(memcmp(serial.vm_to_pcpu, parallel.vm_to_pcpu, sizeof(int) * state.nr_vms) == 0);
+        assert(serial.total_cost == parallel.total_cost);
+    }
+    domain_scheduler_stop(&threads);
+    domain_scheduler_stop(&ds);
+
+    printf("PASS test_workers_match_one_thread\n");
+}
+
+static void test_solves_through_compute_schedule_on() {
+    static ScheduleWorkspace ws;
+    srand(6243);
+    assert(domain_scheduler_start(&ds, SPLIT_BY_NODE, 2) == 0);
+    ws.solver = &ds.solver;
+    setup_numa_state(40, 2, 16);
+    Schedule schedule = compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "numa_nodes") == 0);
+    assert(schedule.num_assigned == 40);
+    assert(ws.result.total_cost == schedule.total_cost);
+
+    /* The auction solves every domain to the same cost */
+    ds.inner = &auction_schedule_solver;
+    Schedule auction = compute_schedule_on(&ws, &state);
+    assert(auction.total_cost == schedule.total_cost);
+    for (int d = 0; d < ds.stats.nr_domains; d++) {
+        assert(strcmp(ds.domains[d]->ws.solved_by, "auction") == 0);
+    }
+
+    /* Without a topology there is a single domain, and the flow network solves the host */
+    state.topology.nr_cpus = 0;
+    schedule = compute_schedule_on(&ws, &state);
+    assert(strcmp(ws.solved_by, "mcmf") == 0);
+    assert(schedule.num_assigned == 40);
+    domain_scheduler_stop(&ds);
+    schedule_workspace_destroy(&ws);
+
+    printf("PASS test_solves_through_compute_schedule_on\n");
+}
+
+int main(void) {
+    printf("Running domain scheduler tests ...\n\n");
+
+    test_splits_host_by_node();
+    test_vms_leave_busy_nodes();
+    test_workers_match_one_thread();
+    test_solves_through_compute_schedule_on();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
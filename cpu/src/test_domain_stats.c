@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm_types.h"
+#include "domain_stats.h"
+
+#define FIXTURE "domstats_vcpu.virsh"
+
+static void test_can_read_recorded_domstats() {
+    static SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    FILE *file = fopen(FIXTURE, "r");
+    assert(file != NULL);
+    assert(domain_stats_read_virsh(file, &state) == 3);
+    fclose(file);
+
+    assert(state.nr_vms == 3);
+    assert(strcmp(state.vms[0].name, "aos_vm1") == 0);
+    assert(state.vms[0].id == 1);
+    assert(state.vms[0].nr_vcpus == 1);
+    assert(state.vms[0].cpu_time == 5120000000ULL);
+    assert(state.vms[1].nr_vcpus == 2);
+    assert(state.vms[1].cpu_time == 4000000000ULL);
+    /* vcpu.current counts, not vcpu.maximum */
+    assert(state.vms[2].nr_vcpus == 4);
+    assert(state.vms[2].cpu_time == 1000000000ULL);
+    for (int k = 0; k < 4; k++) {
+        assert(state.vms[2].vcpu_pcpu[k] == -1);
+    }
+
+    printf("PASS test_can_read_recorded_domstats\n");
+}
+
+static void test_rejects_domain_without_vcpu_count() {
+    DomainStat stats[] = {
+        {"state.state", 1},
+        {"vcpu.0.time", 100},
+    };
+    VM vm;
+    memset(&vm, 0, sizeof(VM));
+    assert(domain_stats_to_vm(&vm, stats, 2) == -1);
+
+    DomainStat too_many[] = {
+        {"vcpu.current", MAX_VCPUS_PER_VM + 1},
+    };
+    assert(domain_stats_to_vm(&vm, too_many, 1) == -1);
+
+    printf("PASS test_rejects_domain_without_vcpu_count\n");
+}
+
+int main(void) {
+    printf("Running domain stats tests ...\n\n");
+
+    test_can_read_recorded_domstats();
+    test_rejects_domain_without_vcpu_count();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
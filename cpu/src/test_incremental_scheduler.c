@@ -0,0 +1,434 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+#include "incremental_scheduler.h"
+#include "topology.h"
+#include "tick_schedule.h"
+
+static void setup_random_state(SystemState *state, int nr_vms, int nr_pcpus) {
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = nr_pcpus;
+    for (int j = 0; j < nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].utilization_rate = rand() % 100;
+    }
+    state->nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        state->vms[i].id = i + 1;
+        state->vms[i].current_pcpu = rand() % nr_pcpus;
+    }
+}
+
+/**
+ * @brief Recomputes the cost of a schedule the way the flow network prices it.
+ */
+static int schedule_cost(const SystemState *state, const Schedule *schedule) {
+    int vms_on_pcpu[MAX_PCPUS] = {0};
+    int cost = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        int pcpu = schedule->vm_to_pcpu[i];
+        assert(pcpu >= 0 && pcpu < state->nr_pcpus);
+        cost += vm_pcpu_cost(state, i, pcpu) + vms_on_pcpu[pcpu] * ADDITION_VM_PENALTY;
+        vms_on_pcpu[pcpu]++;
+        assert(vms_on_pcpu[pcpu] <= MAX_VMS_PER_PCPU);
+    }
+    return cost;
+}
+
+/**
+ * @brief Random state where every VM has 1 to max_vcpus vCPUs on random pCPUs.
+ */
+static void setup_random_multi_vcpu_state(SystemState *state, int nr_vms, int nr_pcpus, int max_vcpus) {
+    setup_random_state(state, nr_vms, nr_pcpus);
+    for (int i = 0; i < nr_vms; i++) {
+        state->vms[i].nr_vcpus = 1 + rand() % max_vcpus;
+        for (int k = 0; k < state->vms[i].nr_vcpus; k++) {
+            state->vms[i].vcpu_pcpu[k] = rand() % nr_pcpus;
+        }
+        state->vms[i].current_pcpu = state->vms[i].vcpu_pcpu[0];
+    }
+}
+
+/**
+ * @brief Same as schedule_cost but for the vCPU assignment (unassigned vCPUs are allowed).
+ */
+static int schedule_vcpu_cost(const SystemState *state, const Schedule *schedule) {
+    int vcpus_on_pcpu[MAX_PCPUS] = {0};
+    int cost = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        int vm_vcpus_on_pcpu[MAX_PCPUS] = {0};
+        for (int k = 0; k < vm_nr_vcpus(&state->vms[i]); k++) {
+            int pcpu = schedule->vcpu_to_pcpu[i][k];
+            if (pcpu < 0) {
+                continue;
+            }
+            assert(pcpu < state->nr_pcpus);
+            cost += vm_pcpu_slot_cost(state, i, pcpu, vm_vcpus_on_pcpu[pcpu]) + vcpus_on_pcpu[pcpu] * ADDITION_VM_PENALTY;
+            vm_vcpus_on_pcpu[pcpu]++;
+            vcpus_on_pcpu[pcpu]++;
+            assert(vcpus_on_pcpu[pcpu] <= MAX_VMS_PER_PCPU);
+        }
+        assert(schedule->vm_to_pcpu[i] == schedule->vcpu_to_pcpu[i][0]);
+    }
+    return cost;
+}
+
+static void test_incremental_matches_compute_schedule_on_first_tick() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule incremental;
+
+    srand(6210);
+    for (int round = 0; round < 50; round++) {
+        int nr_pcpus = 1 + rand() % 16;
+        int nr_vms = 1 + rand() % (nr_pcpus * MAX_VMS_PER_PCPU);
+        setup_random_state(&state, nr_vms, nr_pcpus);
+
+        Schedule full = compute_schedule(&state);
+        assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+
+        assert(scheduler.stats.rebuilt);
+        assert(scheduler.stats.optimal);
+        assert(incremental.num_assigned == full.num_assigned);
+        assert(incremental.total_cost == full.total_cost);
+        assert(schedule_cost(&state, &incremental) == incremental.total_cost);
+    }
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_matches_compute_schedule_on_first_tick\n");
+}
+
+static void test_incremental_follows_changes_across_ticks() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule incremental;
+
+    srand(6211);
+    setup_random_state(&state, 48, 32);
+    for (int tick = 0; tick < 200; tick++) {
+        /* A few pCPUs change utilization every tick */
+        for (int k = 0; k < 3; k++) {
+            state.pcpus[rand() % state.nr_pcpus].utilization_rate = rand() % 100;
+        }
+
+        Schedule full = compute_schedule(&state);
+        assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+
+        assert(scheduler.stats.rebuilt == (tick == 0));
+        assert(incremental.num_assigned == full.num_assigned);
+        assert(incremental.total_cost == full.total_cost);
+        assert(schedule_cost(&state, &incremental) == incremental.total_cost);
+
+        /* The VMs get pinned where they were scheduled */
+        for (int i = 0; i < state.nr_vms; i++) {
+            state.vms[i].current_pcpu = incremental.vm_to_pcpu[i];
+        }
+    }
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_follows_changes_across_ticks\n");
+}
+
+static void test_incremental_follows_multi_vcpu_vms() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    static Schedule incremental;
+    static Schedule full;
+
+    srand(6214);
+    setup_random_multi_vcpu_state(&state, 12, 16, 4);
+    for (int tick = 0; tick < 100; tick++) {
+        for (int k = 0; k < 3; k++) {
+            state.pcpus[rand() % state.nr_pcpus].utilization_rate = rand() % 100;
+        }
+
+        full = compute_schedule(&state);
+        assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+
+        assert(scheduler.stats.rebuilt == (tick == 0));
+        assert(incremental.num_assigned == full.num_assigned);
+        assert(incremental.total_cost == full.total_cost);
+        assert(schedule_vcpu_cost(&state, &full) == full.total_cost);
+        assert(schedule_vcpu_cost(&state, &incremental) == incremental.total_cost);
+
+        /* Every vCPU gets pinned where it was scheduled */
+        for (int i = 0; i < state.nr_vms; i++) {
+            for (int k = 0; k < state.vms[i].nr_vcpus; k++) {
+                if (incremental.vcpu_to_pcpu[i][k] >= 0) {
+                    state.vms[i].vcpu_pcpu[k] = incremental.vcpu_to_pcpu[i][k];
+                }
+            }
+            state.vms[i].current_pcpu = state.vms[i].vcpu_pcpu[0];
+        }
+    }
+
+    /* A VM gets more vCPUs */
+    state.vms[0].nr_vcpus++;
+    state.vms[0].vcpu_pcpu[state.vms[0].nr_vcpus - 1] = 0;
+    assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+    assert(scheduler.stats.rebuilt);
+    assert(incremental.total_cost == compute_schedule(&state).total_cost);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_follows_multi_vcpu_vms\n");
+}
+
+static void test_incremental_follows_topology_costs() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule incremental;
+
+    srand(6215);
+    setup_random_state(&state, 40, 32);
+    FILE *file = fopen("topology_dual_socket.lscpu", "r");
+    assert(file != NULL);
+    assert(topology_parse_lscpu(&state.topology, file) == 0);
+    fclose(file);
+
+    for (int tick = 0; tick < 100; tick++) {
+        for (int k = 0; k < 3; k++) {
+            state.pcpus[rand() % state.nr_pcpus].utilization_rate = rand() % 100;
+        }
+
+        Schedule full = compute_schedule(&state);
+        assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+
+        assert(scheduler.stats.rebuilt == (tick == 0));
+        assert(incremental.total_cost == full.total_cost);
+        assert(schedule_cost(&state, &incremental) == incremental.total_cost);
+
+        for (int i = 0; i < state.nr_vms; i++) {
+            state.vms[i].current_pcpu = incremental.vm_to_pcpu[i];
+        }
+    }
+
+    /* A different topology changes every migration cost */
+    state.topology.nr_cpus = 0;
+    assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+    assert(scheduler.stats.rebuilt);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_follows_topology_costs\n");
+}
+
+static void test_incremental_follows_move_penalties() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule incremental;
+
+    srand(6216);
+    setup_random_state(&state, 40, 32);
+    for (int tick = 0; tick < 100; tick++) {
+        /* The stabilizer raises and drops the move penalties of some VMs every tick */
+        for (int k = 0; k < 5; k++) {
+            state.vms[rand() % state.nr_vms].move_penalty = (rand() % 2) ? rand() % 200 : 0;
+        }
+        state.pcpus[rand() % state.nr_pcpus].utilization_rate = rand() % 100;
+
+        Schedule full = compute_schedule(&state);
+        assert(incremental_schedule(&scheduler, &state, &incremental) == 0);
+
+        assert(scheduler.stats.rebuilt == (tick == 0));
+        assert(incremental.total_cost == full.total_cost);
+        assert(schedule_cost(&state, &incremental) == incremental.total_cost);
+
+        for (int i = 0; i < state.nr_vms; i++) {
+            state.vms[i].current_pcpu = incremental.vm_to_pcpu[i];
+        }
+    }
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_follows_move_penalties\n");
+}
+
+static void test_incremental_does_no_work_when_nothing_changed() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule first;
+    Schedule second;
+
+    srand(6212);
+    setup_random_state(&state, 64, 32);
+    assert(incremental_schedule(&scheduler, &state, &first) == 0);
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].current_pcpu = first.vm_to_pcpu[i];
+    }
+    /* Settles on the pinned placement */
+    assert(incremental_schedule(&scheduler, &state, &first) == 0);
+    assert(incremental_schedule(&scheduler, &state, &second) == 0);
+
+    assert(!scheduler.stats.rebuilt);
+    assert(scheduler.stats.nr_updated_edges == 0);
+    assert(scheduler.stats.nr_cancelled_cycles == 0);
+    assert(scheduler.stats.nr_relaxations == 0);
+    assert(memcmp(first.vm_to_pcpu, second.vm_to_pcpu, sizeof(int) * state.nr_vms) == 0);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_does_no_work_when_nothing_changed\n");
+}
+
+static void test_incremental_rebuilds_when_vms_change() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    Schedule schedule;
+
+    srand(6213);
+    setup_random_state(&state, 8, 4);
+    assert(incremental_schedule(&scheduler, &state, &schedule) == 0);
+    assert(scheduler.stats.rebuilt);
+
+    /* A VM shuts down */
+    state.nr_vms = 7;
+    assert(incremental_schedule(&scheduler, &state, &schedule) == 0);
+    assert(scheduler.stats.rebuilt);
+    assert(schedule.num_assigned == 7);
+    assert(schedule.total_cost == compute_schedule(&state).total_cost);
+
+    /* A different VM takes its place */
+    state.nr_vms = 8;
+    state.vms[7].id = 100;
+    assert(incremental_schedule(&scheduler, &state, &schedule) == 0);
+    assert(scheduler.stats.rebuilt);
+    assert(schedule.num_assigned == 8);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_rebuilds_when_vms_change\n");
+}
+
+static void test_incremental_stops_at_deadline() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    static Schedule schedule;
+
+    srand(6215);
+    setup_random_state(&state, 256, 192);
+    int optimum = compute_schedule(&state).total_cost;
+
+    /* A deadline already past leaves the flow built from the current placement */
+    assert(incremental_schedule_until(&scheduler, &state, 1, &schedule) == 0);
+    assert(scheduler.stats.rebuilt);
+    assert(!scheduler.stats.optimal);
+    assert(scheduler.stats.nr_cancelled_cycles == 0);
+    assert(schedule.num_assigned == state.nr_vms);
+    assert(schedule_cost(&state, &schedule) == schedule.total_cost);
+    int first_cost = schedule.total_cost;
+    assert(first_cost > optimum);
+
+    /* A millisecond at a time, every schedule is feasible and none is worse than the last */
+    int cost = first_cost;
+    for (int call = 0; call < 20 && !scheduler.stats.optimal; call++) {
+        assert(incremental_schedule_until(&scheduler, &state, tick_now_ns() + 1000000, &schedule) == 0);
+        assert(!scheduler.stats.rebuilt);
+        assert(schedule.num_assigned == state.nr_vms);
+        assert(schedule_cost(&state, &schedule) == schedule.total_cost);
+        assert(schedule.total_cost <= cost);
+        cost = schedule.total_cost;
+    }
+    assert(cost < first_cost);
+
+    /* Without a deadline the search carries on to the optimum */
+    assert(incremental_schedule(&scheduler, &state, &schedule) == 0);
+    assert(scheduler.stats.optimal);
+    assert(schedule.total_cost == optimum);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_stops_at_deadline\n");
+}
+
+static void test_incremental_converges_under_short_budget() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    static Schedule schedule;
+
+    srand(6217);
+    setup_random_state(&state, 256, 192);
+    assert(incremental_schedule_until(&scheduler, &state, 1, &schedule) == 0);
+
+    /* A tenth of a millisecond is well under one round of the search here, the rounds resume at the next call */
+    for (int tick = 0; tick < 2; tick++) {
+        int optimum = compute_schedule(&state).total_cost;
+        int cost = schedule.total_cost;
+        int nr_calls = 0;
+        do {
+            assert(incremental_schedule_until(&scheduler, &state, tick_now_ns() + 100000, &schedule) == 0);
+            assert(schedule.num_assigned == state.nr_vms);
+            assert(schedule_cost(&state, &schedule) == schedule.total_cost);
+            assert(schedule.total_cost <= cost);
+            cost = schedule.total_cost;
+            nr_calls++;
+        } while (!scheduler.stats.optimal && nr_calls < 20000);
+        printf("tick %d: optimum after %d calls\n", tick, nr_calls);
+        assert(nr_calls > 1);
+        assert(scheduler.stats.optimal);
+        assert(schedule.total_cost == optimum);
+
+        /* Cut short on new loads, the next call moves single vCPUs again */
+        for (int j = 0; j < state.nr_pcpus; j += 4) {
+            state.pcpus[j].utilization_rate = rand() % 100;
+        }
+        assert(incremental_schedule_until(&scheduler, &state, 1, &schedule) == 0);
+        assert(!scheduler.stats.optimal);
+        assert(scheduler.nr_unmoved_vms == 0);
+    }
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_converges_under_short_budget\n");
+}
+
+static void test_incremental_reaches_optimum_before_deadline() {
+    static SystemState state;
+    static IncrementalScheduler scheduler;
+    static Schedule incremental;
+    static Schedule full;
+
+    /* The vCPU moves and swaps run first under a deadline, the search still ends at the optimum */
+    srand(6216);
+    for (int round = 0; round < 20; round++) {
+        setup_random_multi_vcpu_state(&state, 1 + rand() % 12, 16, 4);
+        for (int tick = 0; tick < 5; tick++) {
+            for (int k = 0; k < 3; k++) {
+                state.pcpus[rand() % state.nr_pcpus].utilization_rate = rand() % 100;
+            }
+
+            full = compute_schedule(&state);
+            assert(incremental_schedule_until(&scheduler, &state, tick_now_ns() + 10000000000LL, &incremental) == 0);
+
+            assert(scheduler.stats.optimal);
+            assert(incremental.num_assigned == full.num_assigned);
+            assert(incremental.total_cost == full.total_cost);
+            assert(schedule_vcpu_cost(&state, &incremental) == incremental.total_cost);
+
+            for (int i = 0; i < state.nr_vms; i++) {
+                for (int k = 0; k < state.vms[i].nr_vcpus; k++) {
+                    if (incremental.vcpu_to_pcpu[i][k] >= 0) {
+                        state.vms[i].vcpu_pcpu[k] = incremental.vcpu_to_pcpu[i][k];
+                    }
+                }
+                state.vms[i].current_pcpu = state.vms[i].vcpu_pcpu[0];
+            }
+        }
+    }
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_incremental_reaches_optimum_before_deadline\n");
+}
+
+int main(void) {
+    printf("Running incremental scheduler tests ...\n\n");
+
+    test_incremental_matches_compute_schedule_on_first_tick();
+    test_incremental_follows_changes_across_ticks();
+    test_incremental_follows_multi_vcpu_vms();
+    test_incremental_follows_topology_costs();
+    test_incremental_follows_move_penalties();
+    test_incremental_does_no_work_when_nothing_changed();
+    test_incremental_rebuilds_when_vms_change();
+    test_incremental_stops_at_deadline();
+    test_incremental_converges_under_short_budget();
+    test_incremental_reaches_optimum_before_deadline();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -1,10 +1,12 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "graph.h"
 #include "mcmf.h"
 
 static void test_graph_can_init() {
     FlowGraph g;
+    assert(graph_create(&g, 8, 0) == 0);
     
     graph_init(&g, 0);
     assert(g.nr_edges == 0);
@@ -17,6 +19,7 @@ static void test_graph_can_init() {
     for(int i = 0; i < g.nr_nodes; i++) {
         assert(g.heads[i] == -1);
     }
+    graph_destroy(&g);
     
     printf("  PASS: test_graph_can_init\n");
 }
@@ -28,6 +31,7 @@ static void test_graph_can_add_edge() {
     int capacity = 10;
     int cost = 5;
     int nr_nodes = 2;
+    assert(graph_create(&g, nr_nodes, 2) == 0);
     graph_init(&g, nr_nodes);
     graph_add_edge(&g, u, v, capacity, cost);
     assert(g.nr_edges == 2);
@@ -46,13 +50,44 @@ static void test_graph_can_add_edge() {
     assert(g.edges[1].cost == -cost);
     assert(g.edges[1].flow == 0);
     assert(g.edges[1].next == -1);
+    /* No room left for another pair */
+    assert(graph_add_edge(&g, u, v, capacity, cost) == -1);
+    graph_destroy(&g);
 
     printf("  PASS: test_graph_can_add_edge\n");
 }
 
+static void test_graph_can_add_convex_edge() {
+    FlowGraph g;
+    int capacities[] = { 2, 1, 5 };
+    int costs[] = { 0, 3, 3 };
+    int concave_costs[] = { 0, 4, 3 };
+    assert(graph_create(&g, 2, 8) == 0);
+    graph_init(&g, 2);
+
+    /* Decreasing costs are refused */
+    assert(graph_add_convex_edge(&g, 0, 1, capacities, concave_costs, 3) == -1);
+    assert(g.nr_edges == 0);
+    /* One forward and reverse pair per piece, in order */
+    assert(graph_add_convex_edge(&g, 0, 1, capacities, costs, 3) == 0);
+    assert(g.nr_edges == 6);
+    for (int p = 0; p < 3; p++) {
+        assert(g.edges[2 * p].to == 1);
+        assert(g.edges[2 * p].capacity == capacities[p]);
+        assert(g.edges[2 * p].cost == costs[p]);
+        assert(g.edges[2 * p + 1].cost == -costs[p]);
+    }
+    /* No room left for another piece */
+    assert(graph_add_convex_edge(&g, 0, 1, capacities, costs, 2) == -1);
+    graph_destroy(&g);
+
+    printf("  PASS: test_graph_can_add_convex_edge\n");
+}
+
 static void test_mcmf_can_map_one_vm_to_one_cpu() {
     FlowGraph g;
     int nr_nodes = 4;
+    assert(graph_create(&g, nr_nodes, 6) == 0);
     graph_init(&g, nr_nodes);
 
     int source = 0;
@@ -97,7 +132,7 @@ static void test_mcmf_can_map_one_vm_to_one_cpu() {
     assert(g.edges[g.heads[vm_1] ^ 1].cost     == -1  );
     assert(g.edges[g.heads[vm_1] ^ 1].next     == -1  );
 
-    /* pcpu_1 -> sink */
+    /* pcpu_1 -> sink (the solver never changes a cost) */
     assert(g.edges[g.heads[pcpu_1]].to       == sink               );
     assert(g.edges[g.heads[pcpu_1]].capacity == 0                  );
     assert(g.edges[g.heads[pcpu_1]].flow     == 1                  );
@@ -107,8 +142,9 @@ static void test_mcmf_can_map_one_vm_to_one_cpu() {
     assert(g.edges[g.heads[pcpu_1] ^ 1].to       == pcpu_1);
     assert(g.edges[g.heads[pcpu_1] ^ 1].capacity == 1   );
     assert(g.edges[g.heads[pcpu_1] ^ 1].flow     == 0   );
-    assert(g.edges[g.heads[pcpu_1] ^ 1].cost     == 0  );
+    assert(g.edges[g.heads[pcpu_1] ^ 1].cost     == 0   );
     assert(g.edges[g.heads[pcpu_1] ^ 1].next     == -1  );
+    graph_destroy(&g);
 
     printf("  PASS: test_mcmf_can_map_one_vm_to_one_cpu\n");
 }
@@ -116,6 +152,7 @@ static void test_mcmf_can_map_one_vm_to_one_cpu() {
 static void test_mcmf_can_map_two_vm_to_two_cpu_using_reverse_edge() {
     FlowGraph g;
     int nr_nodes = 6;
+    assert(graph_create(&g, nr_nodes, 16) == 0);
     graph_init(&g, nr_nodes);
 
     int source = 0;
@@ -161,17 +198,287 @@ static void test_mcmf_can_map_two_vm_to_two_cpu_using_reverse_edge() {
     assert(g.edges[g.edges[g.heads[vm_2]].next].to == pcpu_2 );
     assert(g.edges[g.edges[g.heads[vm_2]].next].capacity == 1);
     assert(g.edges[g.edges[g.heads[vm_2]].next].flow == 0    );
+    graph_destroy(&g);
 
     printf("  PASS: test_mcmf_can_map_two_vm_to_two_cpu_using_reverse_edge\n");
 }
 
+/**
+ * @brief Builds a Source -> VMs -> pCPUs -> Sink graph with random costs.
+ */
+static void build_random_vm_pcpu_graph(FlowGraph *g, int nr_vms, int nr_pcpus, int pcpu_capacity, int max_cost) {
+    int source = 0;
+    int vm_base = 1;
+    int pcpu_base = vm_base + nr_vms;
+    int sink = pcpu_base + nr_pcpus;
+
+    graph_init(g, sink + 1);
+    for (int i = 0; i < nr_vms; i++) {
+        graph_add_edge(g, source, vm_base + i, 1, 0);
+    }
+    for (int i = 0; i < nr_vms; i++) {
+        for (int j = 0; j < nr_pcpus; j++) {
+            graph_add_edge(g, vm_base + i, pcpu_base + j, 1, rand() % (max_cost + 1));
+        }
+    }
+    for (int j = 0; j < nr_pcpus; j++) {
+        graph_add_edge(g, pcpu_base + j, sink, pcpu_capacity, 0);
+    }
+}
+
+static void test_mcmf_dijkstra_matches_spfa_on_reverse_edge_graph() {
+    FlowGraph spfa_graph;
+    FlowGraph dijkstra_graph;
+    int source = 0;
+    int sink = 5;
+
+    assert(graph_create(&spfa_graph, 6, 16) == 0);
+    assert(graph_create(&dijkstra_graph, 6, 16) == 0);
+    graph_init(&spfa_graph, 6);
+    graph_add_edge(&spfa_graph, source, 1, 1, 0 );
+    graph_add_edge(&spfa_graph, 1     , 3, 1, 1 );
+    graph_add_edge(&spfa_graph, 3     , 5, 1, 0 );
+    graph_add_edge(&spfa_graph, source, 2, 1, 0 );
+    graph_add_edge(&spfa_graph, 2     , 4, 1, 10);
+    graph_add_edge(&spfa_graph, 4     , 5, 1, 0 );
+    graph_add_edge(&spfa_graph, 1     , 4, 1, 3 );
+    graph_add_edge(&spfa_graph, 2     , 3, 1, 5 );
+    assert(graph_copy(&dijkstra_graph, &spfa_graph) == 0);
+
+    MCMFResult spfa = mcmf_solve_with(&spfa_graph, source, sink, MCMF_SPFA);
+    MCMFResult dijkstra = mcmf_solve_with(&dijkstra_graph, source, sink, MCMF_DIJKSTRA);
+
+    assert(dijkstra.total_flow == spfa.total_flow);
+    assert(dijkstra.total_cost == spfa.total_cost);
+    assert(dijkstra.total_cost == 8);
+    graph_destroy(&spfa_graph);
+    graph_destroy(&dijkstra_graph);
+
+    printf("  PASS: test_mcmf_dijkstra_matches_spfa_on_reverse_edge_graph\n");
+}
+
+static void test_mcmf_dijkstra_matches_spfa_on_random_graphs() {
+    FlowGraph spfa_graph;
+    FlowGraph dijkstra_graph;
+    int max_vms = 64;
+    int max_pcpus = 32;
+    int max_nodes = max_vms + max_pcpus + 2;
+    int max_edges = (max_vms + max_vms * max_pcpus + max_pcpus) * 2;
+    assert(graph_create(&spfa_graph, max_nodes, max_edges) == 0);
+    assert(graph_create(&dijkstra_graph, max_nodes, max_edges) == 0);
+
+    srand(6210);
+    for (int round = 0; round < 500; round++) {
+        int nr_vms = 1 + rand() % max_vms;
+        int nr_pcpus = 1 + rand() % max_pcpus;
+        int pcpu_capacity = 1 + rand() % 2;
+        int sink = 1 + nr_vms + nr_pcpus;
+        build_random_vm_pcpu_graph(&spfa_graph, nr_vms, nr_pcpus, pcpu_capacity, 150);
+        assert(graph_copy(&dijkstra_graph, &spfa_graph) == 0);
+
+        MCMFResult spfa = mcmf_solve_with(&spfa_graph, 0, sink, MCMF_SPFA);
+        MCMFResult dijkstra = mcmf_solve_with(&dijkstra_graph, 0, sink, MCMF_DIJKSTRA);
+
+        assert(dijkstra.total_flow == spfa.total_flow);
+        assert(dijkstra.total_cost == spfa.total_cost);
+    }
+    graph_destroy(&spfa_graph);
+    graph_destroy(&dijkstra_graph);
+
+    printf("  PASS: test_mcmf_dijkstra_matches_spfa_on_random_graphs\n");
+}
+
+static void test_mcmf_dijkstra_handles_negative_costs() {
+    FlowGraph spfa_graph;
+    FlowGraph dijkstra_graph;
+    int source = 0;
+    int sink = 4;
+
+    assert(graph_create(&spfa_graph, 5, 10) == 0);
+    assert(graph_create(&dijkstra_graph, 5, 10) == 0);
+
+    /* Two routes to the sink where the cheaper one goes through a negative edge */
+    graph_init(&spfa_graph, 5);
+    graph_add_edge(&spfa_graph, source, 1, 2, 0 );
+    graph_add_edge(&spfa_graph, 1     , 2, 1, 4 );
+    graph_add_edge(&spfa_graph, 1     , 3, 1, 6 );
+    graph_add_edge(&spfa_graph, 3     , 2, 1, -5);
+    graph_add_edge(&spfa_graph, 2     , sink, 2, 0);
+    assert(graph_copy(&dijkstra_graph, &spfa_graph) == 0);
+
+    MCMFResult spfa = mcmf_solve_with(&spfa_graph, source, sink, MCMF_SPFA);
+    MCMFResult dijkstra = mcmf_solve_with(&dijkstra_graph, source, sink, MCMF_DIJKSTRA);
+
+    assert(spfa.total_flow == 2);
+    assert(dijkstra.total_flow == spfa.total_flow);
+    assert(dijkstra.total_cost == spfa.total_cost);
+    graph_destroy(&spfa_graph);
+    graph_destroy(&dijkstra_graph);
+
+    printf("  PASS: test_mcmf_dijkstra_handles_negative_costs\n");
+}
+
+static void test_csr_keeps_adjacency_order_and_reverse_edges() {
+    FlowGraph g;
+    CSRGraph csr;
+    assert(graph_create(&g, 4, 6) == 0);
+    assert(csr_create(&csr, 0, 0) == 0);
+    graph_init(&g, 4);
+    graph_add_edge(&g, 0, 1, 1, 0);
+    graph_add_edge(&g, 0, 2, 1, 7);
+    graph_add_edge(&g, 1, 3, 2, 3);
+
+    assert(csr_from_graph(&csr, &g) == 0);
+    assert(csr.nr_nodes == 4);
+    assert(csr.nr_edges == 6);
+    /* Node 0 has the edges to 2 then 1 (the last edge added comes first) */
+    assert(csr.offsets[0] == 0);
+    assert(csr.offsets[1] == 2);
+    assert(csr.to[0] == 2);
+    assert(csr.cost[0] == 7);
+    assert(csr.to[1] == 1);
+    for (int p = 0; p < csr.nr_edges; p++) {
+        assert(csr.rev[csr.rev[p]] == p);
+        assert(csr.edge_id[csr.rev[p]] == (csr.edge_id[p] ^ 1));
+        assert(csr.to[csr.rev[p]] == g.edges[csr.edge_id[p] ^ 1].to);
+    }
+    assert(csr.offsets[4] == 6);
+
+    graph_destroy(&g);
+    csr_destroy(&csr);
+    printf("  PASS: test_csr_keeps_adjacency_order_and_reverse_edges\n");
+}
+
+static void test_mcmf_csr_matches_adjacency_list_on_random_graphs() {
+    FlowGraph list_graph;
+    FlowGraph csr_result;
+    CSRGraph csr;
+    int max_vms = 64;
+    int max_pcpus = 32;
+    int max_nodes = max_vms + max_pcpus + 2;
+    int max_edges = (max_vms + max_vms * max_pcpus + max_pcpus) * 2;
+    assert(graph_create(&list_graph, max_nodes, max_edges) == 0);
+    assert(graph_create(&csr_result, max_nodes, max_edges) == 0);
+    assert(csr_create(&csr, max_nodes, max_edges) == 0);
+
+    srand(6211);
+    for (int round = 0; round < 200; round++) {
+        int nr_vms = 1 + rand() % max_vms;
+        int nr_pcpus = 1 + rand() % max_pcpus;
+        int pcpu_capacity = 1 + rand() % 2;
+        int sink = 1 + nr_vms + nr_pcpus;
+        MCMFAlgorithm algorithm = (round % 2) ? MCMF_SPFA : MCMF_DIJKSTRA;
+        build_random_vm_pcpu_graph(&list_graph, nr_vms, nr_pcpus, pcpu_capacity, 150);
+        assert(graph_copy(&csr_result, &list_graph) == 0);
+        assert(csr_from_graph(&csr, &csr_result) == 0);
+
+        MCMFResult list = mcmf_solve_with(&list_graph, 0, sink, algorithm);
+        MCMFResult compact = mcmf_solve_csr(&csr, 0, sink, algorithm);
+        csr_to_graph(&csr, &csr_result);
+
+        assert(compact.total_flow == list.total_flow);
+        assert(compact.total_cost == list.total_cost);
+        /* Same paths are picked so every edge ends up with the same flow */
+        for (int e = 0; e < list_graph.nr_edges; e++) {
+            assert(csr_result.edges[e].flow == list_graph.edges[e].flow);
+            assert(csr_result.edges[e].capacity == list_graph.edges[e].capacity);
+        }
+    }
+    graph_destroy(&list_graph);
+    graph_destroy(&csr_result);
+    csr_destroy(&csr);
+
+    printf("  PASS: test_mcmf_csr_matches_adjacency_list_on_random_graphs\n");
+}
+
+/**
+ * @brief The cheapest way to put every VM on a pCPU, trying them all. pcpu_costs[j][n] is pCPU j's cost for n VMs.
+ */
+static int brute_force_min_cost(int nr_vms, int nr_pcpus, int vm_costs[][3], int pcpu_costs[][7], int vm, int *nr_on_pcpu) {
+    if (vm == nr_vms) {
+        int cost = 0;
+        for (int j = 0; j < nr_pcpus; j++) {
+            cost += pcpu_costs[j][nr_on_pcpu[j]];
+        }
+        return cost;
+    }
+    int best = INF;
+    for (int j = 0; j < nr_pcpus; j++) {
+        nr_on_pcpu[j]++;
+        int cost = brute_force_min_cost(nr_vms, nr_pcpus, vm_costs, pcpu_costs, vm + 1, nr_on_pcpu);
+        nr_on_pcpu[j]--;
+        if (cost < INF && cost + vm_costs[vm][j] < best) {
+            best = cost + vm_costs[vm][j];
+        }
+    }
+    return best;
+}
+
+static void test_mcmf_convex_edges_match_brute_force() {
+    FlowGraph g;
+    CSRGraph csr;
+    int max_nodes = 6 + 3 + 2;
+    int max_edges = (6 + 6 * 3 + 3 * 6) * 2;
+    assert(graph_create(&g, max_nodes, max_edges) == 0);
+    assert(csr_create(&csr, max_nodes, max_edges) == 0);
+
+    srand(6212);
+    for (int round = 0; round < 300; round++) {
+        int nr_vms = 1 + rand() % 6;
+        int nr_pcpus = 1 + rand() % 3;
+        int vm_costs[6][3];
+        int pcpu_costs[3][7];
+        int sink = 1 + nr_vms + nr_pcpus;
+        graph_init(&g, sink + 1);
+        for (int i = 0; i < nr_vms; i++) {
+            graph_add_edge(&g, 0, 1 + i, 1, 0);
+            for (int j = 0; j < nr_pcpus; j++) {
+                vm_costs[i][j] = rand() % 100;
+                graph_add_edge(&g, 1 + i, 1 + nr_vms + j, 1, vm_costs[i][j]);
+            }
+        }
+        /* Every pCPU takes all the VMs, each one dearer than the last by a random step */
+        for (int j = 0; j < nr_pcpus; j++) {
+            int capacities[6];
+            int costs[6];
+            pcpu_costs[j][0] = 0;
+            for (int n = 0; n < 6; n++) {
+                capacities[n] = 1;
+                costs[n] = (n > 0 ? costs[n - 1] : 0) + rand() % 60;
+                pcpu_costs[j][n + 1] = pcpu_costs[j][n] + costs[n];
+            }
+            assert(graph_add_convex_edge(&g, 1 + nr_vms + j, sink, capacities, costs, 6) >= 0);
+        }
+        int nr_on_pcpu[3] = { 0 };
+        int expected = brute_force_min_cost(nr_vms, nr_pcpus, vm_costs, pcpu_costs, 0, nr_on_pcpu);
+
+        assert(csr_from_graph(&csr, &g) == 0);
+        MCMFResult compact = mcmf_solve_csr(&csr, 0, sink, round % 2 ? MCMF_SPFA : MCMF_DIJKSTRA);
+        MCMFResult list = mcmf_solve_with(&g, 0, sink, round % 2 ? MCMF_SPFA : MCMF_DIJKSTRA);
+        assert(list.total_flow == nr_vms && compact.total_flow == nr_vms);
+        assert(list.total_cost == expected);
+        assert(compact.total_cost == expected);
+    }
+    graph_destroy(&g);
+    csr_destroy(&csr);
+
+    printf("  PASS: test_mcmf_convex_edges_match_brute_force\n");
+}
+
 int main(void) {
     printf("Running mcmf tests ...\n\n");
 
     test_graph_can_init();
     test_graph_can_add_edge();
+    test_graph_can_add_convex_edge();
     test_mcmf_can_map_one_vm_to_one_cpu();
     test_mcmf_can_map_two_vm_to_two_cpu_using_reverse_edge();
+    test_mcmf_dijkstra_matches_spfa_on_reverse_edge_graph();
+    test_mcmf_dijkstra_matches_spfa_on_random_graphs();
+    test_mcmf_dijkstra_handles_negative_costs();
+    test_csr_keeps_adjacency_order_and_reverse_edges();
+    test_mcmf_csr_matches_adjacency_list_on_random_graphs();
+    test_mcmf_convex_edges_match_brute_force();
 
     printf("\nAll tests passed.\n");
     return 0;
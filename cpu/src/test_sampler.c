@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm_types.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+#define NS_PER_SEC 1000000000LL
+
+static void test_ring_keeps_ewma_peak_and_variance() {
+    SampleRing ring;
+    memset(&ring, 0, sizeof(SampleRing));
+    assert(sample_ring_peak(&ring) == 0);
+    assert(sample_ring_variance(&ring) == 0);
+
+    /* The first sample starts the average */
+    sample_ring_add(&ring, 40, 0.5);
+    assert(ring.ewma == 40);
+    sample_ring_add(&ring, 80, 0.5);
+    assert(ring.ewma == 60);
+    assert(sample_ring_peak(&ring) == 80);
+    assert(sample_ring_variance(&ring) == 400);
+
+    /* Old samples fall out of the ring but not out of the average */
+    for (int k = 0; k < SAMPLE_RING_LEN; k++) {
+        sample_ring_add(&ring, 10, 0.5);
+    }
+    assert(ring.nr_values == SAMPLE_RING_LEN);
+    assert(sample_ring_peak(&ring) == 10);
+    assert(sample_ring_variance(&ring) == 0);
+    assert(ring.ewma > 10 && ring.ewma < 10.01);
+
+    printf("PASS test_ring_keeps_ewma_peak_and_variance\n");
+}
+
+static void test_sampler_turns_counters_into_rates() {
+    static Sampler sampler;
+    static SystemState state;
+    sampler_init(&sampler, 1.0);
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 1;
+    state.nr_vms = 1;
+    state.vms[0].id = 7;
+
+    /* The first sample only records the counters */
+    sampler_add(&sampler, &state, 1 * NS_PER_SEC);
+    assert(sampler_apply(&sampler, &state) == 0);
+
+    /* Half a second of CPU time and a quarter second idle in one second */
+    state.vms[0].cpu_time = NS_PER_SEC / 2;
+    state.pcpus[0].idle_ns = NS_PER_SEC / 4;
+    sampler_add(&sampler, &state, 2 * NS_PER_SEC);
+    assert(sampler_apply(&sampler, &state) == 2);
+    assert(state.vms[0].cpu_usage_rate == 50);
+    assert(state.pcpus[0].utilization_rate == 75);
+    assert(state.pcpus[0].idle_rate == 25);
+
+    /* A VM that went away comes back without its history */
+    state.nr_vms = 0;
+    sampler_add(&sampler, &state, 3 * NS_PER_SEC);
+    state.nr_vms = 1;
+    state.vms[0].cpu_usage_rate = -1;
+    sampler_add(&sampler, &state, 4 * NS_PER_SEC);
+    assert(sampler_apply(&sampler, &state) == 1);
+    assert(state.vms[0].cpu_usage_rate == -1);
+
+    printf("PASS test_sampler_turns_counters_into_rates\n");
+}
+
+/**
+ * @brief Two pCPUs that take turns being busy, with one VM.
+ *
+ * Raw rates make the VM chase the idle pCPU every tick, the smoothed signals keep it put.
+ */
+static void test_bursty_load_does_not_flap() {
+    static Sampler sampler;
+    static SystemState state;
+    sampler_init(&sampler, SAMPLE_EWMA_ALPHA);
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 2;
+    state.pcpus[0].id = 0;
+    state.pcpus[1].id = 1;
+    state.nr_vms = 1;
+    state.vms[0].id = 1;
+    state.vms[0].current_pcpu = 0;
+
+    int raw_pcpu = 0;
+    int raw_moves = 0;
+    int smoothed_moves = 0;
+    for (int k = 1; k <= 40; k++) {
+        double busy0 = k % 2 ? 90 : 10;
+        double busy1 = 100 - busy0;
+        state.pcpus[0].idle_ns += (unsigned long long) ((100 - busy0) * NS_PER_SEC / 100);
+        state.pcpus[1].idle_ns += (unsigned long long) ((100 - busy1) * NS_PER_SEC / 100);
+
+        static SystemState raw;
+        raw = state;
+        raw.pcpus[0].utilization_rate = busy0;
+        raw.pcpus[1].utilization_rate = busy1;
+        raw.vms[0].current_pcpu = raw_pcpu;
+        Schedule schedule = compute_schedule(&raw);
+        raw_moves += schedule.vm_to_pcpu[0] != raw_pcpu;
+        raw_pcpu = schedule.vm_to_pcpu[0];
+
+        sampler_add(&sampler, &state, k * NS_PER_SEC);
+        sampler_apply(&sampler, &state);
+        schedule = compute_schedule(&state);
+        /* Let the average warm up */
+        if (k > 8) {
+            smoothed_moves += schedule.vm_to_pcpu[0] != state.vms[0].current_pcpu;
+        }
+        state.vms[0].current_pcpu = schedule.vm_to_pcpu[0];
+    }
+    assert(raw_moves >= 30);
+    assert(smoothed_moves == 0);
+    assert(state.pcpus[0].utilization_peak == 90);
+    assert(fabs(state.pcpus[0].utilization_stddev - 40) < 1e-6);
+
+    printf("PASS test_bursty_load_does_not_flap\n");
+}
+
+int main(void) {
+    printf("Running sampler tests ...\n\n");
+
+    test_ring_keeps_ewma_peak_and_variance();
+    test_sampler_turns_counters_into_rates();
+    test_bursty_load_does_not_flap();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
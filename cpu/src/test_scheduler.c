@@ -5,6 +5,7 @@
 #include "graph.h"
 #include "mcmf.h"
 #include "scheduler.h"
+#include "topology.h"
 
 static void test_can_four_vms_four_pcpus_with_zero_utilitzation() {
     SystemState state;
@@ -145,8 +146,9 @@ static void test_can_four_vms_four_pcpus_with_75p_utilitzation() {
     print_schedule(&schedule, 4);
 
     assert(schedule.num_assigned == 4);
-    assert(schedule.total_cost == 50);
-    assert(schedule.vm_to_pcpu[0] == 3);  // Pick the first edge that is cheaper. (PCPU 3 is the edge added the last so it appears first)
+    /* Moving VM 0 costs MIGRATION_PENALTY plus ADDITION_VM_PENALTY for doubling up, which is more than staying */
+    assert(schedule.total_cost == 75);
+    assert(schedule.vm_to_pcpu[0] == 0);
     assert(schedule.vm_to_pcpu[1] == 1);
     assert(schedule.vm_to_pcpu[2] == 2);
     assert(schedule.vm_to_pcpu[3] == 3);
@@ -154,12 +156,216 @@ static void test_can_four_vms_four_pcpus_with_75p_utilitzation() {
     printf("PASS test_can_four_vms_four_pcpus_with_75p_utilitzation\n");
 }
 
+static void test_can_schedule_512_vms_256_pcpus_without_reallocating() {
+    static SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 256;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+        state.pcpus[j].utilization_rate = (j * 37) % 100;
+    }
+    state.nr_vms = 512;
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].id = i;
+        state.vms[i].current_pcpu = (i * 7) % state.nr_pcpus;
+    }
+
+    static ScheduleWorkspace ws;
+    Schedule first = compute_schedule_on(&ws, &state);
+    int nr_mallocs = ws.graph.arena.nr_mallocs + ws.csr.arena.nr_mallocs;
+    Schedule second = compute_schedule_on(&ws, &state);
+
+    assert(first.num_assigned == 512);
+    assert(second.num_assigned == 512);
+    assert(first.total_cost == second.total_cost);
+    assert(ws.graph.arena.nr_mallocs + ws.csr.arena.nr_mallocs == nr_mallocs);  // The second tick reuses the arenas
+    for (int i = 0; i < state.nr_vms; i++) {
+        assert(second.vm_to_pcpu[i] >= 0 && second.vm_to_pcpu[i] < state.nr_pcpus);
+    }
+    schedule_workspace_destroy(&ws);
+
+    printf("PASS test_can_schedule_512_vms_256_pcpus_without_reallocating\n");
+}
+
+static void test_can_spread_vcpus_of_one_vm_across_pcpus() {
+    static SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 4;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+        state.pcpus[j].utilization_rate = 0;
+    }
+    /* One VM with all 4 vCPUs on pCPU 0 */
+    state.nr_vms = 1;
+    state.vms[0].id = 0;
+    state.vms[0].nr_vcpus = 4;
+    for (int k = 0; k < 4; k++) {
+        state.vms[0].vcpu_pcpu[k] = 0;
+    }
+    state.vms[0].current_pcpu = 0;
+
+    Schedule schedule = compute_schedule(&state);
+
+    /* vCPU 0 stays and the other 3 move to their own pCPU */
+    assert(schedule.num_assigned == 4);
+    assert(schedule.total_cost == 3 * MIGRATION_PENALTY);
+    assert(schedule.vm_to_pcpu[0] == 0);
+    bool used[4] = { false };
+    for (int k = 0; k < 4; k++) {
+        int pcpu = schedule.vcpu_to_pcpu[0][k];
+        assert(pcpu >= 0 && pcpu < 4);
+        assert(!used[pcpu]);
+        used[pcpu] = true;
+    }
+
+    printf("PASS test_can_spread_vcpus_of_one_vm_across_pcpus\n");
+}
+
+static void test_can_keep_spread_vcpus_in_place() {
+    static SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 4;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+        state.pcpus[j].utilization_rate = 25;
+    }
+    /* Two VMs with 2 vCPUs each on their own pCPUs, listed in reverse */
+    state.nr_vms = 2;
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].id = i;
+        state.vms[i].nr_vcpus = 2;
+        state.vms[i].vcpu_pcpu[0] = 2 * i + 1;
+        state.vms[i].vcpu_pcpu[1] = 2 * i;
+        state.vms[i].current_pcpu = 2 * i + 1;
+    }
+
+    Schedule schedule = compute_schedule(&state);
+
+    assert(schedule.num_assigned == 4);
+    assert(schedule.total_cost == 4 * 25);
+    for (int i = 0; i < state.nr_vms; i++) {
+        assert(schedule.vcpu_to_pcpu[i][0] == 2 * i + 1);
+        assert(schedule.vcpu_to_pcpu[i][1] == 2 * i);
+    }
+
+    printf("PASS test_can_keep_spread_vcpus_in_place\n");
+}
+
+/**
+ * @brief One single vCPU VM on pCPU 3 of the dual socket fixture host.
+ */
+static void setup_dual_socket_state(SystemState *state) {
+    memset(state, 0, sizeof(SystemState));
+    FILE *file = fopen("topology_dual_socket.lscpu", "r");
+    assert(file != NULL);
+    assert(topology_parse_lscpu(&state->topology, file) == 0);
+    fclose(file);
+
+    state->nr_pcpus = 32;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].utilization_rate = 0;
+    }
+    state->nr_vms = 1;
+    state->vms[0].id = 0;
+    state->vms[0].current_pcpu = 3;
+}
+
+static void test_can_move_within_llc_before_remote_node() {
+    static SystemState state;
+    setup_dual_socket_state(&state);
+    state.pcpus[3].utilization_rate = 90;
+
+    /* The SMT sibling 19 shares the busy core, so a pCPU on the same LLC is cheapest */
+    assert(pcpu_load_cost(&state, 19) == 45);
+    Schedule schedule = compute_schedule(&state);
+    int pcpu = schedule.vm_to_pcpu[0];
+    assert(schedule.total_cost == SAME_LLC_MIGRATION_PENALTY);
+    assert(pcpu % 16 < 8 && pcpu != 3 && pcpu != 19);
+
+    printf("PASS test_can_move_within_llc_before_remote_node\n");
+}
+
+static void test_can_move_to_smt_sibling_when_node_is_busy() {
+    static SystemState state;
+    setup_dual_socket_state(&state);
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        bool same_node = (j % 16) < 8;
+        state.pcpus[j].utilization_rate = same_node ? 60 : 0;
+    }
+    state.pcpus[3].utilization_rate = 90;
+    state.pcpus[19].utilization_rate = 0;
+
+    /* Sibling: 10 + 45, same LLC: 25 + 60 + 30, remote: 80 */
+    Schedule schedule = compute_schedule(&state);
+    assert(schedule.vm_to_pcpu[0] == 19);
+    assert(schedule.total_cost == SMT_SIBLING_MIGRATION_PENALTY + 45);
+
+    /* Without a topology every move costs the same and the idle remote pCPUs win */
+    state.topology.nr_cpus = 0;
+    schedule = compute_schedule(&state);
+    assert(schedule.total_cost == MIGRATION_PENALTY);
+
+    printf("PASS test_can_move_to_smt_sibling_when_node_is_busy\n");
+}
+
+/**
+ * @brief The lowest schedule_total_cost of any placement of the single vCPU VMs from vm on.
+ */
+static int cheapest_placement(const SystemState *state, Schedule *schedule, int vm) {
+    if (vm == state->nr_vms) {
+        int cost = schedule_total_cost(state, schedule);
+        return cost >= 0 ? cost : INF;
+    }
+    int best = INF;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        schedule->vcpu_to_pcpu[vm][0] = j;
+        int cost = cheapest_placement(state, schedule, vm + 1);
+        best = cost < best ? cost : best;
+    }
+    return best;
+}
+
+static void test_schedule_is_optimal_with_addition_penalty() {
+    static SystemState state;
+    static Schedule schedule;
+    srand(6213);
+    for (int round = 0; round < 200; round++) {
+        memset(&state, 0, sizeof(SystemState));
+        state.nr_pcpus = 2 + rand() % 3;
+        for (int j = 0; j < state.nr_pcpus; j++) {
+            state.pcpus[j].id = j;
+            state.pcpus[j].utilization_rate = rand() % 100;
+        }
+        state.nr_vms = 1 + rand() % (state.nr_pcpus * MAX_VMS_PER_PCPU);
+        for (int i = 0; i < state.nr_vms; i++) {
+            state.vms[i].id = i + 1;
+            state.vms[i].current_pcpu = rand() % state.nr_pcpus;
+        }
+
+        /* The pCPU -> Sink costs are convex edges, so the flow is the cheapest placement */
+        Schedule flow = compute_schedule(&state);
+        assert(flow.num_assigned == state.nr_vms);
+        assert(flow.total_cost == schedule_total_cost(&state, &flow));
+        memset(&schedule, -1, sizeof(Schedule));
+        assert(flow.total_cost == cheapest_placement(&state, &schedule, 0));
+    }
+
+    printf("PASS test_schedule_is_optimal_with_addition_penalty\n");
+}
+
 int main(void) {
     printf("Running scheduler tests ...\n\n");
 
     test_can_four_vms_four_pcpus_with_zero_utilitzation();
     test_can_four_vms_four_pcpus_with_25p_utilitzation();
     test_can_four_vms_four_pcpus_with_75p_utilitzation();
+    test_can_schedule_512_vms_256_pcpus_without_reallocating();
+    test_can_spread_vcpus_of_one_vm_across_pcpus();
+    test_can_keep_spread_vcpus_in_place();
+    test_can_move_within_llc_before_remote_node();
+    test_can_move_to_smt_sibling_when_node_is_busy();
+    test_schedule_is_optimal_with_addition_penalty();
 
     printf("\nAll tests passed.\n");
     return 0;
@@ -0,0 +1,365 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+#include "incremental_scheduler.h"
+#include "stability.h"
+
+/* Recorded monitor.py output of the three test cases */
+static const char *TRACES[] = { "vcpu_scheduler1.log", "vcpu_scheduler2.log", "vcpu_scheduler3.log" };
+#define TRACE_VMS 4
+#define TRACE_PCPUS 6
+#define MAX_TRACE_TICKS 64
+
+/**
+ * @brief The CPU demand of each VM (percent of a pCPU) at every iteration of a monitor.py run.
+ */
+typedef struct {
+    int nr_ticks;
+    double demand[MAX_TRACE_TICKS][TRACE_VMS];
+} MonitorTrace;
+
+/**
+ * @brief Reads the iterations of a monitor.py log. A pCPU's usage is split evenly between the VMs mapped to it.
+ */
+static void read_monitor_trace(const char *path, MonitorTrace *trace) {
+    FILE *file = fopen(path, "r");
+    assert(file != NULL);
+    memset(trace, 0, sizeof(MonitorTrace));
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int pcpu;
+        double usage;
+        if (strncmp(line, "Iteration number", strlen("Iteration number")) == 0) {
+            assert(trace->nr_ticks < MAX_TRACE_TICKS);
+            trace->nr_ticks++;
+            continue;
+        }
+        if (trace->nr_ticks == 0 || sscanf(line, "%d - usage: %lf", &pcpu, &usage) != 2) {
+            continue;
+        }
+        int vms[TRACE_VMS];
+        int nr_vms = 0;
+        for (char *name = strstr(line, "'aos_vm"); name != NULL; name = strstr(name + 1, "'aos_vm")) {
+            int vm = atoi(name + strlen("'aos_vm")) - 1;
+            assert(vm >= 0 && vm < TRACE_VMS && nr_vms < TRACE_VMS);
+            vms[nr_vms++] = vm;
+        }
+        for (int v = 0; v < nr_vms; v++) {
+            trace->demand[trace->nr_ticks - 1][vms[v]] = usage / nr_vms;
+        }
+    }
+    fclose(file);
+    assert(trace->nr_ticks > 0);
+}
+
+typedef struct {
+    int nr_migrations;
+    int max_tick_migrations;
+    /* pCPU ticks with more demand than the pCPU has */
+    int nr_overloaded;
+} ReplayResult;
+
+/**
+ * @brief Runs the scheduler over the trace, moving the VMs where every schedule puts them.
+ *
+ * The pCPUs are busy with the demand of the VMs on them. Checks the budget and
+ * cooldown of the stabilizer on every tick when there is one.
+ */
+static ReplayResult replay(const MonitorTrace *trace, Stabilizer *stabilizer) {
+    static SystemState state;
+    ReplayResult result = { 0, 0, 0 };
+    int moved_tick[TRACE_VMS];
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = TRACE_PCPUS;
+    for (int j = 0; j < TRACE_PCPUS; j++) {
+        state.pcpus[j].id = j;
+    }
+    state.nr_vms = TRACE_VMS;
+    for (int i = 0; i < TRACE_VMS; i++) {
+        state.vms[i].id = i + 1;
+        snprintf(state.vms[i].name, MAX_NAME_LEN, "aos_vm%d", i + 1);
+        state.vms[i].current_pcpu = i;
+        moved_tick[i] = -MAX_TRACE_TICKS;
+    }
+
+    for (int t = 0; t < trace->nr_ticks; t++) {
+        double demand[TRACE_PCPUS] = { 0 };
+        for (int i = 0; i < TRACE_VMS; i++) {
+            state.vms[i].cpu_usage_rate = trace->demand[t][i];
+            demand[state.vms[i].current_pcpu] += trace->demand[t][i];
+        }
+        for (int j = 0; j < TRACE_PCPUS; j++) {
+            state.pcpus[j].utilization_rate = demand[j] < 100 ? demand[j] : 100;
+            result.nr_overloaded += demand[j] > 100;
+        }
+
+        Schedule schedule;
+        if (stabilizer == NULL) {
+            schedule = compute_schedule(&state);
+        } else {
+            assert(stable_schedule(stabilizer, NULL, &state, &schedule) == 0);
+        }
+        assert(schedule.num_assigned == TRACE_VMS);
+        int nr_migrations = schedule_nr_migrations(&state, &schedule);
+        if (stabilizer != NULL) {
+            assert(stabilizer->stats.nr_migrations == nr_migrations);
+            assert(nr_migrations <= stabilizer->policy.max_migrations);
+        }
+        result.nr_migrations += nr_migrations;
+        if (nr_migrations > result.max_tick_migrations) {
+            result.max_tick_migrations = nr_migrations;
+        }
+        for (int i = 0; i < TRACE_VMS; i++) {
+            if (schedule.vm_to_pcpu[i] == state.vms[i].current_pcpu) {
+                continue;
+            }
+            if (stabilizer != NULL) {
+                assert(t - moved_tick[i] > stabilizer->policy.cooldown_ticks);
+            }
+            moved_tick[i] = t;
+            state.vms[i].current_pcpu = schedule.vm_to_pcpu[i];
+        }
+    }
+    return result;
+}
+
+static void test_replayed_traces_migrate_less() {
+    static MonitorTrace trace;
+    for (int n = 0; n < 3; n++) {
+        read_monitor_trace(TRACES[n], &trace);
+        static Stabilizer stabilizer;
+        stabilizer_init(&stabilizer, stability_default_policy());
+        ReplayResult unstable = replay(&trace, NULL);
+        ReplayResult stable = replay(&trace, &stabilizer);
+        printf("%s: %d -> %d migrations, %d -> %d overloaded pCPU ticks\n",
+            TRACES[n], unstable.nr_migrations, stable.nr_migrations, unstable.nr_overloaded, stable.nr_overloaded);
+        assert(stable.nr_migrations <= unstable.nr_migrations);
+        assert(stable.nr_overloaded <= unstable.nr_overloaded);
+    }
+
+    printf("PASS test_replayed_traces_migrate_less\n");
+}
+
+/**
+ * @brief VMs that jump between light and heavy load every few ticks keep chasing the idle pCPUs without the stabilizer.
+ */
+static void test_bursty_trace_does_not_flap() {
+    static MonitorTrace trace;
+    memset(&trace, 0, sizeof(MonitorTrace));
+    srand(14);
+    trace.nr_ticks = MAX_TRACE_TICKS;
+    for (int t = 0; t < trace.nr_ticks; t++) {
+        for (int i = 0; i < TRACE_VMS; i++) {
+            trace.demand[t][i] = (rand() % 3 == 0) ? 95 : 40 + rand() % 20;
+        }
+    }
+    static Stabilizer stabilizer;
+    stabilizer_init(&stabilizer, stability_default_policy());
+    ReplayResult unstable = replay(&trace, NULL);
+    ReplayResult stable = replay(&trace, &stabilizer);
+    printf("bursty: %d -> %d migrations\n", unstable.nr_migrations, stable.nr_migrations);
+    assert(stable.nr_migrations * 3 < unstable.nr_migrations * 2);
+    assert(stable.nr_overloaded == 0);
+
+    printf("PASS test_bursty_trace_does_not_flap\n");
+}
+
+/**
+ * @brief One VM alone on a busy pCPU next to idle ones, moving saves load - MIGRATION_PENALTY.
+ */
+static void setup_busy_vm(SystemState *state, double load) {
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = 2;
+    state->pcpus[0].id = 0;
+    state->pcpus[0].utilization_rate = load;
+    state->pcpus[1].id = 1;
+    state->nr_vms = 1;
+    state->vms[0].id = 7;
+    state->vms[0].current_pcpu = 0;
+}
+
+static void test_small_improvement_keeps_current() {
+    static SystemState state;
+    Schedule schedule;
+    static Stabilizer stabilizer;
+    stabilizer_init(&stabilizer, stability_default_policy());
+
+    setup_busy_vm(&state, MIGRATION_PENALTY + STABILITY_MIN_IMPROVEMENT - 1);
+    assert(compute_schedule(&state).vm_to_pcpu[0] == 1);
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.vm_to_pcpu[0] == 0);
+    assert(schedule.total_cost == MIGRATION_PENALTY + STABILITY_MIN_IMPROVEMENT - 1);
+    assert(stabilizer.stats.kept_current);
+    assert(stabilizer.stats.improvement == STABILITY_MIN_IMPROVEMENT - 1);
+    assert(stabilizer.stats.nr_migrations == 0);
+
+    setup_busy_vm(&state, MIGRATION_PENALTY + STABILITY_MIN_IMPROVEMENT);
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.vm_to_pcpu[0] == 1);
+    assert(schedule.total_cost == MIGRATION_PENALTY);
+    assert(!stabilizer.stats.kept_current);
+    assert(stabilizer.stats.nr_migrations == 1);
+
+    printf("PASS test_small_improvement_keeps_current\n");
+}
+
+static void test_cooldown_holds_moved_vm() {
+    static SystemState state;
+    Schedule schedule;
+    static Stabilizer stabilizer;
+    stabilizer_init(&stabilizer, stability_default_policy());
+
+    setup_busy_vm(&state, 100);
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.vm_to_pcpu[0] == 1);
+
+    /* Now pCPU 1 is the busy one */
+    state.vms[0].current_pcpu = 1;
+    state.pcpus[0].utilization_rate = 0;
+    state.pcpus[1].utilization_rate = 100;
+    for (int t = 0; t < STABILITY_COOLDOWN_TICKS; t++) {
+        assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+        assert(schedule.vm_to_pcpu[0] == 1);
+        assert(stabilizer.stats.nr_cooling == 1);
+    }
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.vm_to_pcpu[0] == 0);
+    assert(stabilizer.stats.nr_cooling == 0);
+
+    printf("PASS test_cooldown_holds_moved_vm\n");
+}
+
+/**
+ * @brief Two busy VMs on each of the first pCPUs and as many idle pCPUs.
+ */
+static void setup_stacked_vms(SystemState *state, int nr_busy_pcpus) {
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = 2 * nr_busy_pcpus;
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].utilization_rate = j < nr_busy_pcpus ? 100 : 0;
+    }
+    state->nr_vms = 2 * nr_busy_pcpus;
+    for (int i = 0; i < state->nr_vms; i++) {
+        state->vms[i].id = 100 + i;
+        state->vms[i].current_pcpu = i / 2;
+    }
+}
+
+static void test_budget_caps_migrations() {
+    static SystemState state;
+    static Schedule schedule;
+    static IncrementalScheduler scheduler;
+    static Stabilizer stabilizer;
+    StabilityPolicy policy = { .min_improvement = 0, .max_migrations = 2, .cooldown_ticks = 0 };
+    stabilizer_init(&stabilizer, policy);
+
+    setup_stacked_vms(&state, 4);
+    schedule = compute_schedule(&state);
+    assert(schedule_nr_migrations(&state, &schedule) > 2);
+    assert(stable_schedule(&stabilizer, &scheduler, &state, &schedule) == 0);
+    assert(schedule.num_assigned == 8);
+    assert(schedule_nr_migrations(&state, &schedule) == 2);
+    assert(stabilizer.stats.nr_migrations == 2);
+    assert(stabilizer.stats.budget_penalty > 0);
+    assert(stabilizer.stats.nr_solves > 2);
+    /* Still cheaper than staying put, and priced without the budget penalty */
+    assert(schedule.total_cost == schedule_total_cost(&state, &schedule));
+    assert(schedule.total_cost < current_schedule(&state).total_cost);
+
+    /* The moves left over happen on the next ticks */
+    for (int t = 0; t < 3; t++) {
+        for (int i = 0; i < state.nr_vms; i++) {
+            state.vms[i].current_pcpu = schedule.vm_to_pcpu[i];
+        }
+        assert(stable_schedule(&stabilizer, &scheduler, &state, &schedule) == 0);
+        assert(stabilizer.stats.nr_migrations <= 2);
+    }
+    assert(stabilizer.stats.nr_migrations == 0);
+    assert(schedule.total_cost == compute_schedule(&state).total_cost);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_budget_caps_migrations\n");
+}
+
+static void test_forced_moves_ignore_budget_and_cooldown() {
+    static SystemState state;
+    static Schedule schedule;
+    static Stabilizer stabilizer;
+    StabilityPolicy policy = { .min_improvement = 1000, .max_migrations = 1, .cooldown_ticks = 10 };
+    stabilizer_init(&stabilizer, policy);
+
+    /* Four VMs on a pCPU that takes two */
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 3;
+    for (int j = 0; j < state.nr_pcpus; j++) {
+        state.pcpus[j].id = j;
+    }
+    state.nr_vms = 4;
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].id = i;
+    }
+    assert(current_schedule(&state).total_cost == -1);
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.num_assigned == 4);
+    assert(stabilizer.stats.nr_migrations == 2);
+    assert(stabilizer.stats.improvement == -1);
+    assert(!stabilizer.stats.kept_current);
+
+    /* The VMs that moved are cooling down, but pCPU 0 still has no room for them */
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].current_pcpu = 0;
+    }
+    assert(stable_schedule(&stabilizer, NULL, &state, &schedule) == 0);
+    assert(schedule.num_assigned == 4);
+    assert(stabilizer.stats.nr_cooling == 2);
+    assert(stabilizer.stats.nr_migrations == 2);
+
+    printf("PASS test_forced_moves_ignore_budget_and_cooldown\n");
+}
+
+static void test_solve_budget_bounds_the_tick() {
+    static SystemState state;
+    static Schedule schedule;
+    static IncrementalScheduler scheduler;
+    static Stabilizer stabilizer;
+    StabilityPolicy policy = { .min_improvement = 0, .max_migrations = 2, .cooldown_ticks = 0, .solve_budget_ns = 1 };
+    stabilizer_init(&stabilizer, policy);
+
+    /* Out of time before the first cycle: the flow built from the current placement */
+    setup_stacked_vms(&state, 64);
+    assert(stable_schedule(&stabilizer, &scheduler, &state, &schedule) == 0);
+    assert(!stabilizer.stats.optimal);
+    assert(stabilizer.stats.nr_solves == 1);
+    assert(schedule.num_assigned == state.nr_vms);
+    assert(stabilizer.stats.nr_migrations == 0);
+    assert(schedule.total_cost == current_schedule(&state).total_cost);
+
+    /* With the time for it, the same tick ends at the optimum within the migration budget */
+    stabilizer.policy.solve_budget_ns = 10000000000LL;
+    assert(stable_schedule(&stabilizer, &scheduler, &state, &schedule) == 0);
+    assert(stabilizer.stats.optimal);
+    assert(stabilizer.stats.nr_migrations == 2);
+    assert(stabilizer.stats.nr_solves > 2);
+    assert(schedule.total_cost < current_schedule(&state).total_cost);
+    incremental_scheduler_destroy(&scheduler);
+
+    printf("PASS test_solve_budget_bounds_the_tick\n");
+}
+
+int main(void) {
+    printf("Running stability tests ...\n\n");
+
+    test_small_improvement_keeps_current();
+    test_cooldown_holds_moved_vm();
+    test_budget_caps_migrations();
+    test_forced_moves_ignore_budget_and_cooldown();
+    test_solve_budget_bounds_the_tick();
+    test_replayed_traces_migrate_less();
+    test_bursty_trace_does_not_flap();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
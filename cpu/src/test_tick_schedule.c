@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <stdio.h>
+#include "tick_schedule.h"
+
+#define MS 1000000LL
+
+static void test_deadlines_do_not_drift() {
+    TickSchedule schedule;
+    tick_schedule_init(&schedule, 0, 500 * MS);
+    assert(tick_schedule_timeout_ms(&schedule, 0, false) == 0);
+
+    /* Every tick takes 30 ms, the deadlines stay on the 500 ms grid */
+    long long now = 0;
+    for (int k = 1; k <= 10; k++) {
+        now += 30 * MS;
+        tick_schedule_ran(&schedule, now);
+        assert(schedule.next_ns == k * 500 * MS);
+        assert(tick_schedule_timeout_ms(&schedule, now, false) == 470);
+        now = schedule.next_ns;
+    }
+    assert(schedule.nr_missed == 0);
+
+    printf("PASS test_deadlines_do_not_drift\n");
+}
+
+static void test_overrun_skips_missed_deadlines() {
+    TickSchedule schedule;
+    tick_schedule_init(&schedule, 0, 100 * MS);
+
+    /* A 350 ms tick passes the 100, 200 and 300 ms deadlines */
+    tick_schedule_ran(&schedule, 350 * MS);
+    assert(schedule.nr_missed == 3);
+    assert(schedule.next_ns == 400 * MS);
+    assert(tick_schedule_timeout_ms(&schedule, 350 * MS, false) == 50);
+
+    printf("PASS test_overrun_skips_missed_deadlines\n");
+}
+
+static void test_early_tick_keeps_grid_and_gap() {
+    TickSchedule schedule;
+    tick_schedule_init(&schedule, 0, 1000 * MS);
+    tick_schedule_ran(&schedule, 10 * MS);
+
+    /* Requested 100 ms after the tick, waits for a quarter period */
+    assert(tick_schedule_timeout_ms(&schedule, 100 * MS, true) == 160);
+    /* Requested later it runs right away */
+    assert(tick_schedule_timeout_ms(&schedule, 600 * MS, true) == 0);
+
+    /* The early tick doesn't move the regular deadline */
+    tick_schedule_ran(&schedule, 620 * MS);
+    assert(schedule.next_ns == 1000 * MS);
+    assert(tick_schedule_timeout_ms(&schedule, 620 * MS, false) == 380);
+    /* A deadline closer than the end of the gap wins */
+    tick_schedule_ran(&schedule, 950 * MS);
+    assert(tick_schedule_timeout_ms(&schedule, 960 * MS, true) == 40);
+
+    printf("PASS test_early_tick_keeps_grid_and_gap\n");
+}
+
+static void test_can_parse_sub_second_periods() {
+    assert(tick_parse_period("2") == 2000 * MS);
+    assert(tick_parse_period("0.25") == 250 * MS);
+    assert(tick_parse_period("0") == -1);
+    assert(tick_parse_period("-1") == -1);
+    assert(tick_parse_period("1s") == -1);
+    assert(tick_parse_period("") == -1);
+
+    printf("PASS test_can_parse_sub_second_periods\n");
+}
+
+static void test_threshold_crossings() {
+    double previous[] = {50, 95, 89, 90};
+    double current[]  = {95, 99, 90, 50};
+    assert(tick_crossed_above(previous, current, 4, 90) == 2);
+    assert(tick_crossed_below(previous, current, 4, 90) == 1);
+    assert(tick_crossed_above(current, current, 4, 90) == 0);
+
+    printf("PASS test_threshold_crossings\n");
+}
+
+int main(void) {
+    printf("Running tick schedule tests ...\n\n");
+
+    test_deadlines_do_not_drift();
+    test_overrun_skips_missed_deadlines();
+    test_early_tick_keeps_grid_and_gap();
+    test_can_parse_sub_second_periods();
+    test_threshold_crossings();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "topology.h"
+
+#define FIXTURE "topology_dual_socket.lscpu"
+
+static void write_file(const char *dir, const char *name, const char *content) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    /* Make the parent directories */
+    for (char *p = path + strlen(dir) + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    fprintf(file, "%s\n", content);
+    fclose(file);
+}
+
+static void test_can_parse_lscpu_fixture() {
+    CPUTopology topology;
+    FILE *file = fopen(FIXTURE, "r");
+    assert(file != NULL);
+    assert(topology_parse_lscpu(&topology, file) == 0);
+    fclose(file);
+
+    /* 2 sockets x 8 cores x 2 threads, cpu N and N + 16 are siblings */
+    assert(topology.nr_cpus == 32);
+    assert(topology_distance(&topology, 3, 3) == TOPOLOGY_SAME_CPU);
+    assert(topology_distance(&topology, 3, 19) == TOPOLOGY_SMT_SIBLING);
+    assert(topology_distance(&topology, 3, 4) == TOPOLOGY_SAME_LLC);
+    assert(topology_distance(&topology, 3, 20) == TOPOLOGY_SAME_LLC);
+    assert(topology_distance(&topology, 3, 8) == TOPOLOGY_REMOTE_NODE);
+    assert(topology_distance(&topology, 31, 0) == TOPOLOGY_REMOTE_NODE);
+
+    printf("PASS test_can_parse_lscpu_fixture\n");
+}
+
+static void test_can_load_sysfs_tree() {
+    char root[] = "/tmp/test_topology_XXXXXX";
+    assert(mkdtemp(root) != NULL);
+
+    /* 1 node, 2 cores x 2 threads, each core has its own L2 and they share an L3 */
+    const char *siblings[] = {"0,2", "1,3", "0,2", "1,3"};
+    const char *l2[] = {"0,2", "1,3", "0,2", "1,3"};
+    char name[256];
+    for (int cpu = 0; cpu < 4; cpu++) {
+        snprintf(name, sizeof(name), "devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        write_file(root, name, siblings[cpu]);
+        snprintf(name, sizeof(name), "devices/system/cpu/cpu%d/cache/index0/level", cpu);
+        write_file(root, name, "2");
+        snprintf(name, sizeof(name), "devices/system/cpu/cpu%d/cache/index0/shared_cpu_list", cpu);
+        write_file(root, name, l2[cpu]);
+        snprintf(name, sizeof(name), "devices/system/cpu/cpu%d/cache/index1/level", cpu);
+        write_file(root, name, "3");
+        snprintf(name, sizeof(name), "devices/system/cpu/cpu%d/cache/index1/shared_cpu_list", cpu);
+        write_file(root, name, "0-3");
+    }
+    write_file(root, "devices/system/node/node0/cpulist", "0-1");
+    write_file(root, "devices/system/node/node1/cpulist", "2-3");
+
+    CPUTopology topology;
+    assert(topology_load_sysfs(&topology, root, 4) == 0);
+    assert(topology.nr_cpus == 4);
+    assert(topology_distance(&topology, 0, 1) == TOPOLOGY_SAME_LLC);
+    assert(topology_distance(&topology, 0, 2) == TOPOLOGY_REMOTE_NODE);
+    assert(topology_distance(&topology, 2, 3) == TOPOLOGY_SAME_LLC);
+    assert(topology.core[0] == topology.core[2]);
+
+    /* A CPU without topology fails the load */
+    assert(topology_load_sysfs(&topology, root, 5) == -1);
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    assert(system(command) == 0);
+
+    printf("PASS test_can_load_sysfs_tree\n");
+}
+
+static void test_unknown_topology_is_one_node() {
+    CPUTopology topology;
+    memset(&topology, 0, sizeof(CPUTopology));
+    assert(topology_distance(&topology, 0, 0) == TOPOLOGY_SAME_CPU);
+    assert(topology_distance(&topology, 0, 1) == TOPOLOGY_SAME_NODE);
+    assert(topology_distance(&topology, -1, 1) == TOPOLOGY_SAME_NODE);
+
+    printf("PASS test_unknown_topology_is_one_node\n");
+}
+
+int main(void) {
+    printf("Running topology tests ...\n\n");
+
+    test_can_parse_lscpu_fixture();
+    test_can_load_sysfs_tree();
+    test_unknown_topology_is_one_node();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+#include "topology.h"
+#include "trace.h"
+#include "simulator.h"
+
+/**
+ * @brief Random state where every VM has 1 to max_vcpus vCPUs on random pCPUs.
+ */
+static void setup_random_state(SystemState *state, int nr_vms, int nr_pcpus, int max_vcpus) {
+    memset(state, 0, sizeof(SystemState));
+    state->nr_pcpus = nr_pcpus;
+    for (int j = 0; j < nr_pcpus; j++) {
+        state->pcpus[j].id = j;
+        state->pcpus[j].utilization_rate = rand() % 100;
+        state->pcpus[j].utilization_peak = state->pcpus[j].utilization_rate + rand() % 10;
+        state->pcpus[j].utilization_stddev = (rand() % 100) / 10.0;
+        state->pcpus[j].idle_ns = (unsigned long long) rand() * 1000;
+        state->pcpus[j].idle_rate = 1 - state->pcpus[j].utilization_rate / 100;
+    }
+    state->nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        vm->id = i + 1;
+        snprintf(vm->name, MAX_NAME_LEN, "vm%d", i);
+        vm->nr_vcpus = 1 + rand() % max_vcpus;
+        for (int k = 0; k < vm->nr_vcpus; k++) {
+            vm->vcpu_pcpu[k] = rand() % nr_pcpus;
+        }
+        vm->current_pcpu = vm->vcpu_pcpu[0];
+        vm->cpu_usage_rate = rand() % (100 * vm->nr_vcpus);
+        vm->cpu_usage_peak = vm->cpu_usage_rate + 5;
+        vm->cpu_usage_stddev = 2.5;
+        vm->cpu_time = (unsigned long long) rand() * rand();
+    }
+}
+
+static void assert_same_state(const SystemState *a, const SystemState *b) {
+    assert(a->nr_pcpus == b->nr_pcpus);
+    assert(memcmp(a->pcpus, b->pcpus, sizeof(PCPU) * a->nr_pcpus) == 0);
+    assert(a->nr_vms == b->nr_vms);
+    for (int i = 0; i < a->nr_vms; i++) {
+        const VM *x = &a->vms[i];
+        const VM *y = &b->vms[i];
+        assert(strcmp(x->name, y->name) == 0);
+        assert(x->id == y->id && x->current_pcpu == y->current_pcpu && x->nr_vcpus == y->nr_vcpus);
+        assert(memcmp(x->vcpu_pcpu, y->vcpu_pcpu, sizeof(int) * x->nr_vcpus) == 0);
+        assert(x->cpu_usage_rate == y->cpu_usage_rate);
+        assert(x->cpu_usage_peak == y->cpu_usage_peak);
+        assert(x->cpu_usage_stddev == y->cpu_usage_stddev);
+        assert(x->cpu_time == y->cpu_time);
+    }
+    assert(memcmp(&a->topology, &b->topology, sizeof(CPUTopology)) == 0);
+}
+
+static void test_trace_round_trips_states_and_schedules() {
+    static SystemState states[3];
+    static SystemState read;
+    static Schedule schedules[3];
+    static Schedule read_schedule;
+    TraceWriter writer;
+    TraceReader reader;
+
+    srand(15);
+    FILE *topology_file = fopen("topology_dual_socket.lscpu", "r");
+    assert(topology_file != NULL);
+    for (int t = 0; t < 3; t++) {
+        setup_random_state(&states[t], 6, 32, 4);
+        /* The topology shows up in the second tick and stays */
+        if (t == 1) {
+            assert(topology_parse_lscpu(&states[t].topology, topology_file) == 0);
+        } else if (t == 2) {
+            states[t].topology = states[1].topology;
+        }
+        schedules[t] = compute_schedule(&states[t]);
+    }
+    fclose(topology_file);
+
+    FILE *file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    long topology_bytes = 0;
+    for (int t = 0; t < 3; t++) {
+        long before = writer.nr_bytes;
+        assert(trace_write_state(&writer, 1000 * t, &states[t]) == 0);
+        assert(trace_write_schedule(&writer, 1000 * t + 1, &schedules[t]) == 0);
+        if (t == 1) {
+            topology_bytes = writer.nr_bytes - before;
+        } else if (t == 2) {
+            /* No second copy of the topology */
+            assert(writer.nr_bytes - before < topology_bytes);
+        }
+    }
+    assert(ftell(file) == writer.nr_bytes);
+
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == 0);
+    for (int t = 0; t < 3; t++) {
+        assert(trace_read(&reader, &read, &read_schedule) == TRACE_STATE);
+        assert(reader.time_ns == 1000 * t);
+        assert_same_state(&states[t], &read);
+
+        assert(trace_read(&reader, &read, &read_schedule) == TRACE_SCHEDULE);
+        assert(reader.time_ns == 1000 * t + 1);
+        assert(read_schedule.num_assigned == schedules[t].num_assigned);
+        assert(read_schedule.total_cost == schedules[t].total_cost);
+        for (int i = 0; i < states[t].nr_vms; i++) {
+            assert(read_schedule.vm_to_pcpu[i] == schedules[t].vm_to_pcpu[i]);
+            assert(memcmp(read_schedule.vcpu_to_pcpu[i], schedules[t].vcpu_to_pcpu[i], sizeof(int) * MAX_VCPUS_PER_VM) == 0);
+        }
+    }
+    assert(trace_read(&reader, &read, &read_schedule) == 0);
+    fclose(file);
+
+    printf("PASS test_trace_round_trips_states_and_schedules\n");
+}
+
+static void test_trace_rejects_other_files_and_truncated_records() {
+    static SystemState state;
+    static Schedule schedule;
+    TraceWriter writer;
+    TraceReader reader;
+
+    FILE *file = tmpfile();
+    fputs("Script started on 2026-02-16", file);
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == -1);
+    fclose(file);
+
+    /* Every cut inside the state record is an error, not a short state */
+    srand(16);
+    setup_random_state(&state, 4, 4, 2);
+    file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    long header_bytes = writer.nr_bytes;
+    assert(trace_write_state(&writer, 5, &state) == 0);
+    fflush(file);
+    char *bytes = malloc(writer.nr_bytes);
+    rewind(file);
+    assert(fread(bytes, 1, writer.nr_bytes, file) == (size_t) writer.nr_bytes);
+    fclose(file);
+    /* Past the header and the empty topology record (type and count) */
+    for (long length = header_bytes + 3; length < writer.nr_bytes; length++) {
+        file = tmpfile();
+        fwrite(bytes, 1, length, file);
+        rewind(file);
+        assert(trace_reader_init(&reader, file) == 0);
+        assert(trace_read(&reader, &state, &schedule) == -1);
+        fclose(file);
+    }
+    free(bytes);
+
+    printf("PASS test_trace_rejects_other_files_and_truncated_records\n");
+}
+
+/**
+ * @brief Records ticks of random load where the VMs are pinned where compute_schedule put them, like vcpu_scheduler does.
+ */
+static FILE *record_run(int nr_ticks, int nr_vms, int nr_pcpus) {
+    static SystemState state;
+    static Schedule schedule;
+    TraceWriter writer;
+    FILE *file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    setup_random_state(&state, nr_vms, nr_pcpus, 1);
+    for (int t = 0; t < nr_ticks; t++) {
+        for (int j = 0; j < nr_pcpus; j++) {
+            state.pcpus[j].utilization_rate = rand() % 100;
+        }
+        for (int i = 0; i < nr_vms; i++) {
+            state.vms[i].cpu_usage_rate = rand() % 100;
+        }
+        schedule = compute_schedule(&state);
+        assert(trace_write_state(&writer, t, &state) == 0);
+        assert(trace_write_schedule(&writer, t, &schedule) == 0);
+        for (int i = 0; i < nr_vms; i++) {
+            state.vms[i].current_pcpu = schedule.vm_to_pcpu[i];
+        }
+    }
+    /* The daemon stopped after querying the state */
+    assert(trace_write_state(&writer, nr_ticks, &state) == 0);
+    return file;
+}
+
+static ReplayStats replay(FILE *file, ReplayOptions options) {
+    static CPUSimulator sim;
+    TraceReader reader;
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == 0);
+    simulator_init(&sim, options);
+    assert(simulator_replay(&sim, &reader) == 0);
+    return sim.stats;
+}
+
+static void test_open_loop_replay_reproduces_recorded_decisions() {
+    srand(17);
+    FILE *file = record_run(50, 12, 8);
+    ReplayOptions options = { .mode = REPLAY_OPEN_LOOP, .stable = false };
+    ReplayStats stats = replay(file, options);
+    assert(stats.nr_ticks == 51);
+    assert(stats.nr_decisions == 51);
+    assert(stats.nr_differences == 0);
+
+    /* Another policy is told apart */
+    options.stable = true;
+    stats = replay(file, options);
+    assert(stats.nr_differences > 0);
+    fclose(file);
+
+    printf("PASS test_open_loop_replay_reproduces_recorded_decisions\n");
+}
+
+static void test_closed_loop_replay_is_deterministic() {
+    srand(18);
+    FILE *file = record_run(100, 6, 8);
+    ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP, .stable = false };
+    ReplayStats first = replay(file, options);
+    ReplayStats second = replay(file, options);
+    first.solve_ns = second.solve_ns = 0;
+    assert(memcmp(&first, &second, sizeof(ReplayStats)) == 0);
+    assert(first.nr_ticks == 101);
+    assert(first.nr_differences > 0);
+
+    options.stable = true;
+    ReplayStats stable = replay(file, options);
+    printf("%d -> %d migrations, %d -> %d overloaded pCPU ticks\n",
+        first.nr_migrations, stable.nr_migrations, first.nr_overloaded, stable.nr_overloaded);
+    assert(stable.nr_migrations < first.nr_migrations);
+    fclose(file);
+
+    printf("PASS test_closed_loop_replay_is_deterministic\n");
+}
+
+static void test_closed_loop_model_follows_the_placement() {
+    static SystemState state;
+    static CPUSimulator sim;
+    ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP, .stable = false };
+    simulator_init(&sim, options);
+
+    /* Two busy VMs stacked on pCPU 0 of an idle host */
+    memset(&state, 0, sizeof(SystemState));
+    state.nr_pcpus = 3;
+    for (int j = 0; j < 3; j++) {
+        state.pcpus[j].id = j;
+    }
+    state.nr_vms = 2;
+    for (int i = 0; i < 2; i++) {
+        state.vms[i].id = i + 1;
+        state.vms[i].cpu_usage_rate = 80;
+    }
+    assert(simulator_tick(&sim, &state, NULL) == 0);
+    assert(sim.stats.nr_overloaded == 1);
+    assert(sim.stats.unmet_demand == 60);
+    /* Both go to an idle pCPU of their own */
+    assert(sim.stats.nr_migrations == 2);
+    double stacked_imbalance = sim.stats.imbalance;
+    assert(stacked_imbalance > 0);
+
+    /* The recorded state still has them stacked, the simulated host doesn't */
+    assert(simulator_tick(&sim, &state, NULL) == 0);
+    assert(sim.stats.nr_ticks == 2);
+    assert(sim.stats.nr_overloaded == 1);
+    assert(sim.stats.imbalance - stacked_imbalance < stacked_imbalance);
+
+    printf("PASS test_closed_loop_model_follows_the_placement\n");
+}
+
+int main(void) {
+    printf("Running trace tests ...\n\n");
+
+    test_trace_round_trips_states_and_schedules();
+    test_trace_rejects_other_files_and_truncated_records();
+    test_open_loop_replay_reproduces_recorded_decisions();
+    test_closed_loop_replay_is_deterministic();
+    test_closed_loop_model_follows_the_placement();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
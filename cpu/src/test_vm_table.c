@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_types.h"
+#include "vm_table.h"
+#include "sampler.h"
+
+static void test_table_put_get_remove() {
+    static VMTable table;
+    vm_table_clear(&table);
+    assert(vm_table_get(&table, 1) == -1);
+    assert(vm_table_put(&table, 1, 10) == 0);
+    assert(vm_table_put(&table, 2, 20) == 0);
+    assert(vm_table_put(&table, 1, 11) == 0);
+    assert(table.nr_entries == 2);
+    assert(vm_table_get(&table, 1) == 11);
+    assert(vm_table_get(&table, 2) == 20);
+    assert(vm_table_remove(&table, 1));
+    assert(!vm_table_remove(&table, 1));
+    assert(vm_table_get(&table, 1) == -1);
+    assert(vm_table_get(&table, 2) == 20);
+    assert(vm_table_put(&table, VM_TABLE_EMPTY, 0) == -1);
+
+    printf("PASS test_table_put_get_remove\n");
+}
+
+/**
+ * @brief Domains come and go at random, the table has to agree with a plain array every step.
+ */
+static void test_table_survives_churn() {
+    static VMTable table;
+    static int expected[4 * MAX_VMS];
+    vm_table_clear(&table);
+    for (int id = 0; id < 4 * MAX_VMS; id++) {
+        expected[id] = -1;
+    }
+    srand(6210);
+    int nr_entries = 0;
+    for (int step = 0; step < 200000; step++) {
+        int id = rand() % (4 * MAX_VMS);
+        if (expected[id] >= 0 && rand() % 2) {
+            assert(vm_table_remove(&table, id));
+            expected[id] = -1;
+            nr_entries--;
+        } else if (nr_entries < MAX_VMS || expected[id] >= 0) {
+            nr_entries += expected[id] < 0;
+            expected[id] = step;
+            assert(vm_table_put(&table, id, step) == 0);
+        }
+        assert(table.nr_entries == nr_entries);
+        if (step % 1000 == 0) {
+            for (int k = 0; k < 4 * MAX_VMS; k++) {
+                assert(vm_table_get(&table, k) == expected[k]);
+            }
+        }
+    }
+
+    printf("PASS test_table_survives_churn\n");
+}
+
+static void add_vm(SystemState *state, int id, const char *name, unsigned long long cpu_time) {
+    VM *vm = &state->vms[state->nr_vms++];
+    vm->id = id;
+    snprintf(vm->name, MAX_NAME_LEN, "%s", name);
+    vm->cpu_time = cpu_time;
+    vm->cpu_usage_rate = -1;
+}
+
+static void test_usage_rate_follows_vms_by_id() {
+    static SystemState previous;
+    static SystemState current;
+    memset(&previous, 0, sizeof(SystemState));
+    memset(&current, 0, sizeof(SystemState));
+    add_vm(&previous, 1, "aos_vm1", 1000);
+    add_vm(&previous, 2, "aos_vm2", 1000);
+    add_vm(&previous, 3, "aos_vm3", 1000);
+
+    /* vm2 stopped, the others moved in the list and vm4 started */
+    add_vm(&current, 4, "aos_vm4", 5000);
+    add_vm(&current, 3, "aos_vm3", 1500);
+    add_vm(&current, 1, "aos_vm1", 2000);
+
+    assert(caculate_utilization_rate(&current, &previous, 1000) == 2);
+    assert(current.vms[0].cpu_usage_rate == -1);
+    assert(current.vms[1].cpu_usage_rate == 50);
+    assert(current.vms[2].cpu_usage_rate == 100);
+
+    /* The same ID under another name is another domain */
+    snprintf(current.vms[2].name, MAX_NAME_LEN, "%s", "other");
+    current.vms[2].cpu_usage_rate = -1;
+    assert(caculate_utilization_rate(&current, &previous, 1000) == 1);
+    assert(current.vms[2].cpu_usage_rate == -1);
+
+    printf("PASS test_usage_rate_follows_vms_by_id\n");
+}
+
+static void test_usage_rate_of_every_vm_on_a_full_host() {
+    static SystemState previous;
+    static SystemState current;
+    memset(&previous, 0, sizeof(SystemState));
+    memset(&current, 0, sizeof(SystemState));
+    for (int i = 0; i < MAX_VMS; i++) {
+        add_vm(&previous, 100 + i, "vm", 0);
+        /* Reversed order, every VM busy by its position */
+        add_vm(&current, 100 + MAX_VMS - 1 - i, "vm", (MAX_VMS - 1 - i) % 100);
+    }
+    assert(caculate_utilization_rate(&current, &previous, 100) == MAX_VMS);
+    for (int i = 0; i < MAX_VMS; i++) {
+        assert(current.vms[i].cpu_usage_rate == (MAX_VMS - 1 - i) % 100);
+    }
+
+    printf("PASS test_usage_rate_of_every_vm_on_a_full_host\n");
+}
+
+int main(void) {
+    printf("Running VM table tests ...\n\n");
+
+    test_table_put_get_remove();
+    test_table_survives_churn();
+    test_usage_rate_follows_vms_by_id();
+    test_usage_rate_of_every_vm_on_a_full_host();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
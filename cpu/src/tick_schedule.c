@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <time.h>
+#include "tick_schedule.h"
+
+long long tick_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long tick_parse_period(const char *seconds) {
+    char *end;
+    double value = strtod(seconds, &end);
+    if (end == seconds || *end != '\0' || !(value > 0) || value > 86400) {
+        return -1;
+    }
+    long long period_ns = (long long) (value * 1e9);
+    return period_ns > 0 ? period_ns : -1;
+}
+
+void tick_schedule_init(TickSchedule *schedule, long long now_ns, long long period_ns) {
+    schedule->period_ns = period_ns;
+    schedule->next_ns = now_ns;
+    schedule->last_ns = -1;
+    schedule->nr_missed = 0;
+}
+
+void tick_schedule_ran(TickSchedule *schedule, long long now_ns) {
+    schedule->last_ns = now_ns;
+    if (now_ns < schedule->next_ns) {
+        return;
+    }
+    /* Deadlines passed while the tick ran are skipped, the grid stays put */
+    long long behind = (now_ns - schedule->next_ns) / schedule->period_ns;
+    schedule->nr_missed += behind;
+    schedule->next_ns += (behind + 1) * schedule->period_ns;
+}
+
+int tick_schedule_timeout_ms(const TickSchedule *schedule, long long now_ns, bool early) {
+    long long due_ns = schedule->next_ns;
+    if (early) {
+        long long early_ns = schedule->last_ns < 0 ? now_ns
+            : schedule->last_ns + schedule->period_ns / EARLY_TICK_MIN_GAP_DIVISOR;
+        if (early_ns < due_ns) {
+            due_ns = early_ns;
+        }
+    }
+    if (due_ns <= now_ns) {
+        return 0;
+    }
+    return (int) ((due_ns - now_ns + 999999) / 1000000);
+}
+
+int tick_crossed_above(const double *previous, const double *current, int nr_values, double threshold) {
+    int nr_crossed = 0;
+    for (int i = 0; i < nr_values; i++) {
+        if (previous[i] < threshold && current[i] >= threshold) {
+            nr_crossed++;
+        }
+    }
+    return nr_crossed;
+}
+
+int tick_crossed_below(const double *previous, const double *current, int nr_values, double threshold) {
+    int nr_crossed = 0;
+    for (int i = 0; i < nr_values; i++) {
+        if (previous[i] >= threshold && current[i] < threshold) {
+            nr_crossed++;
+        }
+    }
+    return nr_crossed;
+}
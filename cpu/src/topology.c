@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "vm_types.h"
+#include "topology.h"
+
+/* NUMA nodes looked up under <root>/devices/system/node */
+#define MAX_NUMA_NODES 64
+
+/**
+ * @brief Reads the first line of a sysfs file.
+ *
+ * @return 0 on success, -1 when the file can't be read.
+ */
+static int read_sysfs_line(const char *path, char *buf, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fgets(buf, size, file) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Parses a CPU list such as "0-3,8,10-11" into in_list (MAX_PCPUS entries).
+ *
+ * @return The first CPU of the list, -1 when the list is empty or malformed.
+ */
+static int parse_cpu_list(const char *list, bool *in_list) {
+    int first = -1;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0) {
+            return -1;
+        }
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo) {
+                return -1;
+            }
+        }
+        for (long cpu = lo; cpu <= hi && cpu < MAX_PCPUS; cpu++) {
+            if (in_list != NULL) {
+                in_list[cpu] = true;
+            }
+        }
+        if (first < 0 || lo < first) {
+            first = (int) lo;
+        }
+        p = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+    }
+    return first;
+}
+
+/**
+ * @brief The first CPU that shares the highest level cache with cpu, -1 when the caches can't be read.
+ */
+static int read_llc(const char *root, int cpu) {
+    char path[256];
+    char buf[256];
+    int best_level = -1;
+    int llc = -1;
+    for (int index = 0; ; index++) {
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cache/index%d/level", root, cpu, index);
+        if (read_sysfs_line(path, buf, sizeof(buf)) < 0) {
+            break;
+        }
+        int level = atoi(buf);
+        if (level <= best_level) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", root, cpu, index);
+        if (read_sysfs_line(path, buf, sizeof(buf)) < 0) {
+            continue;
+        }
+        int first = parse_cpu_list(buf, NULL);
+        if (first >= 0) {
+            best_level = level;
+            llc = first;
+        }
+    }
+    return llc;
+}
+
+int topology_load_sysfs(CPUTopology *topology, const char *root, int nr_cpus) {
+    char path[256];
+    char buf[256];
+    memset(topology, 0, sizeof(CPUTopology));
+    if (nr_cpus <= 0 || nr_cpus > MAX_PCPUS) {
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < nr_cpus; cpu++) {
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/thread_siblings_list", root, cpu);
+        if (read_sysfs_line(path, buf, sizeof(buf)) < 0 || (topology->core[cpu] = parse_cpu_list(buf, NULL)) < 0) {
+            fprintf(stderr, "Failed to read the SMT siblings of CPU %d\n", cpu);
+            return -1;
+        }
+        /* Without cache information every core is its own LLC */
+        int llc = read_llc(root, cpu);
+        topology->llc[cpu] = llc >= 0 ? llc : topology->core[cpu];
+        topology->node[cpu] = 0;
+    }
+
+    /* Hosts without NUMA have no node directory, everything is on node 0 */
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), "%s/devices/system/node/node%d/cpulist", root, node);
+        if (read_sysfs_line(path, buf, sizeof(buf)) < 0) {
+            continue;
+        }
+        bool in_node[MAX_PCPUS] = { false };
+        if (parse_cpu_list(buf, in_node) < 0) {
+            continue;
+        }
+        for (int cpu = 0; cpu < nr_cpus; cpu++) {
+            if (in_node[cpu]) {
+                topology->node[cpu] = node;
+            }
+        }
+    }
+    topology->nr_cpus = nr_cpus;
+    return 0;
+}
+
+int topology_parse_lscpu(CPUTopology *topology, FILE *file) {
+    char line[512];
+    memset(topology, 0, sizeof(CPUTopology));
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        /* CPU,Core,Socket,Node,,L1d,L1i,L2,L3 */
+        char *fields[16];
+        int nr_fields = 0;
+        char *p = line;
+        while (nr_fields < 16) {
+            fields[nr_fields++] = p;
+            char *comma = strchr(p, ',');
+            if (comma == NULL) {
+                break;
+            }
+            *comma = '\0';
+            p = comma + 1;
+        }
+        if (nr_fields < 4) {
+            fprintf(stderr, "Malformed lscpu line: %s\n", line);
+            return -1;
+        }
+        int cpu = atoi(fields[0]);
+        if (cpu < 0 || cpu >= MAX_PCPUS) {
+            fprintf(stderr, "CPU %d is beyond %d CPUs\n", cpu, MAX_PCPUS);
+            return -1;
+        }
+        topology->core[cpu] = atoi(fields[1]);
+        topology->node[cpu] = fields[3][0] != '\0' ? atoi(fields[3]) : atoi(fields[2]);
+        const char *llc = fields[nr_fields - 1];
+        topology->llc[cpu] = (nr_fields > 5 && llc[0] != '\0') ? atoi(llc) : topology->core[cpu];
+        if (cpu + 1 > topology->nr_cpus) {
+            topology->nr_cpus = cpu + 1;
+        }
+    }
+    return 0;
+}
+
+TopologyDistance topology_distance(const CPUTopology *topology, int a, int b) {
+    if (a == b) {
+        return TOPOLOGY_SAME_CPU;
+    }
+    if (topology->nr_cpus <= 0 || a < 0 || b < 0 || a >= topology->nr_cpus || b >= topology->nr_cpus) {
+        return TOPOLOGY_SAME_NODE;
+    }
+    if (topology->node[a] != topology->node[b]) {
+        return TOPOLOGY_REMOTE_NODE;
+    }
+    if (topology->core[a] == topology->core[b]) {
+        return TOPOLOGY_SMT_SIBLING;
+    }
+    if (topology->llc[a] == topology->llc[b]) {
+        return TOPOLOGY_SAME_LLC;
+    }
+    return TOPOLOGY_SAME_NODE;
+}
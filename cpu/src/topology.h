@@ -0,0 +1,47 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdio.h>
+#include "vm_types.h"
+
+/**
+ * @brief How far apart two host CPUs are, from closest to farthest.
+ */
+typedef enum {
+    TOPOLOGY_SAME_CPU,
+    TOPOLOGY_SMT_SIBLING,
+    TOPOLOGY_SAME_LLC,
+    TOPOLOGY_SAME_NODE,
+    TOPOLOGY_REMOTE_NODE,
+} TopologyDistance;
+
+/**
+ * @brief Reads the topology of nr_cpus CPUs from a sysfs tree.
+ *
+ * Reads <root>/devices/system/cpu/cpuN/topology/thread_siblings_list, the
+ * shared_cpu_list of the highest level cache under cpuN/cache and the cpulist of
+ * <root>/devices/system/node/nodeM. root is "/sys" on a real host.
+ *
+ * @return 0 on success, -1 when the topology of a CPU can't be read.
+ */
+int topology_load_sysfs(CPUTopology *topology, const char *root, int nr_cpus);
+
+/**
+ * @brief Parses the output of `lscpu -p` (CPU,Core,Socket,Node,,L1d,L1i,L2,L3).
+ *
+ * The last cache column is taken as the last level cache. A missing node falls
+ * back to the socket.
+ *
+ * @return 0 on success, -1 on a malformed line or a CPU beyond MAX_PCPUS.
+ */
+int topology_parse_lscpu(CPUTopology *topology, FILE *file);
+
+/**
+ * @brief Distance between CPUs a and b.
+ *
+ * Two different CPUs are TOPOLOGY_SAME_NODE when the topology is unknown or
+ * a CPU is outside of it.
+ */
+TopologyDistance topology_distance(const CPUTopology *topology, int a, int b);
+
+#endif
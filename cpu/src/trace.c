@@ -0,0 +1,302 @@
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+static void put_byte(TraceWriter *writer, int byte) {
+    fputc(byte, writer->file);
+    writer->nr_bytes++;
+}
+
+static void put_uvarint(TraceWriter *writer, unsigned long long value) {
+    while (value >= 0x80) {
+        put_byte(writer, (int) (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    put_byte(writer, (int) value);
+}
+
+/* Zigzag keeps small negative numbers such as -1 to one byte */
+static void put_varint(TraceWriter *writer, long long value) {
+    put_uvarint(writer, ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63));
+}
+
+static void put_double(TraceWriter *writer, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int b = 0; b < 8; b++) {
+        put_byte(writer, (int) ((bits >> (8 * b)) & 0xff));
+    }
+}
+
+static int end_record(TraceWriter *writer) {
+    if (ferror(writer->file)) {
+        fprintf(stderr, "Failed to write the trace\n");
+        return -1;
+    }
+    return 0;
+}
+
+int trace_writer_init(TraceWriter *writer, FILE *file) {
+    memset(writer, 0, sizeof(TraceWriter));
+    writer->file = file;
+    for (int b = 0; b < 4; b++) {
+        put_byte(writer, TRACE_MAGIC[b]);
+    }
+    put_uvarint(writer, TRACE_VERSION);
+    return end_record(writer);
+}
+
+static void write_topology(TraceWriter *writer, const CPUTopology *topology) {
+    put_byte(writer, TRACE_TOPOLOGY);
+    int nr_cpus = topology->nr_cpus > 0 ? topology->nr_cpus : 0;
+    put_varint(writer, nr_cpus);
+    for (int c = 0; c < nr_cpus; c++) {
+        put_varint(writer, topology->core[c]);
+        put_varint(writer, topology->llc[c]);
+        put_varint(writer, topology->node[c]);
+    }
+    writer->topology = *topology;
+    writer->has_topology = true;
+}
+
+int trace_write_state(TraceWriter *writer, long long time_ns, const SystemState *state) {
+    if (!writer->has_topology || memcmp(&writer->topology, &state->topology, sizeof(CPUTopology)) != 0) {
+        write_topology(writer, &state->topology);
+    }
+    put_byte(writer, TRACE_STATE);
+    put_varint(writer, time_ns);
+    put_varint(writer, state->nr_pcpus);
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        const PCPU *pcpu = &state->pcpus[j];
+        put_varint(writer, pcpu->id);
+        put_double(writer, pcpu->utilization_rate);
+        put_double(writer, pcpu->utilization_peak);
+        put_double(writer, pcpu->utilization_stddev);
+        put_uvarint(writer, pcpu->idle_ns);
+        put_double(writer, pcpu->idle_rate);
+    }
+    put_varint(writer, state->nr_vms);
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int name_len = strnlen(vm->name, MAX_NAME_LEN - 1);
+        put_varint(writer, name_len);
+        for (int c = 0; c < name_len; c++) {
+            put_byte(writer, vm->name[c]);
+        }
+        put_varint(writer, vm->id);
+        put_varint(writer, vm->current_pcpu);
+        put_varint(writer, vm_nr_vcpus(vm));
+        for (int k = 0; k < vm->nr_vcpus && vm->nr_vcpus > 1; k++) {
+            put_varint(writer, vm->vcpu_pcpu[k]);
+        }
+        put_double(writer, vm->cpu_usage_rate);
+        put_double(writer, vm->cpu_usage_peak);
+        put_double(writer, vm->cpu_usage_stddev);
+        put_uvarint(writer, vm->cpu_time);
+    }
+    writer->nr_vms = state->nr_vms;
+    return end_record(writer);
+}
+
+int trace_write_schedule(TraceWriter *writer, long long time_ns, const Schedule *schedule) {
+    put_byte(writer, TRACE_SCHEDULE);
+    put_varint(writer, time_ns);
+    put_varint(writer, schedule->num_assigned);
+    put_varint(writer, schedule->total_cost);
+    /* The state before says how many vCPUs each VM has, trailing unassigned ones are left out */
+    for (int i = 0; i < writer->nr_vms; i++) {
+        int nr_vcpus = MAX_VCPUS_PER_VM;
+        while (nr_vcpus > 0 && schedule->vcpu_to_pcpu[i][nr_vcpus - 1] < 0) {
+            nr_vcpus--;
+        }
+        put_varint(writer, nr_vcpus);
+        for (int k = 0; k < nr_vcpus; k++) {
+            put_varint(writer, schedule->vcpu_to_pcpu[i][k]);
+        }
+    }
+    return end_record(writer);
+}
+
+static int get_byte(TraceReader *reader, int *byte) {
+    *byte = fgetc(reader->file);
+    return *byte == EOF ? -1 : 0;
+}
+
+static int get_uvarint(TraceReader *reader, unsigned long long *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte;
+        if (get_byte(reader, &byte) < 0) {
+            return -1;
+        }
+        *value |= (unsigned long long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_varint(TraceReader *reader, long long *value) {
+    unsigned long long zigzag;
+    if (get_uvarint(reader, &zigzag) < 0) {
+        return -1;
+    }
+    *value = (long long) (zigzag >> 1) ^ -(long long) (zigzag & 1);
+    return 0;
+}
+
+/**
+ * @brief Reads a signed integer that has to be within [min, max].
+ */
+static int get_int(TraceReader *reader, int *value, long long min, long long max) {
+    long long wide;
+    if (get_varint(reader, &wide) < 0 || wide < min || wide > max) {
+        return -1;
+    }
+    *value = (int) wide;
+    return 0;
+}
+
+static int get_double(TraceReader *reader, double *value) {
+    uint64_t bits = 0;
+    for (int b = 0; b < 8; b++) {
+        int byte;
+        if (get_byte(reader, &byte) < 0) {
+            return -1;
+        }
+        bits |= (uint64_t) byte << (8 * b);
+    }
+    memcpy(value, &bits, sizeof(bits));
+    return 0;
+}
+
+int trace_reader_init(TraceReader *reader, FILE *file) {
+    memset(reader, 0, sizeof(TraceReader));
+    reader->file = file;
+    char magic[4];
+    unsigned long long version;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        get_uvarint(reader, &version) < 0 || version != TRACE_VERSION) {
+        fprintf(stderr, "Not a version %d vCPU scheduler trace\n", TRACE_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_topology(TraceReader *reader) {
+    CPUTopology *topology = &reader->topology;
+    memset(topology, 0, sizeof(CPUTopology));
+    if (get_int(reader, &topology->nr_cpus, 0, MAX_PCPUS) < 0) {
+        return -1;
+    }
+    for (int c = 0; c < topology->nr_cpus; c++) {
+        if (get_int(reader, &topology->core[c], -1, INT32_MAX) < 0 ||
+            get_int(reader, &topology->llc[c], -1, INT32_MAX) < 0 ||
+            get_int(reader, &topology->node[c], -1, INT32_MAX) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int read_state(TraceReader *reader, SystemState *state) {
+    memset(state, 0, sizeof(SystemState));
+    state->topology = reader->topology;
+    if (get_int(reader, &state->nr_pcpus, 0, MAX_PCPUS) < 0) {
+        return -1;
+    }
+    for (int j = 0; j < state->nr_pcpus; j++) {
+        PCPU *pcpu = &state->pcpus[j];
+        if (get_int(reader, &pcpu->id, INT32_MIN, INT32_MAX) < 0 ||
+            get_double(reader, &pcpu->utilization_rate) < 0 ||
+            get_double(reader, &pcpu->utilization_peak) < 0 ||
+            get_double(reader, &pcpu->utilization_stddev) < 0 ||
+            get_uvarint(reader, &pcpu->idle_ns) < 0 ||
+            get_double(reader, &pcpu->idle_rate) < 0) {
+            return -1;
+        }
+    }
+    if (get_int(reader, &state->nr_vms, 0, MAX_VMS) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < state->nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        int name_len;
+        if (get_int(reader, &name_len, 0, MAX_NAME_LEN - 1) < 0 ||
+            fread(vm->name, 1, name_len, reader->file) != (size_t) name_len) {
+            return -1;
+        }
+        if (get_int(reader, &vm->id, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->current_pcpu, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->nr_vcpus, 1, MAX_VCPUS_PER_VM) < 0) {
+            return -1;
+        }
+        for (int k = 0; k < vm->nr_vcpus && vm->nr_vcpus > 1; k++) {
+            if (get_int(reader, &vm->vcpu_pcpu[k], INT32_MIN, INT32_MAX) < 0) {
+                return -1;
+            }
+        }
+        if (vm->nr_vcpus == 1) {
+            vm->vcpu_pcpu[0] = vm->current_pcpu;
+        }
+        if (get_double(reader, &vm->cpu_usage_rate) < 0 ||
+            get_double(reader, &vm->cpu_usage_peak) < 0 ||
+            get_double(reader, &vm->cpu_usage_stddev) < 0 ||
+            get_uvarint(reader, &vm->cpu_time) < 0) {
+            return -1;
+        }
+    }
+    reader->nr_vms = state->nr_vms;
+    return 0;
+}
+
+static int read_schedule(TraceReader *reader, Schedule *schedule) {
+    memset(schedule, -1, sizeof(Schedule));
+    if (get_int(reader, &schedule->num_assigned, INT32_MIN, INT32_MAX) < 0 ||
+        get_int(reader, &schedule->total_cost, INT32_MIN, INT32_MAX) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < reader->nr_vms; i++) {
+        int nr_vcpus;
+        if (get_int(reader, &nr_vcpus, 0, MAX_VCPUS_PER_VM) < 0) {
+            return -1;
+        }
+        for (int k = 0; k < nr_vcpus; k++) {
+            if (get_int(reader, &schedule->vcpu_to_pcpu[i][k], -1, INT32_MAX) < 0) {
+                return -1;
+            }
+        }
+        schedule->vm_to_pcpu[i] = schedule->vcpu_to_pcpu[i][0];
+    }
+    return 0;
+}
+
+int trace_read(TraceReader *reader, SystemState *state, Schedule *schedule) {
+    for (;;) {
+        int type = fgetc(reader->file);
+        if (type == EOF) {
+            return 0;
+        }
+        if (type == TRACE_TOPOLOGY) {
+            if (read_topology(reader) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (type != TRACE_STATE && type != TRACE_SCHEDULE) {
+            break;
+        }
+        long long time_ns;
+        if (get_varint(reader, &time_ns) < 0) {
+            break;
+        }
+        reader->time_ns = time_ns;
+        if (type == TRACE_STATE ? read_state(reader, state) < 0 : read_schedule(reader, schedule) < 0) {
+            break;
+        }
+        return type;
+    }
+    fprintf(stderr, "Malformed trace record at byte %ld\n", ftell(reader->file));
+    return -1;
+}
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "vm_types.h"
+#include "scheduler.h"
+
+#define TRACE_MAGIC "VCTR"
+#define TRACE_VERSION 1
+
+/**
+ * @brief Record types. A topology record is only written when the topology changes.
+ */
+typedef enum {
+    TRACE_TOPOLOGY = 1,
+    TRACE_STATE = 2,
+    TRACE_SCHEDULE = 3,
+} TraceRecordType;
+
+/**
+ * @brief Appends the system states and schedules of a run to a binary trace.
+ *
+ * The file starts with TRACE_MAGIC and TRACE_VERSION. Every record is a type
+ * byte followed by its fields: integers as LEB128 varints (signed ones zigzag
+ * encoded) and doubles as 8 little endian bytes, so a 4 VM tick takes a few
+ * hundred bytes instead of a whole SystemState.
+ */
+typedef struct {
+    FILE        *file;          // NULL when not recording
+    CPUTopology topology;       // The last topology written
+    bool        has_topology;
+    int         nr_vms;         // VMs of the last state, a schedule covers those
+    long        nr_bytes;
+} TraceWriter;
+
+/**
+ * @brief Writes the header to file. The writer doesn't own the file.
+ *
+ * @return 0 on success, -1 when the write fails.
+ */
+int trace_writer_init(TraceWriter *writer, FILE *file);
+
+/**
+ * @brief Writes the state seen at time_ns, and the topology before it when it changed.
+ */
+int trace_write_state(TraceWriter *writer, long long time_ns, const SystemState *state);
+
+/**
+ * @brief Writes the schedule computed for the last state written.
+ */
+int trace_write_schedule(TraceWriter *writer, long long time_ns, const Schedule *schedule);
+
+/**
+ * @brief Reads a trace back, one state or schedule at a time.
+ */
+typedef struct {
+    FILE        *file;
+    CPUTopology topology;       // From the last topology record
+    int         nr_vms;         // VMs of the last state
+    long long   time_ns;        // Of the last record
+} TraceReader;
+
+/**
+ * @brief Reads and checks the header. The reader doesn't own the file.
+ *
+ * @return 0 on success, -1 when the file isn't a trace of this version.
+ */
+int trace_reader_init(TraceReader *reader, FILE *file);
+
+/**
+ * @brief Reads the next state into state or schedule into schedule.
+ *
+ * Topology records are taken in along the way and every state gets the last one.
+ * A schedule covers the VMs of the state before it.
+ *
+ * @return TRACE_STATE or TRACE_SCHEDULE, 0 at the end of the trace, -1 on a malformed record.
+ */
+int trace_read(TraceReader *reader, SystemState *state, Schedule *schedule);
+
+#endif
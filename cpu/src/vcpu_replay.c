@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+#include "simulator.h"
+#include "trace.h"
+
+/* Not on the stack, the simulator holds every vCPU's placement */
+static CPUSimulator sim;
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [--open-loop] [--stable] [--demand] trace\n", program);
+	printf("  --open-loop  replay the recorded states as they are and compare with the recorded schedules\n");
+	printf("  --stable     schedule with the hysteresis, migration budget and cooldown of stable_schedule\n");
+	printf("  --demand     place the vCPUs by their measured demand (compute_demand_schedule)\n");
+}
+
+/*
+Replays a trace recorded with VCPU_SCHEDULER_TRACE=<file> ./vcpu_scheduler <interval>
+*/
+int main(int argc, char *argv[])
+{
+	ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP, .stable = false, .placement = PLACE_VCPU_SLOTS };
+	const char *path = NULL;
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--open-loop") == 0) {
+			options.mode = REPLAY_OPEN_LOOP;
+		} else if (strcmp(argv[a], "--stable") == 0) {
+			options.stable = true;
+		} else if (strcmp(argv[a], "--demand") == 0) {
+			options.placement = PLACE_BY_DEMAND;
+		} else if (path == NULL && argv[a][0] != '-') {
+			path = argv[a];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (path == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return 1;
+	}
+	TraceReader reader;
+	simulator_init(&sim, options);
+	int result = trace_reader_init(&reader, file) < 0 ? -1 : simulator_replay(&sim, &reader);
+	fclose(file);
+	if (result < 0) {
+		fprintf(stderr, "Failed to replay %s\n", path);
+		return 1;
+	}
+	print_replay_stats(&sim.stats);
+	return 0;
+}
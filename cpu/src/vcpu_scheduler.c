@@ -6,55 +6,21 @@
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
+#include <time.h>
 #include "virt_query.h"
 #include "vm_types.h"
 #include "scheduler.h"
+#include "auction.h"
+#include "domain_scheduler.h"
+#include "event_loop.h"
+#include "control_loop.h"
+#include "trace.h"
 #define MIN(a, b) ((a) < (b) ? a : b)
 #define MAX(a, b) ((a) > (b) ? a : b)
 
-/**
- * @brief Pin a virtual CPU to a physical CPU.
- *
- * This function pins a virtual CPU (vCPU) of a domain to a specific 
- * physical CPU (pCPU) on the host. It allocates a CPU map (bitmask) 
- * to specify which pCPU the vCPU should be pinned to, and then uses 
- * the libvirt API to set the CPU affinity for the vCPU.
- *
- * @param domain The domain pointer.
- * @param nr_pcpus Number of physical CPUs.
- * @param pcpu_id The physical CPU ID to pin the virtual CPU to.
- * @return -1 when memory allocation fails, 0 otherwise.
- */
-static int pin_vcpu_to_pcpu(virDomainPtr domain, int nr_pcpus, int pcpu_id, int vm_id, char *vm_name) {
-	// 1. Allocate the bitmask (cpumap) for the number of host CPUs (nhostcpus) using calloc to initialize it to all zeros
-	int vcpu_index = 0;  // Assume each VM has one VCPU only
-	size_t pcpu_maplen = VIR_CPU_MAPLEN(nr_pcpus);
-	unsigned char *cpumap;
-	cpumap = calloc(1, pcpu_maplen); // Initialize map to all zeros
-	if (!cpumap) {
-		fprintf(stderr, "Memory allocation failed for cpumap\n");
-        return -1;
-    }
-
-	// 2. Set the bit for the physical CPU (pcpu_id) in the cpumap.
-    VIR_USE_CPU(cpumap, pcpu_id);
-
-	// 3. Apply the pinning to the domain
-    if (virDomainPinVcpu(domain, vcpu_index, cpumap, pcpu_maplen) < 0) {
-        fprintf(stderr, "Failed to pin vCPU\n");
-        free(cpumap);
-        return -1;
-    }
-
-	printf("Successfully pinned VM %d (%s) vCPU %d to pCPU %d\n", vm_id, vm_name, vcpu_index, pcpu_id);
-
-	free(cpumap);
-	return 0;
-}
-
 int is_exit = 0; // DO NOT MODIFY THIS VARIABLE
 
-void CPUScheduler(virConnectPtr conn, int interval);
+void CPUScheduler(virConnectPtr conn, double interval);
 
 /*
 DO NOT CHANGE THE FOLLOWING FUNCTION
@@ -65,15 +31,55 @@ void signal_callback_handler()
 	is_exit = 1;
 }
 
-// The last saved cumulative idle CPU time from previous interval
-SystemState previous_sys_state;
+// Keeps the previous state, the flow network, the stabilizer and the samples between intervals
+CPUControl control;
+
+// Keeps the domain handles, cpumaps and last pinning between intervals
+VirtContext virt_ctx;
+
+// A pCPU whose average utilization reaches this between two ticks triggers an early tick
+#define PCPU_BUSY_PERCENT 90.0
+// Samples of the VM and pCPU times per tick period
+#define SAMPLES_PER_TICK 4
+
+// Records every state and schedule when VCPU_SCHEDULER_TRACE names a file, for vcpu_replay
+TraceWriter trace_writer;
+
+// Solves the NUMA nodes (or LLCs) of the host in parallel when VCPU_SCHEDULER_SPLIT is set
+DomainScheduler domain_scheduler;
+// Workers of the domain scheduler unless VCPU_SCHEDULER_WORKERS says otherwise, the tick's thread solves too
+#define SPLIT_WORKERS 3
+
+/**
+ * @brief Samples the VM and pCPU times, and asks for an early tick when a pCPU's average became busy.
+ */
+static bool sample_load(void *opaque)
+{
+	VirtBackend backend = virt_backend(&virt_ctx);
+	bool busy = cpu_control_sample(&control, &backend, tick_now_ns(), PCPU_BUSY_PERCENT);
+	if (busy) {
+		printf("A pCPU reached %.0f%% utilization, rescheduling early\n", PCPU_BUSY_PERCENT);
+	}
+	return busy;
+}
+
+static void scheduler_tick(void *opaque)
+{
+	CPUScheduler(virt_ctx.conn, *(double *) opaque);
+}
+
+static void domains_changed(void *opaque)
+{
+	printf("A domain started or stopped, rescheduling early\n");
+	event_loop_request_tick(opaque);
+}
 
 /*
-DO NOT CHANGE THE FOLLOWING FUNCTION
+Opens the connection and calls CPUScheduler every interval seconds from the libvirt
+event loop, or from a sleep loop when there is none, until a signal sets is_exit.
 */
 int main(int argc, char *argv[])
 {
-	memset(&previous_sys_state, -1, sizeof(SystemState));
 	virConnectPtr conn;
 
 	if (argc != 2)
@@ -83,8 +89,17 @@ int main(int argc, char *argv[])
 	}
 
 	// Gets the interval passes as a command line argument and sets it as the STATS_PERIOD for collection of balloon memory statistics of the domains
-	int interval = atoi(argv[1]);
+	// Sub-second intervals such as 0.5 are allowed
+	long long period_ns = tick_parse_period(argv[1]);
+	if (period_ns < 0)
+	{
+		printf("Interval must be a positive number of seconds\n");
+		return 0;
+	}
+	double interval = period_ns / 1e9;
 
+	// Lifecycle events need an event loop registered before the connection is opened
+	virEventRegisterDefaultImpl();
 	conn = virConnectOpen("qemu:///system");
 	if (conn == NULL)
 	{
@@ -95,55 +110,135 @@ int main(int argc, char *argv[])
 	// Get the total number of pCpus in the host
 	signal(SIGINT, signal_callback_handler);
 
-	while (!is_exit)
-	// Run the CpuScheduler function that checks the CPU Usage and sets the pin at an interval of "interval" seconds
+	const char *trace_path = getenv("VCPU_SCHEDULER_TRACE");
+	if (trace_path != NULL)
 	{
-		CPUScheduler(conn, interval);
-		sleep(interval);
+		// A trace that can't be written only costs the trace, the daemon still runs
+		FILE *trace_file = fopen(trace_path, "wb");
+		if (trace_file == NULL)
+		{
+			fprintf(stderr, "Failed to open the trace %s, running without it\n", trace_path);
+		}
+		else if (trace_writer_init(&trace_writer, trace_file) < 0)
+		{
+			fprintf(stderr, "Failed to write the trace %s, running without it\n", trace_path);
+			fclose(trace_file);
+			trace_writer.file = NULL;
+		}
+	}
+
+	// Ticks run from the event loop on a drift-free schedule, and early when a domain starts or stops or a pCPU gets busy
+	cpu_control_init(&control, period_ns);
+	control.verbose = true;
+	control.trace = trace_writer.file != NULL ? &trace_writer : NULL;
+	// VCPU_SCHEDULER_PLACEMENT=demand places the vCPUs by their measured demand instead of two per pCPU
+	const char *placement = getenv("VCPU_SCHEDULER_PLACEMENT");
+	if (placement != NULL && strcmp(placement, "demand") == 0)
+	{
+		control.stabilizer.placement = PLACE_BY_DEMAND;
+	}
+	else if (placement != NULL && strcmp(placement, "slots") != 0)
+	{
+		fprintf(stderr, "Unknown placement %s, placing two vCPUs per pCPU\n", placement);
+	}
+	// The demand placement solves its own flow network, so it takes neither a solver nor a split
+	bool by_demand = control.stabilizer.placement == PLACE_BY_DEMAND;
+	// VCPU_SCHEDULER_SOLVER=auction solves every tick with the auction instead of the incremental flow network
+	const char *solver = getenv("VCPU_SCHEDULER_SOLVER");
+	if (solver != NULL && by_demand)
+	{
+		fprintf(stderr, "Solver %s doesn't place by demand, ignoring it\n", solver);
+	}
+	else if (solver != NULL && strcmp(solver, "auction") == 0)
+	{
+		control.stabilizer.solver = &auction_schedule_solver;
+	}
+	else if (solver != NULL && strcmp(solver, "mcmf") != 0)
+	{
+		fprintf(stderr, "Unknown solver %s, solving with the flow network\n", solver);
+	}
+	// VCPU_SCHEDULER_SPLIT=node (or llc) solves every NUMA node (or LLC) on its own, with the solver above
+	const char *split = getenv("VCPU_SCHEDULER_SPLIT");
+	const char *workers = getenv("VCPU_SCHEDULER_WORKERS");
+	bool split_started = false;
+	if (split != NULL && by_demand)
+	{
+		fprintf(stderr, "Split %s doesn't place by demand, solving the whole host at once\n", split);
+	}
+	else if (split != NULL && (strcmp(split, "node") == 0 || strcmp(split, "llc") == 0))
+	{
+		DomainLevel level = strcmp(split, "node") == 0 ? SPLIT_BY_NODE : SPLIT_BY_LLC;
+		int nr_workers = workers != NULL ? atoi(workers) : SPLIT_WORKERS;
+		if (domain_scheduler_start(&domain_scheduler, level, nr_workers) == 0)
+		{
+			domain_scheduler.inner = control.stabilizer.solver;
+			control.stabilizer.solver = &domain_scheduler.solver;
+			split_started = true;
+		}
+	}
+	else if (split != NULL)
+	{
+		fprintf(stderr, "Unknown split %s, solving the whole host at once\n", split);
+	}
+	EventLoop loop = {
+		.tick = scheduler_tick,
+		.probe = sample_load,
+		.opaque = &interval,
+	};
+	virt_context_init(&virt_ctx, conn);
+	domain_registry_watch(&virt_ctx.registry, domains_changed, &loop);
+	if (event_loop_run(&loop, period_ns, period_ns / SAMPLES_PER_TICK, &is_exit) < 0)
+	{
+		fprintf(stderr, "No event loop, polling every %.3f seconds\n", interval);
+		virt_ctx.registry.external_loop = false;
+		while (!is_exit)
+		// Run the CpuScheduler function that checks the CPU Usage and sets the pin at an interval of "interval" seconds
+		{
+			CPUScheduler(conn, interval);
+			struct timespec period = { period_ns / 1000000000LL, period_ns % 1000000000LL };
+			nanosleep(&period, NULL);
+		}
+	}
+	printf("Ran %d ticks, %d early\n", loop.nr_ticks, loop.nr_early_ticks);
+	if (control.stats.nr_ticks > 0)
+	{
+		printf("Per tick: query %.3f ms, schedule %.3f ms, pinning %.3f ms\n", control.stats.query_ns / 1e6 / control.stats.nr_ticks,
+			control.stats.schedule_ns / 1e6 / control.stats.nr_ticks, control.stats.apply_ns / 1e6 / control.stats.nr_ticks);
+		printf("Solves cut short by the budget: %d ticks\n", control.stats.nr_cut_short);
+	}
+	cpu_control_destroy(&control);
+	if (split_started)
+	{
+		domain_scheduler_stop(&domain_scheduler);
+	}
+
+	if (trace_writer.file != NULL)
+	{
+		printf("Recorded %ld bytes of trace\n", trace_writer.nr_bytes);
+		fclose(trace_writer.file);
 	}
 
 	// Closing the connection
+	virt_context_destroy(&virt_ctx);
 	virConnectClose(conn);
 
 	return 0;
 }
 
-/* COMPLETE THE IMPLEMENTATION */
-void CPUScheduler(virConnectPtr conn, int interval)
+/*
+One tick: query the host, schedule and pin.
+
+interval stays for the skeleton's signature but isn't read: ticks can run
+early, so cpu_control_tick measures the time since the last query instead.
+*/
+void CPUScheduler(virConnectPtr conn, double interval)
 {
-	unsigned long long interval_ns = interval * 1000000000L;
-	VirtContext ctx = {
-		.conn = conn
-	};
-	SystemState current_sys_state;
-	if(virt_query_state(&ctx, &current_sys_state) < 0) {
-		fprintf(stderr, "Failed to query the current system state\n");
-	}
-	printf("Found %d VMs, %d pCPUs\n", current_sys_state.nr_vms, current_sys_state.nr_pcpus);
-	
-	if (previous_sys_state.nr_pcpus == -1) {
-		printf("Skip the cycle for gathering more system information for scheduling\n");
-		previous_sys_state = current_sys_state;
-		return;
-	}
-	
-	caculate_utilization_rate(&current_sys_state, &previous_sys_state, interval_ns);
-	previous_sys_state = current_sys_state;
-
-	printf("\n");
-	print_sys_state(&current_sys_state);
-
-	if (current_sys_state.nr_vms > 0){
-		Schedule schedule = compute_schedule(&current_sys_state);
-		print_schedule(&schedule, current_sys_state.nr_vms);
-
-		for (int i = 0; i < current_sys_state.nr_vms; i++) {
-			int pcpu_id = schedule.vm_to_pcpu[i];
-			int vm_id = current_sys_state.vms[i].id;
-			char *vm_name = current_sys_state.vms[i].name;
-			
-			virDomainPtr domain = virDomainLookupByID(conn, vm_id);
-			pin_vcpu_to_pcpu(domain, current_sys_state.nr_pcpus, pcpu_id, vm_id, vm_name);
-		}
+	(void) interval;
+	if (virt_ctx.conn != conn) {
+		virt_context_destroy(&virt_ctx);
+		virt_context_init(&virt_ctx, conn);
 	}
+	/* The tick itself doesn't know it talks to libvirt, see control_loop.c */
+	VirtBackend backend = virt_backend(&virt_ctx);
+	cpu_control_tick(&control, &backend, tick_now_ns());
 }
@@ -0,0 +1,26 @@
+#ifndef VIRT_BACKEND_H
+#define VIRT_BACKEND_H
+
+#include "vm_types.h"
+#include "scheduler.h"
+
+/**
+ * @brief What the scheduler needs from a hypervisor, without libvirt types.
+ *
+ * virt_backend (virt_query.c) puts these on a libvirt connection and sim_backend
+ * (sim_backend.c) on a simulated host, so the control loop runs the same on both.
+ */
+typedef struct {
+    const char *name;
+    /* @brief Fills the pCPUs, the topology, and the vCPUs and CPU time of every VM. 0 on success, -1 on error */
+    int (*query_state)(void *impl, SystemState *state);
+    /* @brief Pins the vCPUs the schedule moves. The number of RPCs made, -1 on error */
+    int (*apply_pinning)(void *impl, const SystemState *state, const Schedule *schedule);
+} VirtBackendOps;
+
+typedef struct {
+    const VirtBackendOps *ops;
+    void *impl;
+} VirtBackend;
+
+#endif
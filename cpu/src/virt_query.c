@@ -5,6 +5,12 @@
 #include "vm_types.h"
 #include "scheduler.h"
 #include "virt_query.h"
+#include "topology.h"
+#include "domain_stats.h"
+
+/* The host topology does not change while the scheduler runs, so sysfs is only read once */
+static CPUTopology host_topology;
+static bool host_topology_loaded = false;
 
 static int get_number_of_pcpus(VirtContext *ctx) {
     virNodeInfo nodeinfo;
@@ -14,152 +20,392 @@ static int get_number_of_pcpus(VirtContext *ctx) {
     return nodeinfo.cpus;
 }
 
-int virt_query_state(VirtContext *ctx, SystemState *state) {
-    /* Reset system state */
-    memset(state, 0, sizeof(SystemState));
-
+/**
+ * @brief Fills the pCPUs and the topology of the state.
+ *
+ * The number of stats a pCPU reports doesn't change, so it is asked for once and
+ * kept in the context. Every later tick makes one virNodeGetCPUStats call per pCPU.
+ */
+static int query_pcpus(VirtContext *ctx, SystemState *state) {
     /* Number of PCPUs */
     int nr_pcpus = get_number_of_pcpus(ctx);
     if ( nr_pcpus < 0) {
         fprintf(stderr, "Failed to get node information\n");
         return -1;
     }
+    if (nr_pcpus > MAX_PCPUS) {
+        fprintf(stderr, "Found %d pCPUs but only support up to %d\n", nr_pcpus, MAX_PCPUS);
+        return -1;
+    }
     state->nr_pcpus = nr_pcpus;
+
+    /* Host topology for tiered migration costs, all pCPUs look the same without it */
+    if (!host_topology_loaded) {
+        if (topology_load_sysfs(&host_topology, "/sys", nr_pcpus) < 0) {
+            fprintf(stderr, "Failed to read the host topology, migration costs ignore it\n");
+            memset(&host_topology, 0, sizeof(CPUTopology));
+        }
+        host_topology_loaded = true;
+    }
+    state->topology = host_topology;
     
     /* PCPU usage */
+    if (ctx->nr_cpu_stats == 0) {
+        // Call with nr_stats=0 to get the number of supported stats, the same for every CPU
+        int nr_stats = 0;
+        if (virNodeGetCPUStats(ctx->conn, 0, NULL, &nr_stats, 0) == 0 && nr_stats > 0) {
+            ctx->nr_cpu_stats = nr_stats < VIR_NODE_CPU_STATS_FIELD_LENGTH ? nr_stats : VIR_NODE_CPU_STATS_FIELD_LENGTH;
+        }
+    }
     for(int i = 0; i < nr_pcpus; i++){
         state->pcpus[i].id = i;
-        // First call with nr_stats=0 to get the number of supported stats for this CPU
         virNodeCPUStats params[VIR_NODE_CPU_STATS_FIELD_LENGTH];
-        int nr_stats = 0;
+        int nr_stats = ctx->nr_cpu_stats;
         int need_fields = 2;
         int found_field = 0;
-        if (virNodeGetCPUStats(ctx->conn, i, NULL, &nr_stats, 0) == 0 && nr_stats != 0) {
-            if (virNodeGetCPUStats(ctx->conn, i, params, &nr_stats, 0) == 0) {
-                for (int j = 0; j < nr_stats && found_field < need_fields; j++) {
-                    // Search specifically for the fields needed
-                    if (strcmp(params[j].field, VIR_NODE_CPU_STATS_UTILIZATION) == 0) {
-                        /* Utilization rate seems always be zero */
-                        state->pcpus[i].utilization_rate = params[j].value;  // value in percentage
-                        found_field++;
-                    }
-                    if (strcmp(params[j].field, VIR_NODE_CPU_STATS_IDLE) == 0) {
-                        /* Idle time seems more up to date */
-                        state->pcpus[i].idle_ns = params[j].value;
-                        found_field++;
-                    }
+        if (nr_stats != 0 && virNodeGetCPUStats(ctx->conn, i, params, &nr_stats, 0) == 0) {
+            for (int j = 0; j < nr_stats && found_field < need_fields; j++) {
+                // Search specifically for the fields needed
+                if (strcmp(params[j].field, VIR_NODE_CPU_STATS_UTILIZATION) == 0) {
+                    /* Utilization rate seems always be zero */
+                    state->pcpus[i].utilization_rate = params[j].value;  // value in percentage
+                    found_field++;
+                }
+                if (strcmp(params[j].field, VIR_NODE_CPU_STATS_IDLE) == 0) {
+                    /* Idle time seems more up to date */
+                    state->pcpus[i].idle_ns = params[j].value;
+                    found_field++;
                 }
             }
         }
     }
+    return 0;
+}
 
-    /* Number of VMs */
-    virDomainPtr *domains;
-	unsigned int flags = VIR_CONNECT_LIST_DOMAINS_RUNNING |
-						 VIR_CONNECT_LIST_DOMAINS_PERSISTENT;
-	int nr_vms = virConnectListAllDomains(ctx->conn, &domains, flags);
-	if (nr_vms < 0) {
-		fprintf(stderr, "Failed to get list of domains\n");
-		return -1;
-	}
-    state->nr_vms = nr_vms;
+/**
+ * @brief Fills the vCPU count, the pCPU of every vCPU and the CPU time of the VM with virDomainGetVcpus.
+ */
+static int query_vcpus(virDomainPtr domain, int nr_vcpus, int nr_pcpus, VM *vm) {
+    if (nr_vcpus < 1 || nr_vcpus > MAX_VCPUS_PER_VM) {
+        fprintf(stderr, "Only support VM with 1 to %d vCPUs but found %d vCPUs\n", MAX_VCPUS_PER_VM, nr_vcpus);
+        return -1;
+    }
+
+	/* Allocate memory for getting virtual CPU info */
+    virVcpuInfoPtr vcpuinfos = malloc(nr_vcpus * sizeof(virVcpuInfo));
+    size_t pcpu_maplen = VIR_CPU_MAPLEN(nr_pcpus);
+    unsigned char *cpumaps  = malloc(nr_vcpus * pcpu_maplen);
+    if (vcpuinfos == NULL || cpumaps == NULL) {
+        fprintf(stderr, "Memory allocation failed for vcpu info\n");
+        free(vcpuinfos);
+        free(cpumaps);
+        return -1;
+    }
+    int ret = virDomainGetVcpus(domain, vcpuinfos, nr_vcpus, cpumaps, pcpu_maplen);
+    if (ret < 1) {
+        // Handle error
+        fprintf(stderr, "Error getting vcpu info\n");
+        free(vcpuinfos);
+        free(cpumaps);
+        return -1;
+    }
+    /* Each vCPU is scheduled on its own, the VM's CPU time is the sum over them */
+    vm->nr_vcpus = ret;
+    vm->cpu_time = 0;
+    for (int k = 0; k < ret; k++) {
+        vm->vcpu_pcpu[k] = vcpuinfos[k].cpu;
+        vm->cpu_time += vcpuinfos[k].cpuTime;
+    }
+    vm->current_pcpu = vcpuinfos[0].cpu;
+    free(vcpuinfos);
+    free(cpumaps);
+    return 0;
+}
+
+int virt_query_pcpus(VirtContext *ctx, SystemState *state) {
+    return query_pcpus(ctx, state);
+}
+
+int virt_query_state(VirtContext *ctx, SystemState *state) {
+    /* Reset system state */
+    memset(state, 0, sizeof(SystemState));
+
+    if (query_pcpus(ctx, state) < 0) {
+        return -1;
+    }
+
+    /* The running domains, only listed when there are no lifecycle events */
+    if (domain_registry_refresh(&ctx->registry) < 0) {
+        return -1;
+    }
+    DomainRegistry *registry = &ctx->registry;
+    if (registry->nr_domains > MAX_VMS) {
+        fprintf(stderr, "Found %d VMs but only support up to %d\n", registry->nr_domains, MAX_VMS);
+        return -1;
+    }
 
     /* VM's CPU time */
-    for (int i = 0; i < nr_vms; i++) {
+    int nr_vms = 0;
+    for (int s = 0; s < MAX_VMS; s++) {
+        virDomainPtr domain = registry->entries[s].dom;
+        if (domain == NULL) {
+            continue;
+        }
         /* Get Virtual Machine's name and vCPU usage */
-		virDomainPtr domain = domains[i];
+        VM *vm = &state->vms[nr_vms];
         const char *vm_name = virDomainGetName(domain);
         if (vm_name) {
-            snprintf(state->vms[i].name, MAX_NAME_LEN, "%s", vm_name);
+            snprintf(vm->name, MAX_NAME_LEN, "%s", vm_name);
         }
-        state->vms[i].id = virDomainGetID(domain);
+        vm->id = registry->entries[s].id;
 
         /* Get number of vCPUs for a given domain (i.e VM) */
 		virDomainInfo dominfo;
 		if (virDomainGetInfo(domain, &dominfo) != 0) { // Get domain vCPU count
-			fprintf(stderr, "Failed to get info for domain: %d\n", i);
+			fprintf(stderr, "Failed to get info for domain: %d\n", vm->id);
 			return -1;
 		}
-		int nr_vcpus = dominfo.nrVirtCpu;
-
-        if (nr_vcpus != 1) {
-            fprintf(stderr, "Only support VM with 1 vCPU but found %d vCPUs\n", nr_vcpus);
+        if (query_vcpus(domain, dominfo.nrVirtCpu, state->nr_pcpus, vm) < 0) {
             return -1;
         }
+        nr_vms++;
+    }
+    state->nr_vms = nr_vms;
+    return 0;
+}
 
-		/* Allocate memory for getting virtual CPU info */
-        virVcpuInfoPtr vcpuinfos = malloc(nr_vcpus * sizeof(virVcpuInfo));
-        size_t pcpu_maplen = VIR_CPU_MAPLEN(nr_pcpus);
-        unsigned char *cpumaps  = malloc(nr_vcpus * pcpu_maplen);
-        int ret = virDomainGetVcpus(domain, vcpuinfos, nr_vcpus, cpumaps, pcpu_maplen);
-        if (ret < 0) {
-            // Handle error
-            fprintf(stderr, "Error getting vcpu info\n");
-            return -1;
-        } else if (ret == 1) {
-            state->vms[i].current_pcpu = vcpuinfos[0].cpu;
-            state->vms[i].cpu_time = vcpuinfos[0].cpuTime;
-        } else {
-            // Handle error
-            fprintf(stderr, "Error getting more than one vcpu info\n");
-            return -1;
+/**
+ * @brief Copies the numeric typed parameters of a stats record, skipping strings.
+ */
+static int typed_params_to_stats(const virTypedParameter *params, int nparams, DomainStat *stats) {
+    int nr_stats = 0;
+    for (int j = 0; j < nparams && nr_stats < MAX_DOMAIN_STATS; j++) {
+        unsigned long long value;
+        switch (params[j].type) {
+            case VIR_TYPED_PARAM_INT:     value = params[j].value.i < 0 ? 0 : params[j].value.i; break;
+            case VIR_TYPED_PARAM_UINT:    value = params[j].value.ui; break;
+            case VIR_TYPED_PARAM_LLONG:   value = params[j].value.l < 0 ? 0 : params[j].value.l; break;
+            case VIR_TYPED_PARAM_ULLONG:  value = params[j].value.ul; break;
+            case VIR_TYPED_PARAM_DOUBLE:  value = params[j].value.d < 0 ? 0 : (unsigned long long) params[j].value.d; break;
+            case VIR_TYPED_PARAM_BOOLEAN: value = params[j].value.b; break;
+            default: continue;
         }
-		
-		virDomainFree(domains[i]);
+        snprintf(stats[nr_stats].field, DOMAIN_STAT_FIELD_LEN, "%s", params[j].field);
+        stats[nr_stats].value = value;
+        nr_stats++;
     }
-    return 0;
+    return nr_stats;
 }
 
-int caculate_utilization_rate(SystemState *current, SystemState *previous, unsigned long long interval_ns) {
-    /* calculate current VM's utilization rate */
-    int vms_updated = 0;
-    for (int i = 0; i < current->nr_vms; i++) {
-        for (int j = 0; j < previous->nr_vms; j++) {
-            /* find matching previous vm */
-            if (current->vms[i].name == previous->vms[j].name) {
-                current->vms[i].cpu_usage_rate = (current->vms[i].cpu_time - previous->vms[j].cpu_time) * 100.0 / interval_ns;
-                vms_updated++;
-                break;
-            }
+/**
+ * @brief Registry slot of the domain when virt_apply_pinning pinned it, -1 otherwise.
+ */
+static int pinned_slot(VirtContext *ctx, int id) {
+    DomainEntry *entry = domain_registry_find_id(&ctx->registry, id);
+    if (entry == NULL) {
+        return -1;
+    }
+    int slot = entry - ctx->registry.entries;
+    return ctx->pinned_generation[slot] == entry->generation ? slot : -1;
+}
+
+/**
+ * @brief Takes the pCPU of every vCPU from what virt_apply_pinning last pinned.
+ *
+ * @return true when every vCPU of the VM has a known pCPU.
+ */
+static bool pinned_vcpu_pcpus(VirtContext *ctx, VM *vm) {
+    int slot = pinned_slot(ctx, vm->id);
+    if (slot < 0) {
+        return false;
+    }
+    for (int k = 0; k < vm_nr_vcpus(vm); k++) {
+        if (ctx->pinned_pcpu[slot][k] < 0) {
+            return false;
         }
     }
-    for (int i = 0; i < current->nr_pcpus; i++) {
-        for (int j = 0; j < previous->nr_pcpus; j++) {
-            if (current->pcpus[i].id == previous->pcpus[j].id) {
-                current->pcpus[i].idle_rate = (current->pcpus[i].idle_ns - previous->pcpus[j].idle_ns) * 100.0 / interval_ns;
-                /* Overwrite utilization rate */
-                current->pcpus[i].utilization_rate = 100.0 - current->pcpus[i].idle_rate;
-                break;
-            }
+    for (int k = 0; k < vm_nr_vcpus(vm); k++) {
+        vm->vcpu_pcpu[k] = ctx->pinned_pcpu[slot][k];
+    }
+    vm->current_pcpu = vm->vcpu_pcpu[0];
+    return true;
+}
+
+int virt_query_state_bulk(VirtContext *ctx, SystemState *state) {
+    /* Reset system state */
+    memset(state, 0, sizeof(SystemState));
+
+    if (query_pcpus(ctx, state) < 0) {
+        return -1;
+    }
+
+    virDomainStatsRecordPtr *records = NULL;
+    unsigned int flags = VIR_CONNECT_GET_ALL_DOMAINS_STATS_RUNNING |
+                         VIR_CONNECT_GET_ALL_DOMAINS_STATS_PERSISTENT;
+    int nr_vms = virConnectGetAllDomainStats(ctx->conn, VIR_DOMAIN_STATS_VCPU, &records, flags);
+    if (nr_vms < 0) {
+        fprintf(stderr, "Failed to get the stats of all domains\n");
+        return -1;
+    }
+
+    /* The reply names every running domain, so the registry follows it without listing */
+    static virDomainPtr doms[MAX_VMS];
+    for (int i = 0; i < nr_vms && i < MAX_VMS; i++) {
+        doms[i] = records[i]->dom;
+    }
+    domain_registry_sync(&ctx->registry, doms, nr_vms < MAX_VMS ? nr_vms : MAX_VMS);
+    int ret = 0;
+    if (nr_vms > MAX_VMS) {
+        fprintf(stderr, "Found %d VMs but only support up to %d\n", nr_vms, MAX_VMS);
+        ret = -1;
+    }
+
+    static DomainStat stats[MAX_DOMAIN_STATS];
+    for (int i = 0; i < nr_vms && ret == 0; i++) {
+        virDomainStatsRecordPtr record = records[i];
+        VM *vm = &state->vms[i];
+        /* Name and ID are kept in the handle, no RPC */
+        const char *vm_name = virDomainGetName(record->dom);
+        if (vm_name) {
+            snprintf(vm->name, MAX_NAME_LEN, "%s", vm_name);
+        }
+        vm->id = virDomainGetID(record->dom);
+
+        int nr_stats = typed_params_to_stats(record->params, record->nparams, stats);
+        if (domain_stats_to_vm(vm, stats, nr_stats) < 0) {
+            fprintf(stderr, "Unusable vcpu stats for VM %d (%s)\n", vm->id, vm->name);
+            ret = -1;
+            break;
+        }
+        /* Only domains that were never pinned (new or after a failed pin) need asking where they run */
+        if (!pinned_vcpu_pcpus(ctx, vm)) {
+            ret = query_vcpus(record->dom, vm->nr_vcpus, state->nr_pcpus, vm);
         }
     }
-    return vms_updated;
+
+    virDomainStatsRecordListFree(records);
+    /* A state that failed part way holds no VMs, so nothing walks past what was filled */
+    if (ret == 0) {
+        state->nr_vms = nr_vms;
+    }
+    return ret;
+}
+
+/**
+ * @brief Makes one cpumap per pCPU, each with only the bit of its pCPU set.
+ */
+static int prepare_cpumaps(VirtContext *ctx, int nr_pcpus) {
+    if (ctx->cpumaps != NULL && ctx->nr_cpumaps == nr_pcpus) {
+        return 0;
+    }
+    size_t cpumap_len = VIR_CPU_MAPLEN(nr_pcpus);
+    unsigned char *cpumaps = calloc(nr_pcpus, cpumap_len);
+    if (cpumaps == NULL) {
+        fprintf(stderr, "Memory allocation failed for cpumaps\n");
+        return -1;
+    }
+    for (int j = 0; j < nr_pcpus; j++) {
+        VIR_USE_CPU(cpumaps + j * cpumap_len, j);
+    }
+    free(ctx->cpumaps);
+    ctx->cpumaps = cpumaps;
+    ctx->cpumap_len = cpumap_len;
+    ctx->nr_cpumaps = nr_pcpus;
+    return 0;
+}
+
+/**
+ * @brief Forgets what was pinned for the slot when it now holds another domain.
+ */
+static void claim_pinned_slot(VirtContext *ctx, const DomainEntry *entry) {
+    int slot = entry - ctx->registry.entries;
+    if (ctx->pinned_generation[slot] == entry->generation) {
+        return;
+    }
+    for (int k = 0; k < MAX_VCPUS_PER_VM; k++) {
+        ctx->pinned_pcpu[slot][k] = -1;
+    }
+    ctx->pinned_generation[slot] = entry->generation;
 }
 
 int virt_apply_pinning(VirtContext *ctx, const SystemState *state, const Schedule *schedule) {
-    return -1;
-}
-
-void print_sys_state(SystemState *state) {
-    printf("System state\n");
-	for(int i = 0; i < state->nr_vms; i++){
-		printf(
-			"%d: VM %d (%s) pCPU: %d, usage rate: %.4f%%, cpu time: %lld\n",
-			i,
-            state->vms[i].id,
-			state->vms[i].name,
-			state->vms[i].current_pcpu,
-			state->vms[i].cpu_usage_rate,
-            state->vms[i].cpu_time
-		);
-	}
-	for(int i = 0; i < state->nr_pcpus; i++){
-		printf(
-			"PCPU %d utilization: %.6f%% idle (ns): %lld idel rate: %.4f%%\n",
-			state->pcpus[i].id,
-			state->pcpus[i].utilization_rate,
-            state->pcpus[i].idle_ns,
-            state->pcpus[i].idle_rate
-		);
-	}
-}
\ No newline at end of file
+    if (prepare_cpumaps(ctx, state->nr_pcpus) < 0) {
+        return -1;
+    }
+
+    int rpcs_before = ctx->registry.nr_rpcs;
+    int nr_rpcs = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int slot = pinned_slot(ctx, vm->id);
+
+        for (int k = 0; k < vm_nr_vcpus(vm); k++) {
+            int pcpu_id = schedule->vcpu_to_pcpu[i][k];
+            if (pcpu_id < 0 || pcpu_id >= ctx->nr_cpumaps) {
+                continue;
+            }
+            /* Running there and pinned there by an earlier tick */
+            if (slot >= 0 && pcpu_id == vm_vcpu_pcpu(vm, k) && pcpu_id == ctx->pinned_pcpu[slot][k]) {
+                continue;
+            }
+
+            if (slot < 0) {
+                DomainEntry *entry = domain_registry_lookup_id(&ctx->registry, vm->id);
+                if (entry == NULL) {
+                    fprintf(stderr, "Failed to look up VM %d (%s)\n", vm->id, vm->name);
+                    break;
+                }
+                claim_pinned_slot(ctx, entry);
+                slot = entry - ctx->registry.entries;
+            }
+
+            nr_rpcs++;
+            if (virDomainPinVcpu(ctx->registry.entries[slot].dom, k, ctx->cpumaps + pcpu_id * ctx->cpumap_len, ctx->cpumap_len) < 0) {
+                fprintf(stderr, "Failed to pin VM %d (%s) vCPU %d to pCPU %d\n", vm->id, vm->name, k, pcpu_id);
+                ctx->pinned_pcpu[slot][k] = -1;
+                continue;
+            }
+            ctx->pinned_pcpu[slot][k] = pcpu_id;
+            printf("Pinned VM %d (%s) vCPU %d to pCPU %d\n", vm->id, vm->name, k, pcpu_id);
+        }
+    }
+    return nr_rpcs + ctx->registry.nr_rpcs - rpcs_before;
+}
+
+void virt_context_init(VirtContext *ctx, virConnectPtr conn) {
+    memset(ctx, 0, sizeof(VirtContext));
+    ctx->conn = conn;
+    domain_registry_open(&ctx->registry, conn);
+}
+
+void virt_context_destroy(VirtContext *ctx) {
+    if (ctx->conn != NULL) {
+        domain_registry_close(&ctx->registry);
+    }
+    free(ctx->cpumaps);
+    memset(ctx, 0, sizeof(VirtContext));
+}
+
+/* One bulk stats call when libvirt has it, per domain calls otherwise */
+static int libvirt_query_state(void *impl, SystemState *state) {
+    VirtContext *ctx = impl;
+    if (virt_query_state_bulk(ctx, state) < 0 && virt_query_state(ctx, state) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int libvirt_apply_pinning(void *impl, const SystemState *state, const Schedule *schedule) {
+    return virt_apply_pinning(impl, state, schedule);
+}
+
+static const VirtBackendOps libvirt_ops = {
+    .name = "libvirt",
+    .query_state = libvirt_query_state,
+    .apply_pinning = libvirt_apply_pinning,
+};
+
+VirtBackend virt_backend(VirtContext *ctx) {
+    VirtBackend backend = { .ops = &libvirt_ops, .impl = ctx };
+    return backend;
+}
@@ -4,17 +4,78 @@
 #include <libvirt/libvirt.h>
 #include "vm_types.h"
 #include "scheduler.h"
+#include "domain_registry.h"
+#include "virt_backend.h"
 
+/**
+ * @brief The connection plus what the queries and virt_apply_pinning keep between ticks.
+ *
+ * Start it with virt_context_init and keep it for as long as the connection.
+ */
 typedef struct {
     virConnectPtr conn;
+    /* @brief Domain handles of the running domains */
+    DomainRegistry registry;
+    /* @brief pCPU each vCPU was last pinned to by virt_apply_pinning, by registry slot */
+    int pinned_pcpu[MAX_VMS][MAX_VCPUS_PER_VM];
+    /* @brief Generation of the registry slot pinned_pcpu was recorded for, 0 when nothing is pinned */
+    unsigned int pinned_generation[MAX_VMS];
+    /* @brief One cpumap per pCPU with only that pCPU's bit set */
+    unsigned char *cpumaps;
+    size_t cpumap_len;
+    int nr_cpumaps;
+    /* @brief Number of stats virNodeGetCPUStats reports per pCPU, 0 until asked */
+    int nr_cpu_stats;
 } VirtContext;
 
+/**
+ * @brief Queries the pCPUs and the vCPUs of every running domain, with a few calls per domain.
+ *
+ * @return 0 on success, -1 on failure. On failure the state holds no VMs.
+ */
 int virt_query_state(VirtContext *ctx, SystemState *state);
 
-int caculate_utilization_rate(SystemState *current, SystemState *previous, unsigned long long interval_ns);
+/**
+ * @brief Queries only the pCPUs (and topology) of the state, one RPC per pCPU.
+ */
+int virt_query_pcpus(VirtContext *ctx, SystemState *state);
 
+/**
+ * @brief Queries the same state as virt_query_state with one virConnectGetAllDomainStats call.
+ *
+ * The vCPU count and CPU time of every domain come from its vcpu.* stats. The stats
+ * don't say where a vCPU runs, so the pCPUs are the ones virt_apply_pinning last
+ * pinned; only domains it never pinned cost a virDomainGetVcpus call.
+ *
+ * @return 0 on success, -1 when the call fails (e.g. libvirt older than 1.2.8)
+ * or finds more than MAX_VMS domains. On failure the state holds no VMs.
+ */
+int virt_query_state_bulk(VirtContext *ctx, SystemState *state);
+
+/**
+ * @brief Pins the vCPUs whose placement changed.
+ *
+ * A vCPU is pinned when its pCPU in the schedule differs from the pCPU it runs on
+ * or from the pCPU it was last pinned to. Domain handles come from the registry and
+ * cpumaps are kept in the context, so a tick without moves makes no libvirt calls.
+ *
+ * @return The number of libvirt RPCs made (domain lookups and pins), -1 when memory allocation fails.
+ */
 int virt_apply_pinning(VirtContext *ctx, const SystemState *state, const Schedule *schedule);
 
-void print_sys_state(SystemState *state);
+/**
+ * @brief Starts a context for the connection, subscribing to lifecycle events when it can.
+ */
+void virt_context_init(VirtContext *ctx, virConnectPtr conn);
+
+/**
+ * @brief Frees the domain handles and cpumaps of the context.
+ */
+void virt_context_destroy(VirtContext *ctx);
+
+/**
+ * @brief The backend that queries and pins through the context's connection.
+ */
+VirtBackend virt_backend(VirtContext *ctx);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include "vm_table.h"
+
+/**
+ * @brief Fibonacci hashing, domain IDs are small consecutive numbers.
+ */
+static int bucket_of(int id) {
+    return (int) (((uint32_t) id * 2654435769u) % VM_TABLE_CAPACITY);
+}
+
+void vm_table_clear(VMTable *table) {
+    for (int b = 0; b < VM_TABLE_CAPACITY; b++) {
+        table->keys[b] = VM_TABLE_EMPTY;
+    }
+    table->nr_entries = 0;
+}
+
+/**
+ * @brief The bucket holding id, or the free bucket where it would go.
+ */
+static int find_bucket(const VMTable *table, int id) {
+    int b = bucket_of(id);
+    while (table->keys[b] != VM_TABLE_EMPTY && table->keys[b] != id) {
+        b = (b + 1) % VM_TABLE_CAPACITY;
+    }
+    return b;
+}
+
+int vm_table_get(const VMTable *table, int id) {
+    if (id == VM_TABLE_EMPTY) {
+        return -1;
+    }
+    int b = find_bucket(table, id);
+    return table->keys[b] == id ? table->values[b] : -1;
+}
+
+int vm_table_put(VMTable *table, int id, int value) {
+    if (id == VM_TABLE_EMPTY) {
+        return -1;
+    }
+    /* Keep a free bucket so probes always end */
+    int b = find_bucket(table, id);
+    if (table->keys[b] != id) {
+        if (table->nr_entries >= VM_TABLE_CAPACITY - 1) {
+            return -1;
+        }
+        table->keys[b] = id;
+        table->nr_entries++;
+    }
+    table->values[b] = value;
+    return 0;
+}
+
+bool vm_table_remove(VMTable *table, int id) {
+    if (id == VM_TABLE_EMPTY) {
+        return false;
+    }
+    int hole = find_bucket(table, id);
+    if (table->keys[hole] != id) {
+        return false;
+    }
+    table->keys[hole] = VM_TABLE_EMPTY;
+    table->nr_entries--;
+
+    /* Move back the entries of the cluster that can no longer be reached past the hole */
+    int b = (hole + 1) % VM_TABLE_CAPACITY;
+    while (table->keys[b] != VM_TABLE_EMPTY) {
+        int home = bucket_of(table->keys[b]);
+        /* The entry stays when its home lies cyclically in (hole, b] */
+        bool reachable = hole < b ? (home > hole && home <= b) : (home > hole || home <= b);
+        if (!reachable) {
+            table->keys[hole] = table->keys[b];
+            table->values[hole] = table->values[b];
+            table->keys[b] = VM_TABLE_EMPTY;
+            hole = b;
+        }
+        b = (b + 1) % VM_TABLE_CAPACITY;
+    }
+    return true;
+}
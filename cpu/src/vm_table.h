@@ -0,0 +1,42 @@
+#ifndef VM_TABLE_H
+#define VM_TABLE_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+
+/* Power of two, twice MAX_VMS so probes stay short when every VM is in */
+#define VM_TABLE_CAPACITY (2 * MAX_VMS)
+#define VM_TABLE_EMPTY INT32_MIN
+
+/**
+ * @brief Open addressing hash map from domain ID to an int (e.g. a VM index or a history slot).
+ *
+ * Linear probing, and removal shifts the rest of the cluster back instead of
+ * leaving tombstones, so lookups stay O(1) however many domains come and go.
+ */
+typedef struct {
+    int keys[VM_TABLE_CAPACITY];     // Domain ID, VM_TABLE_EMPTY when the bucket is free
+    int values[VM_TABLE_CAPACITY];
+    int nr_entries;
+} VMTable;
+
+void vm_table_clear(VMTable *table);
+
+/**
+ * @brief The value of domain ID id, -1 when it isn't in the table.
+ */
+int vm_table_get(const VMTable *table, int id);
+
+/**
+ * @brief Sets the value of domain ID id, adding it when needed.
+ *
+ * @return 0 on success, -1 when the table is full or id is VM_TABLE_EMPTY.
+ */
+int vm_table_put(VMTable *table, int id, int value);
+
+/**
+ * @brief Removes domain ID id. Returns false when it wasn't in the table.
+ */
+bool vm_table_remove(VMTable *table, int id);
+
+#endif
@@ -5,30 +5,47 @@
 #include <stdbool.h>
 
 #define MAX_NAME_LEN 8
-#define MAX_VMS      8
-#define MAX_PCPUS    4
+#define MAX_VMS      1024
+#define MAX_PCPUS    512
+#define MAX_VCPUS_PER_VM 32
 
 typedef struct {
     char               name[MAX_NAME_LEN];  // VM's name (aka domain's name)
     int                id;
-    int                current_pcpu;
-    double             cpu_usage_rate;
-    unsigned long long cpu_time;
+    int                current_pcpu;        // pCPU of vCPU 0
+    int                nr_vcpus;            // 0 or 1 both mean one vCPU on current_pcpu
+    int                vcpu_pcpu[MAX_VCPUS_PER_VM];  // pCPU of each vCPU when nr_vcpus > 1
+    double             cpu_usage_rate;      // Moving average when sampled
+    double             cpu_usage_peak;      // Highest recent sample
+    double             cpu_usage_stddev;    // Spread of the recent samples
+    unsigned long long cpu_time;            // Sum over the vCPUs
+    int                move_penalty;        // Extra cost of moving any of its vCPUs, 0 or less for none
 } VM;
 
 typedef struct {
     int    id;
     double utilization_rate;
+    double utilization_peak;                // Highest recent sample
+    double utilization_stddev;              // Spread of the recent samples, 0 when not sampled
     unsigned long long idle_ns;
     /* Idle rate is more accurate than utilization rate */
     double idle_rate;
 } PCPU;
 
+/* Where each host CPU (indexed by pCPU id) sits. Groups are compared by id only. */
+typedef struct {
+    int nr_cpus;                 // 0 or less when the topology is unknown
+    int core[MAX_PCPUS];         // CPUs with the same core are SMT siblings
+    int llc[MAX_PCPUS];          // CPUs with the same llc share the last level cache
+    int node[MAX_PCPUS];         // NUMA node
+} CPUTopology;
+
 typedef struct {
     VM vms[MAX_VMS];
     PCPU pcpus[MAX_PCPUS];
     int nr_vms;
     int nr_pcpus;
+    CPUTopology topology;
 } SystemState;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "balloon_applier.h"
+#include "coordinator.h"
+#include "tick_schedule.h"
+
+void latency_histogram_add(LatencyHistogram *histogram, long long ns) {
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && ns >= (1000LL << b)) {
+        b++;
+    }
+    histogram->counts[b]++;
+    histogram->nr_calls++;
+    histogram->total_ns += ns;
+    if (ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+long long latency_histogram_percentile(const LatencyHistogram *histogram, double p) {
+    if (histogram->nr_calls == 0) {
+        return 0;
+    }
+    /* The first bucket whose calls and all below make up p percent */
+    long long rank = (long long) (p / 100 * histogram->nr_calls + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    long long nr_calls = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        nr_calls += histogram->counts[b];
+        if (nr_calls >= rank) {
+            long long bound_ns = 1000LL << b;
+            return bound_ns < histogram->max_ns ? bound_ns : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+void print_latency_histogram(const LatencyHistogram *histogram, const char *name) {
+    if (histogram->nr_calls == 0) {
+        printf("%s: no calls\n", name);
+        return;
+    }
+    printf("%s: %lld calls, mean %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms\n", name, histogram->nr_calls,
+        histogram->total_ns / 1e6 / histogram->nr_calls, latency_histogram_percentile(histogram, 50) / 1e6,
+        latency_histogram_percentile(histogram, 99) / 1e6, histogram->max_ns / 1e6);
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        if (histogram->counts[b] == 0) {
+            continue;
+        }
+        if (b == LATENCY_BUCKETS - 1) {
+            printf("  >= %9lld us: %lld\n", 1LL << (b - 1), histogram->counts[b]);
+        } else {
+            printf("  <  %9lld us: %lld\n", 1LL << b, histogram->counts[b]);
+        }
+    }
+}
+
+static bool is_busy(const BalloonApplier *applier, int vm_id) {
+    for (int i = 0; i < applier->nr_busy; i++) {
+        if (applier->busy_ids[i] == vm_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void drop_busy(BalloonApplier *applier, int vm_id) {
+    for (int i = 0; i < applier->nr_busy; i++) {
+        if (applier->busy_ids[i] == vm_id) {
+            applier->busy_ids[i] = applier->busy_ids[--applier->nr_busy];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Takes calls off the queue until the applier stops, making them without the lock.
+ */
+static void *run_worker(void *opaque) {
+    BalloonApplier *applier = opaque;
+    pthread_mutex_lock(&applier->lock);
+    for (;;) {
+        while (applier->nr_queued == 0 && !applier->stopping) {
+            pthread_cond_wait(&applier->queued, &applier->lock);
+        }
+        if (applier->nr_queued == 0) {
+            break;
+        }
+        BalloonCall call = applier->queue[applier->head];
+        applier->head = (applier->head + 1) % MAX_VMS;
+        applier->nr_queued--;
+        pthread_mutex_unlock(&applier->lock);
+
+        long long start_ns = tick_now_ns();
+        int result = call.backend.ops->set_memory(call.backend.impl, call.vm_id, call.memory_kb);
+        long long call_ns = tick_now_ns() - start_ns;
+        if (result < 0) {
+            fprintf(stderr, "Failed to set VM %d memory\n", call.vm_id);
+        }
+
+        pthread_mutex_lock(&applier->lock);
+        latency_histogram_add(&applier->latency, call_ns);
+        if (call.batch == applier->batch) {
+            applier->current.nr_pending--;
+            if (result < 0) {
+                applier->current.nr_failed++;
+            } else {
+                applier->current.nr_set++;
+            }
+        } else {
+            applier->nr_late++;
+            applier->nr_late_failed += result < 0;
+        }
+        drop_busy(applier, call.vm_id);
+        pthread_cond_broadcast(&applier->done);
+    }
+    pthread_mutex_unlock(&applier->lock);
+    return NULL;
+}
+
+int balloon_applier_start(BalloonApplier *applier, int nr_workers, int min_change_mb, long long wait_ns) {
+    if (nr_workers < 1 || nr_workers > APPLIER_MAX_WORKERS || min_change_mb < 0 || wait_ns < 0) {
+        fprintf(stderr, "Can't set balloons from %d workers\n", nr_workers);
+        return -1;
+    }
+    memset(applier, 0, sizeof(BalloonApplier));
+    applier->min_change_kb = min_change_mb * ONE_K;
+    applier->wait_ns = wait_ns;
+    pthread_mutex_init(&applier->lock, NULL);
+    pthread_cond_init(&applier->queued, NULL);
+    /* Applies wait on the monotonic clock, like the ticks */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&applier->done, &attr);
+    pthread_condattr_destroy(&attr);
+    for (int w = 0; w < nr_workers; w++) {
+        if (pthread_create(&applier->workers[w], NULL, run_worker, applier) != 0) {
+            fprintf(stderr, "Failed to start balloon worker %d\n", w);
+            balloon_applier_stop(applier);
+            return -1;
+        }
+        applier->nr_workers++;
+    }
+    return 0;
+}
+
+int balloon_applier_apply(BalloonApplier *applier, const VirtBackend *backend, const SystemState *state, ApplyResult *result) {
+    pthread_mutex_lock(&applier->lock);
+    applier->batch++;
+    memset(&applier->current, 0, sizeof(ApplyResult));
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int change_kb = abs(vm->target_memory_kb - vm->balloon_size_kb);
+        if (change_kb == 0 || change_kb < applier->min_change_kb) {
+            applier->current.nr_skipped++;
+            continue;
+        }
+        /* A full list only holds calls of VMs that are hung or gone */
+        if (is_busy(applier, vm->id) || applier->nr_busy == MAX_VMS) {
+            applier->current.nr_busy++;
+            continue;
+        }
+        BalloonCall *call = &applier->queue[(applier->head + applier->nr_queued) % MAX_VMS];
+        call->backend = *backend;
+        call->vm_id = vm->id;
+        call->memory_kb = vm->target_memory_kb;
+        call->batch = applier->batch;
+        applier->nr_queued++;
+        applier->busy_ids[applier->nr_busy++] = vm->id;
+        applier->current.nr_pending++;
+    }
+    pthread_cond_broadcast(&applier->queued);
+
+    long long deadline_ns = tick_now_ns() + applier->wait_ns;
+    struct timespec deadline = { deadline_ns / 1000000000LL, deadline_ns % 1000000000LL };
+    while (applier->current.nr_pending > 0) {
+        if (pthread_cond_timedwait(&applier->done, &applier->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    *result = applier->current;
+    pthread_mutex_unlock(&applier->lock);
+    return 0;
+}
+
+void balloon_applier_drain(BalloonApplier *applier) {
+    pthread_mutex_lock(&applier->lock);
+    while (applier->nr_busy > 0) {
+        pthread_cond_wait(&applier->done, &applier->lock);
+    }
+    pthread_mutex_unlock(&applier->lock);
+}
+
+void balloon_applier_stop(BalloonApplier *applier) {
+    pthread_mutex_lock(&applier->lock);
+    applier->stopping = true;
+    pthread_cond_broadcast(&applier->queued);
+    pthread_mutex_unlock(&applier->lock);
+    /* The workers finish the queue before they leave */
+    for (int w = 0; w < applier->nr_workers; w++) {
+        pthread_join(applier->workers[w], NULL);
+    }
+    applier->nr_workers = 0;
+    pthread_cond_destroy(&applier->queued);
+    pthread_cond_destroy(&applier->done);
+    pthread_mutex_destroy(&applier->lock);
+}
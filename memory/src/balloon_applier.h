@@ -0,0 +1,115 @@
+#ifndef BALLOON_APPLIER_H
+#define BALLOON_APPLIER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "vm_types.h"
+#include "virt_backend.h"
+
+// Worker threads setting balloons at the same time, at most
+#define APPLIER_MAX_WORKERS 8
+// A balloon closer than this to its target isn't worth a call
+#define APPLIER_MIN_CHANGE_MB 4
+// Bucket b counts the calls under 2^b us, the last one everything from about 4 s up
+#define LATENCY_BUCKETS 24
+
+/**
+ * @brief How long calls took, in power of two buckets of microseconds.
+ */
+typedef struct {
+    long long counts[LATENCY_BUCKETS];
+    long long nr_calls;
+    long long total_ns;
+    long long max_ns;
+} LatencyHistogram;
+
+void latency_histogram_add(LatencyHistogram *histogram, long long ns);
+
+/**
+ * @brief The upper bound of the bucket the p-th percentile (0 to 100) falls in.
+ *
+ * @return Nanoseconds, max_ns for the last bucket, 0 without calls
+ */
+long long latency_histogram_percentile(const LatencyHistogram *histogram, double p);
+
+void print_latency_histogram(const LatencyHistogram *histogram, const char *name);
+
+/**
+ * @brief A balloon to set, queued for the workers.
+ */
+typedef struct {
+    VirtBackend backend;
+    int         vm_id;
+    int         memory_kb;
+    unsigned    batch;       // The apply that queued it
+} BalloonCall;
+
+/**
+ * @brief What one balloon_applier_apply did with the targets of a state.
+ */
+typedef struct {
+    int nr_set;
+    int nr_failed;
+    int nr_skipped;   // Already within min_change_kb of the target
+    int nr_busy;      // The call of an earlier apply still runs for the VM
+    int nr_pending;   // Queued, but not done when the apply stopped waiting
+} ApplyResult;
+
+/**
+ * @brief Sets balloons from a small pool of worker threads.
+ *
+ * An apply queues a call for every VM whose balloon is min_change_kb or more away
+ * from its target, and waits up to wait_ns for them. A guest whose balloon driver
+ * is slow to answer only holds up its own worker: the apply returns with the call
+ * still pending, and later applies skip the VM until it finishes. A VM never has
+ * more than one call queued or running. The backend's set_memory must be safe to
+ * call from the workers while the caller queries the host.
+ */
+typedef struct {
+    pthread_t        workers[APPLIER_MAX_WORKERS];
+    int              nr_workers;
+    int              min_change_kb;
+    long long        wait_ns;
+    pthread_mutex_t  lock;
+    pthread_cond_t   queued;             // A call was queued, or the workers should stop
+    pthread_cond_t   done;               // A call finished
+    BalloonCall      queue[MAX_VMS];     // Ring of the calls no worker took yet
+    int              head;
+    int              nr_queued;
+    int              busy_ids[MAX_VMS];  // VMs with a call queued or running
+    int              nr_busy;
+    unsigned         batch;
+    ApplyResult      current;            // Of the last apply, the workers fill it in
+    bool             stopping;
+    int              nr_late;            // Calls that finished after their apply stopped waiting
+    int              nr_late_failed;
+    LatencyHistogram latency;            // Of every set_memory call
+} BalloonApplier;
+
+/**
+ * @brief Starts nr_workers threads.
+ *
+ * @param min_change_mb Smaller changes are skipped, 0 only skips the balloons already at their target
+ * @param wait_ns How long an apply waits for its calls
+ * @return 0 on success, -1 when the arguments are out of range or a thread couldn't start
+ */
+int balloon_applier_start(BalloonApplier *applier, int nr_workers, int min_change_mb, long long wait_ns);
+
+/**
+ * @brief Sets the balloons of the state's VMs to their target_memory_kb.
+ *
+ * @return 0, with what happened to every VM in *result
+ */
+int balloon_applier_apply(BalloonApplier *applier, const VirtBackend *backend, const SystemState *state, ApplyResult *result);
+
+/**
+ * @brief Waits until no call is queued or running.
+ */
+void balloon_applier_drain(BalloonApplier *applier);
+
+/**
+ * @brief Waits for the calls left, and stops the workers.
+ */
+void balloon_applier_stop(BalloonApplier *applier);
+
+#endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include "balloon_controller.h"
+#include "coordinator.h"
+#include "working_set.h"
+
+BalloonGains balloon_default_gains(void) {
+    BalloonGains gains = {
+        .kp = 0.8,
+        .ki = 0.2,
+        .lookahead_ticks = 2,
+    };
+    return gains;
+}
+
+void balloon_controller_init(BalloonController *controller, BalloonGains gains) {
+    memset(controller, 0, sizeof(BalloonController));
+    controller->gains = gains;
+}
+
+double balloon_use_slope(const BalloonHistory *history) {
+    int n = history->nr_samples;
+    if (n < 2) {
+        return 0;
+    }
+    /* Times relative to the oldest sample keep the sums small */
+    int oldest = (history->head - n + BALLOON_HISTORY) % BALLOON_HISTORY;
+    double mean_t = 0;
+    double mean_u = 0;
+    for (int s = 0; s < n; s++) {
+        int k = (oldest + s) % BALLOON_HISTORY;
+        mean_t += (history->time_ns[k] - history->time_ns[oldest]) / 1e9;
+        mean_u += history->used_kb[k];
+    }
+    mean_t /= n;
+    mean_u /= n;
+    double covariance = 0;
+    double variance = 0;
+    for (int s = 0; s < n; s++) {
+        int k = (oldest + s) % BALLOON_HISTORY;
+        double dt = (history->time_ns[k] - history->time_ns[oldest]) / 1e9 - mean_t;
+        covariance += dt * (history->used_kb[k] - mean_u);
+        variance += dt * dt;
+    }
+    return variance > 0 ? covariance / variance : 0;
+}
+
+/**
+ * @brief The history of the VM, keeping only the VMs of this state.
+ */
+static BalloonHistory *find_history(BalloonHistory *previous, int nr_previous, int id) {
+    for (int j = 0; j < nr_previous; j++) {
+        if (previous[j].id == id) {
+            return &previous[j];
+        }
+    }
+    return NULL;
+}
+
+static void add_sample(BalloonHistory *history, double used_kb, long long now_ns) {
+    /* A tick at the same time (a replayed duplicate) replaces the last sample */
+    int last = (history->head - 1 + BALLOON_HISTORY) % BALLOON_HISTORY;
+    if (history->nr_samples > 0 && history->time_ns[last] == now_ns) {
+        history->used_kb[last] = used_kb;
+        return;
+    }
+    history->used_kb[history->head] = used_kb;
+    history->time_ns[history->head] = now_ns;
+    history->head = (history->head + 1) % BALLOON_HISTORY;
+    if (history->nr_samples < BALLOON_HISTORY) {
+        history->nr_samples++;
+    }
+}
+
+/**
+ * @brief Mean time between the samples, 0 with fewer than two.
+ */
+static double sample_period_s(const BalloonHistory *history) {
+    int n = history->nr_samples;
+    if (n < 2) {
+        return 0;
+    }
+    int oldest = (history->head - n + BALLOON_HISTORY) % BALLOON_HISTORY;
+    int newest = (history->head - 1 + BALLOON_HISTORY) % BALLOON_HISTORY;
+    return (history->time_ns[newest] - history->time_ns[oldest]) / 1e9 / (n - 1);
+}
+
+int predict_vm_target_memory(BalloonController *controller, SystemState *sys_state, long long now_ns) {
+    BalloonHistory previous[MAX_VMS];
+    int nr_previous = controller->nr_vms;
+    memcpy(previous, controller->vms, sizeof(BalloonHistory) * nr_previous);
+
+    double step_kb[MAX_VMS];
+    double margin_kb[MAX_VMS];
+    long long host_available_kb = (long long) (sys_state->free_memory_bytes / ONE_K) - TARGET_HOST_FREE_MB * ONE_K;
+    for (int i = 0; i < sys_state->nr_vms; i++) {
+        VM *vm = &sys_state->vms[i];
+        BalloonHistory *history = &controller->vms[i];
+        BalloonHistory *known = find_history(previous, nr_previous, vm->id);
+        if (known != NULL) {
+            *history = *known;
+        } else {
+            memset(history, 0, sizeof(BalloonHistory));
+            history->id = vm->id;
+        }
+        double used_kb = working_set_used_kb(vm);
+        add_sample(history, used_kb, now_ns);
+
+        /* Only growth is projected, a shrinking VM gives memory back at the reclaim pace anyway */
+        double slope = balloon_use_slope(history);
+        double lookahead_s = controller->gains.lookahead_ticks * sample_period_s(history);
+        double projected_kb = used_kb + (slope > 0 ? slope * lookahead_s : 0);
+        double error_kb = projected_kb + TARGET_VM_AVAILABLE_MB * ONE_K - vm->balloon_size_kb;
+
+        /* The integral restarts when the error changes sign, so it can't wind up across a reversal */
+        if ((error_kb > 0) != (history->integral_kb > 0)) {
+            history->integral_kb = 0;
+        }
+        double max_integral_kb = BALLOON_MAX_INTEGRAL_MB * ONE_K;
+        history->integral_kb += error_kb;
+        history->integral_kb = history->integral_kb > max_integral_kb ? max_integral_kb :
+            (history->integral_kb < -max_integral_kb ? -max_integral_kb : history->integral_kb);
+        step_kb[i] = controller->gains.kp * error_kb + controller->gains.ki * history->integral_kb;
+        margin_kb[i] = vm->balloon_size_kb - projected_kb;
+
+        if (step_kb[i] < -MAX_MEMORY_DELTA_MB * ONE_K) {
+            step_kb[i] = -MAX_MEMORY_DELTA_MB * ONE_K;
+        }
+        if (vm->max_memory_kb > 0 && vm->balloon_size_kb + step_kb[i] > vm->max_memory_kb) {
+            step_kb[i] = vm->max_memory_kb - vm->balloon_size_kb;
+        }
+        vm->target_memory_kb = vm->balloon_size_kb;
+        if (step_kb[i] < 0) {
+            vm->target_memory_kb += (int) step_kb[i];
+            host_available_kb -= (int) step_kb[i];
+        }
+    }
+    controller->nr_vms = sys_state->nr_vms;
+
+    /* Growth goes to the VMs with the least projected headroom first */
+    bool granted[MAX_VMS] = { false };
+    for (;;) {
+        int next = -1;
+        for (int i = 0; i < sys_state->nr_vms; i++) {
+            if (!granted[i] && step_kb[i] > 0 && (next < 0 || margin_kb[i] < margin_kb[next])) {
+                next = i;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        granted[next] = true;
+        long long grant_kb = (long long) step_kb[next] < host_available_kb ? (long long) step_kb[next] : host_available_kb;
+        if (grant_kb > 0) {
+            sys_state->vms[next].target_memory_kb += (int) grant_kb;
+            host_available_kb -= grant_kb;
+        }
+    }
+    return sys_state->nr_vms;
+}
@@ -0,0 +1,68 @@
+#ifndef BALLOON_CONTROLLER_H
+#define BALLOON_CONTROLLER_H
+
+#include "vm_types.h"
+
+// Samples of every VM's memory use kept for its slope
+#define BALLOON_HISTORY 8
+// The integral term never asks for more than this on its own
+#define BALLOON_MAX_INTEGRAL_MB 256
+
+/**
+ * @brief Gains of the balloon controller.
+ */
+typedef struct {
+    double kp;               // Share of the error closed per tick
+    double ki;               // Share of the summed error added per tick
+    double lookahead_ticks;  // How far ahead the growth of a VM is projected
+} BalloonGains;
+
+/**
+ * @brief Recent memory use of one VM, in a ring buffer.
+ */
+typedef struct {
+    int       id;
+    double    used_kb[BALLOON_HISTORY];
+    long long time_ns[BALLOON_HISTORY];
+    int       head;          // Next slot to write
+    int       nr_samples;
+    double    integral_kb;   // Summed error since its sign last changed
+} BalloonHistory;
+
+/**
+ * @brief Sizes the balloons ahead of where the VMs' memory use is heading.
+ *
+ * compute_vm_target_memory moves a balloon by at most MAX_MEMORY_DELTA_MB per
+ * tick towards TARGET_VM_AVAILABLE_MB available, so a guest growing faster than
+ * that runs out of memory before the balloon catches up. The controller fits a
+ * slope to each VM's use (working_set_used_kb) over the last BALLOON_HISTORY
+ * ticks, projects it lookahead_ticks ahead and asks for that plus the target. A
+ * PI step closes the gap: growth is only capped by the host and the domain's
+ * maximum, and reclaim still moves at most MAX_MEMORY_DELTA_MB per tick.
+ */
+typedef struct {
+    BalloonGains   gains;
+    BalloonHistory vms[MAX_VMS];
+    int            nr_vms;
+} BalloonController;
+
+BalloonGains balloon_default_gains(void);
+
+void balloon_controller_init(BalloonController *controller, BalloonGains gains);
+
+/**
+ * @brief Least squares slope of the VM's memory use, in KB per second. 0 with fewer than two samples.
+ */
+double balloon_use_slope(const BalloonHistory *history);
+
+/**
+ * @brief Sets every VM's target_memory_kb from its projected use.
+ *
+ * Reclaimed memory goes back to the host first, then the VMs closest to running
+ * out get theirs, as long as the host keeps TARGET_HOST_FREE_MB free.
+ *
+ * @return -1 in error or number of VMs updated
+ */
+int predict_vm_target_memory(BalloonController *controller, SystemState *sys_state, long long now_ns);
+
+#endif
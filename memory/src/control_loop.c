@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <locale.h>
+#include <string.h>
+#include "control_loop.h"
+#include "coordinator.h"
+#include "fair_share.h"
+#include "tick_schedule.h"
+
+void memory_control_init(MemoryControl *ctl) {
+    memset(ctl, 0, sizeof(MemoryControl));
+    balloon_controller_init(&ctl->controller, balloon_default_gains());
+    working_set_init(&ctl->working_set);
+}
+
+bool memory_control_probe(MemoryControl *ctl, const VirtBackend *backend, double low_mb) {
+    SystemState current;
+    if (backend->ops->query_state(backend->impl, &current) < 0) {
+        return false;
+    }
+    /* VMs come in no fixed order, so match them by id */
+    double previous_mb[MAX_VMS];
+    double current_mb[MAX_VMS];
+    int nr_vms = 0;
+    for (int i = 0; i < current.nr_vms && ctl->has_probed; i++) {
+        for (int j = 0; j < ctl->probed.nr_vms; j++) {
+            if (current.vms[i].id == ctl->probed.vms[j].id) {
+                previous_mb[nr_vms] = ctl->probed.vms[j].memory_available_kb / (double) ONE_K;
+                current_mb[nr_vms] = current.vms[i].memory_available_kb / (double) ONE_K;
+                nr_vms++;
+                break;
+            }
+        }
+    }
+    ctl->probed = current;
+    ctl->has_probed = true;
+    return tick_crossed_below(previous_mb, current_mb, nr_vms, low_mb) > 0;
+}
+
+int memory_control_tick(MemoryControl *ctl, const VirtBackend *backend, long long now_ns) {
+    long long start_ns = tick_now_ns();
+    if (backend->ops->set_stats_period(backend->impl) < 0) {
+        fprintf(stderr, "Failed to set vm memory stats period\n");
+        return -1;
+    }
+    SystemState sys_state;
+    if (backend->ops->query_state(backend->impl, &sys_state) < 0) {
+        fprintf(stderr, "Failed to query the current system state\n");
+        return -1;
+    }
+    ctl->stats.query_ns += tick_now_ns() - start_ns;
+    ctl->stats.nr_ticks++;
+    if (ctl->verbose) {
+        print_sys_state(&sys_state);
+    }
+    if (ctl->trace != NULL) {
+        trace_write_state(ctl->trace, now_ns, &sys_state);
+    }
+
+    start_ns = tick_now_ns();
+    working_set_update(&ctl->working_set, &sys_state, now_ns);
+    int result = ctl->mode == ALLOCATE_PREDICTIVE ? predict_vm_target_memory(&ctl->controller, &sys_state, now_ns) :
+        (ctl->mode == ALLOCATE_FAIR_SHARE ? fair_share_vm_target_memory(&sys_state) : compute_vm_target_memory(&sys_state));
+    if (result < 0) {
+        fprintf(stderr, "Failed to computer new target memory\n");
+        return -1;
+    }
+    ctl->stats.compute_ns += tick_now_ns() - start_ns;
+    if (ctl->trace != NULL) {
+        trace_write_targets(ctl->trace, now_ns, &sys_state);
+    }
+
+    start_ns = tick_now_ns();
+    if (ctl->applier != NULL) {
+        ApplyResult applied;
+        balloon_applier_apply(ctl->applier, backend, &sys_state, &applied);
+        ctl->stats.nr_set += applied.nr_set;
+        ctl->stats.nr_failed += applied.nr_failed;
+        ctl->stats.nr_skipped += applied.nr_skipped;
+        ctl->stats.nr_busy += applied.nr_busy;
+        ctl->stats.nr_pending += applied.nr_pending;
+        ctl->stats.apply_ns += tick_now_ns() - start_ns;
+        if (ctl->verbose) {
+            printf("Set %d balloons, %d failed, %d close to their target, %d still setting\n", applied.nr_set,
+                applied.nr_failed, applied.nr_skipped, applied.nr_busy + applied.nr_pending);
+        }
+        return 0;
+    }
+    for(int i = 0; i < sys_state.nr_vms; i++){
+        int vm_id = sys_state.vms[i].id;
+        int vm_target_kb = sys_state.vms[i].target_memory_kb;
+        if (backend->ops->set_memory(backend->impl, vm_id, vm_target_kb) < 0) {
+            fprintf(stderr, "Failed to set new VM memory\n");
+            ctl->stats.nr_failed++;
+            continue;
+        }
+        ctl->stats.nr_set++;
+        if (ctl->verbose) {
+            printf("Successfully set VM %d (%s) memory to %'d KB\n", vm_id, sys_state.vms[i].name, vm_target_kb);
+        }
+    }
+    ctl->stats.apply_ns += tick_now_ns() - start_ns;
+    return 0;
+}
+
+void print_sys_state(SystemState *state) {
+    setlocale(LC_NUMERIC, "en_US.UTF-8");
+    printf("\nSystem state (MBs)\n");
+    printf("------------\n");
+    printf("Available: %'lld\n", state->free_memory_bytes / 1024 / 1024);
+    printf("------------\n");
+	for(int i = 0; i < state->nr_vms; i++){
+		printf(
+			"%d: VM %d (%s) max: %'d, unused: %'d, available: %'d, usable: %'d, balloon: %'d\n",
+			i,
+            state->vms[i].id,
+			state->vms[i].name,
+            state->vms[i].max_memory_kb / 1024,
+			state->vms[i].memory_unused_kb / 1024,
+			state->vms[i].memory_available_kb / 1024,
+            state->vms[i].balloon_size_kb / 1024,
+            state->vms[i].memory_usable_kb / 1024
+		);
+	}
+}
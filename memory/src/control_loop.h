@@ -0,0 +1,65 @@
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "trace.h"
+#include "coordinator.h"
+#include "balloon_controller.h"
+#include "working_set.h"
+#include "balloon_applier.h"
+#include "virt_backend.h"
+
+/**
+ * @brief Where a tick's time goes, measured on the monotonic clock.
+ */
+typedef struct {
+    int       nr_ticks;
+    int       nr_set;       // Balloons set
+    int       nr_failed;    // Balloons that failed to set
+    int       nr_skipped;   // Balloons within the applier's min_change_kb of their target
+    int       nr_busy;      // Balloons the applier was still setting from an earlier tick
+    int       nr_pending;   // Balloons the applier was still setting when the tick stopped waiting
+    long long query_ns;     // In the backend's set_stats_period and query_state
+    long long compute_ns;   // Estimating the working sets and computing the targets
+    long long apply_ns;     // In the backend's set_memory, or waiting for the applier
+} ControlStats;
+
+/**
+ * @brief What memory_coordinator keeps between ticks.
+ *
+ * The loop only talks to the hypervisor through a VirtBackend, so the same ticks
+ * run against libvirt in the daemon and against a SimHypervisor in the tests.
+ */
+typedef struct {
+    bool                verbose;             // Print the state and balloons of every tick
+    TraceWriter         *trace;              // NULL when not recording
+    SystemState         probed;              // The last state the probe saw
+    bool                has_probed;
+    AllocationMode      mode;
+    BalloonController   controller;          // ALLOCATE_PREDICTIVE only
+    WorkingSetEstimator working_set;
+    BalloonApplier      *applier;            // NULL sets every balloon in turn from the tick
+    ControlStats        stats;
+} MemoryControl;
+
+void memory_control_init(MemoryControl *ctl);
+
+/**
+ * @brief Queries the host, computes the target memory of every VM and sets the balloons.
+ *
+ * @param now_ns Monotonic time of the tick, the simulated clock against a SimHypervisor
+ * @return 0 on success, -1 when the query or the targets failed. A balloon that fails to set doesn't stop the others.
+ */
+int memory_control_tick(MemoryControl *ctl, const VirtBackend *backend, long long now_ns);
+
+/**
+ * @brief Reads the balloon stats between ticks.
+ *
+ * @return true when a VM's available memory fell below low_mb since the last probe, asking for an early tick
+ */
+bool memory_control_probe(MemoryControl *ctl, const VirtBackend *backend, double low_mb);
+
+void print_sys_state(SystemState *state);
+
+#endif
@@ -1,7 +1,22 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
 #include "vm_types.h"
+
 #define TARGET_VM_AVAILABLE_MB 100
 #define TARGET_HOST_FREE_MB 200 
 #define ONE_K 1024
 #define MAX_MEMORY_DELTA_MB 50
 
 int compute_vm_target_memory(SystemState *sys_state);
+
+/**
+ * @brief How the targets of a tick are computed.
+ */
+typedef enum {
+    ALLOCATE_FIXED_STEP,  // compute_vm_target_memory, MAX_MEMORY_DELTA_MB a tick, VMs served in order
+    ALLOCATE_PREDICTIVE,  // predict_vm_target_memory (balloon_controller.c)
+    ALLOCATE_FAIR_SHARE,  // fair_share_vm_target_memory (fair_share.c)
+} AllocationMode;
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef DOMAIN_REGISTRY_H
+#define DOMAIN_REGISTRY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <libvirt/libvirt.h>
+#include "vm_types.h"
+
+/**
+ * @brief A running domain and the handle kept for it.
+ */
+typedef struct {
+    virDomainPtr  dom;                          // NULL when the slot is free
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int           id;
+    unsigned int  generation;                   // Changes every time the slot gets another domain, never 0
+} DomainEntry;
+
+/**
+ * @brief Handles of the running domains, kept between ticks and keyed by UUID.
+ *
+ * Lifecycle events add and drop domains, so a tick makes no RPCs to find them.
+ * Without events (no event loop was registered before the connection was opened)
+ * the domains are listed again on every refresh. Slots never move, so state kept
+ * per slot stays valid for as long as the slot's generation doesn't change.
+ *
+ * Only the thread that opened the registry changes it, holding the lock, so it
+ * reads the entries without. Other threads only go through domain_registry_ref_id.
+ */
+typedef struct {
+    virConnectPtr conn;
+    DomainEntry   entries[MAX_VMS];
+    int           nr_domains;
+    int           callback_id;                  // -1 without lifecycle events
+    int           timer_id;                     // Wakes the event loop to dispatch pending events
+    bool          stale;                        // An event couldn't be applied, list on the next refresh
+    int           nr_rpcs;                      // Discovery RPCs (listings and lookups) made so far
+    bool          external_loop;                // The caller runs the event loop, refresh doesn't dispatch
+    void          (*on_change)(void *opaque);   // Called after a domain started or stopped
+    void          *on_change_opaque;
+    pthread_mutex_t lock;                       // Recursive, held while the entries change
+} DomainRegistry;
+
+/**
+ * @brief Starts an empty registry and subscribes to lifecycle events when an event loop is registered.
+ */
+void domain_registry_open(DomainRegistry *registry, virConnectPtr conn);
+
+/**
+ * @brief Tells the registry the caller runs the event loop and wants to hear about domain changes.
+ *
+ * Lifecycle events are then applied as the loop dispatches them, and on_change
+ * runs after every start, resume, suspend or stop.
+ */
+void domain_registry_watch(DomainRegistry *registry, void (*on_change)(void *opaque), void *opaque);
+
+/**
+ * @brief Applies pending lifecycle events, and lists the domains when there are no events or one was missed.
+ *
+ * @return 0 on success, -1 when listing the domains fails.
+ */
+int domain_registry_refresh(DomainRegistry *registry);
+
+/**
+ * @brief Makes the registry hold exactly the given domains, e.g. the ones of a bulk stats reply.
+ *
+ * Handles of domains already in the registry are kept. The caller still owns the given handles.
+ */
+void domain_registry_sync(DomainRegistry *registry, virDomainPtr *doms, int nr_doms);
+
+/**
+ * @brief Adds a domain, or updates it when its UUID is known. The registry takes its own reference.
+ *
+ * @return The entry, NULL when the registry is full.
+ */
+DomainEntry *domain_registry_add(DomainRegistry *registry, virDomainPtr dom);
+
+void domain_registry_remove(DomainRegistry *registry, const unsigned char *uuid);
+
+DomainEntry *domain_registry_find(DomainRegistry *registry, const unsigned char *uuid);
+
+DomainEntry *domain_registry_find_id(DomainRegistry *registry, int id);
+
+/**
+ * @brief Finds the domain by ID, and looks it up with one RPC when the registry doesn't have it.
+ */
+DomainEntry *domain_registry_lookup_id(DomainRegistry *registry, int id);
+
+/**
+ * @brief Finds the domain by ID from any thread, and looks it up with one RPC when the registry doesn't have it.
+ *
+ * The registry doesn't keep a looked up domain, only the thread that opened it adds domains.
+ *
+ * @return A reference of the caller's own, to virDomainFree. NULL when there is no such domain.
+ */
+virDomainPtr domain_registry_ref_id(DomainRegistry *registry, int id);
+
+/**
+ * @brief Unsubscribes from events and frees every handle.
+ */
+void domain_registry_close(DomainRegistry *registry);
+
+#endif
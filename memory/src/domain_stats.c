@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_types.h"
+#include "domain_stats.h"
+
+int domain_stats_to_vm(VM *vm, const DomainStat *stats, int nr_stats) {
+    bool has_current = false;
+    bool has_maximum = false;
+    for (int p = 0; p < nr_stats; p++) {
+        const char *field = stats[p].field;
+        int value = (int) stats[p].value;
+        if (strcmp(field, "balloon.current") == 0) {
+            vm->balloon_size_kb = value;
+            has_current = true;
+        } else if (strcmp(field, "balloon.maximum") == 0) {
+            vm->max_memory_kb = value;
+            has_maximum = true;
+        } else if (strcmp(field, "balloon.unused") == 0) {
+            vm->memory_unused_kb = value;
+        } else if (strcmp(field, "balloon.available") == 0) {
+            vm->memory_available_kb = value;
+        } else if (strcmp(field, "balloon.usable") == 0) {
+            vm->memory_usable_kb = value;
+        } else if (strcmp(field, "balloon.rss") == 0) {
+            vm->memory_rss_kb = value;
+        } else if (strcmp(field, "balloon.disk_caches") == 0) {
+            vm->memory_disk_caches_kb = value;
+        } else if (strcmp(field, "balloon.swap_in") == 0) {
+            vm->swap_in_kb = stats[p].value;
+        } else if (strcmp(field, "balloon.major_fault") == 0) {
+            vm->major_faults = stats[p].value;
+        } else if (strcmp(field, "balloon.minor_fault") == 0) {
+            vm->minor_faults = stats[p].value;
+        }
+    }
+    if (!has_current || !has_maximum) {
+        fprintf(stderr, "VM %d (%s) has no balloon.current or balloon.maximum stats\n", vm->id, vm->name);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Turns the stats collected for the current domain block into the next VM.
+ */
+static int finish_virsh_domain(SystemState *state, const char *name, const DomainStat *stats, int nr_stats) {
+    if (state->nr_vms >= MAX_VMS) {
+        fprintf(stderr, "Found more than %d VMs\n", MAX_VMS);
+        return -1;
+    }
+    VM *vm = &state->vms[state->nr_vms];
+    memset(vm, 0, sizeof(VM));
+    snprintf(vm->name, MAX_NAME_LEN, "%s", name);
+    vm->id = state->nr_vms + 1;
+    if (domain_stats_to_vm(vm, stats, nr_stats) < 0) {
+        return -1;
+    }
+    state->nr_vms++;
+    return 0;
+}
+
+int domain_stats_read_virsh(FILE *file, SystemState *state) {
+    static DomainStat stats[MAX_DOMAIN_STATS];
+    int nr_stats = 0;
+    char name[256] = "";
+    bool in_domain = false;
+    char line[512];
+
+    state->nr_vms = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            continue;
+        }
+
+        if (strncmp(p, "Domain: ", 8) == 0) {
+            if (in_domain && finish_virsh_domain(state, name, stats, nr_stats) < 0) {
+                return -1;
+            }
+            /* Domain: 'name' */
+            char *start = strchr(p, '\'');
+            char *end = start != NULL ? strrchr(start + 1, '\'') : NULL;
+            if (start == NULL || end == NULL) {
+                fprintf(stderr, "Malformed domain line: %s\n", line);
+                return -1;
+            }
+            *end = '\0';
+            snprintf(name, sizeof(name), "%s", start + 1);
+            in_domain = true;
+            nr_stats = 0;
+            continue;
+        }
+
+        /* field=value, only numeric values are kept */
+        char *equals = strchr(p, '=');
+        if (!in_domain || equals == NULL) {
+            fprintf(stderr, "Malformed stats line: %s\n", line);
+            return -1;
+        }
+        *equals = '\0';
+        char *end;
+        unsigned long long value = strtoull(equals + 1, &end, 10);
+        if (end == equals + 1 || *end != '\0' || nr_stats >= MAX_DOMAIN_STATS || strlen(p) >= DOMAIN_STAT_FIELD_LEN) {
+            continue;
+        }
+        strcpy(stats[nr_stats].field, p);
+        stats[nr_stats].value = value;
+        nr_stats++;
+    }
+    if (in_domain && finish_virsh_domain(state, name, stats, nr_stats) < 0) {
+        return -1;
+    }
+    return state->nr_vms;
+}
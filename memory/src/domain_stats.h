@@ -0,0 +1,39 @@
+#ifndef DOMAIN_STATS_H
+#define DOMAIN_STATS_H
+
+#include <stdio.h>
+#include "vm_types.h"
+
+#define DOMAIN_STAT_FIELD_LEN 80
+/* Stats kept per domain, the balloon.* group has about a dozen */
+#define MAX_DOMAIN_STATS 64
+
+/**
+ * @brief One numeric typed parameter of a domain stats record (libvirt free).
+ */
+typedef struct {
+    char field[DOMAIN_STAT_FIELD_LEN];
+    unsigned long long value;
+} DomainStat;
+
+/**
+ * @brief Fills the memory sizes of the VM from the balloon.* stats of one domain.
+ *
+ * All balloon.* stats are in KiB. The guest only reports unused, available and
+ * usable once its stats period is set, until then they stay 0.
+ *
+ * @return 0 on success, -1 when balloon.current or balloon.maximum is missing.
+ */
+int domain_stats_to_vm(VM *vm, const DomainStat *stats, int nr_stats);
+
+/**
+ * @brief Reads recorded `virsh domstats --raw --balloon` output into the VMs of the state.
+ *
+ * Each "Domain: 'name'" block becomes a VM, in order. virsh doesn't print the
+ * domain ID, so the VMs get IDs 1, 2, ... The host free memory is left alone.
+ *
+ * @return The number of VMs read, -1 on a malformed record.
+ */
+int domain_stats_read_virsh(FILE *file, SystemState *state);
+
+#endif
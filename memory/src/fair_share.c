@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fair_share.h"
+#include "coordinator.h"
+#include "working_set.h"
+
+static long long clamp(long long value, long long low, long long high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ * @brief Memory granted at a water level, each request getting clamp(level * weight, min, demand).
+ */
+static double granted_at(const ShareRequest *requests, int nr_requests, double level) {
+    double total_kb = 0;
+    for (int i = 0; i < nr_requests; i++) {
+        double share_kb = level * requests[i].weight;
+        total_kb += share_kb < requests[i].min_kb ? requests[i].min_kb :
+            (share_kb > requests[i].demand_kb ? requests[i].demand_kb : share_kb);
+    }
+    return total_kb;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+long long fair_share_allocate(const ShareRequest *requests, int nr_requests, long long pool_kb, long long *granted_kb) {
+    long long total_min_kb = 0;
+    long long total_demand_kb = 0;
+    for (int i = 0; i < nr_requests; i++) {
+        total_min_kb += requests[i].min_kb;
+        total_demand_kb += requests[i].demand_kb;
+    }
+    pool_kb = pool_kb > 0 ? pool_kb : 0;
+    long long total_kb = 0;
+    if (total_demand_kb <= pool_kb || total_min_kb >= pool_kb) {
+        /* Everyone gets their demand, or the guarantees are all there is to share */
+        for (int i = 0; i < nr_requests; i++) {
+            granted_kb[i] = total_demand_kb <= pool_kb ? requests[i].demand_kb :
+                (long long) ((double) requests[i].min_kb * pool_kb / total_min_kb);
+            total_kb += granted_kb[i];
+        }
+        return total_kb;
+    }
+
+    /*
+     * What the level grants is piecewise linear, bending where a request
+     * leaves its minimum or reaches its demand. Find the piece the pool
+     * ends on and interpolate within it.
+     */
+    double breakpoints[2 * MAX_VMS];
+    int nr_breakpoints = 0;
+    for (int i = 0; i < nr_requests; i++) {
+        breakpoints[nr_breakpoints++] = requests[i].min_kb / requests[i].weight;
+        breakpoints[nr_breakpoints++] = requests[i].demand_kb / requests[i].weight;
+    }
+    qsort(breakpoints, nr_breakpoints, sizeof(double), compare_doubles);
+    double low = 0;
+    double low_kb = granted_at(requests, nr_requests, low);
+    double level = breakpoints[nr_breakpoints - 1];
+    for (int b = 0; b < nr_breakpoints; b++) {
+        double high_kb = granted_at(requests, nr_requests, breakpoints[b]);
+        if (high_kb >= pool_kb) {
+            level = high_kb > low_kb ? low + (pool_kb - low_kb) * (breakpoints[b] - low) / (high_kb - low_kb) : breakpoints[b];
+            break;
+        }
+        low = breakpoints[b];
+        low_kb = high_kb;
+    }
+    for (int i = 0; i < nr_requests; i++) {
+        granted_kb[i] = clamp((long long) (level * requests[i].weight), requests[i].min_kb, requests[i].demand_kb);
+        total_kb += granted_kb[i];
+    }
+    return total_kb;
+}
+
+int fair_share_vm_target_memory(SystemState *sys_state) {
+    ShareRequest requests[MAX_VMS];
+    long long granted_kb[MAX_VMS];
+    long long pool_kb = (long long) (sys_state->free_memory_bytes / ONE_K) - TARGET_HOST_FREE_MB * ONE_K;
+    for (int i = 0; i < sys_state->nr_vms; i++) {
+        const VM *vm = &sys_state->vms[i];
+        long long max_kb = vm->max_memory_kb;
+        if (vm->limit_memory_kb > 0 && (max_kb <= 0 || vm->limit_memory_kb < max_kb)) {
+            max_kb = vm->limit_memory_kb;
+        }
+        long long used_kb = working_set_used_kb(vm);
+        requests[i].min_kb = vm->min_memory_kb < max_kb ? vm->min_memory_kb : max_kb;
+        requests[i].demand_kb = clamp(used_kb + TARGET_VM_AVAILABLE_MB * ONE_K, requests[i].min_kb, max_kb);
+        requests[i].weight = vm->share_weight > 0 ? vm->share_weight : 1;
+        pool_kb += vm->balloon_size_kb;
+    }
+    fair_share_allocate(requests, sys_state->nr_vms, pool_kb, granted_kb);
+    for (int i = 0; i < sys_state->nr_vms; i++) {
+        sys_state->vms[i].target_memory_kb = (int) granted_kb[i];
+    }
+    return sys_state->nr_vms;
+}
+
+/**
+ * @brief Reads name="number" from the element, 0 when the attribute is missing.
+ */
+static int parse_attribute(const char *xml, const char *name, int *value) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), " %s=", name);
+    const char *attribute = strstr(xml, pattern);
+    if (attribute == NULL) {
+        *value = 0;
+        return 0;
+    }
+    attribute += strlen(pattern);
+    char quote = *attribute++;
+    char *end;
+    long parsed = strtol(attribute, &end, 10);
+    if ((quote != '"' && quote != '\'') || end == attribute || *end != quote || parsed < 0 || parsed > 0x7fffffffL / ONE_K) {
+        return -1;
+    }
+    *value = (int) parsed;
+    return 0;
+}
+
+int fair_share_parse_metadata(const char *xml, VM *vm) {
+    int min_mb;
+    int max_mb;
+    int weight;
+    if (parse_attribute(xml, "min_mb", &min_mb) < 0 || parse_attribute(xml, "max_mb", &max_mb) < 0 ||
+        parse_attribute(xml, "weight", &weight) < 0) {
+        fprintf(stderr, "Malformed memory metadata %s\n", xml);
+        return -1;
+    }
+    vm->min_memory_kb = min_mb * ONE_K;
+    vm->limit_memory_kb = max_mb * ONE_K;
+    vm->share_weight = weight;
+    return 0;
+}
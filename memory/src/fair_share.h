@@ -0,0 +1,52 @@
+#ifndef FAIR_SHARE_H
+#define FAIR_SHARE_H
+
+#include "vm_types.h"
+
+// Namespace of the <memory> element fair share reads from the domain's <metadata>
+#define FAIR_SHARE_METADATA_URI "urn:memory-coordinator:1"
+
+/**
+ * @brief What one VM asks of the shared pool, in KB.
+ */
+typedef struct {
+    long long min_kb;     // Granted before anyone gets more
+    long long demand_kb;  // Never granted more, at least min_kb
+    double    weight;     // Above min_kb, memory is shared in proportion to it
+} ShareRequest;
+
+/**
+ * @brief Shares pool_kb between the requests, weighted max-min fair.
+ *
+ * Every request gets clamp(level * weight, min_kb, demand_kb) for the highest
+ * level the pool covers, so no VM can get more without taking from one that has
+ * less per unit of weight. When the pool doesn't even cover the minimums they
+ * are scaled down together.
+ *
+ * @return The memory granted, at most pool_kb. Shares are rounded down to the KB.
+ */
+long long fair_share_allocate(const ShareRequest *requests, int nr_requests, long long pool_kb, long long *granted_kb);
+
+/**
+ * @brief Sets every VM's target_memory_kb to its share of the memory the host can give the VMs.
+ *
+ * The pool is every balloon plus the host's free memory above TARGET_HOST_FREE_MB.
+ * A VM demands what it uses (working_set_used_kb) plus TARGET_VM_AVAILABLE_MB, within its min_memory_kb
+ * and limit_memory_kb (or max_memory_kb). Unlike compute_vm_target_memory, no VM
+ * goes first because of where it is in the state.
+ *
+ * @return -1 in error or number of VMs updated
+ */
+int fair_share_vm_target_memory(SystemState *sys_state);
+
+/**
+ * @brief Reads the min_mb, max_mb and weight attributes of the metadata element into the VM.
+ *
+ * e.g. <memory xmlns="urn:memory-coordinator:1" min_mb="512" max_mb="2048" weight="2"/>.
+ * Missing attributes are left at 0.
+ *
+ * @return 0 on success, -1 when an attribute isn't a non negative number
+ */
+int fair_share_parse_metadata(const char *xml, VM *vm);
+
+#endif
@@ -6,16 +6,63 @@
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
+#include <time.h>
 #include "coordinator.h"
 #include "virt_query.h"
 #include "vm_types.h"
+#include "event_loop.h"
+#include "control_loop.h"
+#include "balloon_applier.h"
+#include "trace.h"
 #define MIN(a, b) ((a) < (b) ? a : b)
 #define MAX(a, b) ((a) > (b) ? a : b)
 
 int is_exit = 0; // DO NOT MODIFY THE VARIABLE
-bool set_vm_stats_period = false;
 
-void MemoryScheduler(virConnectPtr conn, int interval);
+// Keeps the domain handles between intervals
+VirtContext virt_ctx;
+
+// Keeps the last probed state and the time spent per tick
+MemoryControl control;
+
+// Sets the balloons off the tick, so a slow guest doesn't stall it
+BalloonApplier applier;
+
+// Records every state and its targets when MEMORY_COORDINATOR_TRACE names a file, for memory_replay
+TraceWriter trace_writer;
+
+// A VM whose available memory drops below this between two ticks triggers an early tick
+#define LOW_AVAILABLE_MB (TARGET_VM_AVAILABLE_MB / 2)
+// Probes of the VMs' available memory per tick period
+#define PROBES_PER_TICK 4
+// Balloons set at the same time
+#define BALLOON_WORKERS 4
+
+void MemoryScheduler(virConnectPtr conn, double interval);
+
+/**
+ * @brief Reads the balloon stats in one call and asks for an early tick when a VM runs low on memory.
+ */
+static bool probe_available_memory(void *opaque)
+{
+	VirtBackend backend = virt_backend(&virt_ctx);
+	bool low = memory_control_probe(&control, &backend, LOW_AVAILABLE_MB);
+	if (low) {
+		printf("A VM has less than %d MB available, rebalancing early\n", LOW_AVAILABLE_MB);
+	}
+	return low;
+}
+
+static void coordinator_tick(void *opaque)
+{
+	MemoryScheduler(virt_ctx.conn, *(double *) opaque);
+}
+
+static void domains_changed(void *opaque)
+{
+	printf("A domain started or stopped, rebalancing early\n");
+	event_loop_request_tick(opaque);
+}
 
 /*
 DO NOT CHANGE THE FOLLOWING FUNCTION
@@ -27,7 +74,8 @@ void signal_callback_handler()
 }
 
 /*
-DO NOT CHANGE THE FOLLOWING FUNCTION
+Opens the connection and calls MemoryScheduler every interval seconds from the libvirt
+event loop, or from a sleep loop when there is none, until a signal sets is_exit.
 */
 int main(int argc, char *argv[])
 {
@@ -40,8 +88,17 @@ int main(int argc, char *argv[])
 	}
 
 	// Gets the interval passes as a command line argument and sets it as the STATS_PERIOD for collection of balloon memory statistics of the domains
-	int interval = atoi(argv[1]);
+	// Sub-second intervals such as 0.5 are allowed
+	long long period_ns = tick_parse_period(argv[1]);
+	if (period_ns < 0)
+	{
+		printf("Interval must be a positive number of seconds\n");
+		return 0;
+	}
+	double interval = period_ns / 1e9;
 
+	// Lifecycle events need an event loop registered before the connection is opened
+	virEventRegisterDefaultImpl();
 	conn = virConnectOpen("qemu:///system");
 	if (conn == NULL)
 	{
@@ -51,53 +108,116 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, signal_callback_handler);
 
-	while (!is_exit)
+	const char *trace_path = getenv("MEMORY_COORDINATOR_TRACE");
+	if (trace_path != NULL)
 	{
-		// Calls the MemoryScheduler function after every 'interval' seconds
-		MemoryScheduler(conn, interval);
-		sleep(interval);
+		// A trace that can't be written only costs the trace, the daemon still runs
+		FILE *trace_file = fopen(trace_path, "wb");
+		if (trace_file == NULL)
+		{
+			fprintf(stderr, "Failed to open the trace %s, running without it\n", trace_path);
+		}
+		else if (trace_writer_init(&trace_writer, trace_file) < 0)
+		{
+			fprintf(stderr, "Failed to write the trace %s, running without it\n", trace_path);
+			fclose(trace_file);
+			trace_writer.file = NULL;
+		}
 	}
 
-	// Close the connection
-	virConnectClose(conn);
-	return 0;
-}
+	memory_control_init(&control);
+	control.verbose = true;
+	// Grow the balloons ahead of the guests' use rather than 50 MB at a time behind it, unless
+	// MEMORY_COORDINATOR_ALLOCATION asks for fixed-step or fair-share
+	control.mode = ALLOCATE_PREDICTIVE;
+	const char *allocation = getenv("MEMORY_COORDINATOR_ALLOCATION");
+	if (allocation != NULL && strcmp(allocation, "fair-share") == 0)
+	{
+		control.mode = ALLOCATE_FAIR_SHARE;
+	}
+	else if (allocation != NULL && strcmp(allocation, "fixed-step") == 0)
+	{
+		control.mode = ALLOCATE_FIXED_STEP;
+	}
+	else if (allocation != NULL && strcmp(allocation, "predictive") != 0)
+	{
+		fprintf(stderr, "Unknown allocation %s, allocating predictively\n", allocation);
+	}
+	control.trace = trace_writer.file != NULL ? &trace_writer : NULL;
+	// A tick waits up to half a period for its balloons, and skips changes under APPLIER_MIN_CHANGE_MB
+	if (balloon_applier_start(&applier, BALLOON_WORKERS, APPLIER_MIN_CHANGE_MB, period_ns / 2) == 0)
+	{
+		control.applier = &applier;
+	}
+	else
+	{
+		fprintf(stderr, "Setting the balloons from the tick\n");
+	}
 
-/*
-COMPLETE THE IMPLEMENTATION
-*/
-void MemoryScheduler(virConnectPtr conn, int interval)
-{
-	VirtContext ctx = {
-		.conn = conn
+	// Ticks run from the event loop on a drift-free schedule, and early when a domain starts or stops or a VM runs low
+	EventLoop loop = {
+		.tick = coordinator_tick,
+		.probe = probe_available_memory,
+		.opaque = &interval,
 	};
-
-	if (!set_vm_stats_period) {
-		if (set_vm_memory_stats(&ctx) < 0) {
-			fprintf(stderr, "Failed to set vm memory stats period");
-			return;
+	virt_context_init(&virt_ctx, conn);
+	domain_registry_watch(&virt_ctx.registry, domains_changed, &loop);
+	if (event_loop_run(&loop, period_ns, period_ns / PROBES_PER_TICK, &is_exit) < 0)
+	{
+		fprintf(stderr, "No event loop, polling every %.3f seconds\n", interval);
+		virt_ctx.registry.external_loop = false;
+		while (!is_exit)
+		{
+			// Calls the MemoryScheduler function after every 'interval' seconds
+			MemoryScheduler(conn, interval);
+			struct timespec period = { period_ns / 1000000000LL, period_ns % 1000000000LL };
+			nanosleep(&period, NULL);
 		}
 	}
-
-	SystemState sys_state;
-	if(virt_query_state(&ctx, &sys_state) < 0) {
-		fprintf(stderr, "Failed to query the current system state\n");
-		return;
+	printf("Ran %d ticks, %d early\n", loop.nr_ticks, loop.nr_early_ticks);
+	if (control.stats.nr_ticks > 0)
+	{
+		printf("Per tick: query %.3f ms, targets %.3f ms, balloons %.3f ms\n", control.stats.query_ns / 1e6 / control.stats.nr_ticks,
+			control.stats.compute_ns / 1e6 / control.stats.nr_ticks, control.stats.apply_ns / 1e6 / control.stats.nr_ticks);
+	}
+	if (control.applier != NULL)
+	{
+		balloon_applier_stop(&applier);
+		printf("Balloons: %d set, %d failed, %d skipped close to their target, %d skipped still setting, %d finished late\n",
+			control.stats.nr_set, control.stats.nr_failed, control.stats.nr_skipped, control.stats.nr_busy, applier.nr_late);
+		print_latency_histogram(&applier.latency, "set_memory");
 	}
-	print_sys_state(&sys_state);
 
-	if (compute_vm_target_memory(&sys_state) < 0) {
-		fprintf(stderr, "Failed to computer new target memory\n");
+	if (trace_writer.file != NULL)
+	{
+		printf("Recorded %ld bytes of trace\n", trace_writer.nr_bytes);
+		fclose(trace_writer.file);
 	}
 
-	for(int i = 0; i < sys_state.nr_vms; i++){
-		int vm_id = sys_state.vms[i].id;
-		int vm_target_kb = sys_state.vms[i].target_memory_kb;
-		virDomainPtr domain = virDomainLookupByID(ctx.conn, vm_id);
-		if (virDomainSetMemory(domain, vm_target_kb) < 0) {
-			fprintf(stderr, "Failed to set new VM memory\n");
-		} else {
-			printf("Successfully set VM %d (%s) memory to %'d KB\n", vm_id, sys_state.vms[i].name, vm_target_kb);
+	// Close the connection
+	virt_context_destroy(&virt_ctx);
+	virConnectClose(conn);
+	return 0;
+}
+
+/*
+One tick: read the balloon stats, decide the targets and hand them to the applier.
+
+interval stays for the skeleton's signature but isn't read: ticks can run
+early, and the control loop works from the stats of each tick instead.
+*/
+void MemoryScheduler(virConnectPtr conn, double interval)
+{
+	(void) interval;
+	if (virt_ctx.conn != conn) {
+		/* The workers may still use the old connection's handles */
+		if (control.applier != NULL) {
+			balloon_applier_drain(control.applier);
 		}
+		virt_context_destroy(&virt_ctx);
+		virt_context_init(&virt_ctx, conn);
 	}
-}
\ No newline at end of file
+	/* The tick itself doesn't know it talks to libvirt, see control_loop.c */
+	VirtBackend backend = virt_backend(&virt_ctx);
+	memory_control_tick(&control, &backend, tick_now_ns());
+}
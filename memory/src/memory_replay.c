@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+#include "simulator.h"
+#include "trace.h"
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [--open-loop] [--predictive | --fair-share] trace\n", program);
+	printf("  --open-loop   replay the recorded states as they are and compare with the recorded targets\n");
+	printf("  --predictive  size the balloons with the predictive controller instead of the fixed step\n");
+	printf("  --fair-share  share the host's memory between the VMs max-min fair instead of the fixed step\n");
+}
+
+/*
+Replays a trace recorded with MEMORY_COORDINATOR_TRACE=<file> ./memory_coordinator <interval>
+*/
+int main(int argc, char *argv[])
+{
+	ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP };
+	const char *path = NULL;
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--open-loop") == 0) {
+			options.mode = REPLAY_OPEN_LOOP;
+		} else if (strcmp(argv[a], "--predictive") == 0) {
+			options.allocation = ALLOCATE_PREDICTIVE;
+		} else if (strcmp(argv[a], "--fair-share") == 0) {
+			options.allocation = ALLOCATE_FAIR_SHARE;
+		} else if (path == NULL && argv[a][0] != '-') {
+			path = argv[a];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (path == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return 1;
+	}
+	MemorySimulator sim;
+	TraceReader reader;
+	simulator_init(&sim, options);
+	int result = trace_reader_init(&reader, file) < 0 ? -1 : simulator_replay(&sim, &reader);
+	fclose(file);
+	if (result < 0) {
+		fprintf(stderr, "Failed to replay %s\n", path);
+		return 1;
+	}
+	print_replay_stats(&sim.stats);
+	return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_backend.h"
+#include "coordinator.h"
+#include "working_set.h"
+
+static double random_between(SimHypervisor *sim, double low, double high) {
+    return low + (high - low) * (rand_r(&sim->rng) / (double) RAND_MAX);
+}
+
+static void start_domain(SimHypervisor *sim, SimDomain *domain) {
+    memset(domain, 0, sizeof(SimDomain));
+    domain->id = sim->next_id++;
+    snprintf(domain->name, MAX_NAME_LEN, "vm%u", (unsigned int) domain->id % 100000);
+    domain->max_memory_kb = sim->config.max_memory_mb * ONE_K;
+    domain->balloon_kb = domain->max_memory_kb;
+    domain->used_kb = random_between(sim, 0.3, 0.7) * domain->max_memory_kb;
+    domain->growth_kb = random_between(sim, 1, 8) * ONE_K * SIM_STEP_NS / 1e9;
+}
+
+int sim_init(SimHypervisor *sim, SimConfig config) {
+    if (config.nr_vms < 0 || config.nr_vms > MAX_VMS || config.max_memory_mb < 64 || config.host_memory_mb < 0) {
+        fprintf(stderr, "Can't simulate %d VMs of %d MB\n", config.nr_vms, config.max_memory_mb);
+        return -1;
+    }
+    memset(sim, 0, sizeof(SimHypervisor));
+    sim->config = config;
+    sim->rng = config.seed;
+    sim->next_id = 1;
+    pthread_mutex_init(&sim->lock, NULL);
+    return sim_resize(sim, config.nr_vms);
+}
+
+int sim_resize(SimHypervisor *sim, int nr_vms) {
+    if (nr_vms < 0 || nr_vms > MAX_VMS) {
+        fprintf(stderr, "Can't simulate %d VMs\n", nr_vms);
+        return -1;
+    }
+    pthread_mutex_lock(&sim->lock);
+    while (sim->nr_domains < nr_vms) {
+        start_domain(sim, &sim->domains[sim->nr_domains++]);
+    }
+    sim->nr_domains = nr_vms;
+    pthread_mutex_unlock(&sim->lock);
+    return 0;
+}
+
+/**
+ * @brief The page cache the guest has, what its use leaves of the balloon up to what its files want.
+ */
+static double cache_kb(const SimDomain *domain) {
+    double room_kb = domain->balloon_kb - domain->used_kb;
+    return room_kb <= 0 ? 0 : (room_kb < domain->cache_demand_kb ? room_kb : domain->cache_demand_kb);
+}
+
+/**
+ * @brief Counts the faults of one step, the swap and cache the guest reads back, and the pages it touches first.
+ */
+static void count_faults(SimHypervisor *sim, SimDomain *domain, double grown_kb, long long step_ns) {
+    double step_s = step_ns / 1e9;
+    double swap_in_kb = domain->used_kb > domain->balloon_kb ? (domain->used_kb - domain->balloon_kb) * step_s : 0;
+    double file_kb = (domain->cache_demand_kb - cache_kb(domain)) * step_s;
+    domain->swap_in_kb += (uint64_t) swap_in_kb;
+    domain->major_faults += (uint64_t) ((swap_in_kb + file_kb) / PAGE_KB);
+    domain->minor_faults += (uint64_t) (grown_kb > 0 ? grown_kb / PAGE_KB : 0);
+    sim->refault_mb += (swap_in_kb + file_kb) / ONE_K;
+}
+
+void sim_advance(SimHypervisor *sim, long long ns) {
+    pthread_mutex_lock(&sim->lock);
+    while (ns > 0) {
+        long long step_ns = ns < SIM_STEP_NS ? ns : SIM_STEP_NS;
+        for (int i = 0; i < sim->nr_domains; i++) {
+            SimDomain *domain = &sim->domains[i];
+            double used_before_kb = domain->used_kb;
+            if (sim->config.load == SIM_LOAD_GROWING) {
+                domain->used_kb += domain->growth_kb * step_ns / SIM_STEP_NS;
+                if (domain->used_kb > 0.9 * domain->max_memory_kb) {
+                    domain->used_kb = 0.25 * domain->max_memory_kb;
+                }
+            } else if (sim->config.load == SIM_LOAD_RANDOM_WALK) {
+                double used_kb = domain->used_kb + random_between(sim, -2, 2) * ONE_K;
+                domain->used_kb = used_kb < 64 * ONE_K ? 64 * ONE_K : (used_kb > domain->max_memory_kb ? domain->max_memory_kb : used_kb);
+            }
+            if (domain->used_kb > domain->balloon_kb) {
+                sim->swapped_mb_s += (domain->used_kb - domain->balloon_kb) / ONE_K * step_ns / 1e9;
+            }
+            count_faults(sim, domain, domain->used_kb - used_before_kb, step_ns);
+        }
+        sim->clock_ns += step_ns;
+        ns -= step_ns;
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/**
+ * @brief Counts the RPCs and sleeps for their injected latency plus extra_ns. Called without the lock.
+ */
+static void make_rpcs(SimHypervisor *sim, int nr_rpcs, long long extra_ns) {
+    long long latency_ns = sim->config.rpc_latency_ns * nr_rpcs + extra_ns;
+    pthread_mutex_lock(&sim->lock);
+    sim->nr_rpcs += nr_rpcs;
+    sim->rpc_ns += latency_ns;
+    pthread_mutex_unlock(&sim->lock);
+    if (latency_ns > 0) {
+        struct timespec latency = { latency_ns / 1000000000LL, latency_ns % 1000000000LL };
+        nanosleep(&latency, NULL);
+    }
+}
+
+static int sim_set_stats_period(void *impl) {
+    SimHypervisor *sim = impl;
+    int nr_set = 0;
+    pthread_mutex_lock(&sim->lock);
+    for (int i = 0; i < sim->nr_domains; i++) {
+        if (!sim->domains[i].stats_period_set) {
+            sim->domains[i].stats_period_set = true;
+            nr_set++;
+        }
+    }
+    pthread_mutex_unlock(&sim->lock);
+    make_rpcs(sim, nr_set, 0);
+    return nr_set;
+}
+
+static int sim_query_state(void *impl, SystemState *state) {
+    SimHypervisor *sim = impl;
+    make_rpcs(sim, 2, 0);
+    memset(state, 0, sizeof(SystemState));
+    pthread_mutex_lock(&sim->lock);
+    long long free_kb = (long long) sim->config.host_memory_mb * ONE_K;
+    state->nr_vms = sim->nr_domains;
+    for (int i = 0; i < sim->nr_domains; i++) {
+        const SimDomain *domain = &sim->domains[i];
+        VM *vm = &state->vms[i];
+        memcpy(vm->name, domain->name, MAX_NAME_LEN);
+        vm->id = domain->id;
+        vm->max_memory_kb = domain->max_memory_kb;
+        vm->balloon_size_kb = domain->balloon_kb;
+        /* A guest past its balloon swaps and has nothing available. Page cache counts as available, not unused. */
+        int available_kb = domain->balloon_kb - (int) domain->used_kb;
+        vm->memory_available_kb = available_kb > 0 ? available_kb : 0;
+        vm->memory_disk_caches_kb = (int) cache_kb(domain);
+        vm->memory_unused_kb = vm->memory_available_kb - vm->memory_disk_caches_kb;
+        vm->memory_usable_kb = vm->memory_available_kb;
+        vm->swap_in_kb = domain->swap_in_kb;
+        vm->major_faults = domain->major_faults;
+        vm->minor_faults = domain->minor_faults;
+        vm->memory_rss_kb = domain->balloon_kb - vm->memory_available_kb;
+        vm->min_memory_kb = domain->min_memory_kb;
+        vm->limit_memory_kb = domain->limit_memory_kb;
+        vm->share_weight = domain->share_weight;
+        free_kb -= domain->balloon_kb;
+    }
+    state->free_memory_bytes = free_kb > 0 ? (unsigned long long) free_kb * ONE_K : 0;
+    pthread_mutex_unlock(&sim->lock);
+    return 0;
+}
+
+/**
+ * @brief The domain with this ID, NULL when it isn't running. Called with the lock.
+ */
+static SimDomain *find_domain(SimHypervisor *sim, int vm_id) {
+    for (int i = 0; i < sim->nr_domains; i++) {
+        if (sim->domains[i].id == vm_id) {
+            return &sim->domains[i];
+        }
+    }
+    return NULL;
+}
+
+static int sim_set_memory(void *impl, int vm_id, int memory_kb) {
+    SimHypervisor *sim = impl;
+    pthread_mutex_lock(&sim->lock);
+    SimDomain *domain = find_domain(sim, vm_id);
+    long long set_latency_ns = domain != NULL ? domain->set_latency_ns : 0;
+    pthread_mutex_unlock(&sim->lock);
+    make_rpcs(sim, 1, set_latency_ns);
+
+    /* The domain may have stopped while the call slept */
+    pthread_mutex_lock(&sim->lock);
+    domain = find_domain(sim, vm_id);
+    /* Like virDomainSetMemory, no more than the domain's maximum */
+    bool valid = domain != NULL && memory_kb >= 0 && memory_kb <= domain->max_memory_kb;
+    if (valid) {
+        domain->balloon_kb = memory_kb;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return valid ? 0 : -1;
+}
+
+static const VirtBackendOps sim_ops = {
+    .name = "simulated",
+    .set_stats_period = sim_set_stats_period,
+    .query_state = sim_query_state,
+    .set_memory = sim_set_memory,
+};
+
+VirtBackend sim_backend(SimHypervisor *sim) {
+    VirtBackend backend = { .ops = &sim_ops, .impl = sim };
+    return backend;
+}
@@ -0,0 +1,92 @@
+#ifndef SIM_BACKEND_H
+#define SIM_BACKEND_H
+
+#include <pthread.h>
+#include "vm_types.h"
+#include "virt_backend.h"
+
+// The load generators change the guests' memory use this often
+#define SIM_STEP_NS 100000000LL
+
+typedef enum {
+    SIM_LOAD_STEADY,       // Every guest keeps using 30% to 70% of its maximum memory
+    SIM_LOAD_GROWING,      // Every guest grows by 1 to 8 MB a second up to 90% of its maximum, then drops to 25%
+    SIM_LOAD_RANDOM_WALK,  // Every guest's use moves up to 2 MB per step within [64 MB, its maximum]
+} SimLoad;
+
+typedef struct {
+    int          nr_vms;
+    int          host_memory_mb;
+    int          max_memory_mb;   // Of every guest, which also starts with its balloon there
+    SimLoad      load;
+    long long    rpc_latency_ns;  // Slept for every RPC, 0 for none
+    unsigned int seed;
+} SimConfig;
+
+typedef struct {
+    int      id;
+    char     name[MAX_NAME_LEN];
+    int      max_memory_kb;
+    int      balloon_kb;
+    double   used_kb;
+    double   growth_kb;        // Per step, SIM_LOAD_GROWING only
+    bool     stats_period_set;
+    int      min_memory_kb;    // The guarantees its metadata would carry, 0 for none
+    int      limit_memory_kb;
+    int      share_weight;
+    double   cache_demand_kb;  // Page cache the guest's files want, 0 for none
+    uint64_t swap_in_kb;
+    uint64_t major_faults;
+    uint64_t minor_faults;
+    long long set_latency_ns;  // Its balloon driver's extra time to answer a set_memory
+} SimDomain;
+
+/**
+ * @brief An in-process host whose guests use memory as their load generators ask.
+ *
+ * A guest that uses more than its balloon swaps, reading its overflow back once
+ * a second. Page cache fills what its use leaves of the balloon, up to
+ * cache_demand_kb, and the cache it is short of is read back once a second too.
+ * Both count as major faults. The host's free memory is what the balloons leave. Time only passes in sim_advance, which keeps runs deterministic.
+ * The backend may be called from several threads, the lock guards the domains and counters and the latency is slept without it.
+ */
+typedef struct {
+    SimConfig    config;
+    SimDomain    domains[MAX_VMS];
+    int          nr_domains;
+    int          next_id;
+    long long    clock_ns;
+    unsigned int rng;
+    int          nr_rpcs;
+    long long    rpc_ns;       // Latency injected so far
+    double       swapped_mb_s; // Memory used beyond the balloons, integrated over time
+    double       refault_mb;   // Read back from swap or files by major faults
+    pthread_mutex_t lock;
+} SimHypervisor;
+
+/**
+ * @brief Starts config.nr_vms domains.
+ *
+ * @return 0 on success, -1 when the config doesn't fit MAX_VMS
+ */
+int sim_init(SimHypervisor *sim, SimConfig config);
+
+/**
+ * @brief Starts or stops domains until nr_vms run. New domains get new IDs, the last ones stop first.
+ */
+int sim_resize(SimHypervisor *sim, int nr_vms);
+
+/**
+ * @brief Runs the guests for ns nanoseconds of simulated time.
+ */
+void sim_advance(SimHypervisor *sim, long long ns);
+
+/**
+ * @brief The backend that queries the simulated host and sets its balloons.
+ *
+ * A query costs one RPC for the domain stats and one for the host's free memory,
+ * setting a balloon or a new domain's stats period one RPC each.
+ */
+VirtBackend sim_backend(SimHypervisor *sim);
+
+#endif
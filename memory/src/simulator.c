@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simulator.h"
+#include "coordinator.h"
+#include "fair_share.h"
+#include "tick_schedule.h"
+
+void simulator_init(MemorySimulator *sim, ReplayOptions options) {
+    memset(sim, 0, sizeof(MemorySimulator));
+    sim->options = options;
+    sim->stats.min_host_free_mb = -1;
+    balloon_controller_init(&sim->controller, balloon_default_gains());
+    working_set_init(&sim->working_set);
+}
+
+/**
+ * @brief Gives the VMs of the state their simulated balloons. VMs seen for the first time keep their recorded ones.
+ */
+static void inflate_balloons(MemorySimulator *sim, SystemState *state) {
+    long long balloon_delta_kb = 0;
+    for (int i = 0; i < state->nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        int balloon_kb = vm->balloon_size_kb;
+        for (int j = 0; j < sim->nr_vms; j++) {
+            if (sim->ids[j] == vm->id) {
+                balloon_kb = sim->balloon_kb[j];
+                break;
+            }
+        }
+        /* The guest uses what it used in the recording, the rest of the balloon is free to it */
+        int delta_kb = balloon_kb - vm->balloon_size_kb;
+        vm->memory_available_kb += delta_kb;
+        vm->memory_unused_kb += delta_kb;
+        vm->memory_usable_kb += delta_kb;
+        vm->balloon_size_kb = balloon_kb;
+        balloon_delta_kb += delta_kb;
+    }
+    long long free_kb = (long long) (state->free_memory_bytes / ONE_K) - balloon_delta_kb;
+    state->free_memory_bytes = free_kb > 0 ? (unsigned long long) free_kb * ONE_K : 0;
+}
+
+static bool same_targets(const SystemState *state, const int *recorded_targets_kb) {
+    for (int i = 0; i < state->nr_vms; i++) {
+        if (state->vms[i].target_memory_kb != recorded_targets_kb[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int simulator_tick(MemorySimulator *sim, long long time_ns, const SystemState *recorded_state, const int *recorded_targets_kb) {
+    SystemState state = *recorded_state;
+    ReplayStats *stats = &sim->stats;
+    bool closed_loop = sim->options.mode == REPLAY_CLOSED_LOOP;
+    if (closed_loop) {
+        inflate_balloons(sim, &state);
+    }
+
+    /* What the balloons left the guests and the host */
+    for (int i = 0; i < state.nr_vms; i++) {
+        double available_mb = state.vms[i].memory_available_kb / (double) ONE_K;
+        if (available_mb < TARGET_VM_AVAILABLE_MB) {
+            stats->deficit_mb += TARGET_VM_AVAILABLE_MB - available_mb;
+            stats->nr_under_target++;
+        }
+        if (available_mb < TARGET_VM_AVAILABLE_MB / 2) {
+            stats->nr_starved++;
+        }
+        if (available_mb <= 0) {
+            stats->nr_swapping++;
+        }
+    }
+    double host_free_mb = state.free_memory_bytes / (double) (ONE_K * ONE_K);
+    if (host_free_mb < TARGET_HOST_FREE_MB) {
+        stats->nr_host_low++;
+    }
+    if (stats->min_host_free_mb < 0 || host_free_mb < stats->min_host_free_mb) {
+        stats->min_host_free_mb = host_free_mb;
+    }
+    stats->nr_ticks++;
+    if (state.nr_vms == 0) {
+        return 0;
+    }
+
+    long long start_ns = tick_now_ns();
+    working_set_update(&sim->working_set, &state, time_ns);
+    AllocationMode allocation = sim->options.allocation;
+    int result = allocation == ALLOCATE_PREDICTIVE ? predict_vm_target_memory(&sim->controller, &state, time_ns) :
+        (allocation == ALLOCATE_FAIR_SHARE ? fair_share_vm_target_memory(&state) : compute_vm_target_memory(&state));
+    if (result < 0) {
+        return -1;
+    }
+    stats->solve_ns += tick_now_ns() - start_ns;
+    stats->nr_decisions++;
+    for (int i = 0; i < state.nr_vms; i++) {
+        stats->churn_mb += abs(state.vms[i].target_memory_kb - state.vms[i].balloon_size_kb) / (double) ONE_K;
+    }
+    if (recorded_targets_kb != NULL && !same_targets(&state, recorded_targets_kb)) {
+        stats->nr_differences++;
+    }
+
+    /* The hypervisor sets the balloons, within what the domains allow. Only the VMs of this state are kept. */
+    for (int i = 0; i < state.nr_vms && closed_loop; i++) {
+        const VM *vm = &state.vms[i];
+        int balloon_kb = vm->target_memory_kb > 0 ? vm->target_memory_kb : 0;
+        if (vm->max_memory_kb > 0 && balloon_kb > vm->max_memory_kb) {
+            balloon_kb = vm->max_memory_kb;
+        }
+        sim->ids[i] = vm->id;
+        sim->balloon_kb[i] = balloon_kb;
+    }
+    if (closed_loop) {
+        sim->nr_vms = state.nr_vms;
+    }
+    return 0;
+}
+
+int simulator_replay(MemorySimulator *sim, TraceReader *reader) {
+    static SystemState states[2];
+    int recorded_targets_kb[MAX_VMS];
+    SystemState *state = &states[0];
+    SystemState *next = &states[1];
+    long long state_ns = 0;
+    bool has_state = false;
+    for (;;) {
+        int type = trace_read(reader, next, recorded_targets_kb);
+        if (type < 0) {
+            return -1;
+        }
+        if (type == TRACE_TARGETS) {
+            if (has_state && simulator_tick(sim, state_ns, state, recorded_targets_kb) < 0) {
+                return -1;
+            }
+            has_state = false;
+            continue;
+        }
+        /* A state without targets (the last tick, or a failed one) */
+        if (has_state && simulator_tick(sim, state_ns, state, NULL) < 0) {
+            return -1;
+        }
+        if (type == 0) {
+            return 0;
+        }
+        SystemState *swap = state;
+        state = next;
+        next = swap;
+        state_ns = reader->time_ns;
+        has_state = true;
+    }
+}
+
+void print_replay_stats(const ReplayStats *stats) {
+    printf("Ticks: %d, decisions: %d\n", stats->nr_ticks, stats->nr_decisions);
+    printf("Decisions unlike the recorded ones: %d\n", stats->nr_differences);
+    printf("VM ticks under target: %d, starved: %d, swapping: %d\n", stats->nr_under_target, stats->nr_starved, stats->nr_swapping);
+    printf("Memory deficit: %.1f MB\n", stats->deficit_mb);
+    printf("Host low on memory: %d ticks, minimum free: %.1f MB\n", stats->nr_host_low, stats->min_host_free_mb);
+    printf("Balloon churn: %.1f MB\n", stats->churn_mb);
+    printf("Coordinator time: %.3f ms\n", stats->solve_ns / 1e6);
+}
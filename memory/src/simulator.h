@@ -0,0 +1,74 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdbool.h>
+#include "vm_types.h"
+#include "trace.h"
+#include "coordinator.h"
+#include "balloon_controller.h"
+#include "working_set.h"
+
+typedef enum {
+    REPLAY_OPEN_LOOP,    // Every tick sees the recorded state, the targets are only compared with the recorded ones
+    REPLAY_CLOSED_LOOP,  // The simulated guests get the balloons the coordinator set
+} ReplayMode;
+
+typedef struct {
+    ReplayMode     mode;
+    AllocationMode allocation;  // What computes the targets
+} ReplayOptions;
+
+/**
+ * @brief What the replayed coordinator did to the guests and the host.
+ */
+typedef struct {
+    int       nr_ticks;
+    int       nr_decisions;
+    int       nr_differences;    // Ticks whose targets are not the recorded ones
+    int       nr_under_target;   // VM ticks with less than TARGET_VM_AVAILABLE_MB available
+    int       nr_starved;        // VM ticks with less than half of TARGET_VM_AVAILABLE_MB available
+    int       nr_swapping;       // VM ticks with nothing available, the guest swaps
+    double    deficit_mb;        // Summed over the VM ticks short of TARGET_VM_AVAILABLE_MB
+    int       nr_host_low;       // Ticks the host had less than TARGET_HOST_FREE_MB free
+    double    min_host_free_mb;
+    double    churn_mb;          // Balloon changes asked for
+    long long solve_ns;
+} ReplayStats;
+
+/**
+ * @brief The balloons of the simulated guests, matched across ticks by domain id.
+ *
+ * A guest uses what the recorded one used (balloon minus available), so in
+ * closed loop only the balloon sizes differ from the recording.
+ */
+typedef struct {
+    ReplayOptions       options;
+    int                 ids[MAX_VMS];
+    int                 balloon_kb[MAX_VMS];
+    int                 nr_vms;
+    BalloonController   controller;          // ALLOCATE_PREDICTIVE only
+    WorkingSetEstimator working_set;
+    ReplayStats         stats;
+} MemorySimulator;
+
+void simulator_init(MemorySimulator *sim, ReplayOptions options);
+
+/**
+ * @brief Computes the targets of one recorded state as options.allocation says.
+ *
+ * @param time_ns When the state was recorded
+ * @param recorded_targets_kb The targets the daemon set for the state, NULL when it set none
+ * @return 0 on success, -1 on error
+ */
+int simulator_tick(MemorySimulator *sim, long long time_ns, const SystemState *recorded_state, const int *recorded_targets_kb);
+
+/**
+ * @brief Replays every tick of a trace.
+ *
+ * @return 0 at the end of the trace, -1 on a malformed one
+ */
+int simulator_replay(MemorySimulator *sim, TraceReader *reader);
+
+void print_replay_stats(const ReplayStats *stats);
+
+#endif
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "coordinator.h"
+#include "balloon_applier.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+#include "tick_schedule.h"
+
+#define PERIOD_NS 1000000000LL
+#define MS 1000000LL
+// Long enough for the balloons to come down 50 MB a tick and settle
+#define NR_TICKS 100
+
+static void test_histogram_buckets_and_percentiles() {
+    LatencyHistogram histogram;
+    memset(&histogram, 0, sizeof(LatencyHistogram));
+    assert(latency_histogram_percentile(&histogram, 50) == 0);
+
+    /* 90 calls of 3 us, 9 of 1.5 ms and one of 10 s */
+    for (int i = 0; i < 90; i++) {
+        latency_histogram_add(&histogram, 3000);
+    }
+    for (int i = 0; i < 9; i++) {
+        latency_histogram_add(&histogram, 1500000);
+    }
+    latency_histogram_add(&histogram, 10 * PERIOD_NS);
+    assert(histogram.nr_calls == 100);
+    assert(histogram.counts[2] == 90);
+    assert(histogram.counts[11] == 9);
+    assert(histogram.counts[LATENCY_BUCKETS - 1] == 1);
+    assert(histogram.max_ns == 10 * PERIOD_NS);
+
+    assert(latency_histogram_percentile(&histogram, 50) == 4000);
+    assert(latency_histogram_percentile(&histogram, 90) == 4000);
+    assert(latency_histogram_percentile(&histogram, 99) == 2048000);
+    assert(latency_histogram_percentile(&histogram, 100) == 10 * PERIOD_NS);
+    /* Never above the slowest call */
+    memset(&histogram, 0, sizeof(LatencyHistogram));
+    latency_histogram_add(&histogram, 1500000);
+    assert(latency_histogram_percentile(&histogram, 50) == 1500000);
+
+    printf("PASS test_histogram_buckets_and_percentiles\n");
+}
+
+static void test_small_changes_make_no_calls() {
+    static SimHypervisor sim;
+    BalloonApplier applier;
+    SimConfig config = { .nr_vms = 4, .host_memory_mb = 8192, .max_memory_mb = 1024, .load = SIM_LOAD_STEADY, .seed = 7 };
+    assert(sim_init(&sim, config) == 0);
+    VirtBackend backend = sim_backend(&sim);
+    assert(balloon_applier_start(&applier, 2, APPLIER_MIN_CHANGE_MB, PERIOD_NS) == 0);
+
+    SystemState state;
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    int rpcs_before = sim.nr_rpcs;
+    state.vms[0].target_memory_kb = 1024 * ONE_K;
+    state.vms[1].target_memory_kb = (1024 - APPLIER_MIN_CHANGE_MB + 1) * ONE_K;
+    state.vms[2].target_memory_kb = (1024 - APPLIER_MIN_CHANGE_MB) * ONE_K;
+    state.vms[3].target_memory_kb = 600 * ONE_K;
+    ApplyResult result;
+    assert(balloon_applier_apply(&applier, &backend, &state, &result) == 0);
+    assert(result.nr_skipped == 2 && result.nr_set == 2 && result.nr_pending == 0);
+    assert(sim.nr_rpcs - rpcs_before == 2);
+    assert(sim.domains[1].balloon_kb == 1024 * ONE_K);
+    assert(sim.domains[2].balloon_kb == (1024 - APPLIER_MIN_CHANGE_MB) * ONE_K);
+    assert(sim.domains[3].balloon_kb == 600 * ONE_K);
+
+    /* A failed call counts as one, and the VM can be set again */
+    state.vms[0].target_memory_kb = 2048 * ONE_K;
+    assert(balloon_applier_apply(&applier, &backend, &state, &result) == 0);
+    assert(result.nr_failed == 1 && result.nr_set == 2);
+    assert(applier.nr_busy == 0 && applier.latency.nr_calls == 5);
+    balloon_applier_stop(&applier);
+
+    printf("PASS test_small_changes_make_no_calls\n");
+}
+
+static void test_slow_guest_doesnt_stall_the_others() {
+    static SimHypervisor sim;
+    BalloonApplier applier;
+    SimConfig config = { .nr_vms = 6, .host_memory_mb = 8192, .max_memory_mb = 1024, .load = SIM_LOAD_STEADY,
+                         .rpc_latency_ns = MS, .seed = 8 };
+    assert(sim_init(&sim, config) == 0);
+    sim.domains[0].set_latency_ns = 400 * MS;
+    VirtBackend backend = sim_backend(&sim);
+    assert(balloon_applier_start(&applier, 3, APPLIER_MIN_CHANGE_MB, 100 * MS) == 0);
+
+    SystemState state;
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].target_memory_kb = 800 * ONE_K;
+    }
+    ApplyResult result;
+    long long start_ns = tick_now_ns();
+    assert(balloon_applier_apply(&applier, &backend, &state, &result) == 0);
+    long long apply_ns = tick_now_ns() - start_ns;
+    /* The others share the two workers left, while the slow one blocks the third */
+    assert(result.nr_set == 5 && result.nr_pending == 1);
+    assert(apply_ns >= 100 * MS && apply_ns < 300 * MS);
+
+    /* The next apply leaves the slow guest alone, and only waits for the others */
+    for (int i = 0; i < state.nr_vms; i++) {
+        state.vms[i].balloon_size_kb = 800 * ONE_K;
+        state.vms[i].target_memory_kb = 700 * ONE_K;
+    }
+    start_ns = tick_now_ns();
+    assert(balloon_applier_apply(&applier, &backend, &state, &result) == 0);
+    assert(tick_now_ns() - start_ns < 100 * MS);
+    assert(result.nr_busy == 1 && result.nr_set == 5 && result.nr_pending == 0);
+
+    balloon_applier_drain(&applier);
+    assert(applier.nr_late == 1 && applier.nr_late_failed == 0);
+    assert(sim.domains[0].balloon_kb == 800 * ONE_K);
+    assert(sim.domains[1].balloon_kb == 700 * ONE_K);
+    assert(applier.latency.nr_calls == 11);
+    assert(applier.latency.max_ns >= 400 * MS);
+    assert(latency_histogram_percentile(&applier.latency, 50) < 10 * MS);
+    print_latency_histogram(&applier.latency, "set_memory");
+    balloon_applier_stop(&applier);
+
+    printf("PASS test_slow_guest_doesnt_stall_the_others\n");
+}
+
+/**
+ * @brief Runs the loop on guests whose use doesn't move, with or without an applier.
+ */
+static void run_steady_guests(BalloonApplier *applier, SimHypervisor *sim, MemoryControl *control) {
+    SimConfig config = { .nr_vms = 8, .host_memory_mb = 16384, .max_memory_mb = 2048, .load = SIM_LOAD_STEADY,
+                         .rpc_latency_ns = 2 * MS, .seed = 9 };
+    assert(sim_init(sim, config) == 0);
+    VirtBackend backend = sim_backend(sim);
+    memory_control_init(control);
+    control->mode = ALLOCATE_PREDICTIVE;
+    control->applier = applier;
+    for (int t = 0; t < NR_TICKS; t++) {
+        assert(memory_control_tick(control, &backend, sim->clock_ns) == 0);
+        sim_advance(sim, PERIOD_NS);
+    }
+}
+
+static void test_control_loop_skips_settled_balloons() {
+    static SimHypervisor serial_sim;
+    static SimHypervisor applier_sim;
+    static MemoryControl serial;
+    static MemoryControl batched;
+    BalloonApplier applier;
+    run_steady_guests(NULL, &serial_sim, &serial);
+    assert(balloon_applier_start(&applier, 4, APPLIER_MIN_CHANGE_MB, PERIOD_NS / 2) == 0);
+    run_steady_guests(&applier, &applier_sim, &batched);
+    balloon_applier_stop(&applier);
+    printf("In turn: %d balloon calls, %.2f ms a tick\n", serial.stats.nr_set, serial.stats.apply_ns / 1e6 / NR_TICKS);
+    printf("Applier: %d balloon calls, %d skipped, %.2f ms a tick\n", batched.stats.nr_set, batched.stats.nr_skipped,
+        batched.stats.apply_ns / 1e6 / NR_TICKS);
+    assert(serial.stats.nr_set == 8 * NR_TICKS);
+    assert(batched.stats.nr_set + batched.stats.nr_skipped == 8 * NR_TICKS);
+    assert(batched.stats.nr_set < serial.stats.nr_set / 2);
+    assert(batched.stats.apply_ns < serial.stats.apply_ns / 2);
+    /* Skipping the small changes kept the guests as well off */
+    assert(applier_sim.swapped_mb_s == 0 && serial_sim.swapped_mb_s == 0);
+
+    printf("PASS test_control_loop_skips_settled_balloons\n");
+}
+
+int main(void) {
+    printf("Running balloon applier tests ...\n\n");
+
+    test_histogram_buckets_and_percentiles();
+    test_small_changes_make_no_calls();
+    test_slow_guest_doesnt_stall_the_others();
+    test_control_loop_skips_settled_balloons();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "coordinator.h"
+#include "balloon_controller.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+#include "simulator.h"
+
+#define PERIOD_NS 1000000000LL
+// Faster than the fixed step's MAX_MEMORY_DELTA_MB a tick
+#define GROWTH_MB_S 80
+
+static void test_slope_fits_the_history() {
+    BalloonHistory history;
+    memset(&history, 0, sizeof(BalloonHistory));
+    assert(balloon_use_slope(&history) == 0);
+
+    /* 12 samples wrap the ring, only the last BALLOON_HISTORY count */
+    for (int t = 0; t < 12; t++) {
+        int k = history.head;
+        history.time_ns[k] = t * PERIOD_NS / 2;
+        history.used_kb[k] = (t < 4 ? 0 : 1000 + 300 * t) * ONE_K;
+        history.head = (history.head + 1) % BALLOON_HISTORY;
+        history.nr_samples = history.nr_samples < BALLOON_HISTORY ? history.nr_samples + 1 : BALLOON_HISTORY;
+        if (t == 0) {
+            assert(balloon_use_slope(&history) == 0);
+        }
+    }
+    assert(fabs(balloon_use_slope(&history) - 600 * ONE_K) < 1e-6);
+
+    printf("PASS test_slope_fits_the_history\n");
+}
+
+static void test_reclaim_is_capped_and_growth_keeps_the_host_reserve() {
+    BalloonController controller;
+    SystemState state;
+    balloon_controller_init(&controller, balloon_default_gains());
+    memset(&state, 0, sizeof(SystemState));
+    /* 80 MB above the host reserve before the first VM gives any back */
+    state.free_memory_bytes = (unsigned long long) (TARGET_HOST_FREE_MB + 80) * ONE_K * ONE_K;
+    state.nr_vms = 3;
+    for (int i = 0; i < 3; i++) {
+        state.vms[i].id = i + 1;
+        state.vms[i].max_memory_kb = 4096 * ONE_K;
+        state.vms[i].balloon_size_kb = 1024 * ONE_K;
+    }
+    state.vms[0].memory_available_kb = 900 * ONE_K;
+    state.vms[1].memory_available_kb = 40 * ONE_K;
+    state.vms[2].memory_available_kb = 0;
+    assert(predict_vm_target_memory(&controller, &state, 0) == 3);
+
+    /* The idle VM gives back no more than the fixed step would */
+    assert(state.vms[0].target_memory_kb == (1024 - MAX_MEMORY_DELTA_MB) * ONE_K);
+    /* The swapping VM is served first, the other gets what is left above the reserve */
+    int grown_kb = state.vms[1].target_memory_kb + state.vms[2].target_memory_kb - 2 * 1024 * ONE_K;
+    assert(grown_kb == (80 + MAX_MEMORY_DELTA_MB) * ONE_K);
+    assert(state.vms[2].target_memory_kb == (1024 + TARGET_VM_AVAILABLE_MB) * ONE_K);
+    assert(state.vms[1].target_memory_kb == (1024 + 80 + MAX_MEMORY_DELTA_MB - TARGET_VM_AVAILABLE_MB) * ONE_K);
+
+    /* Never past the domain's maximum */
+    state.vms[2].max_memory_kb = 1030 * ONE_K;
+    assert(predict_vm_target_memory(&controller, &state, PERIOD_NS) == 3);
+    assert(state.vms[2].target_memory_kb == 1030 * ONE_K);
+
+    printf("PASS test_reclaim_is_capped_and_growth_keeps_the_host_reserve\n");
+}
+
+/**
+ * @brief Runs the control loop against guests growing GROWTH_MB_S and counts the ticks a guest was under target.
+ */
+static int run_growing_guests(bool predictive, SimHypervisor *sim) {
+    static MemoryControl control;
+    SimConfig config = { .nr_vms = 4, .host_memory_mb = 32768, .max_memory_mb = 4096, .load = SIM_LOAD_GROWING, .seed = 4 };
+    assert(sim_init(sim, config) == 0);
+    for (int i = 0; i < sim->nr_domains; i++) {
+        sim->domains[i].used_kb = (512 + 128 * i) * ONE_K;
+        sim->domains[i].growth_kb = GROWTH_MB_S * ONE_K * SIM_STEP_NS / 1e9;
+    }
+    VirtBackend backend = sim_backend(sim);
+    memory_control_init(&control);
+    control.mode = predictive ? ALLOCATE_PREDICTIVE : ALLOCATE_FIXED_STEP;
+    int nr_under_target = 0;
+    for (int t = 0; t < 30; t++) {
+        assert(memory_control_tick(&control, &backend, sim->clock_ns) == 0);
+        sim_advance(sim, PERIOD_NS);
+        SystemState state;
+        assert(backend.ops->query_state(backend.impl, &state) == 0);
+        for (int i = 0; i < state.nr_vms; i++) {
+            nr_under_target += state.vms[i].memory_available_kb < TARGET_VM_AVAILABLE_MB * ONE_K;
+        }
+    }
+    return nr_under_target;
+}
+
+static void test_predictive_control_keeps_up_with_fast_growth() {
+    static SimHypervisor fixed_sim;
+    static SimHypervisor predictive_sim;
+    int fixed_under = run_growing_guests(false, &fixed_sim);
+    int predictive_under = run_growing_guests(true, &predictive_sim);
+    printf("Fixed step: %d VM ticks under target, %.1f MB*s swapped\n", fixed_under, fixed_sim.swapped_mb_s);
+    printf("Predictive: %d VM ticks under target, %.1f MB*s swapped\n", predictive_under, predictive_sim.swapped_mb_s);
+    assert(fixed_sim.swapped_mb_s > 0);
+    assert(predictive_sim.swapped_mb_s < fixed_sim.swapped_mb_s / 4);
+    assert(predictive_under < fixed_under / 2);
+
+    printf("PASS test_predictive_control_keeps_up_with_fast_growth\n");
+}
+
+/**
+ * @brief Replays a guest whose use grows GROWTH_MB_S a tick in closed loop.
+ */
+static ReplayStats replay_growing_guest(bool predictive) {
+    static MemorySimulator sim;
+    ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP, .allocation = predictive ? ALLOCATE_PREDICTIVE : ALLOCATE_FIXED_STEP };
+    simulator_init(&sim, options);
+    SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    state.free_memory_bytes = 16ULL * ONE_K * ONE_K * ONE_K;
+    state.nr_vms = 1;
+    state.vms[0].id = 5;
+    state.vms[0].max_memory_kb = 4096 * ONE_K;
+    state.vms[0].balloon_size_kb = 4096 * ONE_K;
+    for (int t = 0; t < 40; t++) {
+        int used_kb = (256 + GROWTH_MB_S * t) * ONE_K;
+        state.vms[0].memory_available_kb = state.vms[0].balloon_size_kb - used_kb;
+        state.vms[0].memory_unused_kb = state.vms[0].memory_available_kb;
+        state.vms[0].memory_usable_kb = state.vms[0].memory_available_kb;
+        assert(simulator_tick(&sim, t * PERIOD_NS, &state, NULL) == 0);
+    }
+    return sim.stats;
+}
+
+static void test_predictive_replay_spends_less_time_under_target() {
+    ReplayStats fixed = replay_growing_guest(false);
+    ReplayStats predictive = replay_growing_guest(true);
+    printf("Replay, fixed step: %d ticks under target, %d swapping\n", fixed.nr_under_target, fixed.nr_swapping);
+    printf("Replay, predictive: %d ticks under target, %d swapping\n", predictive.nr_under_target, predictive.nr_swapping);
+    assert(fixed.nr_ticks == 40 && predictive.nr_ticks == 40);
+    assert(fixed.nr_swapping > 0);
+    assert(predictive.nr_swapping < fixed.nr_swapping);
+    assert(predictive.nr_under_target < fixed.nr_under_target);
+    assert(predictive.deficit_mb < fixed.deficit_mb);
+
+    printf("PASS test_predictive_replay_spends_less_time_under_target\n");
+}
+
+int main(void) {
+    printf("Running balloon controller tests ...\n\n");
+
+    test_slope_fits_the_history();
+    test_reclaim_is_capped_and_growth_keeps_the_host_reserve();
+    test_predictive_control_keeps_up_with_fast_growth();
+    test_predictive_replay_spends_less_time_under_target();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "coordinator.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+
+#define PERIOD_NS 1000000000LL
+
+static void test_sim_backend_reports_balloons() {
+    SimHypervisor sim;
+    SystemState state;
+    SimConfig config = { .nr_vms = 2, .host_memory_mb = 4096, .max_memory_mb = 1024, .load = SIM_LOAD_STEADY, .seed = 1 };
+    assert(sim_init(&sim, config) == 0);
+    sim.domains[0].used_kb = 700 * ONE_K;
+    VirtBackend backend = sim_backend(&sim);
+
+    assert(backend.ops->set_stats_period(backend.impl) == 2);
+    assert(backend.ops->set_stats_period(backend.impl) == 0);
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    assert(sim.nr_rpcs == 4);
+    assert(state.nr_vms == 2);
+    assert(state.free_memory_bytes == 2048ULL * ONE_K * ONE_K);
+    assert(state.vms[0].id == 1 && state.vms[0].max_memory_kb == 1024 * ONE_K);
+    assert(state.vms[0].balloon_size_kb == 1024 * ONE_K);
+    assert(state.vms[0].memory_available_kb == 324 * ONE_K);
+
+    /* Squeezing the balloon below what the guest uses makes it swap */
+    assert(backend.ops->set_memory(backend.impl, 1, 600 * ONE_K) == 0);
+    assert(backend.ops->set_memory(backend.impl, 1, 2048 * ONE_K) == -1);
+    assert(backend.ops->set_memory(backend.impl, 3, 600 * ONE_K) == -1);
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    assert(state.vms[0].memory_available_kb == 0);
+    assert(state.free_memory_bytes == 2472ULL * ONE_K * ONE_K);
+    sim_advance(&sim, 2 * PERIOD_NS);
+    assert(sim.swapped_mb_s > 199.9 && sim.swapped_mb_s < 200.1);
+
+    printf("PASS test_sim_backend_reports_balloons\n");
+}
+
+static void test_control_loop_follows_growing_guests() {
+    SimHypervisor sim;
+    MemoryControl control;
+    SimConfig config = { .nr_vms = 4, .host_memory_mb = 8192, .max_memory_mb = 2048, .load = SIM_LOAD_GROWING, .seed = 2 };
+    assert(sim_init(&sim, config) == 0);
+    VirtBackend backend = sim_backend(&sim);
+    memory_control_init(&control);
+
+    SystemState state;
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    unsigned long long free_before = state.free_memory_bytes;
+    for (int t = 0; t < 60; t++) {
+        assert(memory_control_tick(&control, &backend, sim.clock_ns) == 0);
+        sim_advance(&sim, PERIOD_NS);
+    }
+    assert(control.stats.nr_ticks == 60);
+    assert(control.stats.nr_set == 4 * 60);
+    /* The balloons came down to what the guests use plus the target, and followed them as they grew */
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    assert(state.free_memory_bytes > free_before);
+    for (int i = 0; i < state.nr_vms; i++) {
+        int available_mb = state.vms[i].memory_available_kb / ONE_K;
+        assert(available_mb > TARGET_VM_AVAILABLE_MB / 2 && available_mb < TARGET_VM_AVAILABLE_MB + MAX_MEMORY_DELTA_MB);
+    }
+    assert(sim.swapped_mb_s == 0);
+
+    printf("PASS test_control_loop_follows_growing_guests\n");
+}
+
+static void test_control_loop_follows_domains_starting_and_stopping() {
+    SimHypervisor sim;
+    MemoryControl control;
+    SimConfig config = { .nr_vms = 2, .host_memory_mb = 16384, .max_memory_mb = 1024, .load = SIM_LOAD_RANDOM_WALK,
+                         .rpc_latency_ns = 100000, .seed = 3 };
+    assert(sim_init(&sim, config) == 0);
+    VirtBackend backend = sim_backend(&sim);
+    memory_control_init(&control);
+    static const int nr_vms[] = { 2, 5, 5, 1, 0, 8, 8, 3 };
+    int nr_set = 0;
+    for (int t = 0; t < 8; t++) {
+        assert(sim_resize(&sim, nr_vms[t]) == 0);
+        int rpcs_before = sim.nr_rpcs;
+        assert(memory_control_tick(&control, &backend, sim.clock_ns) == 0);
+        nr_set += nr_vms[t];
+        assert(control.stats.nr_set == nr_set);
+        /* A query and a balloon per VM, plus the stats period of the new VMs */
+        assert(sim.nr_rpcs - rpcs_before >= 2 + nr_vms[t]);
+        sim_advance(&sim, PERIOD_NS / 2);
+        memory_control_probe(&control, &backend, TARGET_VM_AVAILABLE_MB / 2);
+        sim_advance(&sim, PERIOD_NS / 2);
+    }
+    assert(sim.rpc_ns == sim.nr_rpcs * 100000LL);
+    assert(control.stats.query_ns + control.stats.apply_ns >= sim.rpc_ns - 2 * 8 * 100000LL);
+    assert(control.probed.nr_vms == 3);
+
+    printf("PASS test_control_loop_follows_domains_starting_and_stopping\n");
+}
+
+int main(void) {
+    printf("Running control loop tests ...\n\n");
+
+    test_sim_backend_reports_balloons();
+    test_control_loop_follows_growing_guests();
+    test_control_loop_follows_domains_starting_and_stopping();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
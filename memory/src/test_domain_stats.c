@@ -0,0 +1,60 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm_types.h"
+#include "domain_stats.h"
+
+#define FIXTURE "domstats_balloon.virsh"
+
+static void test_can_read_recorded_domstats() {
+    SystemState state;
+    memset(&state, 0, sizeof(SystemState));
+    FILE *file = fopen(FIXTURE, "r");
+    assert(file != NULL);
+    assert(domain_stats_read_virsh(file, &state) == 3);
+    fclose(file);
+
+    assert(state.nr_vms == 3);
+    assert(strcmp(state.vms[0].name, "aos_vm1") == 0);
+    assert(state.vms[0].id == 1);
+    assert(state.vms[0].balloon_size_kb == 524288);
+    assert(state.vms[0].max_memory_kb == 2097152);
+    assert(state.vms[0].memory_unused_kb == 98304);
+    assert(state.vms[0].memory_available_kb == 489012);
+    assert(state.vms[0].memory_usable_kb == 251904);
+    assert(state.vms[0].memory_rss_kb == 561152);
+    assert(state.vms[1].balloon_size_kb == 1048576);
+    assert(state.vms[1].memory_usable_kb == 61440);
+    assert(state.vms[0].memory_disk_caches_kb == 141312);
+    assert(state.vms[0].major_faults == 312 && state.vms[0].minor_faults == 184230);
+    assert(state.vms[1].swap_in_kb == 2048);
+    assert(state.vms[1].major_faults == 9120);
+    /* No guest stats before the stats period is set */
+    assert(state.vms[2].balloon_size_kb == 2097152);
+    assert(state.vms[2].memory_available_kb == 0);
+    assert(state.vms[2].memory_usable_kb == 0);
+
+    printf("PASS test_can_read_recorded_domstats\n");
+}
+
+static void test_rejects_domain_without_balloon() {
+    DomainStat stats[] = {
+        {"state.state", 1},
+        {"balloon.rss", 266240},
+    };
+    VM vm;
+    memset(&vm, 0, sizeof(VM));
+    assert(domain_stats_to_vm(&vm, stats, 2) == -1);
+
+    printf("PASS test_rejects_domain_without_balloon\n");
+}
+
+int main(void) {
+    printf("Running domain stats tests ...\n\n");
+
+    test_can_read_recorded_domstats();
+    test_rejects_domain_without_balloon();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "coordinator.h"
+#include "fair_share.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+
+#define PERIOD_NS 1000000000LL
+
+static void test_allocate_is_max_min_fair() {
+    long long granted_kb[4];
+
+    /* The small demand is met, the others split the rest evenly */
+    ShareRequest equal[3] = { { 0, 100, 1 }, { 0, 1000, 1 }, { 0, 1000, 1 } };
+    assert(fair_share_allocate(equal, 3, 900, granted_kb) == 900);
+    assert(granted_kb[0] == 100 && granted_kb[1] == 400 && granted_kb[2] == 400);
+
+    /* Everything when the pool covers it, the rest stays in the pool */
+    assert(fair_share_allocate(equal, 3, 5000, granted_kb) == 2100);
+    assert(granted_kb[1] == 1000);
+
+    /* Weights share in proportion above the minimums, which always come first */
+    ShareRequest weighted[4] = { { 0, 1000, 1 }, { 0, 1000, 2 }, { 500, 1000, 1 }, { 0, 150, 3 } };
+    /* Shares are rounded down, by less than a KB each */
+    long long total_kb = fair_share_allocate(weighted, 4, 1200, granted_kb);
+    assert(total_kb <= 1200 && total_kb > 1200 - 4);
+    assert(granted_kb[3] == 150);
+    assert(granted_kb[2] == 500);
+    assert(granted_kb[0] == 183 && granted_kb[1] == 366);
+
+    /* Not even the minimums fit, they shrink together */
+    ShareRequest guaranteed[2] = { { 600, 800, 1 }, { 200, 800, 5 } };
+    assert(fair_share_allocate(guaranteed, 2, 400, granted_kb) == 400);
+    assert(granted_kb[0] == 300 && granted_kb[1] == 100);
+    assert(fair_share_allocate(guaranteed, 2, -10, granted_kb) == 0);
+
+    printf("PASS test_allocate_is_max_min_fair\n");
+}
+
+static void setup_contended_state(SystemState *state) {
+    memset(state, 0, sizeof(SystemState));
+    /* 300 MB free, 100 MB above the host reserve */
+    state->free_memory_bytes = 300ULL * ONE_K * ONE_K;
+    state->nr_vms = 4;
+    for (int i = 0; i < 4; i++) {
+        VM *vm = &state->vms[i];
+        vm->id = 10 + i;
+        vm->max_memory_kb = 2048 * ONE_K;
+        vm->balloon_size_kb = 1024 * ONE_K;
+        vm->memory_available_kb = 0;
+    }
+}
+
+static void test_targets_dont_depend_on_vm_order() {
+    SystemState state;
+    SystemState shuffled;
+    setup_contended_state(&state);
+    state.vms[3].min_memory_kb = 1200 * ONE_K;
+    state.vms[1].limit_memory_kb = 900 * ONE_K;
+    state.vms[2].share_weight = 2;
+    shuffled = state;
+    for (int i = 0; i < 4; i++) {
+        shuffled.vms[i] = state.vms[3 - i];
+    }
+    assert(fair_share_vm_target_memory(&state) == 4);
+    assert(fair_share_vm_target_memory(&shuffled) == 4);
+    long long total_kb = 0;
+    for (int i = 0; i < 4; i++) {
+        assert(state.vms[i].target_memory_kb == shuffled.vms[3 - i].target_memory_kb);
+        total_kb += state.vms[i].target_memory_kb;
+    }
+    /* The pool is every balloon plus what the host has above its reserve */
+    assert(total_kb <= (4 * 1024 + 100) * ONE_K && total_kb > (4 * 1024 + 99) * ONE_K);
+    assert(state.vms[3].target_memory_kb >= 1200 * ONE_K);
+    assert(state.vms[1].target_memory_kb == 900 * ONE_K);
+    /* Twice the weight covers the whole demand, what it uses plus the target, and the rest goes to VM 0 */
+    assert(state.vms[2].target_memory_kb == (1024 + TARGET_VM_AVAILABLE_MB) * ONE_K);
+    assert(state.vms[0].target_memory_kb / ONE_K == 4 * 1024 + 100 - 1200 - 900 - 1024 - TARGET_VM_AVAILABLE_MB);
+
+    /* The fixed step serves the VMs in order, the first two get the 100 MB */
+    setup_contended_state(&state);
+    assert(compute_vm_target_memory(&state) == 4);
+    assert(state.vms[0].target_memory_kb == (1024 + MAX_MEMORY_DELTA_MB) * ONE_K);
+    assert(state.vms[1].target_memory_kb == (1024 + MAX_MEMORY_DELTA_MB) * ONE_K);
+    assert(state.vms[3].target_memory_kb == 1024 * ONE_K);
+
+    printf("PASS test_targets_dont_depend_on_vm_order\n");
+}
+
+static void test_metadata_sets_guarantees() {
+    VM vm;
+    memset(&vm, 0, sizeof(VM));
+    assert(fair_share_parse_metadata("<memory xmlns=\"urn:memory-coordinator:1\" min_mb=\"512\" max_mb='2048' weight=\"3\"/>", &vm) == 0);
+    assert(vm.min_memory_kb == 512 * ONE_K && vm.limit_memory_kb == 2048 * ONE_K && vm.share_weight == 3);
+    assert(fair_share_parse_metadata("<memory weight=\"2\"/>", &vm) == 0);
+    assert(vm.min_memory_kb == 0 && vm.limit_memory_kb == 0 && vm.share_weight == 2);
+    assert(fair_share_parse_metadata("<memory min_mb=\"-1\"/>", &vm) == -1);
+    assert(fair_share_parse_metadata("<memory min_mb=\"lots\"/>", &vm) == -1);
+    assert(fair_share_parse_metadata("<memory max_mb=\"9999999999\"/>", &vm) == -1);
+
+    printf("PASS test_metadata_sets_guarantees\n");
+}
+
+/**
+ * @brief Runs the loop on a host that can't give three busy guests what they want, and returns the final balloons in MB.
+ */
+static void run_contended_host(AllocationMode mode, int *balloon_mb) {
+    static SimHypervisor sim;
+    static MemoryControl control;
+    SimConfig config = { .nr_vms = 4, .host_memory_mb = 3584, .max_memory_mb = 1024, .load = SIM_LOAD_STEADY, .seed = 5 };
+    assert(sim_init(&sim, config) == 0);
+    static const int used_mb[] = { 950, 950, 300, 950 };
+    for (int i = 0; i < 4; i++) {
+        sim.domains[i].balloon_kb = 768 * ONE_K;
+        sim.domains[i].used_kb = used_mb[i] * ONE_K;
+    }
+    VirtBackend backend = sim_backend(&sim);
+    memory_control_init(&control);
+    control.mode = mode;
+    for (int t = 0; t < 20; t++) {
+        assert(memory_control_tick(&control, &backend, sim.clock_ns) == 0);
+        sim_advance(&sim, PERIOD_NS);
+    }
+    SystemState state;
+    assert(backend.ops->query_state(backend.impl, &state) == 0);
+    assert(state.free_memory_bytes >= (unsigned long long) TARGET_HOST_FREE_MB * ONE_K * ONE_K);
+    for (int i = 0; i < 4; i++) {
+        balloon_mb[i] = state.vms[i].balloon_size_kb / ONE_K;
+    }
+}
+
+static void test_contended_host_is_shared_evenly() {
+    int fixed_mb[4];
+    int fair_mb[4];
+    run_contended_host(ALLOCATE_FIXED_STEP, fixed_mb);
+    run_contended_host(ALLOCATE_FAIR_SHARE, fair_mb);
+    printf("Fixed step balloons: %d %d %d %d MB\n", fixed_mb[0], fixed_mb[1], fixed_mb[2], fixed_mb[3]);
+    printf("Fair share balloons: %d %d %d %d MB\n", fair_mb[0], fair_mb[1], fair_mb[2], fair_mb[3]);
+    /* The idle guest keeps what it uses plus the target, the busy ones split the rest */
+    assert(fair_mb[2] == 300 + TARGET_VM_AVAILABLE_MB);
+    assert(abs(fair_mb[0] - fair_mb[3]) <= 1 && abs(fair_mb[1] - fair_mb[3]) <= 1);
+    /* The fixed step leaves whoever was served last in the tick the host ran out short */
+    int fixed_spread_mb = abs(fixed_mb[0] - fixed_mb[1]) + abs(fixed_mb[1] - fixed_mb[3]) + abs(fixed_mb[0] - fixed_mb[3]);
+    assert(fixed_spread_mb >= MAX_MEMORY_DELTA_MB);
+
+    printf("PASS test_contended_host_is_shared_evenly\n");
+}
+
+int main(void) {
+    printf("Running fair share tests ...\n\n");
+
+    test_allocate_is_max_min_fair();
+    test_targets_dont_depend_on_vm_order();
+    test_metadata_sets_guarantees();
+    test_contended_host_is_shared_evenly();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "coordinator.h"
+#include "trace.h"
+#include "simulator.h"
+
+static void setup_random_state(SystemState *state, int nr_vms) {
+    memset(state, 0, sizeof(SystemState));
+    state->free_memory_bytes = (unsigned long long) (1 + rand() % 16) * ONE_K * ONE_K * ONE_K;
+    state->nr_vms = nr_vms;
+    for (int i = 0; i < nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        vm->id = i + 1;
+        snprintf(vm->name, MAX_NAME_LEN, "vm%d", i % 10);
+        vm->max_memory_kb = 2048 * ONE_K;
+        vm->balloon_size_kb = (256 + rand() % 1024) * ONE_K;
+        vm->memory_available_kb = rand() % vm->balloon_size_kb;
+        vm->memory_unused_kb = vm->memory_available_kb - rand() % 1000;
+        vm->memory_usable_kb = vm->memory_available_kb + rand() % 1000;
+        vm->memory_rss_kb = vm->balloon_size_kb + rand() % 1000;
+        vm->min_memory_kb = rand() % 256 * ONE_K;
+        vm->limit_memory_kb = rand() % 2 * 1536 * ONE_K;
+        vm->share_weight = rand() % 4;
+        vm->memory_disk_caches_kb = rand() % vm->balloon_size_kb;
+        vm->swap_in_kb = (uint64_t) rand() * rand();
+        vm->major_faults = rand();
+        vm->minor_faults = (uint64_t) rand() << 20;
+    }
+}
+
+static void test_trace_round_trips_states_and_targets() {
+    SystemState states[3];
+    SystemState read;
+    int targets_kb[MAX_VMS];
+    TraceWriter writer;
+    TraceReader reader;
+
+    srand(15);
+    FILE *file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    for (int t = 0; t < 3; t++) {
+        setup_random_state(&states[t], 2 + t);
+        assert(compute_vm_target_memory(&states[t]) == 2 + t);
+        assert(trace_write_state(&writer, 1000 * t, &states[t]) == 0);
+        assert(trace_write_targets(&writer, 1000 * t + 1, &states[t]) == 0);
+    }
+    assert(ftell(file) == writer.nr_bytes);
+
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == 0);
+    for (int t = 0; t < 3; t++) {
+        assert(trace_read(&reader, &read, targets_kb) == TRACE_STATE);
+        assert(reader.time_ns == 1000 * t);
+        assert(read.free_memory_bytes == states[t].free_memory_bytes);
+        assert(read.nr_vms == states[t].nr_vms);
+        for (int i = 0; i < read.nr_vms; i++) {
+            VM expected = states[t].vms[i];
+            expected.target_memory_kb = 0;
+            assert(memcmp(&read.vms[i], &expected, sizeof(VM)) == 0);
+        }
+
+        assert(trace_read(&reader, &read, targets_kb) == TRACE_TARGETS);
+        assert(reader.time_ns == 1000 * t + 1);
+        for (int i = 0; i < states[t].nr_vms; i++) {
+            assert(targets_kb[i] == states[t].vms[i].target_memory_kb);
+        }
+    }
+    assert(trace_read(&reader, &read, targets_kb) == 0);
+    fclose(file);
+
+    printf("PASS test_trace_round_trips_states_and_targets\n");
+}
+
+static void test_trace_rejects_other_files_and_truncated_records() {
+    SystemState state;
+    int targets_kb[MAX_VMS];
+    TraceWriter writer;
+    TraceReader reader;
+
+    FILE *file = tmpfile();
+    fputs("VCTR", file);
+    fputc(1, file);
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == -1);
+    fclose(file);
+
+    /* Every cut inside the record is an error, not a short state */
+    srand(16);
+    setup_random_state(&state, 4);
+    file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    long header_bytes = writer.nr_bytes;
+    assert(trace_write_state(&writer, 5, &state) == 0);
+    fflush(file);
+    char *bytes = malloc(writer.nr_bytes);
+    rewind(file);
+    assert(fread(bytes, 1, writer.nr_bytes, file) == (size_t) writer.nr_bytes);
+    fclose(file);
+    for (long length = header_bytes + 1; length < writer.nr_bytes; length++) {
+        file = tmpfile();
+        fwrite(bytes, 1, length, file);
+        rewind(file);
+        assert(trace_reader_init(&reader, file) == 0);
+        assert(trace_read(&reader, &state, targets_kb) == -1);
+        fclose(file);
+    }
+    free(bytes);
+
+    printf("PASS test_trace_rejects_other_files_and_truncated_records\n");
+}
+
+static void test_trace_reads_version_1_without_guarantees() {
+    SystemState state;
+    int targets_kb[MAX_VMS];
+    TraceReader reader;
+
+    /* A state of one VM named "a" with id 3 and a 512 MB balloon, before the guarantees were recorded */
+    static const unsigned char version_1[] = {
+        'M', 'C', 'T', 'R', 1,
+        TRACE_STATE, 0, 0, 2, 2, 'a', 6, 0, 0, 0, 0, 0, 0x80, 0x80, 0x40,
+    };
+    FILE *file = tmpfile();
+    fwrite(version_1, 1, sizeof(version_1), file);
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == 0);
+    assert(reader.version == 1);
+    assert(trace_read(&reader, &state, targets_kb) == TRACE_STATE);
+    assert(state.nr_vms == 1 && state.vms[0].id == 3 && strcmp(state.vms[0].name, "a") == 0);
+    assert(state.vms[0].balloon_size_kb == 512 * ONE_K);
+    assert(state.vms[0].min_memory_kb == 0 && state.vms[0].limit_memory_kb == 0 && state.vms[0].share_weight == 0);
+    assert(state.vms[0].memory_disk_caches_kb == 0 && state.vms[0].major_faults == 0);
+    assert(trace_read(&reader, &state, targets_kb) == 0);
+    fclose(file);
+
+    /* Nor a version newer than this one */
+    file = tmpfile();
+    fputs("MCTR", file);
+    fputc(TRACE_VERSION + 1, file);
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == -1);
+    fclose(file);
+
+    printf("PASS test_trace_reads_version_1_without_guarantees\n");
+}
+
+/**
+ * @brief Records ticks of guests whose memory use wanders, with the balloons set to the targets like memory_coordinator does.
+ */
+static FILE *record_run(int nr_ticks, int nr_vms) {
+    SystemState state;
+    int used_kb[MAX_VMS];
+    TraceWriter writer;
+    FILE *file = tmpfile();
+    assert(trace_writer_init(&writer, file) == 0);
+    setup_random_state(&state, nr_vms);
+    state.free_memory_bytes = 2ULL * ONE_K * ONE_K * ONE_K;
+    for (int i = 0; i < nr_vms; i++) {
+        used_kb[i] = state.vms[i].balloon_size_kb - state.vms[i].memory_available_kb;
+    }
+    for (int t = 0; t < nr_ticks; t++) {
+        for (int i = 0; i < nr_vms; i++) {
+            VM *vm = &state.vms[i];
+            used_kb[i] += (rand() % 41 - 20) * ONE_K;
+            used_kb[i] = used_kb[i] < 64 * ONE_K ? 64 * ONE_K : used_kb[i];
+            vm->memory_available_kb = vm->balloon_size_kb - used_kb[i];
+        }
+        assert(compute_vm_target_memory(&state) == nr_vms);
+        assert(trace_write_state(&writer, t, &state) == 0);
+        assert(trace_write_targets(&writer, t, &state) == 0);
+        for (int i = 0; i < nr_vms; i++) {
+            VM *vm = &state.vms[i];
+            state.free_memory_bytes -= (long long) (vm->target_memory_kb - vm->balloon_size_kb) * ONE_K;
+            vm->balloon_size_kb = vm->target_memory_kb;
+        }
+    }
+    /* The daemon stopped after querying the state */
+    assert(trace_write_state(&writer, nr_ticks, &state) == 0);
+    return file;
+}
+
+static ReplayStats replay(FILE *file, ReplayOptions options) {
+    MemorySimulator sim;
+    TraceReader reader;
+    rewind(file);
+    assert(trace_reader_init(&reader, file) == 0);
+    simulator_init(&sim, options);
+    assert(simulator_replay(&sim, &reader) == 0);
+    return sim.stats;
+}
+
+static void test_replay_reproduces_recorded_targets() {
+    srand(17);
+    FILE *file = record_run(50, 4);
+    ReplayOptions options = { .mode = REPLAY_OPEN_LOOP };
+    ReplayStats open_loop = replay(file, options);
+    assert(open_loop.nr_ticks == 51);
+    assert(open_loop.nr_decisions == 51);
+    assert(open_loop.nr_differences == 0);
+
+    /* The recording set the balloons the way the simulated hypervisor does */
+    options.mode = REPLAY_CLOSED_LOOP;
+    ReplayStats closed_loop = replay(file, options);
+    assert(closed_loop.nr_differences == 0);
+    closed_loop.solve_ns = open_loop.solve_ns = 0;
+    assert(memcmp(&closed_loop, &open_loop, sizeof(ReplayStats)) == 0);
+    fclose(file);
+
+    printf("PASS test_replay_reproduces_recorded_targets\n");
+}
+
+static void test_closed_loop_model_follows_the_balloons() {
+    SystemState state;
+    MemorySimulator sim;
+    ReplayOptions options = { .mode = REPLAY_CLOSED_LOOP };
+    simulator_init(&sim, options);
+
+    /* A guest using all but 10 MB of its balloon on a roomy host */
+    memset(&state, 0, sizeof(SystemState));
+    state.free_memory_bytes = 4ULL * ONE_K * ONE_K * ONE_K;
+    state.nr_vms = 1;
+    state.vms[0].id = 7;
+    state.vms[0].max_memory_kb = 1024 * ONE_K;
+    state.vms[0].balloon_size_kb = 512 * ONE_K;
+    state.vms[0].memory_available_kb = 10 * ONE_K;
+    assert(simulator_tick(&sim, 0, &state, NULL) == 0);
+    assert(sim.stats.nr_starved == 1);
+    assert(sim.stats.deficit_mb == TARGET_VM_AVAILABLE_MB - 10);
+    assert(sim.balloon_kb[0] == (512 + MAX_MEMORY_DELTA_MB) * ONE_K);
+
+    /* The recorded state never changes, the simulated guest gets the memory it was given */
+    for (int t = 0; t < 4; t++) {
+        assert(simulator_tick(&sim, 1000000000LL * (t + 1), &state, NULL) == 0);
+    }
+    assert(sim.stats.nr_starved == 1);
+    assert(sim.balloon_kb[0] == (512 + TARGET_VM_AVAILABLE_MB - 10) * ONE_K);
+    assert(sim.stats.min_host_free_mb < 4 * ONE_K);
+
+    /* A balloon never grows past the domain's maximum */
+    state.vms[0].memory_available_kb = -2048 * ONE_K;
+    for (int t = 0; t < 40; t++) {
+        assert(simulator_tick(&sim, 1000000000LL * (t + 5), &state, NULL) == 0);
+    }
+    assert(sim.balloon_kb[0] == 1024 * ONE_K);
+
+    printf("PASS test_closed_loop_model_follows_the_balloons\n");
+}
+
+int main(void) {
+    printf("Running trace tests ...\n\n");
+
+    test_trace_round_trips_states_and_targets();
+    test_trace_rejects_other_files_and_truncated_records();
+    test_trace_reads_version_1_without_guarantees();
+    test_replay_reproduces_recorded_targets();
+    test_closed_loop_model_follows_the_balloons();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
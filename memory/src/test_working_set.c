@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "coordinator.h"
+#include "working_set.h"
+#include "control_loop.h"
+#include "sim_backend.h"
+
+#define PERIOD_NS 1000000000LL
+
+static void setup_guest(SystemState *state) {
+    memset(state, 0, sizeof(SystemState));
+    state->free_memory_bytes = 4ULL * ONE_K * ONE_K * ONE_K;
+    state->nr_vms = 1;
+    VM *vm = &state->vms[0];
+    vm->id = 4;
+    vm->max_memory_kb = 2048 * ONE_K;
+    vm->balloon_size_kb = 1024 * ONE_K;
+    vm->memory_unused_kb = 100 * ONE_K;
+    vm->memory_disk_caches_kb = 500 * ONE_K;
+    vm->memory_available_kb = 600 * ONE_K;
+}
+
+static void test_working_set_leaves_out_page_cache() {
+    WorkingSetEstimator estimator;
+    SystemState state;
+    working_set_init(&estimator);
+    setup_guest(&state);
+    assert(working_set_used_kb(&state.vms[0]) == 424 * ONE_K);
+    assert(working_set_update(&estimator, &state, 0) == 0);
+    /* Anonymous memory plus a little of the cache */
+    assert(state.vms[0].working_set_kb == (424 + WORKING_SET_CACHE_KEEP_MB) * ONE_K);
+    assert(working_set_used_kb(&state.vms[0]) == state.vms[0].working_set_kb);
+
+    /* Little cache is all kept */
+    state.vms[0].memory_unused_kb = 580 * ONE_K;
+    state.vms[0].memory_disk_caches_kb = 20 * ONE_K;
+    assert(working_set_update(&estimator, &state, PERIOD_NS) == 0);
+    assert(state.vms[0].working_set_kb == (424 + 20) * ONE_K);
+
+    printf("PASS test_working_set_leaves_out_page_cache\n");
+}
+
+static void test_fault_spikes_raise_the_working_set() {
+    WorkingSetEstimator estimator;
+    SystemState state;
+    working_set_init(&estimator);
+    setup_guest(&state);
+    int base_kb = (424 + WORKING_SET_CACHE_KEEP_MB) * ONE_K;
+
+    /* A busy guest's usual rate is no spike */
+    for (int t = 0; t < 6; t++) {
+        state.vms[0].major_faults += 200;
+        state.vms[0].minor_faults += 10000;
+        assert(working_set_update(&estimator, &state, t * PERIOD_NS) == 0);
+        assert(state.vms[0].working_set_kb == base_kb);
+    }
+    assert(estimator.vms[0].usual_major_s == 200);
+    assert(estimator.vms[0].minor_faults_s == 10000);
+
+    /* 5000 faults in a second read back 20000 KB */
+    state.vms[0].major_faults += 5000;
+    assert(working_set_update(&estimator, &state, 6 * PERIOD_NS) == 1);
+    assert(estimator.vms[0].spiking);
+    assert(state.vms[0].working_set_kb == base_kb + 5000 * PAGE_KB);
+
+    /* The pressure decays once the faults calm down */
+    state.vms[0].major_faults += 200;
+    assert(working_set_update(&estimator, &state, 7 * PERIOD_NS) == 0);
+    assert(state.vms[0].working_set_kb == base_kb + (int) (5000 * PAGE_KB * WORKING_SET_PRESSURE_DECAY));
+
+    /* Any swap-in is a spike, and adds up with the pressure left */
+    state.vms[0].swap_in_kb += 8192;
+    state.vms[0].major_faults += 2048;
+    assert(working_set_update(&estimator, &state, 8 * PERIOD_NS) == 1);
+    double pressure_kb = 5000 * PAGE_KB * WORKING_SET_PRESSURE_DECAY * WORKING_SET_PRESSURE_DECAY + 8192;
+    assert(fabs(estimator.vms[0].pressure_kb - pressure_kb) < 1);
+    assert(estimator.nr_spikes == 2);
+
+    /* A rebooted guest's counters start over, which is no spike */
+    state.vms[0].major_faults = 10;
+    state.vms[0].minor_faults = 1000;
+    state.vms[0].swap_in_kb = 0;
+    assert(working_set_update(&estimator, &state, 9 * PERIOD_NS) == 0);
+    assert(!estimator.vms[0].has_rates);
+    assert(state.vms[0].working_set_kb == base_kb);
+
+    printf("PASS test_fault_spikes_raise_the_working_set\n");
+}
+
+/**
+ * @brief Runs the loop on a guest with 400 MB of anonymous memory whose files want 600 MB of cache.
+ */
+static void run_cached_guest(AllocationMode mode, SimHypervisor *sim, int *balloon_mb) {
+    static MemoryControl control;
+    SimConfig config = { .nr_vms = 1, .host_memory_mb = 8192, .max_memory_mb = 2048, .load = SIM_LOAD_STEADY, .seed = 6 };
+    assert(sim_init(sim, config) == 0);
+    sim->domains[0].used_kb = 400 * ONE_K;
+    sim->domains[0].cache_demand_kb = 600 * ONE_K;
+    VirtBackend backend = sim_backend(sim);
+    memory_control_init(&control);
+    control.mode = mode;
+    for (int t = 0; t < 60; t++) {
+        assert(memory_control_tick(&control, &backend, sim->clock_ns) == 0);
+        sim_advance(sim, PERIOD_NS);
+    }
+    *balloon_mb = sim->domains[0].balloon_kb / ONE_K;
+}
+
+static void test_spikes_keep_the_cache_a_guest_needs() {
+    static SimHypervisor fixed_sim;
+    static SimHypervisor predictive_sim;
+    int fixed_mb;
+    int predictive_mb;
+    run_cached_guest(ALLOCATE_FIXED_STEP, &fixed_sim, &fixed_mb);
+    run_cached_guest(ALLOCATE_PREDICTIVE, &predictive_sim, &predictive_mb);
+    printf("Fixed step: %d MB balloon, %.0f MB read back\n", fixed_mb, fixed_sim.refault_mb);
+    printf("Working set: %d MB balloon, %.0f MB read back\n", predictive_mb, predictive_sim.refault_mb);
+    /* Both gave back the free memory, only the fixed step kept squeezing the cache */
+    assert(predictive_mb < 2048 - 600 && fixed_mb < 600);
+    assert(predictive_mb > 400 + 500);
+    assert(predictive_sim.refault_mb < fixed_sim.refault_mb / 4);
+    assert(predictive_sim.swapped_mb_s == 0);
+
+    printf("PASS test_spikes_keep_the_cache_a_guest_needs\n");
+}
+
+int main(void) {
+    printf("Running working set tests ...\n\n");
+
+    test_working_set_leaves_out_page_cache();
+    test_fault_spikes_raise_the_working_set();
+    test_spikes_keep_the_cache_a_guest_needs();
+
+    printf("\nAll tests passed.\n");
+    return 0;
+}
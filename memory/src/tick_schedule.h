@@ -0,0 +1,66 @@
+#ifndef TICK_SCHEDULE_H
+#define TICK_SCHEDULE_H
+
+#include <stdbool.h>
+
+/* An early tick waits at least this fraction of the period after the last tick */
+#define EARLY_TICK_MIN_GAP_DIVISOR 4
+
+/**
+ * @brief Tick deadlines on the grid start + k * period of the monotonic clock.
+ *
+ * The deadlines don't move with how long a tick takes, so the period doesn't
+ * drift. Deadlines that passed while a tick ran are skipped instead of run back
+ * to back. Early ticks run between deadlines and leave the grid alone.
+ */
+typedef struct {
+    long long period_ns;
+    long long next_ns;          // Deadline of the next regular tick
+    long long last_ns;          // When the last tick finished, -1 before the first
+    int       nr_missed;        // Deadlines skipped so far
+} TickSchedule;
+
+/**
+ * @brief The monotonic clock in nanoseconds.
+ */
+long long tick_now_ns(void);
+
+/**
+ * @brief Parses a period in seconds such as "2" or "0.25".
+ *
+ * @return The period in nanoseconds, -1 when it isn't a positive number.
+ */
+long long tick_parse_period(const char *seconds);
+
+/**
+ * @brief Starts the grid at now, so the first tick is due right away.
+ */
+void tick_schedule_init(TickSchedule *schedule, long long now_ns, long long period_ns);
+
+/**
+ * @brief Records a tick that finished at now.
+ *
+ * A tick that ran at or after the deadline moves the deadline to the first grid
+ * point after now.
+ */
+void tick_schedule_ran(TickSchedule *schedule, long long now_ns);
+
+/**
+ * @brief Milliseconds until the next tick is due (rounded up, 0 when overdue).
+ *
+ * With an early tick pending that is the earlier of the deadline and the end of
+ * the minimum gap after the last tick.
+ */
+int tick_schedule_timeout_ms(const TickSchedule *schedule, long long now_ns, bool early);
+
+/**
+ * @brief Counts the values that rose from below the threshold to at or above it.
+ */
+int tick_crossed_above(const double *previous, const double *current, int nr_values, double threshold);
+
+/**
+ * @brief Counts the values that fell from at or above the threshold to below it.
+ */
+int tick_crossed_below(const double *previous, const double *current, int nr_values, double threshold);
+
+#endif
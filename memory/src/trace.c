@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+static void put_byte(TraceWriter *writer, int byte) {
+    fputc(byte, writer->file);
+    writer->nr_bytes++;
+}
+
+static void put_uvarint(TraceWriter *writer, unsigned long long value) {
+    while (value >= 0x80) {
+        put_byte(writer, (int) (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    put_byte(writer, (int) value);
+}
+
+/* Zigzag keeps small negative numbers to one byte */
+static void put_varint(TraceWriter *writer, long long value) {
+    put_uvarint(writer, ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63));
+}
+
+static int end_record(TraceWriter *writer) {
+    if (ferror(writer->file)) {
+        fprintf(stderr, "Failed to write the trace\n");
+        return -1;
+    }
+    return 0;
+}
+
+int trace_writer_init(TraceWriter *writer, FILE *file) {
+    memset(writer, 0, sizeof(TraceWriter));
+    writer->file = file;
+    for (int b = 0; b < 4; b++) {
+        put_byte(writer, TRACE_MAGIC[b]);
+    }
+    put_uvarint(writer, TRACE_VERSION);
+    return end_record(writer);
+}
+
+int trace_write_state(TraceWriter *writer, long long time_ns, const SystemState *state) {
+    put_byte(writer, TRACE_STATE);
+    put_varint(writer, time_ns);
+    put_uvarint(writer, state->free_memory_bytes);
+    put_varint(writer, state->nr_vms);
+    for (int i = 0; i < state->nr_vms; i++) {
+        const VM *vm = &state->vms[i];
+        int name_len = strnlen(vm->name, MAX_NAME_LEN - 1);
+        put_varint(writer, name_len);
+        for (int c = 0; c < name_len; c++) {
+            put_byte(writer, vm->name[c]);
+        }
+        put_varint(writer, vm->id);
+        put_varint(writer, vm->max_memory_kb);
+        put_varint(writer, vm->memory_unused_kb);
+        put_varint(writer, vm->memory_available_kb);
+        put_varint(writer, vm->memory_usable_kb);
+        put_varint(writer, vm->memory_rss_kb);
+        put_varint(writer, vm->balloon_size_kb);
+        put_varint(writer, vm->min_memory_kb);
+        put_varint(writer, vm->limit_memory_kb);
+        put_varint(writer, vm->share_weight);
+        put_varint(writer, vm->memory_disk_caches_kb);
+        put_uvarint(writer, vm->swap_in_kb);
+        put_uvarint(writer, vm->major_faults);
+        put_uvarint(writer, vm->minor_faults);
+    }
+    writer->nr_vms = state->nr_vms;
+    return end_record(writer);
+}
+
+int trace_write_targets(TraceWriter *writer, long long time_ns, const SystemState *state) {
+    put_byte(writer, TRACE_TARGETS);
+    put_varint(writer, time_ns);
+    for (int i = 0; i < writer->nr_vms; i++) {
+        put_varint(writer, state->vms[i].target_memory_kb);
+    }
+    return end_record(writer);
+}
+
+static int get_uvarint(TraceReader *reader, unsigned long long *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(reader->file);
+        if (byte == EOF) {
+            return -1;
+        }
+        *value |= (unsigned long long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_varint(TraceReader *reader, long long *value) {
+    unsigned long long zigzag;
+    if (get_uvarint(reader, &zigzag) < 0) {
+        return -1;
+    }
+    *value = (long long) (zigzag >> 1) ^ -(long long) (zigzag & 1);
+    return 0;
+}
+
+/**
+ * @brief Reads a signed integer that has to be within [min, max].
+ */
+static int get_int(TraceReader *reader, int *value, long long min, long long max) {
+    long long wide;
+    if (get_varint(reader, &wide) < 0 || wide < min || wide > max) {
+        return -1;
+    }
+    *value = (int) wide;
+    return 0;
+}
+
+int trace_reader_init(TraceReader *reader, FILE *file) {
+    memset(reader, 0, sizeof(TraceReader));
+    reader->file = file;
+    char magic[4];
+    unsigned long long version;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        get_uvarint(reader, &version) < 0 || version < TRACE_MIN_VERSION || version > TRACE_VERSION) {
+        fprintf(stderr, "Not a version %d to %d memory coordinator trace\n", TRACE_MIN_VERSION, TRACE_VERSION);
+        return -1;
+    }
+    reader->version = (int) version;
+    return 0;
+}
+
+static int read_state(TraceReader *reader, SystemState *state) {
+    memset(state, 0, sizeof(SystemState));
+    if (get_uvarint(reader, &state->free_memory_bytes) < 0 ||
+        get_int(reader, &state->nr_vms, 0, MAX_VMS) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < state->nr_vms; i++) {
+        VM *vm = &state->vms[i];
+        int name_len;
+        if (get_int(reader, &name_len, 0, MAX_NAME_LEN - 1) < 0 ||
+            fread(vm->name, 1, name_len, reader->file) != (size_t) name_len) {
+            return -1;
+        }
+        if (get_int(reader, &vm->id, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->max_memory_kb, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->memory_unused_kb, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->memory_available_kb, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->memory_usable_kb, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->memory_rss_kb, INT32_MIN, INT32_MAX) < 0 ||
+            get_int(reader, &vm->balloon_size_kb, INT32_MIN, INT32_MAX) < 0) {
+            return -1;
+        }
+        if (reader->version >= 2 &&
+            (get_int(reader, &vm->min_memory_kb, INT32_MIN, INT32_MAX) < 0 ||
+             get_int(reader, &vm->limit_memory_kb, INT32_MIN, INT32_MAX) < 0 ||
+             get_int(reader, &vm->share_weight, INT32_MIN, INT32_MAX) < 0)) {
+            return -1;
+        }
+        unsigned long long swap_in_kb = 0;
+        unsigned long long major_faults = 0;
+        unsigned long long minor_faults = 0;
+        if (reader->version >= 3 &&
+            (get_int(reader, &vm->memory_disk_caches_kb, INT32_MIN, INT32_MAX) < 0 ||
+             get_uvarint(reader, &swap_in_kb) < 0 || get_uvarint(reader, &major_faults) < 0 ||
+             get_uvarint(reader, &minor_faults) < 0)) {
+            return -1;
+        }
+        vm->swap_in_kb = swap_in_kb;
+        vm->major_faults = major_faults;
+        vm->minor_faults = minor_faults;
+    }
+    reader->nr_vms = state->nr_vms;
+    return 0;
+}
+
+int trace_read(TraceReader *reader, SystemState *state, int *targets_kb) {
+    int type = fgetc(reader->file);
+    if (type == EOF) {
+        return 0;
+    }
+    long long time_ns;
+    if ((type == TRACE_STATE || type == TRACE_TARGETS) && get_varint(reader, &time_ns) == 0) {
+        reader->time_ns = time_ns;
+        if (type == TRACE_STATE && read_state(reader, state) == 0) {
+            return type;
+        }
+        int i = 0;
+        while (type == TRACE_TARGETS && i < reader->nr_vms && get_int(reader, &targets_kb[i], INT32_MIN, INT32_MAX) == 0) {
+            i++;
+        }
+        if (type == TRACE_TARGETS && i == reader->nr_vms) {
+            return type;
+        }
+    }
+    fprintf(stderr, "Malformed trace record at byte %ld\n", ftell(reader->file));
+    return -1;
+}
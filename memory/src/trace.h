@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "vm_types.h"
+
+#define TRACE_MAGIC "MCTR"
+#define TRACE_VERSION 3
+// Version 1 traces have no min_memory_kb, limit_memory_kb or share_weight, versions 1 and 2 no
+// disk caches, swap-ins or faults. Missing fields read as 0.
+#define TRACE_MIN_VERSION 1
+
+typedef enum {
+    TRACE_STATE = 1,
+    TRACE_TARGETS = 2,
+} TraceRecordType;
+
+/**
+ * @brief Appends the system states and target memory sizes of a run to a binary trace.
+ *
+ * The file starts with TRACE_MAGIC and TRACE_VERSION. Every record is a type
+ * byte followed by its fields as LEB128 varints (signed ones zigzag encoded).
+ */
+typedef struct {
+    FILE *file;         // NULL when not recording
+    int   nr_vms;       // VMs of the last state, the targets cover those
+    long  nr_bytes;
+} TraceWriter;
+
+/**
+ * @brief Writes the header to file. The writer doesn't own the file.
+ *
+ * @return 0 on success, -1 when the write fails.
+ */
+int trace_writer_init(TraceWriter *writer, FILE *file);
+
+/**
+ * @brief Writes the state seen at time_ns, without the targets.
+ */
+int trace_write_state(TraceWriter *writer, long long time_ns, const SystemState *state);
+
+/**
+ * @brief Writes the target_memory_kb the coordinator computed for the VMs of the last state written.
+ */
+int trace_write_targets(TraceWriter *writer, long long time_ns, const SystemState *state);
+
+typedef struct {
+    FILE      *file;
+    int       version;
+    int       nr_vms;   // VMs of the last state
+    long long time_ns;  // Of the last record
+} TraceReader;
+
+/**
+ * @brief Reads and checks the header. The reader doesn't own the file.
+ *
+ * @return 0 on success, -1 when the file isn't a trace of a version between TRACE_MIN_VERSION and TRACE_VERSION.
+ */
+int trace_reader_init(TraceReader *reader, FILE *file);
+
+/**
+ * @brief Reads the next record. A state fills state, targets fill targets_kb (one per VM of the state before).
+ *
+ * @return TRACE_STATE or TRACE_TARGETS, 0 at the end of the trace, -1 on a malformed record.
+ */
+int trace_read(TraceReader *reader, SystemState *state, int *targets_kb);
+
+#endif
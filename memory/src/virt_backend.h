@@ -0,0 +1,27 @@
+#ifndef VIRT_BACKEND_H
+#define VIRT_BACKEND_H
+
+#include "vm_types.h"
+
+/**
+ * @brief What the coordinator needs from a hypervisor, without libvirt types.
+ *
+ * virt_backend (virt_query.c) puts these on a libvirt connection and sim_backend
+ * (sim_backend.c) on a simulated host, so the control loop runs the same on both.
+ */
+typedef struct {
+    const char *name;
+    /* @brief Sets the memory stats period of the domains that don't have it yet. The number set, -1 on error */
+    int (*set_stats_period)(void *impl);
+    /* @brief Fills the host's free memory and the memory stats of every VM. 0 on success, -1 on error */
+    int (*query_state)(void *impl, SystemState *state);
+    /* @brief Sets the balloon of the VM with this domain ID. 0 on success, -1 on error */
+    int (*set_memory)(void *impl, int vm_id, int memory_kb);
+} VirtBackendOps;
+
+typedef struct {
+    const VirtBackendOps *ops;
+    void *impl;
+} VirtBackend;
+
+#endif
@@ -1,27 +1,77 @@
 #include <stdio.h>
 #include <assert.h>
-#include <locale.h>
 #include <string.h>
 #include <stdlib.h>
 #include "vm_types.h"
 #include "virt_query.h"
+#include "domain_stats.h"
+#include "fair_share.h"
 
 #define VM_STATS_PERIOD 3
 
+void virt_context_init(VirtContext *ctx, virConnectPtr conn) {
+    memset(ctx, 0, sizeof(VirtContext));
+    ctx->conn = conn;
+    domain_registry_open(&ctx->registry, conn);
+}
+
+void virt_context_destroy(VirtContext *ctx) {
+    if (ctx->conn != NULL) {
+        domain_registry_close(&ctx->registry);
+    }
+    memset(ctx, 0, sizeof(VirtContext));
+}
+
 int set_vm_memory_stats(VirtContext *ctx) {
-    /* Number of VMs */
-    virDomainPtr *domains;
-	unsigned int flags = VIR_CONNECT_LIST_DOMAINS_RUNNING |
-						 VIR_CONNECT_LIST_DOMAINS_PERSISTENT;
-	int nr_vms = virConnectListAllDomains(ctx->conn, &domains, flags);
-    for(int i = 0; i < nr_vms; i++) {
-        virDomainPtr domain = domains[i];
-        if (virDomainSetMemoryStatsPeriod(domain, VM_STATS_PERIOD, VIR_DOMAIN_AFFECT_LIVE) < 0) {
-            fprintf(stderr, "Failed to set memory stats for VM %d", i);
+    if (domain_registry_refresh(&ctx->registry) < 0) {
+        return -1;
+    }
+    /* Only domains that started since the last tick */
+    int nr_set = 0;
+    for (int s = 0; s < MAX_VMS; s++) {
+        DomainEntry *entry = &ctx->registry.entries[s];
+        if (entry->dom == NULL || ctx->stats_period_generation[s] == entry->generation) {
+            continue;
+        }
+        if (virDomainSetMemoryStatsPeriod(entry->dom, VM_STATS_PERIOD, VIR_DOMAIN_AFFECT_LIVE) < 0) {
+            fprintf(stderr, "Failed to set memory stats for VM %d\n", entry->id);
             return -1;
         }
+        ctx->stats_period_generation[s] = entry->generation;
+        nr_set++;
+    }
+    return nr_set;
+}
+
+/**
+ * @brief Fills the guarantees of every VM from its domain's metadata, read once per domain.
+ *
+ * A domain without the element has none, and malformed metadata is ignored.
+ */
+static void read_vm_metadata(VirtContext *ctx, SystemState *state) {
+    for (int i = 0; i < state->nr_vms; i++) {
+        DomainEntry *entry = domain_registry_find_id(&ctx->registry, state->vms[i].id);
+        if (entry == NULL) {
+            continue;
+        }
+        int s = entry - ctx->registry.entries;
+        VM *metadata = &ctx->metadata[s];
+        if (ctx->metadata_generation[s] != entry->generation) {
+            memset(metadata, 0, sizeof(VM));
+            char *xml = virDomainGetMetadata(entry->dom, VIR_DOMAIN_METADATA_ELEMENT, FAIR_SHARE_METADATA_URI,
+                                             VIR_DOMAIN_AFFECT_LIVE);
+            if (xml != NULL) {
+                if (fair_share_parse_metadata(xml, metadata) < 0) {
+                    memset(metadata, 0, sizeof(VM));
+                }
+                free(xml);
+            }
+            ctx->metadata_generation[s] = entry->generation;
+        }
+        state->vms[i].min_memory_kb = metadata->min_memory_kb;
+        state->vms[i].limit_memory_kb = metadata->limit_memory_kb;
+        state->vms[i].share_weight = metadata->share_weight;
     }
-    return nr_vms;
 }
 
 int virt_query_state(VirtContext *ctx, SystemState *state) {
@@ -31,26 +81,26 @@ int virt_query_state(VirtContext *ctx, SystemState *state) {
     /* Host free memory */
     state->free_memory_bytes = virNodeGetFreeMemory(ctx->conn);
 
-    /* Number of VMs */
-    virDomainPtr *domains;
-	unsigned int flags = VIR_CONNECT_LIST_DOMAINS_RUNNING |
-						 VIR_CONNECT_LIST_DOMAINS_PERSISTENT;
-	int nr_vms = virConnectListAllDomains(ctx->conn, &domains, flags);
-	if (nr_vms < 0) {
-		fprintf(stderr, "Failed to get list of domains\n");
-		return -1;
-	}
-    state->nr_vms = nr_vms;
+    /* The running domains, only listed when there are no lifecycle events */
+    if (domain_registry_refresh(&ctx->registry) < 0) {
+        return -1;
+    }
+    DomainRegistry *registry = &ctx->registry;
 
     /* VM's Memory Stats */
-    for (int i = 0; i < nr_vms; i++) {
+    int nr_vms = 0;
+    for (int s = 0; s < MAX_VMS; s++) {
+        if (registry->entries[s].dom == NULL) {
+            continue;
+        }
+        int i = nr_vms++;
         /* Get Virtual Machine's name and memory usage */
-		virDomainPtr domain = domains[i];
+		virDomainPtr domain = registry->entries[s].dom;
         const char *vm_name = virDomainGetName(domain);
         if (vm_name) {
             snprintf(state->vms[i].name, MAX_NAME_LEN, "%s", vm_name);
         }
-        state->vms[i].id = virDomainGetID(domain);
+        state->vms[i].id = registry->entries[s].id;
 
         /* Get physical RAM limit the VM was booted with */
         virDomainInfo dominfo;
@@ -102,30 +152,141 @@ int virt_query_state(VirtContext *ctx, SystemState *state) {
                     by the VM process.
                     */
 					state->vms[i].memory_rss_kb = stats[j].val; break;
+				case VIR_DOMAIN_MEMORY_STAT_DISK_CACHES:
+                    /*
+                    Page cache the guest can drop without swapping, the first memory a balloon should take.
+                    */
+					state->vms[i].memory_disk_caches_kb = stats[j].val; break;
+				case VIR_DOMAIN_MEMORY_STAT_SWAP_IN:
+                    /*
+                    KB read back from the guest's swap since it booted. It grows when the guest has too little memory.
+                    */
+					state->vms[i].swap_in_kb = stats[j].val; break;
+				case VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT:
+                    /*
+                    Page faults that had to read from disk, swapped out pages or dropped page cache.
+                    */
+					state->vms[i].major_faults = stats[j].val; break;
+				case VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT:
+                    /*
+                    Page faults served from memory, e.g. the first touch of a new page.
+                    */
+					state->vms[i].minor_faults = stats[j].val; break;
 			}
 		}
-		virDomainFree(domains[i]);
     }
+    state->nr_vms = nr_vms;
+    read_vm_metadata(ctx, state);
     return 0;
 }
 
-void print_sys_state(SystemState *state) {
-    setlocale(LC_NUMERIC, "en_US.UTF-8");
-    printf("\nSystem state (MBs)\n");
-    printf("------------\n");
-    printf("Available: %'lld\n", state->free_memory_bytes / 1024 / 1024);
-    printf("------------\n");
-	for(int i = 0; i < state->nr_vms; i++){
-		printf(
-			"%d: VM %d (%s) max: %'d, unused: %'d, available: %'d, usable: %'d, balloon: %'d\n",
-			i,
-            state->vms[i].id,
-			state->vms[i].name,
-            state->vms[i].max_memory_kb / 1024,
-			state->vms[i].memory_unused_kb / 1024,
-			state->vms[i].memory_available_kb / 1024,
-            state->vms[i].balloon_size_kb / 1024,
-            state->vms[i].memory_usable_kb / 1024
-		);
-	}
-}
\ No newline at end of file
+/**
+ * @brief Copies the numeric typed parameters of a stats record, skipping strings.
+ */
+static int typed_params_to_stats(const virTypedParameter *params, int nparams, DomainStat *stats) {
+    int nr_stats = 0;
+    for (int j = 0; j < nparams && nr_stats < MAX_DOMAIN_STATS; j++) {
+        unsigned long long value;
+        switch (params[j].type) {
+            case VIR_TYPED_PARAM_INT:     value = params[j].value.i < 0 ? 0 : params[j].value.i; break;
+            case VIR_TYPED_PARAM_UINT:    value = params[j].value.ui; break;
+            case VIR_TYPED_PARAM_LLONG:   value = params[j].value.l < 0 ? 0 : params[j].value.l; break;
+            case VIR_TYPED_PARAM_ULLONG:  value = params[j].value.ul; break;
+            case VIR_TYPED_PARAM_DOUBLE:  value = params[j].value.d < 0 ? 0 : (unsigned long long) params[j].value.d; break;
+            case VIR_TYPED_PARAM_BOOLEAN: value = params[j].value.b; break;
+            default: continue;
+        }
+        snprintf(stats[nr_stats].field, DOMAIN_STAT_FIELD_LEN, "%s", params[j].field);
+        stats[nr_stats].value = value;
+        nr_stats++;
+    }
+    return nr_stats;
+}
+
+int virt_query_state_bulk(VirtContext *ctx, SystemState *state) {
+    /* Reset system state */
+    memset(state, 0, sizeof(SystemState));
+
+    /* Host free memory */
+    state->free_memory_bytes = virNodeGetFreeMemory(ctx->conn);
+
+    virDomainStatsRecordPtr *records = NULL;
+    unsigned int flags = VIR_CONNECT_GET_ALL_DOMAINS_STATS_RUNNING |
+                         VIR_CONNECT_GET_ALL_DOMAINS_STATS_PERSISTENT;
+    int nr_vms = virConnectGetAllDomainStats(ctx->conn, VIR_DOMAIN_STATS_BALLOON, &records, flags);
+    if (nr_vms < 0) {
+        fprintf(stderr, "Failed to get the stats of all domains\n");
+        return -1;
+    }
+
+    /* The reply names every running domain, so the registry follows it without listing */
+    virDomainPtr doms[MAX_VMS];
+    for (int i = 0; i < nr_vms && i < MAX_VMS; i++) {
+        doms[i] = records[i]->dom;
+    }
+    domain_registry_sync(&ctx->registry, doms, nr_vms < MAX_VMS ? nr_vms : MAX_VMS);
+    int ret = 0;
+    if (nr_vms > MAX_VMS) {
+        fprintf(stderr, "Found %d VMs but only support up to %d\n", nr_vms, MAX_VMS);
+        ret = -1;
+    }
+
+    DomainStat stats[MAX_DOMAIN_STATS];
+    for (int i = 0; i < nr_vms && ret == 0; i++) {
+        virDomainStatsRecordPtr record = records[i];
+        /* Name and ID are kept in the handle, no RPC */
+        const char *vm_name = virDomainGetName(record->dom);
+        if (vm_name) {
+            snprintf(state->vms[i].name, MAX_NAME_LEN, "%s", vm_name);
+        }
+        state->vms[i].id = virDomainGetID(record->dom);
+
+        int nr_stats = typed_params_to_stats(record->params, record->nparams, stats);
+        ret = domain_stats_to_vm(&state->vms[i], stats, nr_stats);
+    }
+
+    virDomainStatsRecordListFree(records);
+    /* A state that failed part way holds no VMs, so nothing walks past what was filled */
+    if (ret == 0) {
+        state->nr_vms = nr_vms;
+        read_vm_metadata(ctx, state);
+    }
+    return ret;
+}
+
+/* One bulk stats call when libvirt has it, per domain calls otherwise */
+static int libvirt_query_state(void *impl, SystemState *state) {
+    VirtContext *ctx = impl;
+    if (virt_query_state_bulk(ctx, state) < 0 && virt_query_state(ctx, state) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int libvirt_set_stats_period(void *impl) {
+    return set_vm_memory_stats(impl);
+}
+
+static int libvirt_set_memory(void *impl, int vm_id, int memory_kb) {
+    VirtContext *ctx = impl;
+    /* May run on a balloon applier's worker, which mustn't change the registry */
+    virDomainPtr dom = domain_registry_ref_id(&ctx->registry, vm_id);
+    if (dom == NULL) {
+        return -1;
+    }
+    int result = virDomainSetMemory(dom, memory_kb);
+    virDomainFree(dom);
+    return result < 0 ? -1 : 0;
+}
+
+static const VirtBackendOps libvirt_ops = {
+    .name = "libvirt",
+    .set_stats_period = libvirt_set_stats_period,
+    .query_state = libvirt_query_state,
+    .set_memory = libvirt_set_memory,
+};
+
+VirtBackend virt_backend(VirtContext *ctx) {
+    VirtBackend backend = { .ops = &libvirt_ops, .impl = ctx };
+    return backend;
+}
@@ -3,15 +3,57 @@
 
 #include <libvirt/libvirt.h>
 #include "vm_types.h"
+#include "domain_registry.h"
+#include "virt_backend.h"
 
+/**
+ * @brief The connection plus the domain handles kept between ticks.
+ *
+ * Start it with virt_context_init and keep it for as long as the connection.
+ */
 typedef struct {
     virConnectPtr conn;
+    DomainRegistry registry;
+    /* @brief Generation of the registry slot the stats period was set for, 0 when not set */
+    unsigned int stats_period_generation[MAX_VMS];
+    /* @brief Generation of the registry slot the metadata was read for, 0 when not read */
+    unsigned int metadata_generation[MAX_VMS];
+    /* @brief The min_memory_kb, limit_memory_kb and share_weight read from the slot's domain metadata */
+    VM metadata[MAX_VMS];
 } VirtContext;
 
+void virt_context_init(VirtContext *ctx, virConnectPtr conn);
+
+void virt_context_destroy(VirtContext *ctx);
+
+/**
+ * @brief Sets the memory stats period of the domains that don't have it yet.
+ *
+ * @return The number of domains set, -1 on failure.
+ */
 int set_vm_memory_stats(VirtContext *ctx);
 
+/**
+ * @brief Queries the host free memory and the memory stats of every running domain, with a few calls per domain.
+ *
+ * @return 0 on success, -1 on failure. On failure the state holds no VMs.
+ */
 int virt_query_state(VirtContext *ctx, SystemState *state);
 
-void print_sys_state(SystemState *state);
+/**
+ * @brief Queries the same state as virt_query_state with one virConnectGetAllDomainStats call.
+ *
+ * Every VM's memory sizes come from the balloon.* stats of its domain, instead of a
+ * virDomainGetInfo and a virDomainMemoryStats call per domain.
+ *
+ * @return 0 on success, -1 when the call fails (e.g. libvirt older than 1.2.8)
+ * or finds more than MAX_VMS domains. On failure the state holds no VMs.
+ */
+int virt_query_state_bulk(VirtContext *ctx, SystemState *state);
+
+/**
+ * @brief The backend that queries and sets balloons through the context's connection.
+ */
+VirtBackend virt_backend(VirtContext *ctx);
 
 #endif
\ No newline at end of file
@@ -21,7 +21,15 @@ typedef struct {
     int  memory_usable_kb;       // VIR_DOMAIN_MEMORY_STAT_USABLE
     int  memory_rss_kb;          // VIR_DOMAIN_MEMORY_STAT_RSS
     int  balloon_size_kb;        // VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON
+    int  memory_disk_caches_kb;  // VIR_DOMAIN_MEMORY_STAT_DISK_CACHES
+    uint64_t swap_in_kb;         // VIR_DOMAIN_MEMORY_STAT_SWAP_IN, since the guest booted
+    uint64_t major_faults;       // VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, since the guest booted
+    uint64_t minor_faults;       // VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, since the guest booted
+    int  working_set_kb;         // Estimated by working_set.c, 0 when unknown
     int  target_memory_kb;       // Used for setting new VM memory size
+    int  min_memory_kb;          // Guaranteed by the domain's metadata, 0 for none
+    int  limit_memory_kb;        // Cap from the domain's metadata, 0 for max_memory_kb
+    int  share_weight;           // Weight from the domain's metadata, 0 counts as 1
 } VM;
 
 typedef struct {
@@ -0,0 +1,108 @@
+#include <string.h>
+#include "working_set.h"
+#include "coordinator.h"
+
+void working_set_init(WorkingSetEstimator *estimator) {
+    memset(estimator, 0, sizeof(WorkingSetEstimator));
+}
+
+long long working_set_used_kb(const VM *vm) {
+    if (vm->working_set_kb > 0) {
+        return vm->working_set_kb;
+    }
+    return (long long) vm->balloon_size_kb - vm->memory_available_kb;
+}
+
+/**
+ * @brief Starts the VM's history over, at these counters.
+ */
+static void restart_history(WorkingSetHistory *history, const VM *vm, long long now_ns) {
+    memset(history, 0, sizeof(WorkingSetHistory));
+    history->id = vm->id;
+    history->time_ns = now_ns;
+    history->swap_in_kb = vm->swap_in_kb;
+    history->major_faults = vm->major_faults;
+    history->minor_faults = vm->minor_faults;
+}
+
+/**
+ * @brief Rates since the last tick. False when there is no last tick, or the guest rebooted since.
+ */
+static bool update_rates(WorkingSetHistory *history, const VM *vm, long long now_ns) {
+    double elapsed_s = (now_ns - history->time_ns) / 1e9;
+    if (elapsed_s <= 0) {
+        return history->has_rates;
+    }
+    if (vm->swap_in_kb < history->swap_in_kb || vm->major_faults < history->major_faults ||
+        vm->minor_faults < history->minor_faults) {
+        restart_history(history, vm, now_ns);
+        return false;
+    }
+    history->swap_in_kb_s = (vm->swap_in_kb - history->swap_in_kb) / elapsed_s;
+    history->major_faults_s = (vm->major_faults - history->major_faults) / elapsed_s;
+    history->minor_faults_s = (vm->minor_faults - history->minor_faults) / elapsed_s;
+    history->time_ns = now_ns;
+    history->swap_in_kb = vm->swap_in_kb;
+    history->major_faults = vm->major_faults;
+    history->minor_faults = vm->minor_faults;
+    history->has_rates = true;
+    return true;
+}
+
+int working_set_update(WorkingSetEstimator *estimator, SystemState *sys_state, long long now_ns) {
+    WorkingSetHistory previous[MAX_VMS];
+    int nr_previous = estimator->nr_vms;
+    memcpy(previous, estimator->vms, sizeof(WorkingSetHistory) * nr_previous);
+
+    int nr_spiking = 0;
+    for (int i = 0; i < sys_state->nr_vms; i++) {
+        VM *vm = &sys_state->vms[i];
+        WorkingSetHistory *history = &estimator->vms[i];
+        bool known = false;
+        for (int j = 0; j < nr_previous && !known; j++) {
+            if (previous[j].id == vm->id) {
+                *history = previous[j];
+                known = true;
+            }
+        }
+        if (!known) {
+            restart_history(history, vm, now_ns);
+        }
+
+        history->pressure_kb *= WORKING_SET_PRESSURE_DECAY;
+        history->spiking = false;
+        bool had_rates = history->has_rates;
+        if (known && update_rates(history, vm, now_ns)) {
+            double major_faults_s = history->major_faults_s;
+            /* The first rate is what the guest usually does, a spike needs something to compare with */
+            if (!had_rates) {
+                history->usual_major_s = major_faults_s;
+            }
+            history->spiking = history->swap_in_kb_s > 0 || (had_rates && major_faults_s > WORKING_SET_SPIKE_FAULTS_S &&
+                                                             major_faults_s > WORKING_SET_SPIKE_RATIO * history->usual_major_s);
+            if (history->spiking) {
+                /* Swap-ins are major faults too, count what was read back once */
+                double missing_kb = major_faults_s * PAGE_KB > history->swap_in_kb_s ? major_faults_s * PAGE_KB : history->swap_in_kb_s;
+                history->pressure_kb += missing_kb;
+                if (vm->max_memory_kb > 0 && history->pressure_kb > vm->max_memory_kb) {
+                    history->pressure_kb = vm->max_memory_kb;
+                }
+                nr_spiking++;
+            } else {
+                history->usual_major_s += WORKING_SET_BASELINE_WEIGHT * (major_faults_s - history->usual_major_s);
+            }
+        }
+
+        long long cache_kb = vm->memory_disk_caches_kb > 0 ? vm->memory_disk_caches_kb : 0;
+        long long anon_kb = (long long) vm->balloon_size_kb - vm->memory_unused_kb - cache_kb;
+        long long keep_kb = cache_kb < WORKING_SET_CACHE_KEEP_MB * ONE_K ? cache_kb : WORKING_SET_CACHE_KEEP_MB * ONE_K;
+        long long working_set_kb = (anon_kb > 0 ? anon_kb : 0) + keep_kb + (long long) history->pressure_kb;
+        if (vm->max_memory_kb > 0 && working_set_kb > vm->max_memory_kb) {
+            working_set_kb = vm->max_memory_kb;
+        }
+        vm->working_set_kb = working_set_kb > 0 ? (int) working_set_kb : 1;
+    }
+    estimator->nr_vms = sys_state->nr_vms;
+    estimator->nr_spikes += nr_spiking;
+    return nr_spiking;
+}
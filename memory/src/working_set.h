@@ -0,0 +1,68 @@
+#ifndef WORKING_SET_H
+#define WORKING_SET_H
+
+#include "vm_types.h"
+
+// Page cache counted in the working set, a balloon takes the rest of the cache before anonymous memory
+#define WORKING_SET_CACHE_KEEP_MB 32
+// Major faults a second that count as a spike, however busy the VM usually is
+#define WORKING_SET_SPIKE_FAULTS_S 100
+// A spike is also at least this many times the VM's usual major fault rate
+#define WORKING_SET_SPIKE_RATIO 4
+// Share of the fault pressure kept from one tick to the next
+#define WORKING_SET_PRESSURE_DECAY 0.95
+// Weight of the last tick in the usual major fault rate
+#define WORKING_SET_BASELINE_WEIGHT 0.2
+#define PAGE_KB 4
+
+/**
+ * @brief The fault and swap counters of one VM at the last tick, and what they said.
+ */
+typedef struct {
+    int                id;
+    long long          time_ns;
+    unsigned long long swap_in_kb;
+    unsigned long long major_faults;
+    unsigned long long minor_faults;
+    bool               has_rates;        // False until two ticks of counters from the same boot
+    double             major_faults_s;   // Last tick
+    double             minor_faults_s;
+    double             swap_in_kb_s;
+    double             usual_major_s;    // Moving average over the ticks without a spike
+    bool               spiking;
+    double             pressure_kb;      // Memory the spikes said was missing, decaying
+} WorkingSetHistory;
+
+/**
+ * @brief Turns the guests' memory stats into the memory each VM really needs.
+ *
+ * The working set is the guest's anonymous memory (its balloon minus unused
+ * memory and page cache) plus WORKING_SET_CACHE_KEEP_MB of its cache. Sizing
+ * balloons on it reclaims page cache first, and never takes anonymous memory
+ * the guest would have to swap out. A guest whose major faults or swap-ins
+ * spike between ticks is short of memory the stats can't show, dropped cache
+ * it reads back or pages it swaps in. Every spike adds a second of those reads
+ * to its working set, which decays once the spikes stop. Minor faults are kept along to
+ * tell a rebooted guest, whose counters all start over.
+ */
+typedef struct {
+    WorkingSetHistory vms[MAX_VMS];
+    int               nr_vms;
+    int               nr_spikes;         // VM ticks with a major fault or swap-in spike
+} WorkingSetEstimator;
+
+void working_set_init(WorkingSetEstimator *estimator);
+
+/**
+ * @brief Sets every VM's working_set_kb from its stats and the counter deltas since the last tick.
+ *
+ * @return The number of VMs spiking
+ */
+int working_set_update(WorkingSetEstimator *estimator, SystemState *sys_state, long long now_ns);
+
+/**
+ * @brief Memory the VM uses, its working set when estimated, its balloon minus available otherwise.
+ */
+long long working_set_used_kb(const VM *vm);
+
+#endif